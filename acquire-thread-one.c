@@ -1,7 +1,7 @@
 /*
-This runs the camera in a thread and passes buffers over to the main thread
-for copying into a persistent mapped buffer.
-The memcpy takes about 1ms, but this otherwise runs well.
+Renders every display from the main thread, while a single acquire
+thread posts the frames produced onto each display's plane.
+For streaming a camera into a texture, see camera-ingest.c.
 */
 
 #include <stdlib.h>
@@ -15,25 +15,38 @@ The memcpy takes about 1ms, but this otherwise runs well.
 #include <signal.h>
 
 #include "egl.h"
+#include "gldiag.h"
+#include "threads.h"
 #include "utils.h"
 
 void* AcquireThreadMain(void* Arg) {
     egl_state* EGL = Arg;
 
+    ApplyThreadProfile("Acquire", GetThreadProfile("ACQUIRE_THREAD_PROFILE", -1));
+
     while (1) {
+        // Taken first, so a frame or flip while we look isn't missed
+        uint32_t Events = EGLConsumerEvents(EGL);
+        bool Retry = false;
+
         for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
             egl_display* Display = &EGL->Displays[DisplayIndex];
-            if (Display->PageFlipPending) {
+            if (EGLPageFlipPending(Display)) {
                 continue;
             }
-            EGLint StreamState = EGLQueryStreamState(Display->DisplayDevice, Display->Stream);
-            if (StreamState == EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR) {
-                NEWTIME(StreamAcquire);
-                EGLStreamAcquire(Display);
+            // Checks the render thread's frame count; the stream is
+            // only queried if that count and the stream disagree.
+            NEWTIME(StreamAcquire);
+            if (EGLAcquireProduced(Display)) {
                 ENDTIME(StreamAcquire);
+            } else if (EGLFrameUnconsumed(Display)) {
+                // The acquire failed for now (BUSY or TIMEOUT)
+                Retry = true;
             }
         }
 
+        // Sleeps until a display produces a frame or finishes a flip
+        EGLWaitConsumerEvents(EGL, Events, Retry ? 1 : 100);
     }
     return NULL;
 }
@@ -44,6 +57,8 @@ int main() {
     egl_state* EGL = SetupEGL();
     EnableGLDebug();
 
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
     pthread_t AcquireThread;
     pthread_create(&AcquireThread, NULL, AcquireThreadMain, EGL);
 
@@ -61,16 +76,18 @@ int main() {
         for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
             egl_display* Display = &EGL->Displays[DisplayIndex];
 
-            if (Display->PageFlipPending) {
+            if (EGLPageFlipPending(Display)) {
                 continue;
             }
 
             eglMakeCurrent(Display->DisplayDevice,
-                Display->Surface, Display->Surface,
+                Display->Hot->Surface, Display->Hot->Surface,
                 Display->Context);
 
             PrintDisplayLayerSwapInterval(Display);
 
+            BeginFrame(Display);
+
             glViewport(0, 0,
                 (GLint)Display->Width,
                 (GLint)Display->Height);
@@ -82,8 +99,10 @@ int main() {
                         1);
             glClear(GL_COLOR_BUFFER_BIT);
 
+            EndFrame(Display);
+
             NEWTIME(eglSwapBuffers);
-            eglSwapBuffers(Display->DisplayDevice, Display->Surface);
+            EGLSwapFrame(Display);
             ENDTIME(eglSwapBuffers);
 
             TickFPS(&DisplayFPS[DisplayIndex]);
@@ -91,7 +110,7 @@ int main() {
 
 
 
-        GLCheck("Display Thread");
+        GLDiagnosticsEndFrame("Display Thread");
 
         TickFPS(&MainLoopFPS);
     }
@@ -1,7 +1,7 @@
 /*
-This runs the camera in a thread and passes buffers over to the main thread
-for copying into a persistent mapped buffer.
-The memcpy takes about 1ms, but this otherwise runs well.
+Renders every display from the main thread, while an acquire thread
+per display posts its frames onto its plane.
+For streaming a camera into a texture, see camera-ingest.c.
 */
 
 #include <stdlib.h>
@@ -15,19 +15,24 @@ The memcpy takes about 1ms, but this otherwise runs well.
 #include <signal.h>
 
 #include "egl.h"
+#include "gldiag.h"
+#include "threads.h"
 #include "utils.h"
 
 void* AcquireThreadMain(void* Arg) {
     egl_display* Display = Arg;
 
+    ApplyThreadProfile(Display->MonitorName,
+        GetThreadProfile("ACQUIRE_THREAD_PROFILE", Display->Index));
+
     while (1) {
-        if (Display->PageFlipPending) {
-            continue;
-        }
-        EGLint StreamState = EGLQueryStreamState(Display->DisplayDevice, Display->Stream);
-        if (StreamState == EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR) {
+        EGLWaitForPageFlip(Display);
+
+        // Sleeps until the render thread produces a frame,
+        // rather than polling the stream state
+        if (EGLWaitFrameProduced(Display, 100)) {
             NEWTIME(StreamAcquire);
-            EGLStreamAcquire(Display);
+            EGLAcquireProduced(Display);
             ENDTIME(StreamAcquire);
         }
 
@@ -41,6 +46,8 @@ int main() {
     egl_state* EGL = SetupEGL();
     EnableGLDebug();
 
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
 
 
     fps MainLoopFPS = MakeFPS("Main Loop");
@@ -61,16 +68,18 @@ int main() {
         for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
             egl_display* Display = &EGL->Displays[DisplayIndex];
 
-            if (Display->PageFlipPending) {
+            if (EGLPageFlipPending(Display)) {
                 continue;
             }
 
             eglMakeCurrent(Display->DisplayDevice,
-                Display->Surface, Display->Surface,
+                Display->Hot->Surface, Display->Hot->Surface,
                 Display->Context);
 
             PrintDisplayLayerSwapInterval(Display);
 
+            BeginFrame(Display);
+
             glViewport(0, 0,
                 (GLint)Display->Width,
                 (GLint)Display->Height);
@@ -82,8 +91,10 @@ int main() {
                         1);
             glClear(GL_COLOR_BUFFER_BIT);
 
+            EndFrame(Display);
+
             NEWTIME(eglSwapBuffers);
-            eglSwapBuffers(Display->DisplayDevice, Display->Surface);
+            EGLSwapFrame(Display);
             ENDTIME(eglSwapBuffers);
 
             TickFPS(&DisplayFPS[DisplayIndex]);
@@ -91,7 +102,7 @@ int main() {
 
 
 
-        GLCheck("Display Thread");
+        GLDiagnosticsEndFrame("Display Thread");
 
         TickFPS(&MainLoopFPS);
     }
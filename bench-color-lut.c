@@ -0,0 +1,158 @@
+/*
+Checks and times LUT generation for the CRTC color pipeline (see
+color.h) without touching a GPU or display.
+
+For random sparse curves and common LUT sizes, the vectorized
+GenerateLUT must match the scalar reference exactly; it exits non-zero
+if it doesn't. Then both are timed.
+
+Run with a profile file (and optionally a serial number) to parse it
+and print a few entries of the LUTs it would program:
+
+    ./bench-color-lut.app profiles.txt A1B2C3
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "color.h"
+#include "utils.h"
+
+#define CURVES_CHECKED 1000
+#define BENCH_RUNS     10000
+
+static const int LUTSizes[] = { 17, 33, 256, 1024, 4096 };
+
+static void RandomCurve(color_curve* Curve) {
+    Curve->Count = 1 + rand() % 16;
+    float X = RANDRANGE(0.0f, 0.2f);
+    for (int Point = 0; Point < Curve->Count; Point++) {
+        Curve->X[Point] = MIN(X, 1.0f);
+        // Slightly out of range too, to exercise clamping
+        Curve->Y[Point] = RANDRANGE(-0.1f, 1.1f);
+        X += RANDRANGE(0.001f, 0.2f);
+        if (X > 1) {
+            Curve->Count = Point + 1;
+            break;
+        }
+    }
+}
+
+static bool CheckLUTs() {
+    uint16_t* Vector = malloc(4096 * sizeof(uint16_t));
+    uint16_t* Scalar = malloc(4096 * sizeof(uint16_t));
+    bool OK = true;
+
+    color_curve Identity = { 0 };
+    GenerateLUT(&Identity, Vector, 256);
+    if (Vector[0] != 0 || Vector[255] != 65535) {
+        printf("Identity LUT should span 0..65535, got %u..%u\n", Vector[0], Vector[255]);
+        OK = false;
+    }
+
+    for (int CurveIndex = 0; CurveIndex < CURVES_CHECKED && OK; CurveIndex++) {
+        color_curve Curve;
+        RandomCurve(&Curve);
+        for (int SizeIndex = 0; SizeIndex < ARRAY_LEN(LUTSizes); SizeIndex++) {
+            int Size = LUTSizes[SizeIndex];
+            GenerateLUT(&Curve, Vector, Size);
+            GenerateLUTScalar(&Curve, Scalar, Size);
+            for (int Index = 0; Index < Size; Index++) {
+                if (Vector[Index] != Scalar[Index]) {
+                    printf("Curve %i, LUT size %i, entry %i: vector %u, scalar %u\n",
+                        CurveIndex, Size, Index, Vector[Index], Scalar[Index]);
+                    OK = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(Vector);
+    free(Scalar);
+    return OK;
+}
+
+static void BenchLUTs() {
+    uint16_t* LUT = malloc(4096 * sizeof(uint16_t));
+    color_curve Curve;
+    RandomCurve(&Curve);
+
+    printf("%8s %14s %14s %8s\n", "Size", "Scalar (us)", "Vector (us)", "Speedup");
+    for (int SizeIndex = 0; SizeIndex < ARRAY_LEN(LUTSizes); SizeIndex++) {
+        int Size = LUTSizes[SizeIndex];
+
+        double Start = GetThreadCPUTime();
+        for (int Run = 0; Run < BENCH_RUNS; Run++) {
+            GenerateLUTScalar(&Curve, LUT, Size);
+        }
+        double Scalar = (GetThreadCPUTime() - Start) / BENCH_RUNS * 1e6;
+
+        Start = GetThreadCPUTime();
+        for (int Run = 0; Run < BENCH_RUNS; Run++) {
+            GenerateLUT(&Curve, LUT, Size);
+        }
+        double Vector = (GetThreadCPUTime() - Start) / BENCH_RUNS * 1e6;
+
+        printf("%8i %14.3f %14.3f %7.2fx\n",
+            Size, Scalar, Vector, Scalar / MAX(Vector, 1e-9));
+    }
+    free(LUT);
+}
+
+static void PrintCurves(const char* Stage, const color_curve* Curves) {
+    uint16_t LUT[COLOR_CHANNELS][256];
+    for (int Channel = 0; Channel < COLOR_CHANNELS; Channel++) {
+        GenerateLUT(&Curves[Channel], LUT[Channel], 256);
+    }
+    printf("  %s (256 entries):\n", Stage);
+    for (int Index = 0; Index < 256; Index += 51) {
+        printf("    %3i: %5u %5u %5u\n", Index,
+            LUT[COLOR_RED][Index], LUT[COLOR_GREEN][Index], LUT[COLOR_BLUE][Index]);
+    }
+}
+
+static bool PrintProfiles(const char* Path, const char* SerialNumber) {
+    color_profiles Profiles;
+    if (!LoadColorProfiles(Path, &Profiles)) {
+        return false;
+    }
+
+    for (int ProfileIndex = 0; ProfileIndex < Profiles.Count; ProfileIndex++) {
+        color_profile* Profile = &Profiles.Profiles[ProfileIndex];
+        if (SerialNumber && Profile != FindColorProfile(&Profiles, SerialNumber)) {
+            continue;
+        }
+        printf("Profile %s:\n", Profile->SerialNumber);
+        if (Profile->HasDegamma) PrintCurves("degamma", Profile->Degamma);
+        if (Profile->HasCTM) {
+            printf("  ctm:\n");
+            for (int Row = 0; Row < 3; Row++) {
+                printf("    %8.4f %8.4f %8.4f\n", Profile->CTM[Row * 3],
+                    Profile->CTM[Row * 3 + 1], Profile->CTM[Row * 3 + 2]);
+            }
+        }
+        if (Profile->HasGamma) PrintCurves("gamma", Profile->Gamma);
+    }
+
+    FreeColorProfiles(&Profiles);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        return PrintProfiles(argv[1], argc > 2 ? argv[2] : NULL) ? 0 : 1;
+    }
+
+    srand(1);
+    if (!CheckLUTs()) {
+        printf("FAIL: vectorized LUTs don't match the scalar reference\n");
+        return 1;
+    }
+    printf("Vectorized LUTs match the scalar reference (%i curves)\n", CURVES_CHECKED);
+
+    BenchLUTs();
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+Checks and times the frame copy and convert kernels (see copy.h)
+without touching a GPU or display.
+
+For random sizes, strides and alignments in every source format, and a
+frame big enough for non-temporal stores, CopyFrame must match the
+scalar reference exactly, on one thread and on a worker pool, without
+writing past its rows; it exits non-zero if it doesn't.
+
+Then each format is timed at 1080p and 4K against memcpy(3) of the
+BGRA result: the scalar reference, the vector kernels on one thread,
+and on a pool of a thread per CPU. Run with COPY_KERNELS=scalar, avx2,
+avx512 or neon to check and time a specific set.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "copy.h"
+#include "utils.h"
+#include "workers.h"
+
+#define FRAMES_CHECKED 200
+#define BENCH_RUNS     20
+#define DEST_GUARD     0xCD
+
+static const int BenchSizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+
+static void RandomBytes(uint8_t* Bytes, size_t Size) {
+    for (size_t Index = 0; Index < Size; Index++) {
+        Bytes[Index] = rand();
+    }
+}
+
+// Converts a random frame with padded strides with CopyFrame and the
+// reference, into destinations Offset bytes past 64 byte alignment.
+static bool CheckFrame(worker_pool* Pool, copy_format Format, int Width, int Height,
+    int Offset)
+{
+    int Padding = rand() % 3 * 16 + rand() % 8;
+    copy_source Source;
+    InitCopySource(&Source, Format, Width, Height, NULL);
+    Source.Strides[0] += Padding;
+    Source.Strides[1] += Format == COPY_FORMAT_NV12 ? Padding : 0;
+    size_t LumaSize   = (size_t)Source.Strides[0] * Height;
+    size_t SourceSize = LumaSize + (size_t)Source.Strides[1] * (Height / 2);
+    uint8_t* Pixels = malloc(SourceSize);
+    RandomBytes(Pixels, SourceSize);
+    Source.Planes[0] = Pixels;
+    Source.Planes[1] = Format == COPY_FORMAT_NV12 ? Pixels + LumaSize : NULL;
+
+    int DestStride  = Width * 4 + rand() % 4 * 4;
+    size_t DestSize = (size_t)DestStride * Height + Offset;
+    uint8_t* Vector = aligned_alloc(64, (DestSize + 63) / 64 * 64);
+    uint8_t* Scalar = aligned_alloc(64, (DestSize + 63) / 64 * 64);
+    memset(Vector, DEST_GUARD, DestSize);
+    memset(Scalar, DEST_GUARD, DestSize);
+
+    CopyFrame(Pool, &Source, Vector + Offset, DestStride);
+    CopyFrameScalar(&Source, Scalar + Offset, DestStride);
+
+    bool OK = true;
+    for (size_t Index = 0; Index < DestSize; Index++) {
+        if (Vector[Index] != Scalar[Index]) {
+            size_t Byte = Index - Offset;
+            printf("%s %ix%i (source stride %i, dest stride %i, offset %i, %s): "
+                "row %zu byte %zu: vector %u, scalar %u\n",
+                CopyFormatName(Format), Width, Height, Source.Strides[0], DestStride,
+                Offset, Pool ? "pool" : "one thread", Byte / DestStride, Byte % DestStride,
+                Vector[Index], Scalar[Index]);
+            OK = false;
+            break;
+        }
+    }
+
+    free(Pixels);
+    free(Vector);
+    free(Scalar);
+    return OK;
+}
+
+static bool CheckCopies(worker_pool* Pool) {
+    for (copy_format Format = COPY_FORMAT_BGRA; Format <= COPY_FORMAT_NV12; Format++) {
+        int Align = Format >= COPY_FORMAT_YUYV ? 2 : 1;
+        for (int Frame = 0; Frame < FRAMES_CHECKED; Frame++) {
+            int Width  = (1 + rand() % 300) * Align;
+            int Height = (1 + rand() % 40) * Align;
+            int Offset = rand() % 2 * 4;
+            if (!CheckFrame(Frame % 2 ? Pool : NULL, Format, Width, Height, Offset)) {
+                return false;
+            }
+        }
+        // Past COPY_STREAMING_BYTES, aligned for streaming and not
+        if (!CheckFrame(Pool, Format, 1280, 720, 0) ||
+            !CheckFrame(Pool, Format, 1282, 720, 4)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Milliseconds per frame
+static double TimeCopies(worker_pool* Pool, const copy_source* Source,
+    uint8_t* Dest, bool Scalar)
+{
+    uint64_t Start = GetTimeNS();
+    for (int Run = 0; Run < BENCH_RUNS; Run++) {
+        if (Scalar) {
+            CopyFrameScalar(Source, Dest, Source->Width * 4);
+        } else {
+            CopyFrame(Pool, Source, Dest, Source->Width * 4);
+        }
+    }
+    return (GetTimeNS() - Start) / 1e6 / BENCH_RUNS;
+}
+
+static void BenchCopies(worker_pool* Pool) {
+    printf("%6s %10s %12s %12s %12s %12s %10s\n", "Format", "Size",
+        "memcpy (ms)", "Scalar (ms)", "Vector (ms)", "Pool (ms)", "Pool GB/s");
+    for (int SizeIndex = 0; SizeIndex < ARRAY_LEN(BenchSizes); SizeIndex++) {
+        int Width  = BenchSizes[SizeIndex][0];
+        int Height = BenchSizes[SizeIndex][1];
+        size_t DestSize = (size_t)Width * Height * 4;
+        uint8_t* Pixels = aligned_alloc(64, DestSize);
+        uint8_t* Dest   = aligned_alloc(64, DestSize);
+        RandomBytes(Pixels, DestSize);
+        memset(Dest, 0, DestSize);
+
+        uint64_t Start = GetTimeNS();
+        for (int Run = 0; Run < BENCH_RUNS; Run++) {
+            memcpy(Dest, Pixels, DestSize);
+        }
+        double Memcpy = (GetTimeNS() - Start) / 1e6 / BENCH_RUNS;
+
+        for (copy_format Format = COPY_FORMAT_BGRA; Format <= COPY_FORMAT_NV12; Format++) {
+            copy_source Source;
+            InitCopySource(&Source, Format, Width, Height, Pixels);
+            double Scalar = TimeCopies(NULL, &Source, Dest, true);
+            double Vector = TimeCopies(NULL, &Source, Dest, false);
+            double Pooled = TimeCopies(Pool, &Source, Dest, false);
+            printf("%6s %4ix%-5i %12.3f %12.3f %12.3f %12.3f %10.2f\n",
+                CopyFormatName(Format), Width, Height, Memcpy, Scalar, Vector, Pooled,
+                DestSize / (Pooled * 1e6));
+        }
+
+        free(Pixels);
+        free(Dest);
+    }
+}
+
+int main(int argc, char** argv) {
+    worker_pool* Pool = CreateWorkerPool(0);
+    printf("Kernels: %s, pool of %i threads\n", CopyKernelsName(), Pool->ThreadsCount + 1);
+
+    srand(1);
+    if (!CheckCopies(Pool)) {
+        printf("FAIL: %s copies don't match the scalar reference\n", CopyKernelsName());
+        return 1;
+    }
+    printf("%s copies match the scalar reference (%i frames per format)\n",
+        CopyKernelsName(), FRAMES_CHECKED + 2);
+
+    BenchCopies(Pool);
+    DestroyWorkerPool(Pool);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+Measures event loop dispatch latency, idle and under load
+(one busy thread per CPU):
+ - notifier: time from EventLoopNotify on a worker thread
+   to the callback running on the loop thread
+ - timer: time from a 1ms periodic timer's deadline to its callback
+The loop thread uses EVENT_THREAD_PROFILE (see threads.h).
+No GPU is needed.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "events.h"
+#include "threads.h"
+#include "utils.h"
+
+#define SAMPLES   5000
+#define PERIOD_NS 1000000ULL
+
+typedef struct {
+    event_loop*   Loop;
+    event_source* Notifier;
+    event_source* Timer;
+
+    _Atomic uint64_t SendNS;
+    atomic_bool      Handled;
+    long             NotifyLatencyNS[SAMPLES];
+    int              NotifySamples;
+
+    uint64_t         NextDeadlineNS;
+    long             TimerLatencyNS[SAMPLES];
+    int              TimerSamples;
+} bench_state;
+
+static atomic_bool StopContention;
+
+static void* ContentionThreadMain(void* Arg) {
+    volatile uint64_t Spin = 0;
+    while (!atomic_load_explicit(&StopContention, memory_order_relaxed)) {
+        Spin++;
+    }
+    return NULL;
+}
+
+static void OnNotify(void* UserData) {
+    bench_state* State = UserData;
+    uint64_t Now = GetTimeNS();
+    if (State->NotifySamples < SAMPLES) {
+        State->NotifyLatencyNS[State->NotifySamples++] = Now - atomic_load(&State->SendNS);
+    }
+    atomic_store(&State->Handled, true);
+}
+
+static void OnTimer(void* UserData) {
+    bench_state* State = UserData;
+    uint64_t Now = GetTimeNS();
+    // Measure from the latest deadline, if expirations were coalesced
+    State->NextDeadlineNS += (State->Timer->Count - 1) * PERIOD_NS;
+    if (State->TimerSamples < SAMPLES) {
+        State->TimerLatencyNS[State->TimerSamples++] = Now - State->NextDeadlineNS;
+    }
+    State->NextDeadlineNS += PERIOD_NS;
+
+    if (State->TimerSamples == SAMPLES && State->NotifySamples == SAMPLES) {
+        EventLoopStop(State->Loop);
+    }
+}
+
+static void* SenderThreadMain(void* Arg) {
+    bench_state* State = Arg;
+    for (int Sample = 0; Sample < SAMPLES; Sample++) {
+        atomic_store(&State->Handled, false);
+        atomic_store(&State->SendNS, GetTimeNS());
+        EventLoopNotify(State->Notifier);
+
+        while (!atomic_load(&State->Handled)) {
+            usleep(50);
+        }
+        usleep(200 + rand() % 1800);
+    }
+    return NULL;
+}
+
+static int CompareLongs(const void* A, const void* B) {
+    long L = *(const long*)A, R = *(const long*)B;
+    return (L > R) - (L < R);
+}
+
+static void PrintLatencies(const char* Name, long* Samples, int Count) {
+    qsort(Samples, Count, sizeof(long), CompareLongs);
+    printf("%30s: p50 %7.1fus p99 %7.1fus max %7.1fus\n",
+        Name,
+        Samples[Count / 2] / 1000.0,
+        Samples[Count * 99 / 100] / 1000.0,
+        Samples[Count - 1] / 1000.0);
+}
+
+static void RunBenchmark(const char* Name, bool Loaded) {
+    bench_state* State = calloc(1, sizeof(bench_state));
+    State->Loop     = CreateEventLoop();
+    State->Notifier = EventLoopAddNotifier(State->Loop, OnNotify, State);
+    State->Timer    = EventLoopAddTimer(State->Loop, OnTimer, State);
+
+    int CPUCount = Loaded ? sysconf(_SC_NPROCESSORS_ONLN) : 0;
+    pthread_t* Contention = calloc(CPUCount + 1, sizeof(pthread_t));
+    atomic_store(&StopContention, false);
+    for (int CPU = 0; CPU < CPUCount; CPU++) {
+        pthread_create(&Contention[CPU], NULL, ContentionThreadMain, NULL);
+    }
+
+    State->NextDeadlineNS = GetTimeNS() + PERIOD_NS;
+    EventLoopArmTimer(State->Timer, State->NextDeadlineNS, PERIOD_NS);
+
+    pthread_t Sender;
+    pthread_create(&Sender, NULL, SenderThreadMain, State);
+
+    EventLoopRun(State->Loop);
+
+    pthread_join(Sender, NULL);
+    atomic_store(&StopContention, true);
+    for (int CPU = 0; CPU < CPUCount; CPU++) {
+        pthread_join(Contention[CPU], NULL);
+    }
+    free(Contention);
+
+    printf("%s (%i busy threads):\n", Name, CPUCount);
+    PrintLatencies("Notifier dispatch latency", State->NotifyLatencyNS, State->NotifySamples);
+    PrintLatencies("Timer dispatch latency", State->TimerLatencyNS, State->TimerSamples);
+    free(State);
+}
+
+int main() {
+    ApplyThreadProfile("Event", GetThreadProfile("EVENT_THREAD_PROFILE", -1));
+
+    RunBenchmark("Idle", false);
+    RunBenchmark("Loaded", true);
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+Measures the cost of per-display flip state false-sharing cache lines.
+
+Runs 4 to 8 threads, each driving its own display the way an acquire
+thread and the flip handler do: reading the display's descriptor
+(Width, Surface, Stream) for its EGL calls, then setting its flip flag
+pending, polling it, clearing it and stamping LastPageFlip. The
+displays are laid out:
+ - packed:   in the old single egl_display array, where each display's
+             flags share a cache line with the next display's
+             descriptor fields
+ - hot/cold: in read-only egl_display descriptors and cache-line
+             aligned egl_display_hot blocks, which also hold the
+             display's own Surface and Stream
+For each layout it prints how many displays' flags share a line with
+another display's fields, then ns per iteration. No GPU is needed, but
+the threads only contend with more than one CPU.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "egl.h"
+#include "utils.h"
+
+#define ITERATIONS 10000000
+#define MAX_THREADS 8
+
+// egl_display as it was before the hot fields were split out
+typedef struct {
+    drm_edid* EDID;
+    int Width;
+    int Height;
+    char* MonitorName;
+    char* SerialNumber;
+    EGLSurface Surface;
+    EGLContext Context;
+    EGLDisplay DisplayDevice;
+    EGLConfig Config;
+    EGLStreamKHR Stream;
+    EGLOutputLayerEXT Layer;
+    _Atomic uint32_t PageFlipPending;
+    _Atomic float LastPageFlip;
+} packed_display;
+
+typedef struct {
+    // Written every iteration
+    _Atomic uint32_t* PageFlipPending;
+    _Atomic float*    LastPageFlip;
+    // Read every iteration
+    const volatile int*          Width;
+    const volatile EGLSurface*   Surface;
+    const volatile EGLStreamKHR* Stream;
+} display_fields;
+
+typedef struct {
+    display_fields     Fields;
+    pthread_barrier_t* Barrier;
+} hammer_args;
+
+static void* HammerThreadMain(void* Arg) {
+    hammer_args* Args = Arg;
+    display_fields* Fields = &Args->Fields;
+    pthread_barrier_wait(Args->Barrier);
+
+    uintptr_t Seen = 0;
+    for (int Iteration = 0; Iteration < ITERATIONS; Iteration++) {
+        Seen += *Fields->Width + (uintptr_t)*Fields->Surface + (uintptr_t)*Fields->Stream;
+        atomic_store_explicit(Fields->PageFlipPending, PAGE_FLIP_PENDING,
+            memory_order_release);
+        Seen += atomic_load_explicit(Fields->PageFlipPending,
+            memory_order_acquire);
+        atomic_exchange_explicit(Fields->PageFlipPending, 0,
+            memory_order_release);
+        atomic_store_explicit(Fields->LastPageFlip, (float)Iteration,
+            memory_order_relaxed);
+    }
+    return (void*)Seen;
+}
+
+static bool SameLine(const volatile void* A, const volatile void* B) {
+    return (uintptr_t)A / CACHE_LINE_SIZE == (uintptr_t)B / CACHE_LINE_SIZE;
+}
+
+// Displays whose written flags share a cache line with another
+// display's fields
+static int CountSharedLines(display_fields* Fields, int Count) {
+    int Shared = 0;
+    for (int Writer = 0; Writer < Count; Writer++) {
+        bool Sharing = false;
+        for (int Other = 0; Other < Count; Other++) {
+            if (Other == Writer) continue;
+            const volatile void* OtherFields[] = {
+                Fields[Other].PageFlipPending, Fields[Other].LastPageFlip,
+                Fields[Other].Width, Fields[Other].Surface, Fields[Other].Stream,
+            };
+            for (int FieldIndex = 0; FieldIndex < ARRAY_LEN(OtherFields); FieldIndex++) {
+                Sharing |= SameLine(Fields[Writer].PageFlipPending, OtherFields[FieldIndex]) ||
+                    SameLine(Fields[Writer].LastPageFlip, OtherFields[FieldIndex]);
+            }
+        }
+        Shared += Sharing;
+    }
+    return Shared;
+}
+
+// Returns nanoseconds per iteration
+static double RunHammer(display_fields* Fields, int Count) {
+    pthread_t Threads[MAX_THREADS];
+    hammer_args Args[MAX_THREADS];
+    pthread_barrier_t Barrier;
+    pthread_barrier_init(&Barrier, NULL, Count + 1);
+
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        Args[ThreadIndex] = (hammer_args){
+            .Fields  = Fields[ThreadIndex],
+            .Barrier = &Barrier
+        };
+        pthread_create(&Threads[ThreadIndex], NULL, HammerThreadMain, &Args[ThreadIndex]);
+    }
+
+    pthread_barrier_wait(&Barrier);
+    uint64_t Before = GetTimeNS();
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        pthread_join(Threads[ThreadIndex], NULL);
+    }
+    uint64_t Elapsed = GetTimeNS() - Before;
+
+    pthread_barrier_destroy(&Barrier);
+    return (double)Elapsed / ITERATIONS;
+}
+
+int main() {
+    // Aligned like the start of a malloc'd block, as the old array was
+    packed_display* Packed = aligned_alloc(CACHE_LINE_SIZE,
+        (sizeof(packed_display) * MAX_THREADS + CACHE_LINE_SIZE - 1) /
+        CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+    memset(Packed, 0, sizeof(packed_display) * MAX_THREADS);
+    egl_display* Cold = calloc(MAX_THREADS, sizeof(egl_display));
+    egl_display_hot* Hot = aligned_alloc(CACHE_LINE_SIZE, sizeof(egl_display_hot) * MAX_THREADS);
+    memset(Hot, 0, sizeof(egl_display_hot) * MAX_THREADS);
+
+    display_fields PackedFields[MAX_THREADS];
+    display_fields HotFields[MAX_THREADS];
+    for (int DisplayIndex = 0; DisplayIndex < MAX_THREADS; DisplayIndex++) {
+        packed_display* Display = &Packed[DisplayIndex];
+        PackedFields[DisplayIndex] = (display_fields){
+            &Display->PageFlipPending, &Display->LastPageFlip,
+            &Display->Width, &Display->Surface, &Display->Stream,
+        };
+        HotFields[DisplayIndex] = (display_fields){
+            &Hot[DisplayIndex].PageFlipPending, &Hot[DisplayIndex].LastPageFlip,
+            &Cold[DisplayIndex].Width, &Hot[DisplayIndex].Surface,
+            // Read plainly, the way the packed layout's is
+            (const volatile EGLStreamKHR*)&Hot[DisplayIndex].Stream,
+        };
+    }
+
+    printf("sizeof(packed_display) = %zu, sizeof(egl_display_hot) = %zu\n",
+        sizeof(packed_display), sizeof(egl_display_hot));
+    printf("%8s %14s %18s %14s %18s %8s\n", "Displays", "Packed shared",
+        "Packed (ns/iter)", "Hot/cold shared", "Hot/cold (ns/iter)", "Speedup");
+
+    for (int Count = 4; Count <= MAX_THREADS; Count++) {
+        double PackedNS = RunHammer(PackedFields, Count);
+        double HotNS    = RunHammer(HotFields, Count);
+        printf("%8i %14i %18.2f %14i %18.2f %7.2fx\n", Count,
+            CountSharedLines(PackedFields, Count), PackedNS,
+            CountSharedLines(HotFields, Count), HotNS, PackedNS / HotNS);
+    }
+
+    return 0;
+}
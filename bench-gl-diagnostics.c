@@ -0,0 +1,98 @@
+/*
+Measures the per-frame overhead of each GL diagnostics mode
+(see gldiag.h) in the single threaded render loop.
+
+Runs a few seconds in each mode and prints the average time spent in
+GLDiagnosticsEndFrame and the render thread's CPU time per frame.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <GL/glew.h>
+#include <math.h>
+
+#include "egl.h"
+#include "gldiag.h"
+#include "utils.h"
+
+#define MODE_SECONDS 5
+
+static void RunMode(egl_state* EGL, const char* Name, gl_diag_mode Mode) {
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        eglMakeCurrent(Display->DisplayDevice,
+            Display->Hot->Surface, Display->Hot->Surface,
+            Display->Context);
+        SetGLDiagnosticsMode(Mode);
+    }
+
+    int Frames = 0;
+    double DiagTime = 0;
+    double CPUTime  = 0;
+    float Start = GetTime();
+    while (GetTime() - Start < MODE_SECONDS) {
+
+        EGLUpdateVSync(EGL);
+
+        double CPUBefore = GetThreadCPUTime();
+        bool Rendered = false;
+
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+
+            if (EGLPageFlipPending(Display)) {
+                continue;
+            }
+
+            eglMakeCurrent(Display->DisplayDevice,
+                Display->Hot->Surface, Display->Hot->Surface,
+                Display->Context);
+
+            glViewport(0, 0,
+                (GLint)Display->Width,
+                (GLint)Display->Height);
+
+            glClearColor(
+                        (sin(GetTime()*3)/2+0.5) * 0.8,
+                        (sin(GetTime()*5)/2+0.5) * 0.8,
+                        (sin(GetTime()*7)/2+0.5) * 0.8,
+                        1);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            EGLSwapFrame(Display);
+            EGLAcquireProduced(Display);
+            Rendered = true;
+        }
+
+        if (!Rendered) {
+            continue;
+        }
+
+        uint64_t DiagBefore = GetTimeNS();
+        GLDiagnosticsEndFrame("Display Thread");
+        DiagTime += (GetTimeNS() - DiagBefore) / 1e9;
+
+        CPUTime += GetThreadCPUTime() - CPUBefore;
+        Frames++;
+    }
+
+    printf("%8s: %8.2fus in GLDiagnosticsEndFrame, %8.3fms CPU per frame (%i frames)\n",
+        Name,
+        DiagTime / MAX(Frames, 1) * 1e6,
+        CPUTime / MAX(Frames, 1) * 1e3,
+        Frames);
+}
+
+int main() {
+    GetTime();
+
+    egl_state* EGL = SetupEGL();
+
+    RunMode(EGL, "off",    GL_DIAG_OFF);
+    RunMode(EGL, "async",  GL_DIAG_ASYNC);
+    RunMode(EGL, "strict", GL_DIAG_STRICT);
+
+    return 0;
+}
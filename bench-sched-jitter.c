@@ -0,0 +1,118 @@
+/*
+Measures wakeup jitter of a periodic thread under synthetic CPU
+contention, first with the default thread profile and then with the
+profile in BENCH_THREAD_PROFILE (default "fifo:50,mlock,stack:262144").
+
+The periodic thread sleeps until absolute 1ms deadlines, like a render
+loop waiting on a deadline, and records how late each wakeup is while
+one busy thread per CPU competes for time.
+No GPU is needed; SCHED_FIFO needs CAP_SYS_NICE (or root).
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "threads.h"
+#include "utils.h"
+
+#define PERIOD_NS 1000000L
+#define WAKEUPS   5000
+
+static atomic_bool StopContention;
+
+static void* ContentionThreadMain(void* Arg) {
+    volatile uint64_t Spin = 0;
+    while (!atomic_load_explicit(&StopContention, memory_order_relaxed)) {
+        Spin++;
+    }
+    return NULL;
+}
+
+static int CompareLongs(const void* A, const void* B) {
+    long L = *(const long*)A, R = *(const long*)B;
+    return (L > R) - (L < R);
+}
+
+typedef struct {
+    const char*    Name;
+    thread_profile Profile;
+    long*          LatenessNS;
+} jitter_args;
+
+static void* PeriodicThreadMain(void* Arg) {
+    jitter_args* Args = Arg;
+    ApplyThreadProfile(Args->Name, Args->Profile);
+
+    struct timespec Deadline;
+    clock_gettime(CLOCK_MONOTONIC, &Deadline);
+    for (int Wakeup = 0; Wakeup < WAKEUPS; Wakeup++) {
+        Deadline.tv_nsec += PERIOD_NS;
+        if (Deadline.tv_nsec >= 1000000000L) {
+            Deadline.tv_nsec -= 1000000000L;
+            Deadline.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, NULL);
+
+        struct timespec Now;
+        clock_gettime(CLOCK_MONOTONIC, &Now);
+        Args->LatenessNS[Wakeup] = (Now.tv_sec - Deadline.tv_sec) * 1000000000L
+                                 + (Now.tv_nsec - Deadline.tv_nsec);
+    }
+    return NULL;
+}
+
+static void RunJitter(const char* Name, thread_profile Profile) {
+    jitter_args Args = {
+        .Name       = Name,
+        .Profile    = Profile,
+        .LatenessNS = calloc(WAKEUPS, sizeof(long))
+    };
+
+    int CPUCount = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t* Contention = calloc(CPUCount, sizeof(pthread_t));
+    atomic_store(&StopContention, false);
+    for (int CPU = 0; CPU < CPUCount; CPU++) {
+        pthread_create(&Contention[CPU], NULL, ContentionThreadMain, NULL);
+    }
+
+    pthread_t Periodic;
+    pthread_create(&Periodic, NULL, PeriodicThreadMain, &Args);
+    pthread_join(Periodic, NULL);
+
+    atomic_store(&StopContention, true);
+    for (int CPU = 0; CPU < CPUCount; CPU++) {
+        pthread_join(Contention[CPU], NULL);
+    }
+    free(Contention);
+
+    qsort(Args.LatenessNS, WAKEUPS, sizeof(long), CompareLongs);
+    double Sum = 0;
+    for (int Wakeup = 0; Wakeup < WAKEUPS; Wakeup++) {
+        Sum += Args.LatenessNS[Wakeup];
+    }
+    printf("%20s: wakeup lateness (us) min %.1f avg %.1f p99 %.1f max %.1f "
+           "(%i busy threads)\n",
+        Name,
+        Args.LatenessNS[0] / 1000.0,
+        Sum / WAKEUPS / 1000.0,
+        Args.LatenessNS[WAKEUPS * 99 / 100] / 1000.0,
+        Args.LatenessNS[WAKEUPS - 1] / 1000.0,
+        CPUCount);
+    free(Args.LatenessNS);
+}
+
+int main() {
+    const char* Spec = getenv("BENCH_THREAD_PROFILE");
+    if (!Spec) Spec = "fifo:50,mlock,stack:262144";
+
+    RunJitter("Default", DefaultThreadProfile());
+    RunJitter(Spec, ParseThreadProfile(Spec));
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+Streams video into a texture shown on every display (see ingest.h):
+a producer thread copies each frame from its source into a persistently
+mapped upload ring, converting it to BGRA (see copy.h), and the render
+loop uploads the newest one without waiting on the producer or the
+GPU. Once a second it reports frames produced, uploaded, superseded
+and dropped, the producer's copy time, and the latency from capture
+to the upload completing.
+
+The source is a synthetic camera by default; run with
+--file PATH --size WxH to play raw frames from a file instead,
+e.g. generated with
+  ffmpeg -i in.mp4 -f rawvideo -pix_fmt bgra frames.raw
+--format bgra|rgb24|yuyv|nv12 sets the source's pixel format (default
+bgra; ffmpeg's bgra, rgb24, yuyv422 and nv12), and --fps N its frame
+rate (default 60). INGEST_WORKERS=N sets the threads helping the copy.
+
+Run with --surfaceless to render offscreen (see surfaceless.h), e.g.
+  EGL_PLATFORM=surfaceless LIBGL_ALWAYS_SOFTWARE=1 ./camera-ingest.app --surfaceless
+and --seconds N to exit after N seconds.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <GL/glew.h>
+
+#include "egl.h"
+#include "ingest.h"
+#include "surfaceless.h"
+#include "threads.h"
+#include "utils.h"
+
+#define SURFACELESS_WIDTH  1920
+#define SURFACELESS_HEIGHT 1080
+#define SURFACELESS_FPS    60
+
+// Framebuffer objects aren't shared between contexts, and the texture
+// alternates, so this is reattached every frame.
+static GLuint IngestFramebuffer;
+
+static void DrawIngest(egl_display* Display, ingest* Ingest) {
+    glViewport(0, 0, (GLint)Display->Width, (GLint)Display->Height);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    GLuint Texture = IngestTexture(Ingest);
+    if (!Texture) return;
+
+    if (!IngestFramebuffer) {
+        glGenFramebuffers(1, &IngestFramebuffer);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, IngestFramebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D, Texture, 0);
+    // The frame's top row is the texture's first, so flip it
+    glBlitFramebuffer(0, 0, Ingest->Width, Ingest->Height,
+        0, Display->Height, Display->Width, 0,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+static bool ParseFormat(const char* Name, copy_format* Format) {
+    for (copy_format Candidate = COPY_FORMAT_BGRA; Candidate <= COPY_FORMAT_NV12; Candidate++) {
+        if (strcmp(Name, CopyFormatName(Candidate)) == 0) {
+            *Format = Candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    GetTime();
+
+    bool Surfaceless = false;
+    const char* Path = NULL;
+    int Width = 1920, Height = 1080, FPS = 60;
+    copy_format Format = COPY_FORMAT_BGRA;
+    double Seconds = 0;
+    for (int Arg = 1; Arg < argc; Arg++) {
+        if (strcmp(argv[Arg], "--surfaceless") == 0) {
+            Surfaceless = true;
+        } else if (strcmp(argv[Arg], "--file") == 0 && Arg + 1 < argc) {
+            Path = argv[++Arg];
+        } else if (strcmp(argv[Arg], "--size") == 0 && Arg + 1 < argc &&
+                   sscanf(argv[Arg + 1], "%ix%i", &Width, &Height) == 2) {
+            Arg++;
+        } else if (strcmp(argv[Arg], "--format") == 0 && Arg + 1 < argc &&
+                   ParseFormat(argv[Arg + 1], &Format)) {
+            Arg++;
+        } else if (strcmp(argv[Arg], "--fps") == 0 && Arg + 1 < argc) {
+            FPS = atoi(argv[++Arg]);
+        } else if (strcmp(argv[Arg], "--seconds") == 0 && Arg + 1 < argc) {
+            Seconds = atof(argv[++Arg]);
+        } else {
+            Fatal("Usage: %s [--file PATH] [--size WxH] [--format bgra|rgb24|yuyv|nv12] "
+                "[--fps N] [--surfaceless] [--seconds N]\n", argv[0]);
+        }
+    }
+    if (Format >= COPY_FORMAT_YUYV && (Width % 2 || Height % 2)) {
+        Fatal("%s frames need an even size\n", CopyFormatName(Format));
+    }
+
+    egl_state* EGL = Surfaceless ?
+        SetupSurfaceless(1, SURFACELESS_WIDTH, SURFACELESS_HEIGHT) :
+        SetupEGL();
+
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
+    ingest_source* Source = Path ?
+        CreateFileSource(Path, Format, Width, Height, FPS) :
+        CreateSyntheticSource(Format, Width, Height, FPS);
+    if (!Source) {
+        Fatal("No ingest source\n");
+    }
+
+    // The displays share one context, so one ingest feeds them all
+    egl_display* First = &EGL->Displays[0];
+    if (Surfaceless) {
+        BindSurfacelessDisplay(EGL, First);
+    } else {
+        eglMakeCurrent(First->DisplayDevice, First->Hot->Surface, First->Hot->Surface,
+            First->Context);
+    }
+    ingest* Ingest = CreateIngest(Source);
+    if (!Ingest) {
+        Fatal("Couldn't start ingest\n");
+    }
+
+    double StartTime = GetTime();
+    double LastReport = StartTime;
+    while (Seconds == 0 || GetTime() - StartTime < Seconds) {
+        if (Surfaceless) {
+            usleep(1000000 / SURFACELESS_FPS);
+        } else {
+            EGLUpdateVSync(EGL);
+        }
+
+        bool Updated = false;
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+
+            if (Surfaceless) {
+                BindSurfacelessDisplay(EGL, Display);
+            } else {
+                if (EGLPageFlipPending(Display)) {
+                    continue;
+                }
+                eglMakeCurrent(Display->DisplayDevice,
+                    Display->Hot->Surface, Display->Hot->Surface,
+                    Display->Context);
+            }
+
+            BeginFrame(Display);
+            // Once per loop, by the first display rendered
+            if (!Updated) {
+                UpdateIngest(Ingest);
+                Updated = true;
+            }
+            DrawIngest(Display, Ingest);
+            EndFrame(Display);
+
+            if (!Surfaceless) {
+                EGLSwapFrame(Display);
+                EGLAcquireProduced(Display);
+            }
+        }
+
+        if (GetTime() - LastReport > 1) {
+            LastReport = GetTime();
+            ReportIngest(Ingest);
+        }
+    }
+
+    DestroyIngest(Ingest);
+    Source->Destroy(Source);
+    return 0;
+}
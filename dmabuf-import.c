@@ -0,0 +1,541 @@
+/*
+Shows frames from an external producer on every display without
+copying them: each frame's dma-buf is imported as a texture (see
+dmabuf.h), once per buffer, and blitted to the displays.
+
+The producer is a V4L2 capture device when run with --v4l2 PATH, e.g.
+the vivid test driver:
+  sudo modprobe vivid && ./dmabuf-import.app --v4l2 /dev/video0
+Its buffers are exported with VIDIOC_EXPBUF and only queued back once
+the GPU is done reading them.
+
+By default, frames are drawn by the CPU into udmabuf buffers instead:
+  sudo modprobe udmabuf && ./dmabuf-import.app
+
+Run with --surfaceless to render offscreen (see surfaceless.h); dma-buf
+import needs a GPU driver, so this won't work with llvmpipe.
+Once a second, it reports cache hits and imports, and the latency from
+a frame being captured (or drawn by the CPU) to its first swap.
+
+Run with --self-test to check the import instead: udmabuf frames with
+a known pattern are imported and read back, through the cache as the
+buffers recur, and it exits 1 if any pixel differs.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include <drm_fourcc.h>
+#include <GL/glew.h>
+
+#include "dmabuf.h"
+#include "egl.h"
+#include "surfaceless.h"
+#include "threads.h"
+#include "utils.h"
+
+#define PRODUCER_BUFFERS   4
+#define PRODUCER_WIDTH     1280
+#define PRODUCER_HEIGHT    720
+#define SURFACELESS_WIDTH  1920
+#define SURFACELESS_HEIGHT 1080
+#define SURFACELESS_FPS    60
+#define SELF_TEST_FRAMES   (PRODUCER_BUFFERS * 3)
+
+typedef struct {
+    dmabuf_frame Frame;
+    udmabuf      Memory;    // udmabuf producer only
+    frame_fence  Fence;     // Of the last frame sampling it
+    bool         Queued;    // V4L2: owned by the driver
+    uint64_t     CaptureNS; // V4L2: when it was filled
+} producer_buffer;
+
+typedef struct {
+    int             VideoFd; // -1 for udmabuf
+    producer_buffer Buffers[PRODUCER_BUFFERS];
+    int             BuffersCount;
+    int             Current; // Buffer shown, -1 before the first
+    uint64_t        Frame;
+    frame_stat      Latency;
+} producer;
+
+static bool BufferIdle(producer_buffer* Buffer) {
+    if (!Buffer->Fence) {
+        return true;
+    }
+    if (glClientWaitSync(Buffer->Fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+    glDeleteSync(Buffer->Fence);
+    Buffer->Fence = NULL;
+    return true;
+}
+
+// udmabuf
+
+static void SetupUdmabufProducer(producer* Producer) {
+    Producer->VideoFd = -1;
+    for (int Index = 0; Index < PRODUCER_BUFFERS; Index++) {
+        producer_buffer* Buffer = &Producer->Buffers[Index];
+        int Pitch = PRODUCER_WIDTH * 4;
+        if (!CreateUdmabuf((size_t)Pitch * PRODUCER_HEIGHT, &Buffer->Memory)) {
+            Fatal("No udmabuf producer\n");
+        }
+        Buffer->Frame = (dmabuf_frame){
+            .Width       = PRODUCER_WIDTH,
+            .Height      = PRODUCER_HEIGHT,
+            .Format      = DRM_FORMAT_XRGB8888,
+            .Modifier    = DRM_FORMAT_MOD_LINEAR,
+            .PlanesCount = 1,
+            .Planes      = {{ Buffer->Memory.Fd, 0, Pitch }},
+        };
+    }
+    Producer->BuffersCount = PRODUCER_BUFFERS;
+}
+
+// Draws the next frame into a buffer the GPU isn't reading.
+// Returns false if they're all busy.
+static bool ProduceUdmabufFrame(producer* Producer) {
+    for (int Offset = 1; Offset <= Producer->BuffersCount; Offset++) {
+        int Index = (Producer->Current + Offset + Producer->BuffersCount) %
+            Producer->BuffersCount;
+        producer_buffer* Buffer = &Producer->Buffers[Index];
+        if (Index == Producer->Current || !BufferIdle(Buffer)) {
+            continue;
+        }
+
+        uint32_t Frame = (uint32_t)Producer->Frame++;
+        BeginDmabufWrite(Buffer->Memory.Fd);
+        for (int Y = 0; Y < PRODUCER_HEIGHT; Y++) {
+            uint32_t* Row = (uint32_t*)(Buffer->Memory.Pixels +
+                (size_t)Y * Buffer->Frame.Planes[0].Pitch);
+            uint32_t Shade = ((Y + Frame * 4) * 255 / PRODUCER_HEIGHT) & 0xFF;
+            for (int X = 0; X < PRODUCER_WIDTH; X++) {
+                Row[X] = 0xFF000000 | Shade << 16 | ((X + Frame * 8) & 0xFF) << 8 | 0x40;
+            }
+        }
+        EndDmabufWrite(Buffer->Memory.Fd);
+        Buffer->CaptureNS = GetTimeNS();
+        Producer->Current = Index;
+        return true;
+    }
+    return false;
+}
+
+// V4L2
+
+static int XIoctl(int Fd, unsigned long Request, void* Arg) {
+    int Result;
+    do {
+        Result = ioctl(Fd, Request, Arg);
+    } while (Result == -1 && errno == EINTR);
+    return Result;
+}
+
+static void SetupV4L2Producer(producer* Producer, const char* Path) {
+    Producer->VideoFd = open(Path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (Producer->VideoFd < 0) {
+        Fatal("Couldn't open %s: %s\n", Path, strerror(errno));
+    }
+    int Fd = Producer->VideoFd;
+
+    // XBGR32 is DRM_FORMAT_XRGB8888's byte order
+    struct v4l2_format Format = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    Format.fmt.pix.width       = PRODUCER_WIDTH;
+    Format.fmt.pix.height      = PRODUCER_HEIGHT;
+    Format.fmt.pix.pixelformat = V4L2_PIX_FMT_XBGR32;
+    Format.fmt.pix.field       = V4L2_FIELD_NONE;
+    if (XIoctl(Fd, VIDIOC_S_FMT, &Format) != 0 ||
+        Format.fmt.pix.pixelformat != V4L2_PIX_FMT_XBGR32) {
+        Fatal("%s can't capture XBGR32\n", Path);
+    }
+
+    struct v4l2_requestbuffers Request = {
+        .count  = PRODUCER_BUFFERS,
+        .type   = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory = V4L2_MEMORY_MMAP,
+    };
+    if (XIoctl(Fd, VIDIOC_REQBUFS, &Request) != 0 || Request.count < 2) {
+        Fatal("VIDIOC_REQBUFS failed on %s\n", Path);
+    }
+    Producer->BuffersCount = MIN((int)Request.count, PRODUCER_BUFFERS);
+
+    for (int Index = 0; Index < Producer->BuffersCount; Index++) {
+        struct v4l2_exportbuffer Export = {
+            .type  = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .index = Index,
+            .flags = O_RDONLY | O_CLOEXEC,
+        };
+        if (XIoctl(Fd, VIDIOC_EXPBUF, &Export) != 0) {
+            Fatal("VIDIOC_EXPBUF failed on %s: %s\n", Path, strerror(errno));
+        }
+        Producer->Buffers[Index].Frame = (dmabuf_frame){
+            .Width       = Format.fmt.pix.width,
+            .Height      = Format.fmt.pix.height,
+            .Format      = DRM_FORMAT_XRGB8888,
+            .Modifier    = DRM_FORMAT_MOD_LINEAR,
+            .PlanesCount = 1,
+            .Planes      = {{ Export.fd, 0, Format.fmt.pix.bytesperline }},
+        };
+
+        struct v4l2_buffer Buffer = {
+            .type   = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .memory = V4L2_MEMORY_MMAP,
+            .index  = Index,
+        };
+        if (XIoctl(Fd, VIDIOC_QBUF, &Buffer) != 0) {
+            Fatal("VIDIOC_QBUF failed on %s\n", Path);
+        }
+        Producer->Buffers[Index].Queued = true;
+    }
+
+    enum v4l2_buf_type Type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (XIoctl(Fd, VIDIOC_STREAMON, &Type) != 0) {
+        Fatal("VIDIOC_STREAMON failed on %s\n", Path);
+    }
+    printf("%s: capturing %ix%i into %i dma-bufs\n", Path,
+        Format.fmt.pix.width, Format.fmt.pix.height, Producer->BuffersCount);
+}
+
+// Queues buffers the GPU is done with back to the driver, then takes
+// the newest captured one, if any. Returns true if there's a new frame.
+static bool ProduceV4L2Frame(producer* Producer) {
+    for (int Index = 0; Index < Producer->BuffersCount; Index++) {
+        producer_buffer* Buffer = &Producer->Buffers[Index];
+        if (Buffer->Queued || Index == Producer->Current || !BufferIdle(Buffer)) {
+            continue;
+        }
+        struct v4l2_buffer Queue = {
+            .type   = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .memory = V4L2_MEMORY_MMAP,
+            .index  = Index,
+        };
+        if (XIoctl(Producer->VideoFd, VIDIOC_QBUF, &Queue) == 0) {
+            Buffer->Queued = true;
+        }
+    }
+
+    int Newest = -1;
+    while (1) {
+        struct v4l2_buffer Dequeue = {
+            .type   = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .memory = V4L2_MEMORY_MMAP,
+        };
+        if (XIoctl(Producer->VideoFd, VIDIOC_DQBUF, &Dequeue) != 0) {
+            if (errno != EAGAIN) {
+                LOG_RATE(LOG_WARN, 1000, "VIDIOC_DQBUF failed: %s\n", strerror(errno));
+            }
+            break;
+        }
+        producer_buffer* Buffer = &Producer->Buffers[Dequeue.index];
+        Buffer->Queued = false;
+        // Timestamps are CLOCK_MONOTONIC, like GetTimeNS
+        Buffer->CaptureNS = Dequeue.timestamp.tv_sec * 1000000000ULL +
+            Dequeue.timestamp.tv_usec * 1000ULL;
+        // Older frames captured meanwhile are skipped; they go back
+        // to the driver next time
+        Newest = Dequeue.index;
+    }
+    if (Newest < 0) {
+        return false;
+    }
+    Producer->Current = Newest;
+    Producer->Frame++;
+    return true;
+}
+
+// Drawing
+
+// Framebuffer objects aren't shared between contexts, and imported
+// textures change, so this is reattached every frame.
+static GLuint ImportFramebuffer;
+
+// External textures (YUV) can't be attached to a framebuffer, only
+// sampled, so they're drawn as a quad
+static GLuint ExternalProgram;
+
+static const char* ExternalVertexShader =
+    "#version 120\n"
+    "attribute vec2 Position;\n"
+    "varying vec2 TexCoord;\n"
+    "void main() {\n"
+    "    // dma-bufs are top row first, so flip them\n"
+    "    TexCoord = vec2(Position.x + 1.0, 1.0 - Position.y) * 0.5;\n"
+    "    gl_Position = vec4(Position, 0.0, 1.0);\n"
+    "}\n";
+
+static const char* ExternalFragmentShader =
+    "#version 120\n"
+    "#extension GL_OES_EGL_image_external : require\n"
+    "uniform samplerExternalOES Frame;\n"
+    "varying vec2 TexCoord;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(Frame, TexCoord);\n"
+    "}\n";
+
+static GLuint CompileShader(GLenum Type, const char* Source) {
+    GLuint Shader = glCreateShader(Type);
+    glShaderSource(Shader, 1, &Source, NULL);
+    glCompileShader(Shader);
+    GLint Compiled = 0;
+    glGetShaderiv(Shader, GL_COMPILE_STATUS, &Compiled);
+    if (!Compiled) {
+        char Log[1024];
+        glGetShaderInfoLog(Shader, sizeof(Log), NULL, Log);
+        Fatal("Couldn't compile the external texture shader: %s\n", Log);
+    }
+    return Shader;
+}
+
+static GLuint CreateExternalProgram(void) {
+    GLuint Program = glCreateProgram();
+    GLuint Vertex   = CompileShader(GL_VERTEX_SHADER, ExternalVertexShader);
+    GLuint Fragment = CompileShader(GL_FRAGMENT_SHADER, ExternalFragmentShader);
+    glAttachShader(Program, Vertex);
+    glAttachShader(Program, Fragment);
+    glBindAttribLocation(Program, 0, "Position");
+    glLinkProgram(Program);
+    glDeleteShader(Vertex);
+    glDeleteShader(Fragment);
+    GLint Linked = 0;
+    glGetProgramiv(Program, GL_LINK_STATUS, &Linked);
+    if (!Linked) {
+        char Log[1024];
+        glGetProgramInfoLog(Program, sizeof(Log), NULL, Log);
+        Fatal("Couldn't link the external texture shader: %s\n", Log);
+    }
+    return Program;
+}
+
+static void DrawExternalFrame(GLuint Texture) {
+    static const GLfloat Quad[] = { -1, -1,  1, -1,  -1, 1,  1, 1 };
+    if (!ExternalProgram) {
+        ExternalProgram = CreateExternalProgram();
+    }
+    glUseProgram(ExternalProgram);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, Texture);
+    glUniform1i(glGetUniformLocation(ExternalProgram, "Frame"), 0);
+    // Client-side, so there's no buffer to share between contexts
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, Quad);
+    glEnableVertexAttribArray(0);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray(0);
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
+    glUseProgram(0);
+}
+
+static void DrawFrame(egl_display* Display, GLuint Texture, GLenum Target,
+    producer_buffer* Buffer)
+{
+    glViewport(0, 0, (GLint)Display->Width, (GLint)Display->Height);
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (!Texture) return;
+
+    if (Target == GL_TEXTURE_EXTERNAL_OES) {
+        DrawExternalFrame(Texture);
+        return;
+    }
+
+    if (!ImportFramebuffer) {
+        glGenFramebuffers(1, &ImportFramebuffer);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, ImportFramebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D, Texture, 0);
+    // dma-bufs are top row first, so flip them
+    glBlitFramebuffer(0, 0, Buffer->Frame.Width, Buffer->Frame.Height,
+        0, Display->Height, Display->Width, 0,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+// Produces and imports frames through every buffer a few times, so
+// most imports are cache hits of buffers drawn since, and reads each
+// back to compare with what the CPU drew. Returns the mismatches.
+static int RunSelfTest(dmabuf_importer* Importer) {
+    producer Producer = { .Current = -1 };
+    SetupUdmabufProducer(&Producer);
+
+    GLuint Framebuffer;
+    glGenFramebuffers(1, &Framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, Framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    uint32_t* Pixels = malloc((size_t)PRODUCER_WIDTH * PRODUCER_HEIGHT * 4);
+
+    int Mismatched = 0;
+    for (int Frame = 0; Frame < SELF_TEST_FRAMES; Frame++) {
+        if (!ProduceUdmabufFrame(&Producer)) {
+            Fatal("No idle udmabuf buffer\n");
+        }
+        producer_buffer* Buffer = &Producer.Buffers[Producer.Current];
+        GLenum Target;
+        GLuint Texture = ImportDmabuf(Importer, &Buffer->Frame, &Target);
+        if (!Texture || Target != GL_TEXTURE_2D) {
+            printf("FAIL: frame %i: couldn't import it as a 2D texture\n", Frame);
+            Mismatched++;
+            continue;
+        }
+
+        // The texture's first row is the dma-buf's first row, and
+        // XRGB8888 is BGRA in memory
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, Texture, 0);
+        glReadPixels(0, 0, PRODUCER_WIDTH, PRODUCER_HEIGHT,
+            GL_BGRA, GL_UNSIGNED_BYTE, Pixels);
+        for (int Y = 0; Y < PRODUCER_HEIGHT; Y++) {
+            const uint32_t* Row = (const uint32_t*)(Buffer->Memory.Pixels +
+                (size_t)Y * Buffer->Frame.Planes[0].Pitch);
+            if (memcmp(Row, Pixels + (size_t)Y * PRODUCER_WIDTH, PRODUCER_WIDTH * 4) != 0) {
+                printf("FAIL: frame %i: row %i differs from what was written\n", Frame, Y);
+                Mismatched++;
+                break;
+            }
+        }
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &Framebuffer);
+    free(Pixels);
+
+    if (Importer->Hits == 0) {
+        printf("FAIL: no import was a cache hit\n");
+        Mismatched++;
+    }
+    ReportDmabufImporter(Importer);
+    FlushLog();
+    return Mismatched;
+}
+
+int main(int argc, char** argv) {
+    GetTime();
+
+    bool Surfaceless = false;
+    bool SelfTest = false;
+    const char* VideoPath = NULL;
+    for (int Arg = 1; Arg < argc; Arg++) {
+        if (strcmp(argv[Arg], "--surfaceless") == 0) {
+            Surfaceless = true;
+        } else if (strcmp(argv[Arg], "--self-test") == 0) {
+            SelfTest = true;
+        } else if (strcmp(argv[Arg], "--v4l2") == 0 && Arg + 1 < argc) {
+            VideoPath = argv[++Arg];
+        } else {
+            Fatal("Usage: %s [--v4l2 PATH] [--surfaceless] [--self-test]\n", argv[0]);
+        }
+    }
+
+    egl_state* EGL = Surfaceless ?
+        SetupSurfaceless(1, SURFACELESS_WIDTH, SURFACELESS_HEIGHT) :
+        SetupEGL();
+
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
+    egl_display* First = &EGL->Displays[0];
+    if (Surfaceless) {
+        BindSurfacelessDisplay(EGL, First);
+    } else {
+        eglMakeCurrent(First->DisplayDevice, First->Hot->Surface, First->Hot->Surface,
+            First->Context);
+    }
+    dmabuf_importer* Importer = CreateDmabufImporter(EGL->DisplayDevice);
+    if (!Importer) {
+        Fatal("Can't import dma-bufs\n");
+    }
+
+    if (SelfTest) {
+        int Mismatched = RunSelfTest(Importer);
+        if (Mismatched) {
+            printf("%i check(s) failed\n", Mismatched);
+            return 1;
+        }
+        printf("PASS: %i udmabuf frames read back as written\n", SELF_TEST_FRAMES);
+        return 0;
+    }
+
+    producer Producer = { .Current = -1 };
+    StatReset(&Producer.Latency);
+    if (VideoPath) {
+        SetupV4L2Producer(&Producer, VideoPath);
+    } else {
+        SetupUdmabufProducer(&Producer);
+    }
+
+    double LastReport = GetTime();
+    while (1) {
+        if (Surfaceless) {
+            usleep(1000000 / SURFACELESS_FPS);
+        } else {
+            EGLUpdateVSync(EGL);
+        }
+
+        // The displays share one context, so one import feeds them all
+        bool Produced = false;
+        GLuint Texture = 0;
+        GLenum Target = GL_TEXTURE_2D;
+        producer_buffer* Buffer = NULL;
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+
+            if (Surfaceless) {
+                BindSurfacelessDisplay(EGL, Display);
+            } else {
+                if (EGLPageFlipPending(Display)) {
+                    continue;
+                }
+                eglMakeCurrent(Display->DisplayDevice,
+                    Display->Hot->Surface, Display->Hot->Surface,
+                    Display->Context);
+            }
+
+            BeginFrame(Display);
+            if (!Buffer) {
+                Produced = VideoPath ?
+                    ProduceV4L2Frame(&Producer) : ProduceUdmabufFrame(&Producer);
+                if (Producer.Current >= 0) {
+                    Buffer = &Producer.Buffers[Producer.Current];
+                    Texture = ImportDmabuf(Importer, &Buffer->Frame, &Target);
+                }
+            }
+            DrawFrame(Display, Texture, Target, Buffer);
+            EndFrame(Display);
+
+            if (!Surfaceless) {
+                EGLSwapFrame(Display);
+                EGLAcquireProduced(Display);
+            }
+            // Once a new frame is swapped on its first display
+            if (Produced) {
+                StatAdd(&Producer.Latency,
+                    (GetTimeNS() - Buffer->CaptureNS) / 1000000.0);
+                Produced = false;
+            }
+        }
+
+        // Fenced after every display has drawn it
+        if (Buffer) {
+            if (Buffer->Fence) {
+                glDeleteSync(Buffer->Fence);
+            }
+            Buffer->Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+        if (GetTime() - LastReport > 1) {
+            LastReport = GetTime();
+            ReportDmabufImporter(Importer);
+            LOG(LOG_INFO, "%20s: %lu frames, capture to swap %.2fms (max %.2f)\n",
+                VideoPath ? VideoPath : "udmabuf", (unsigned long)Producer.Frame,
+                StatAverage(&Producer.Latency), Producer.Latency.Max);
+            StatReset(&Producer.Latency);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+Checks the dynamic resolution controller (UpdateResolutionScale, see
+dynres.h) with made-up frame times, so it can be tested without a GPU.
+
+Checks, with the default options and a 60Hz budget:
+ - it starts at the largest scale
+ - it shrinks one step only after ShrinkFrames frames in a row over
+   budget, and a frame under budget starts the count over
+ - it never shrinks below MinScale nor grows above MaxScale
+ - it grows one step only after GrowFrames frames in a row that would
+   still fit at the larger scale
+ - frame times between the two thresholds hold the scale steady
+ - a scene whose cost follows its pixel count settles on the largest
+   scale that fits, and stays there without oscillating
+
+Exits 0 if everything passed, 1 otherwise.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "dynres.h"
+#include "utils.h"
+
+#define BUDGET_MS (1000.0 / 60)
+#define SETTLE_FRAMES 10000
+
+static int Failures;
+
+static void Check(bool Passed, const char* What) {
+    if (!Passed) {
+        printf("FAIL: %s\n", What);
+        Failures++;
+    }
+}
+
+// Feeds FrameMS Count times; returns how many of them changed the scale
+static int Feed(dynres* DynRes, double FrameMS, int Count) {
+    int Changes = 0;
+    for (int Frame = 0; Frame < Count; Frame++) {
+        Changes += UpdateResolutionScale(DynRes, FrameMS, BUDGET_MS);
+    }
+    return Changes;
+}
+
+int main() {
+    dynres_options Options = DefaultDynamicResolutionOptions();
+    dynres DynRes;
+    double OverMS = BUDGET_MS * Options.ShrinkAbove * 1.1;
+    // Fits under GrowBelow even after growing from the smallest scale
+    double UnderMS = BUDGET_MS * Options.GrowBelow *
+        (Options.MinScale * Options.MinScale) / (Options.MaxScale * Options.MaxScale) * 0.5;
+
+    InitDynamicResolution(&DynRes, Options);
+    Check(DynRes.Scale == Options.MaxScale, "didn't start at MaxScale");
+
+    // Shrinking waits for ShrinkFrames in a row
+    Check(Feed(&DynRes, OverMS, Options.ShrinkFrames - 1) == 0, "shrank too early");
+    Feed(&DynRes, UnderMS, 1);
+    Check(Feed(&DynRes, OverMS, Options.ShrinkFrames - 1) == 0,
+        "a frame under budget didn't reset the shrink count");
+    Check(Feed(&DynRes, OverMS, 1) == 1, "didn't shrink after ShrinkFrames");
+    Check(fabsf(DynRes.Scale - (Options.MaxScale - Options.Step)) < 1e-6,
+        "shrank by other than one step");
+
+    // Down to MinScale and no further
+    Feed(&DynRes, OverMS, Options.ShrinkFrames * 100);
+    Check(DynRes.Scale == Options.MinScale, "didn't stop at MinScale");
+
+    // Growing waits for GrowFrames in a row
+    Check(Feed(&DynRes, UnderMS, Options.GrowFrames - 1) == 0, "grew too early");
+    Feed(&DynRes, OverMS, 1);
+    Check(Feed(&DynRes, UnderMS, Options.GrowFrames - 1) == 0,
+        "a frame over budget didn't reset the grow count");
+    Check(Feed(&DynRes, UnderMS, 1) == 1, "didn't grow after GrowFrames");
+    Check(fabsf(DynRes.Scale - (Options.MinScale + Options.Step)) < 1e-6,
+        "grew by other than one step");
+
+    // Up to MaxScale and no further
+    Feed(&DynRes, UnderMS, Options.GrowFrames * 100);
+    Check(DynRes.Scale == Options.MaxScale, "didn't stop at MaxScale");
+
+    // Under ShrinkAbove at this scale, but not under GrowBelow at the
+    // next one: nothing should change
+    InitDynamicResolution(&DynRes, Options);
+    Feed(&DynRes, OverMS, Options.ShrinkFrames);
+    float Larger = DynRes.Scale + Options.Step;
+    double Ratio = (Larger * Larger) / (DynRes.Scale * DynRes.Scale);
+    double BetweenMS = BUDGET_MS * Options.GrowBelow / Ratio * 1.05;
+    Check(BetweenMS < BUDGET_MS * Options.ShrinkAbove, "test thresholds overlap");
+    Check(Feed(&DynRes, BetweenMS, SETTLE_FRAMES) == 0,
+        "scale moved between the thresholds");
+
+    // A scene costing 1.5 budgets at full size, scaling with pixels
+    InitDynamicResolution(&DynRes, Options);
+    double FullMS = BUDGET_MS * 1.5;
+    for (int Frame = 0; Frame < SETTLE_FRAMES; Frame++) {
+        UpdateResolutionScale(&DynRes, FullMS * DynRes.Scale * DynRes.Scale, BUDGET_MS);
+    }
+    float Settled = DynRes.Scale;
+    int Changes = 0;
+    for (int Frame = 0; Frame < SETTLE_FRAMES; Frame++) {
+        Changes += UpdateResolutionScale(&DynRes,
+            FullMS * DynRes.Scale * DynRes.Scale, BUDGET_MS);
+    }
+    Check(Changes == 0, "oscillated on a steady scene");
+    Check(FullMS * Settled * Settled <= BUDGET_MS * Options.ShrinkAbove,
+        "settled on a scale that doesn't fit");
+    float Next = MIN(Settled + Options.Step, Options.MaxScale);
+    Check(Next == Settled || FullMS * Next * Next > BUDGET_MS * Options.ShrinkAbove,
+        "settled below the largest scale that fits");
+
+    if (Failures) {
+        printf("%i check(s) failed\n", Failures);
+        return 1;
+    }
+    printf("PASS: steady scene settled at scale %.3f\n", Settled);
+    return 0;
+}
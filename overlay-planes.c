@@ -0,0 +1,319 @@
+/*
+Shows a HUD and a cursor over each display, alternating every few
+seconds between compositing them in GL every frame and putting them
+on their own overlay and cursor planes (see overlay.h), where the
+display hardware composites them and they're only redrawn when they
+change.
+
+Each phase reports the GPU render time per frame (see frame.h) with
+either approach, and how much GPU time per frame the planes save.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+#include <math.h>
+
+#include "egl.h"
+#include "gldiag.h"
+#include "overlay.h"
+#include "utils.h"
+
+#define HUD_WIDTH     512
+#define HUD_HEIGHT    128
+#define CURSOR_SIZE   64
+#define PHASE_SECONDS 5
+// How often the HUD's contents change
+#define HUD_UPDATES_PER_SECOND 4
+
+typedef enum {
+    COMPOSITE_GL,
+    COMPOSITE_PLANES,
+    COMPOSITE_COUNT
+} composite_mode;
+
+static const char* CompositeModeNames[COMPOSITE_COUNT] = {
+    "GL",
+    "Planes",
+};
+
+typedef struct {
+    overlay_plane* HUD;
+    overlay_plane* Cursor;
+    double         GPUSum[COMPOSITE_COUNT];
+    uint64_t       GPUSamples[COMPOSITE_COUNT];
+    uint64_t       LastGPUSamples;
+    // The planes took the last turn (see overlay.h), so a GL frame
+    // goes next
+    bool           FrameNext;
+} display_layers;
+
+// ARGB8888, which is BGRA in memory
+static void DrawHUD(uint32_t* Pixels, int Stride, int Updates) {
+    for (int Y = 0; Y < HUD_HEIGHT; Y++) {
+        for (int X = 0; X < HUD_WIDTH; X++) {
+            uint32_t Color = 0xC0202020;
+            // One block per update, wrapping around
+            int Block = X / 16;
+            if (Y > HUD_HEIGHT / 4 && Y < HUD_HEIGHT * 3 / 4 &&
+                X % 16 < 12 && Block < Updates % (HUD_WIDTH / 16)) {
+                Color = 0xFF40C040;
+            }
+            Pixels[Y * Stride + X] = Color;
+        }
+    }
+}
+
+static void DrawCursor(uint32_t* Pixels, int Stride, int Size) {
+    float Radius = Size / 2.0f;
+    for (int Y = 0; Y < Size; Y++) {
+        for (int X = 0; X < Size; X++) {
+            float DX = X + 0.5f - Radius;
+            float DY = Y + 0.5f - Radius;
+            float Distance = sqrtf(DX * DX + DY * DY);
+            Pixels[Y * Stride + X] =
+                Distance < Radius / 4 ? 0xFFFFFFFF :
+                Distance < Radius / 3 ? 0xFF000000 :
+                0x00000000;
+        }
+    }
+}
+
+static void GetCursorPosition(egl_display* Display, int* X, int* Y) {
+    float Time = GetTime();
+    *X = (int)((sin(Time * 1.3) * 0.4 + 0.5) * Display->Width)  - CURSOR_SIZE / 2;
+    *Y = (int)((sin(Time * 1.7) * 0.4 + 0.5) * Display->Height) - CURSOR_SIZE / 2;
+}
+
+static GLuint CreateLayerTexture(int Width, int Height, GLuint* Framebuffer) {
+    GLuint Texture;
+    glGenTextures(1, &Texture);
+    glBindTexture(GL_TEXTURE_2D, Texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, Width, Height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, Framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, *Framebuffer);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D, Texture, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return Texture;
+}
+
+static void UploadLayerTexture(GLuint Texture, uint32_t* Pixels, int Width, int Height) {
+    glBindTexture(GL_TEXTURE_2D, Texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, Width, Height,
+        GL_BGRA, GL_UNSIGNED_BYTE, Pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Blits are unblended, which is still a full read and write of each
+// layer's pixels per frame, as compositing them in GL would be.
+static void BlitLayer(GLuint Framebuffer, int Width, int Height,
+    int X, int Y, int DisplayHeight)
+{
+    // GL's origin is bottom left, KMS's is top left
+    int Bottom = DisplayHeight - Y - Height;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, Framebuffer);
+    glBlitFramebuffer(0, Height, Width, 0,
+        X, Bottom, X + Width, Bottom + Height,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+static void SetPlanesVisible(display_layers* Layers, bool Visible) {
+    if (Layers->HUD)    SetOverlayVisible(Layers->HUD, Visible);
+    if (Layers->Cursor) SetOverlayVisible(Layers->Cursor, Visible);
+}
+
+// Commits the display's plane changes together, once its flip landed
+static void FlushPlanes(egl_display* Display, display_layers* Layers) {
+    overlay_plane* Overlays[2];
+    int Count = 0;
+    if (Layers->HUD)    Overlays[Count++] = Layers->HUD;
+    if (Layers->Cursor) Overlays[Count++] = Layers->Cursor;
+    if (Layers->FrameNext || EGLPageFlipPending(Display)) return;
+
+    FlushOverlays(Overlays, Count);
+    // A commit holds the display's flip pending until it lands
+    Layers->FrameNext = EGLPageFlipPending(Display);
+}
+
+static void ReportPhase(egl_state* EGL, display_layers* Layers) {
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        display_layers* Display = &Layers[DisplayIndex];
+        double Average[COMPOSITE_COUNT];
+        for (int Mode = 0; Mode < COMPOSITE_COUNT; Mode++) {
+            Average[Mode] = Display->GPUSamples[Mode] ?
+                Display->GPUSum[Mode] / Display->GPUSamples[Mode] : 0;
+        }
+        printf("%20s: GPU/frame %s %.3fms, %s %.3fms",
+            EGL->Displays[DisplayIndex].MonitorName,
+            CompositeModeNames[COMPOSITE_GL],     Average[COMPOSITE_GL],
+            CompositeModeNames[COMPOSITE_PLANES], Average[COMPOSITE_PLANES]);
+        if (Display->GPUSamples[COMPOSITE_GL] && Display->GPUSamples[COMPOSITE_PLANES]) {
+            double Saved = Average[COMPOSITE_GL] - Average[COMPOSITE_PLANES];
+            printf(", saved %.3fms (%.1f%%)",
+                Saved, Average[COMPOSITE_GL] > 0 ? 100 * Saved / Average[COMPOSITE_GL] : 0);
+        }
+        uint64_t Busy = (Display->HUD ? Display->HUD->BusyCommits : 0) +
+                        (Display->Cursor ? Display->Cursor->BusyCommits : 0);
+        uint64_t Deferred = (Display->HUD ? Display->HUD->DeferredCommits : 0) +
+                            (Display->Cursor ? Display->Cursor->DeferredCommits : 0);
+        printf(", %lu busy and %lu deferred plane commits\n",
+            (unsigned long)Busy, (unsigned long)Deferred);
+    }
+}
+
+int main() {
+    GetTime();
+
+    egl_state* EGL = SetupEGL();
+    EnableGLDebug();
+
+    display_layers* Layers = calloc(EGL->DisplaysCount, sizeof(display_layers));
+    bool AnyPlanes = false;
+    // Whether any display lacks a HUD plane, and so always needs the
+    // GL copy of the HUD
+    bool AnyWithoutHUD = false;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        display_layers* Layer = &Layers[DisplayIndex];
+
+        Layer->HUD = CreateOverlayPlane(EGL->DRMFD, Display,
+            OVERLAY_KIND_OVERLAY, HUD_WIDTH, HUD_HEIGHT);
+        Layer->Cursor = CreateOverlayPlane(EGL->DRMFD, Display,
+            OVERLAY_KIND_CURSOR, CURSOR_SIZE, CURSOR_SIZE);
+
+        if (Layer->HUD) {
+            MoveOverlay(Layer->HUD, 32, 32);
+            SetOverlayZPos(Layer->HUD, 1);
+        }
+        if (Layer->Cursor) {
+            dumb_buffer* Buffer = BeginOverlayUpdate(Layer->Cursor);
+            DrawCursor(DumbBufferRow(Buffer, 0), Buffer->Pitch / 4, CURSOR_SIZE);
+            EndOverlayUpdate(Layer->Cursor);
+        }
+        SetPlanesVisible(Layer, false);
+        AnyPlanes |= Layer->HUD || Layer->Cursor;
+        AnyWithoutHUD |= !Layer->HUD;
+    }
+    if (!AnyPlanes) {
+        printf("No overlay or cursor planes available; only GL compositing will be measured\n");
+    }
+
+    // Layer contents for GL compositing, shared by all displays
+    uint32_t* HUDPixels    = malloc(HUD_WIDTH * HUD_HEIGHT * sizeof(uint32_t));
+    uint32_t* CursorPixels = malloc(CURSOR_SIZE * CURSOR_SIZE * sizeof(uint32_t));
+    GLuint HUDFramebuffer, CursorFramebuffer;
+    GLuint HUDTexture    = CreateLayerTexture(HUD_WIDTH, HUD_HEIGHT, &HUDFramebuffer);
+    GLuint CursorTexture = CreateLayerTexture(CURSOR_SIZE, CURSOR_SIZE, &CursorFramebuffer);
+    DrawCursor(CursorPixels, CURSOR_SIZE, CURSOR_SIZE);
+    UploadLayerTexture(CursorTexture, CursorPixels, CURSOR_SIZE, CURSOR_SIZE);
+
+    composite_mode Mode = COMPOSITE_GL;
+    float PhaseStart = GetTime();
+    int HUDUpdates = -1;
+
+    while (1) {
+
+        EGLUpdateVSync(EGL);
+
+        if (GetTime() - PhaseStart > PHASE_SECONDS) {
+            ReportPhase(EGL, Layers);
+            if (AnyPlanes) {
+                Mode = (Mode + 1) % COMPOSITE_COUNT;
+            }
+            for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+                SetPlanesVisible(&Layers[DisplayIndex], Mode == COMPOSITE_PLANES);
+            }
+            printf("Compositing the HUD and cursor with %s\n", CompositeModeNames[Mode]);
+            PhaseStart = GetTime();
+            HUDUpdates = -1;
+        }
+
+        // The HUD changes a few times a second, independent of the frame rate
+        int Updates = (int)(GetTime() * HUD_UPDATES_PER_SECOND);
+        bool HUDChanged = Updates != HUDUpdates;
+        HUDUpdates = Updates;
+        if (HUDChanged && (Mode == COMPOSITE_GL || AnyWithoutHUD)) {
+            DrawHUD(HUDPixels, HUD_WIDTH, Updates);
+            UploadLayerTexture(HUDTexture, HUDPixels, HUD_WIDTH, HUD_HEIGHT);
+        }
+
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+            display_layers* Layer = &Layers[DisplayIndex];
+
+            int CursorX, CursorY;
+            GetCursorPosition(Display, &CursorX, &CursorY);
+
+            if (Mode == COMPOSITE_PLANES) {
+                if (Layer->HUD && HUDChanged) {
+                    dumb_buffer* Buffer = BeginOverlayUpdate(Layer->HUD);
+                    DrawHUD(DumbBufferRow(Buffer, 0), Buffer->Pitch / 4, Updates);
+                    EndOverlayUpdate(Layer->HUD);
+                }
+                if (Layer->Cursor) {
+                    MoveOverlay(Layer->Cursor, CursorX, CursorY);
+                }
+            }
+            // Including showing or hiding the planes for a new phase.
+            // The planes and GL frames take turns, so a cursor moving
+            // every refresh can't starve the display.
+            FlushPlanes(Display, Layer);
+
+            if (EGLPageFlipPending(Display)) {
+                continue;
+            }
+
+            eglMakeCurrent(Display->DisplayDevice,
+                Display->Hot->Surface, Display->Hot->Surface,
+                Display->Context);
+
+            BeginFrame(Display);
+
+            glViewport(0, 0,
+                (GLint)Display->Width,
+                (GLint)Display->Height);
+
+            glClearColor(
+                        (sin(GetTime()*3)/2+0.5) * 0.8,
+                        (sin(GetTime()*5)/2+0.5) * 0.8,
+                        (sin(GetTime()*7)/2+0.5) * 0.8,
+                        1);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            // Layers without a plane are always composited in GL
+            if (Mode == COMPOSITE_GL || !Layer->HUD) {
+                BlitLayer(HUDFramebuffer, HUD_WIDTH, HUD_HEIGHT,
+                    32, 32, Display->Height);
+            }
+            if (Mode == COMPOSITE_GL || !Layer->Cursor) {
+                BlitLayer(CursorFramebuffer, CURSOR_SIZE, CURSOR_SIZE,
+                    CursorX, CursorY, Display->Height);
+            }
+
+            EndFrame(Display);
+
+            EGLSwapFrame(Display);
+            EGLAcquireProduced(Display);
+            Layer->FrameNext = false;
+
+            // Attribute GPU times read back since the last frame to the
+            // current mode; they lag a few frames, which only blurs the
+            // first frames of each phase.
+            frame_timing* Timing = &Display->Hot->Timing;
+            if (Timing->GPUSamples != Layer->LastGPUSamples) {
+                Layer->GPUSum[Mode] += Timing->LastGPURenderMS;
+                Layer->GPUSamples[Mode]++;
+                Layer->LastGPUSamples = Timing->GPUSamples;
+            }
+        }
+
+        GLDiagnosticsEndFrame("Display Thread");
+    }
+
+    return 0;
+}
@@ -0,0 +1,331 @@
+/*
+Reads frames back from every display without stalling rendering
+(see readback.h), and runs two consumers on them: a checksum of every
+captured frame, and a screenshot writer saving PPM files.
+
+  kill -USR1 <pid>   takes a screenshot of each display
+  kill -USR2 <pid>   toggles continuous capture (every --interval frames)
+
+Run with --surfaceless to render into offscreen framebuffers instead of
+displays (see surfaceless.h), e.g. without a GPU:
+  EGL_PLATFORM=surfaceless LIBGL_ALWAYS_SOFTWARE=1 ./readback-capture.app --surfaceless
+which also tests the readback: each frame's scene is fixed by its
+number, every frame is captured, and each capture must match what a
+synchronous glReadPixels of that frame read, byte for byte. It exits
+1 if any didn't, or if nothing was captured, after --frames N frames
+(default 120).
+Run with --frames N to exit after N frames, and --continuous to start
+with continuous capture on.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <GL/glew.h>
+
+#include "egl.h"
+#include "readback.h"
+#include "surfaceless.h"
+#include "threads.h"
+#include "utils.h"
+
+#define SURFACELESS_WIDTH  1920
+#define SURFACELESS_HEIGHT 1080
+#define SELF_TEST_FRAMES   120
+
+typedef struct {
+    egl_display*     Display;
+    _Atomic uint64_t Checksum; // Of the last frame captured
+    _Atomic uint32_t ScreenshotsPending;
+
+    // Self-test: what each slot's capture should hold, read bottom up
+    // like GL's, and how many captures matched it
+    uint8_t*         Expected[READBACK_SLOTS];
+    _Atomic uint64_t Verified;
+    _Atomic uint64_t Mismatched;
+} capture_state;
+
+static readback**     Readbacks;
+static capture_state* Captures;
+static int            CapturesCount;
+static atomic_bool    Continuous;
+
+// Only atomics, so it's safe from the signal handler
+static void OnSignal(int Signal) {
+    for (int Index = 0; Index < CapturesCount; Index++) {
+        if (!Readbacks[Index]) continue;
+        if (Signal == SIGUSR1) {
+            atomic_fetch_add(&Captures[Index].ScreenshotsPending, 1);
+            RequestReadback(Readbacks[Index], 1);
+        } else {
+            SetReadbackContinuous(Readbacks[Index], !atomic_load(&Continuous));
+        }
+    }
+    if (Signal == SIGUSR2) {
+        atomic_store(&Continuous, !atomic_load(&Continuous));
+    }
+}
+
+// FNV-1a over the visible pixels
+static void ChecksumFrame(readback_frame* Frame, void* UserData) {
+    capture_state* Capture = UserData;
+    uint64_t Hash = 0xcbf29ce484222325ULL;
+    for (int Y = 0; Y < Frame->Height; Y++) {
+        const uint8_t* Row = Frame->Pixels + (ptrdiff_t)Y * Frame->Stride;
+        for (int X = 0; X < Frame->Width * 4; X++) {
+            Hash = (Hash ^ Row[X]) * 0x100000001b3ULL;
+        }
+    }
+    atomic_store_explicit(&Capture->Checksum, Hash, memory_order_relaxed);
+}
+
+static void VerifyFrame(readback_frame* Frame, void* UserData) {
+    capture_state* Capture = UserData;
+    const uint8_t* Expected = Capture->Expected[Frame->Slot];
+    int Pitch = Frame->Width * 4;
+    bool Matched = true;
+    for (int Y = 0; Y < Frame->Height && Matched; Y++) {
+        const uint8_t* Row = Expected + (ptrdiff_t)(Frame->Height - 1 - Y) * Pitch;
+        Matched = memcmp(Frame->Pixels + (ptrdiff_t)Y * Frame->Stride, Row, Pitch) == 0;
+    }
+    atomic_fetch_add(Matched ? &Capture->Verified : &Capture->Mismatched, 1);
+}
+
+// Reads the frame CaptureReadback just captured again, synchronously,
+// into the expected pixels for its slot. The slot isn't reused before
+// VerifyFrame is done with it.
+static void ReadExpectedFrame(readback* Readback, capture_state* Capture) {
+    uint64_t Frame = Readback->Display->Hot->Timing.Frame;
+    for (int SlotIndex = 0; SlotIndex < READBACK_SLOTS; SlotIndex++) {
+        readback_slot* Slot = &Readback->Slots[SlotIndex];
+        if (Slot->InFlight && Slot->Frame.Frame == Frame) {
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, Readback->Width, Readback->Height,
+                GL_BGRA, GL_UNSIGNED_BYTE, Capture->Expected[SlotIndex]);
+        }
+    }
+}
+
+static void WriteScreenshot(readback_frame* Frame, void* UserData) {
+    capture_state* Capture = UserData;
+    uint32_t Pending = atomic_load(&Capture->ScreenshotsPending);
+    if (Pending == 0) {
+        return;
+    }
+    atomic_fetch_sub(&Capture->ScreenshotsPending, 1);
+
+    char Path[256];
+    snprintf(Path, sizeof(Path), "capture-%i-%lu.ppm",
+        Capture->Display->Index, (unsigned long)Frame->Frame);
+    FILE* File = fopen(Path, "wb");
+    if (!File) {
+        LOG(LOG_WARN, "Couldn't write %s\n", Path);
+        return;
+    }
+    fprintf(File, "P6\n%i %i\n255\n", Frame->Width, Frame->Height);
+    uint8_t* Row = malloc(Frame->Width * 3);
+    for (int Y = 0; Y < Frame->Height; Y++) {
+        const uint8_t* Pixels = Frame->Pixels + (ptrdiff_t)Y * Frame->Stride;
+        for (int X = 0; X < Frame->Width; X++) {
+            Row[X * 3 + 0] = Pixels[X * 4 + 2];
+            Row[X * 3 + 1] = Pixels[X * 4 + 1];
+            Row[X * 3 + 2] = Pixels[X * 4 + 0];
+        }
+        fwrite(Row, 3, Frame->Width, File);
+    }
+    free(Row);
+    fclose(File);
+    LOG(LOG_INFO, "Wrote %s\n", Path);
+}
+
+static bool AllFlipsPending(egl_state* EGL) {
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        if (!EGLPageFlipPending(&EGL->Displays[DisplayIndex])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void DrawScene(egl_display* Display, double Time) {
+    glViewport(0, 0, (GLint)Display->Width, (GLint)Display->Height);
+    glClearColor(
+                (sin(Time*3)/2+0.5) * 0.8,
+                (sin(Time*5)/2+0.5) * 0.8,
+                (sin(Time*7)/2+0.5) * 0.8,
+                1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // A bar sweeping across, so consecutive captures differ
+    int BarX = (int)(fmod(Time / 2, 1) * Display->Width);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(BarX, 0, Display->Width / 16, Display->Height);
+    glClearColor(1, 1, 1, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+int main(int argc, char** argv) {
+    GetTime();
+
+    bool Surfaceless = false;
+    bool StartContinuous = false;
+    int Interval = 1;
+    long MaxFrames = 0;
+    for (int Arg = 1; Arg < argc; Arg++) {
+        if (strcmp(argv[Arg], "--surfaceless") == 0) {
+            Surfaceless = true;
+        } else if (strcmp(argv[Arg], "--continuous") == 0) {
+            StartContinuous = true;
+        } else if (strcmp(argv[Arg], "--interval") == 0 && Arg + 1 < argc) {
+            Interval = atoi(argv[++Arg]);
+        } else if (strcmp(argv[Arg], "--frames") == 0 && Arg + 1 < argc) {
+            MaxFrames = atol(argv[++Arg]);
+        } else {
+            Fatal("Usage: %s [--surfaceless] [--continuous] [--interval N] [--frames N]\n",
+                argv[0]);
+        }
+    }
+
+    if (Surfaceless) {
+        StartContinuous = true;
+        if (MaxFrames == 0) {
+            MaxFrames = SELF_TEST_FRAMES;
+        }
+    }
+
+    egl_state* EGL = Surfaceless ?
+        SetupSurfaceless(1, SURFACELESS_WIDTH, SURFACELESS_HEIGHT) :
+        SetupEGL();
+
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
+    CapturesCount = EGL->DisplaysCount;
+    Readbacks = calloc(CapturesCount, sizeof(readback*));
+    Captures  = calloc(CapturesCount, sizeof(capture_state));
+    int ReadbacksCount = 0;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        if (Surfaceless) {
+            BindSurfacelessDisplay(EGL, Display);
+        } else {
+            eglMakeCurrent(Display->DisplayDevice,
+                Display->Hot->Surface, Display->Hot->Surface, Display->Context);
+        }
+        Captures[DisplayIndex].Display = Display;
+        readback* Readback = CreateReadback(Display);
+        if (!Readback) continue;
+        AddReadbackConsumer(Readback, "checksum", ChecksumFrame, &Captures[DisplayIndex]);
+        AddReadbackConsumer(Readback, "screenshot", WriteScreenshot, &Captures[DisplayIndex]);
+        if (Surfaceless) {
+            for (int SlotIndex = 0; SlotIndex < READBACK_SLOTS; SlotIndex++) {
+                Captures[DisplayIndex].Expected[SlotIndex] =
+                    malloc((size_t)Readback->Width * Readback->Height * 4);
+            }
+            AddReadbackConsumer(Readback, "verify", VerifyFrame, &Captures[DisplayIndex]);
+        }
+        SetReadbackInterval(Readback, Interval);
+        SetReadbackContinuous(Readback, StartContinuous);
+        Readbacks[DisplayIndex] = Readback;
+        ReadbacksCount++;
+    }
+    if (ReadbacksCount == 0) {
+        Fatal("No display supports readback\n");
+    }
+    atomic_store(&Continuous, StartContinuous);
+
+    struct sigaction Action = { .sa_handler = OnSignal };
+    sigemptyset(&Action.sa_mask);
+    Action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &Action, NULL);
+    sigaction(SIGUSR2, &Action, NULL);
+
+    double LastReport = GetTime();
+    for (long Frame = 0; MaxFrames == 0 || Frame < MaxFrames; Frame++) {
+        if (!Surfaceless) {
+            // Blocks until a flip completes once every display is
+            // waiting on one, rather than spinning
+            if (AllFlipsPending(EGL)) {
+                EGLWaitVSync(EGL, 100);
+            } else {
+                EGLUpdateVSync(EGL);
+            }
+        }
+
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+
+            if (Surfaceless) {
+                BindSurfacelessDisplay(EGL, Display);
+            } else {
+                if (EGLPageFlipPending(Display)) {
+                    continue;
+                }
+                eglMakeCurrent(Display->DisplayDevice,
+                    Display->Hot->Surface, Display->Hot->Surface,
+                    Display->Context);
+            }
+
+            BeginFrame(Display);
+            DrawScene(Display, Surfaceless ? Frame / 60.0 : GetTime());
+            if (Readbacks[DisplayIndex]) {
+                CaptureReadback(Readbacks[DisplayIndex]);
+                if (Surfaceless) {
+                    ReadExpectedFrame(Readbacks[DisplayIndex], &Captures[DisplayIndex]);
+                }
+            }
+            EndFrame(Display);
+
+            if (!Surfaceless) {
+                EGLSwapFrame(Display);
+                EGLAcquireProduced(Display);
+            }
+        }
+
+        if (GetTime() - LastReport > 1) {
+            LastReport = GetTime();
+            for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+                if (!Readbacks[DisplayIndex]) continue;
+                ReportReadback(Readbacks[DisplayIndex]);
+                LOG(LOG_INFO, "%20s: last checksum %016llx\n",
+                    EGL->Displays[DisplayIndex].MonitorName,
+                    (unsigned long long)atomic_load(&Captures[DisplayIndex].Checksum));
+            }
+        }
+    }
+
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        if (!Readbacks[DisplayIndex]) continue;
+        if (Surfaceless) {
+            BindSurfacelessDisplay(EGL, &EGL->Displays[DisplayIndex]);
+        } else {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+            eglMakeCurrent(Display->DisplayDevice,
+                Display->Hot->Surface, Display->Hot->Surface,
+                Display->Context);
+        }
+        ReportReadback(Readbacks[DisplayIndex]);
+        DestroyReadback(Readbacks[DisplayIndex]);
+    }
+
+    if (!Surfaceless) {
+        return 0;
+    }
+    int Failures = 0;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        capture_state* Capture = &Captures[DisplayIndex];
+        if (!Readbacks[DisplayIndex]) continue;
+        uint64_t Verified   = atomic_load(&Capture->Verified);
+        uint64_t Mismatched = atomic_load(&Capture->Mismatched);
+        bool Passed = Verified > 0 && Mismatched == 0;
+        printf("%s: %s: %lu captures matched glReadPixels, %lu didn't\n",
+            Passed ? "PASS" : "FAIL", Capture->Display->MonitorName,
+            (unsigned long)Verified, (unsigned long)Mismatched);
+        Failures += !Passed;
+    }
+    return Failures ? 1 : 0;
+}
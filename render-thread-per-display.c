@@ -0,0 +1,317 @@
+/*
+Renders each display from its own thread, with its own EGLContext
+sharing objects with the root context.
+This avoids the eglMakeCurrent per display per frame of the single
+threaded loops, and lets displays render in parallel.
+
+Run with --bench to compare total throughput against a single thread
+sharing the root context, for 1 up to 8 displays.
+
+Run with --dynamic-resolution to render at a reduced resolution
+whenever frames don't fit in a refresh (see dynres.h).
+
+Run with --static to only redraw each display once a second, as
+static signage would, using damage tracking (see damage.h).
+
+Run with --inject-stuck-flip to drop the first display's next three
+page flip events, which walks the watchdog through each of its
+recovery steps (see watchdog.h).
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <GL/glew.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "damage.h"
+#include "dynres.h"
+#include "egl.h"
+#include "events.h"
+#include "gldiag.h"
+#include "threads.h"
+#include "utils.h"
+#include "watchdog.h"
+
+#define LOGO_SIZE 64
+
+typedef struct {
+    GLuint       LogoTexture;
+    shared_fence LogoFence;
+    bool         DynamicResolution;
+} shared_scene;
+
+// Framebuffer objects aren't shared between contexts,
+// so each render thread makes its own to read the shared texture.
+static __thread GLuint LogoFramebuffer;
+static __thread dynres DynRes;
+
+static void DrawScene(egl_display* Display, shared_scene* Scene,
+    int Width, int Height)
+{
+    glClearColor(
+                (sin(GetTime()*3)/2+0.5) * 0.8,
+                (sin(GetTime()*5)/2+0.5) * 0.8,
+                (sin(GetTime()*7)/2+0.5) * 0.8,
+                1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (!Scene) return;
+
+    WaitSharedFence(&Scene->LogoFence);
+
+    if (!LogoFramebuffer) {
+        glGenFramebuffers(1, &LogoFramebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, LogoFramebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, Scene->LogoTexture, 0);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, LogoFramebuffer);
+    glBlitFramebuffer(0, 0, LOGO_SIZE, LOGO_SIZE,
+        0, 0, Width / 4, Height / 4,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+static void DrawFrame(egl_display* Display, void* UserData) {
+    shared_scene* Scene = UserData;
+
+    if (!Scene || !Scene->DynamicResolution) {
+        DrawScene(Display, Scene, Display->Width, Display->Height);
+        return;
+    }
+
+    if (DynRes.Scale == 0) {
+        InitDynamicResolution(&DynRes, DefaultDynamicResolutionOptions());
+    }
+    BeginScaledFrame(&DynRes, Display);
+    DrawScene(Display, Scene, DynRes.Width, DynRes.Height);
+    EndScaledFrame(&DynRes, Display);
+}
+
+typedef struct {
+    egl_state*     EGL;
+    render_thread* Threads;
+    uint64_t*      LastFrames;
+} fps_report;
+
+static void ReportFPS(void* UserData) {
+    fps_report* Report = UserData;
+    for (int DisplayIndex = 0; DisplayIndex < Report->EGL->DisplaysCount; DisplayIndex++) {
+        uint64_t Frames = atomic_load(&Report->Threads[DisplayIndex].Frames);
+        LOG(LOG_INFO, "%40s: %i FPS\n",
+            Report->EGL->Displays[DisplayIndex].MonitorName,
+            (int)(Frames - Report->LastFrames[DisplayIndex]));
+        Report->LastFrames[DisplayIndex] = Frames;
+    }
+    ReportDamage(Report->EGL);
+}
+
+static void DamageAllDisplays(void* UserData) {
+    egl_state* EGL = UserData;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        DamageDisplay(&EGL->Displays[DisplayIndex]);
+    }
+}
+
+static void OnHotplug(void* UserData) {
+    LOG(LOG_WARN, "Display hotplug detected; restart to use the new configuration\n");
+}
+
+static void CreateSharedScene(egl_state* EGL, shared_scene* Scene) {
+    EGLMakeRootCurrent(EGL);
+
+    uint32_t* Pixels = malloc(LOGO_SIZE * LOGO_SIZE * sizeof(uint32_t));
+    for (int Y = 0; Y < LOGO_SIZE; Y++) {
+        for (int X = 0; X < LOGO_SIZE; X++) {
+            Pixels[Y * LOGO_SIZE + X] = ((X / 8 + Y / 8) % 2) ? 0xFFFFFFFF : 0xFF000000;
+        }
+    }
+
+    glGenTextures(1, &Scene->LogoTexture);
+    glBindTexture(GL_TEXTURE_2D, Scene->LogoTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, LOGO_SIZE, LOGO_SIZE, 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, Pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    free(Pixels);
+
+    InitSharedFence(&Scene->LogoFence);
+    PublishSharedFence(&Scene->LogoFence);
+
+    eglMakeCurrent(EGL->DisplayDevice,
+        EGL_NO_SURFACE, EGL_NO_SURFACE,
+        EGL_NO_CONTEXT);
+}
+
+// Dispatch flip events until no display is waiting for one,
+// so each benchmark run starts from the same state.
+static void DrainPageFlips(egl_state* EGL) {
+    float Start = GetTime();
+    while (GetTime() - Start < 1) {
+        bool AnyPending = false;
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            AnyPending |= EGLPageFlipPending(&EGL->Displays[DisplayIndex]);
+        }
+        if (!AnyPending) return;
+        EGLWaitVSync(EGL, 100);
+    }
+}
+
+// With the same per-frame hooks as RenderThreadMain (frame timing and
+// frames in flight, GL diagnostics) and counting frames the same way,
+// acquired ones only, so the two compare fairly.
+static uint64_t RunSingleThread(egl_state* EGL, int Count, float Seconds) {
+    uint64_t Frames = 0;
+    float Start = GetTime();
+    while (GetTime() - Start < Seconds) {
+        EGLUpdateVSync(EGL);
+
+        for (int DisplayIndex = 0; DisplayIndex < Count; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+
+            if (EGLPageFlipPending(Display)) {
+                continue;
+            }
+
+            eglMakeCurrent(Display->DisplayDevice,
+                Display->Hot->Surface, Display->Hot->Surface,
+                EGL->RootContext);
+
+            glViewport(0, 0,
+                (GLint)Display->Width,
+                (GLint)Display->Height);
+
+            BeginFrame(Display);
+            DrawFrame(Display, NULL);
+            EndFrame(Display);
+
+            EGLSwapFrame(Display);
+            bool Acquired = EGLAcquireProduced(Display);
+
+            GLDiagnosticsEndFrame(Display->MonitorName);
+
+            if (Acquired) {
+                Frames++;
+            }
+        }
+    }
+    // The render threads will time these displays in their own contexts
+    for (int DisplayIndex = 0; DisplayIndex < Count; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        eglMakeCurrent(Display->DisplayDevice,
+            Display->Hot->Surface, Display->Hot->Surface,
+            EGL->RootContext);
+        ResetFrameTiming(Display);
+    }
+    eglMakeCurrent(EGL->DisplayDevice,
+        EGL_NO_SURFACE, EGL_NO_SURFACE,
+        EGL_NO_CONTEXT);
+    DrainPageFlips(EGL);
+    return Frames;
+}
+
+static uint64_t RunThreaded(egl_state* EGL, int Count, float Seconds) {
+    render_thread* Threads = StartRenderThreads(EGL, Count, DrawFrame, NULL);
+
+    float Start = GetTime();
+    while (GetTime() - Start < Seconds) {
+        EGLWaitVSync(EGL, 100);
+    }
+
+    uint64_t Frames = 0;
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        Frames += atomic_load(&Threads[ThreadIndex].Frames);
+    }
+
+    // Keep dispatching flips while the threads finish their last frame
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        atomic_store(&Threads[ThreadIndex].Stop, true);
+    }
+    DrainPageFlips(EGL);
+    StopRenderThreads(Threads, Count);
+    DrainPageFlips(EGL);
+    return Frames;
+}
+
+static void RunScalingBenchmark(egl_state* EGL) {
+    const float Seconds = 5;
+    int MaxDisplays = MIN(EGL->DisplaysCount, 8);
+
+    printf("%8s %22s %22s %8s\n",
+        "Displays", "Single thread (fps)", "Thread/display (fps)", "Speedup");
+    for (int Count = 1; Count <= MaxDisplays; Count++) {
+        double Single   = RunSingleThread(EGL, Count, Seconds) / Seconds;
+        double Threaded = RunThreaded(EGL, Count, Seconds) / Seconds;
+        printf("%8i %22.1f %22.1f %7.2fx\n",
+            Count, Single, Threaded, Threaded / MAX(Single, 1));
+    }
+    if (EGL->DisplaysCount < 8) {
+        printf("(only %i displays connected)\n", EGL->DisplaysCount);
+    }
+}
+
+int main(int argc, char** argv) {
+    GetTime();
+
+    egl_state* EGL = SetupEGLWithOptions((egl_options){
+        .ContextPerDisplay = true
+    });
+
+    ApplyThreadProfile("Event", GetThreadProfile("EVENT_THREAD_PROFILE", -1));
+
+    bool InjectStuckFlip   = false;
+    bool Static            = false;
+    bool DynamicResolution = false;
+    for (int ArgIndex = 1; ArgIndex < argc; ArgIndex++) {
+        if (strcmp(argv[ArgIndex], "--bench") == 0) {
+            RunScalingBenchmark(EGL);
+            return 0;
+        }
+        if (strcmp(argv[ArgIndex], "--inject-stuck-flip") == 0) {
+            InjectStuckFlip = true;
+        }
+        if (strcmp(argv[ArgIndex], "--static") == 0) {
+            Static = true;
+        }
+        if (strcmp(argv[ArgIndex], "--dynamic-resolution") == 0) {
+            DynamicResolution = true;
+        }
+    }
+
+    shared_scene Scene;
+    CreateSharedScene(EGL, &Scene);
+    Scene.DynamicResolution = DynamicResolution;
+
+    event_loop* Loop = CreateEventLoop();
+    EGLAttachEventLoop(EGL, Loop);
+    EventLoopAddHotplug(Loop, OnHotplug, NULL);
+
+    if (Static) {
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            EnableDamageTracking(&EGL->Displays[DisplayIndex]);
+        }
+        event_source* DamageTimer = EventLoopAddTimer(Loop, DamageAllDisplays, EGL);
+        EventLoopArmTimer(DamageTimer, GetTimeNS() + 1000000000ULL, 1000000000ULL);
+    }
+
+    fps_report Report = {
+        .EGL        = EGL,
+        .Threads    = StartRenderThreads(EGL, EGL->DisplaysCount, DrawFrame, &Scene),
+        .LastFrames = calloc(EGL->DisplaysCount, sizeof(uint64_t))
+    };
+    event_source* ReportTimer = EventLoopAddTimer(Loop, ReportFPS, &Report);
+    EventLoopArmTimer(ReportTimer, GetTimeNS() + 1000000000ULL, 1000000000ULL);
+
+    watchdog* Watchdog = CreateWatchdog(EGL, DEFAULT_WATCHDOG_PERIODS);
+    WatchdogAttachEventLoop(Watchdog, Loop);
+    if (InjectStuckFlip && EGL->DisplaysCount > 0) {
+        WatchdogInjectDroppedFlips(&EGL->Displays[0], 3);
+    }
+
+    EventLoopRun(Loop);
+
+    return 0;
+}
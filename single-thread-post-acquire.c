@@ -1,7 +1,7 @@
 /*
-This runs the camera in a thread and passes buffers over to the main thread
-for copying into a persistent mapped buffer.
-The memcpy takes about 1ms, but this otherwise runs well.
+Renders every display from the main thread each vsync, and acquires
+each frame onto its plane right after swapping it.
+For streaming a camera into a texture, see camera-ingest.c.
 */
 
 #include <stdlib.h>
@@ -15,6 +15,8 @@ The memcpy takes about 1ms, but this otherwise runs well.
 #include <signal.h>
 
 #include "egl.h"
+#include "gldiag.h"
+#include "threads.h"
 #include "utils.h"
 
 int main() {
@@ -23,6 +25,8 @@ int main() {
     egl_state* EGL = SetupEGL();
     EnableGLDebug();
 
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
 
 
     fps MainLoopFPS = MakeFPS("Main Loop");
@@ -39,16 +43,18 @@ int main() {
         for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
             egl_display* Display = &EGL->Displays[DisplayIndex];
 
-            if (Display->PageFlipPending) {
+            if (EGLPageFlipPending(Display)) {
                 continue;
             }
 
             eglMakeCurrent(Display->DisplayDevice,
-                Display->Surface, Display->Surface,
+                Display->Hot->Surface, Display->Hot->Surface,
                 Display->Context);
 
             PrintDisplayLayerSwapInterval(Display);
 
+            BeginFrame(Display);
+
             glViewport(0, 0,
                 (GLint)Display->Width,
                 (GLint)Display->Height);
@@ -60,8 +66,10 @@ int main() {
                         1);
             glClear(GL_COLOR_BUFFER_BIT);
 
+            EndFrame(Display);
+
             NEWTIME(eglSwapBuffers);
-            eglSwapBuffers(Display->DisplayDevice, Display->Surface);
+            EGLSwapFrame(Display);
             ENDTIME(eglSwapBuffers);
 
             TickFPS(&DisplayFPS[DisplayIndex]);
@@ -70,17 +78,17 @@ int main() {
         for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
             egl_display* Display = &EGL->Displays[DisplayIndex];
 
-            if (Display->PageFlipPending) {
+            if (EGLPageFlipPending(Display)) {
                 continue;
             }
 
             NEWTIME(StreamAcquire);
-            EGLStreamAcquire(Display);
+            EGLAcquireProduced(Display);
             ENDTIME(StreamAcquire);
         }
 
 
-        GLCheck("Display Thread");
+        GLDiagnosticsEndFrame("Display Thread");
 
         TickFPS(&MainLoopFPS);
     }
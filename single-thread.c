@@ -1,7 +1,8 @@
 /*
-This runs the camera in a thread and passes buffers over to the main thread
-for copying into a persistent mapped buffer.
-The memcpy takes about 1ms, but this otherwise runs well.
+Renders every display from the main thread, only redrawing displays
+with damage (see damage.h), and acquires each frame onto its plane
+right after swapping it.
+For streaming a camera into a texture, see camera-ingest.c.
 */
 
 #include <stdlib.h>
@@ -14,8 +15,12 @@ The memcpy takes about 1ms, but this otherwise runs well.
 #include <pthread.h>
 #include <signal.h>
 
+#include "damage.h"
 #include "egl.h"
+#include "gldiag.h"
+#include "threads.h"
 #include "utils.h"
+#include "watchdog.h"
 
 int main() {
     GetTime();
@@ -23,6 +28,8 @@ int main() {
     egl_state* EGL = SetupEGL();
     EnableGLDebug();
 
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
 
 
     fps MainLoopFPS = MakeFPS("Main Loop");
@@ -33,23 +40,44 @@ int main() {
         DisplayFPS[DisplayIndex] = MakeFPS(Display->EDID->MonitorName);
     }
 
+    watchdog* Watchdog = CreateWatchdog(EGL, DEFAULT_WATCHDOG_PERIODS);
+
     while (1) {
 
         EGLUpdateVSync(EGL);
+        WatchdogCheck(Watchdog);
 
         for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
             egl_display* Display = &EGL->Displays[DisplayIndex];
 
-            if (Display->PageFlipPending) {
+            if (EGLPageFlipPending(Display)) {
+                continue;
+            }
+
+            // Retry a swapped frame whose acquire was BUSY or TIMEOUT
+            // before looking for damage, or it stays unshown until
+            // new damage arrives
+            if (EGLFrameUnconsumed(Display)) {
+                if (EGLAcquireProduced(Display)) {
+                    TickFPS(&DisplayFPS[DisplayIndex]);
+                }
+                continue;
+            }
+
+            damage_rect Damage[MAX_DAMAGE_RECTS];
+            int DamageCount = TakeDisplayDamage(Display, Damage);
+            if (DamageCount == 0) {
                 continue;
             }
 
             eglMakeCurrent(Display->DisplayDevice,
-                Display->Surface, Display->Surface,
+                Display->Hot->Surface, Display->Hot->Surface,
                 Display->Context);
 
             PrintDisplayLayerSwapInterval(Display);
 
+            BeginFrame(Display);
+
             glViewport(0, 0,
                 (GLint)Display->Width,
                 (GLint)Display->Height);
@@ -61,20 +89,24 @@ int main() {
                         1);
             glClear(GL_COLOR_BUFFER_BIT);
 
+            EndFrame(Display);
+
             NEWTIME(eglSwapBuffers);
-            eglSwapBuffers(Display->DisplayDevice, Display->Surface);
+            SwapDisplayWithDamage(Display, Damage, DamageCount);
             ENDTIME(eglSwapBuffers);
 
             NEWTIME(StreamAcquire);
-            EGLStreamAcquire(Display);
+            bool Acquired = EGLAcquireProduced(Display);
             ENDTIME(StreamAcquire);
 
-            TickFPS(&DisplayFPS[DisplayIndex]);
+            if (Acquired) {
+                TickFPS(&DisplayFPS[DisplayIndex]);
+            }
         }
 
 
 
-        GLCheck("Display Thread");
+        GLDiagnosticsEndFrame("Display Thread");
 
         TickFPS(&MainLoopFPS);
     }
@@ -0,0 +1,207 @@
+/*
+Renders on the CPU into dumb buffers (see soft.h), for machines without
+a GPU, e.g. vkms on a CI host:
+  sudo modprobe vkms && sudo ./software-render.app
+
+A few squares and a blitted sprite bounce over a static gradient.
+Only the tiles they touch are redrawn each frame, unless --full.
+Options:
+  --double              Double instead of triple buffering
+  --workers N           Worker threads (default one per CPU)
+  --full                Redraw every tile every frame
+  --dynamic-resolution  Scale the render resolution to fit the refresh
+                        period, if the plane can scale
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "damage.h"
+#include "dynres.h"
+#include "soft.h"
+#include "threads.h"
+#include "utils.h"
+
+#define SQUARES_COUNT 4
+#define SQUARE_SIZE   96
+#define SPRITE_SIZE   128
+
+typedef struct {
+    int X;
+    int Y;
+    int Size;
+} scene_rect;
+
+typedef struct {
+    double     Time;
+    scene_rect Squares[SQUARES_COUNT];
+    scene_rect Sprite;
+    uint32_t   SpritePixels[SPRITE_SIZE * SPRITE_SIZE];
+} scene;
+
+static const uint32_t SquareColors[SQUARES_COUNT] = {
+    0xFFE04040, 0xFF40E040, 0xFF4040E0, 0xFFE0E040,
+};
+
+// Bounces back and forth across Range
+static int Bounce(double Time, double Speed, int Range) {
+    if (Range <= 0) return 0;
+    double Phase = fmod(Time * Speed, 2.0 * Range);
+    return (int)(Phase < Range ? Phase : 2.0 * Range - Phase);
+}
+
+static void PlaceScene(scene* Scene, int Width, int Height) {
+    for (int SquareIndex = 0; SquareIndex < SQUARES_COUNT; SquareIndex++) {
+        scene_rect* Square = &Scene->Squares[SquareIndex];
+        Square->Size = SQUARE_SIZE;
+        Square->X = Bounce(Scene->Time, 300 + SquareIndex * 70, Width  - SQUARE_SIZE);
+        Square->Y = Bounce(Scene->Time, 200 + SquareIndex * 50, Height - SQUARE_SIZE);
+    }
+    Scene->Sprite.Size = SPRITE_SIZE;
+    Scene->Sprite.X = Bounce(Scene->Time, 250, Width  - SPRITE_SIZE);
+    Scene->Sprite.Y = Bounce(Scene->Time, 330, Height - SPRITE_SIZE);
+}
+
+static void DrawSprite(uint32_t* Pixels) {
+    for (int Y = 0; Y < SPRITE_SIZE; Y++) {
+        for (int X = 0; X < SPRITE_SIZE; X++) {
+            bool Check = ((X / 16) + (Y / 16)) % 2;
+            Pixels[Y * SPRITE_SIZE + X] = Check ? 0xFFFFFFFF : 0xFF202020;
+        }
+    }
+}
+
+static void RenderTile(egl_display* Display, pixel_tile* Tile, void* UserData) {
+    scene* Scene = UserData;
+
+    // A vertical gradient, one fill per row
+    for (int Row = Tile->Y; Row < Tile->Y + Tile->Height; Row++) {
+        uint32_t Shade = Row * 160 / Display->Height;
+        uint32_t Color = 0xFF000000 | (Shade / 4) << 16 | (Shade / 2) << 8 | Shade;
+        FillRow(&Tile->Pixels[(size_t)Row * Tile->Stride + Tile->X], Color, Tile->Width);
+    }
+
+    for (int SquareIndex = 0; SquareIndex < SQUARES_COUNT; SquareIndex++) {
+        scene_rect* Square = &Scene->Squares[SquareIndex];
+        FillRect(Tile, Square->X, Square->Y, Square->Size, Square->Size,
+            SquareColors[SquareIndex]);
+    }
+
+    BlitRect(Tile, Scene->Sprite.X, Scene->Sprite.Y, SPRITE_SIZE, SPRITE_SIZE,
+        Scene->SpritePixels, SPRITE_SIZE);
+}
+
+// One rect per moving object, so a frame's damage fits in the
+// display's rects rather than being merged arbitrarily once they run
+// out (see DamageDisplayRect)
+_Static_assert(SQUARES_COUNT + 1 <= MAX_DAMAGE_RECTS,
+    "the scene's damage doesn't fit in MAX_DAMAGE_RECTS");
+
+// Damages the bounds of where a rect was and is now, which for a rect
+// moving a few pixels a frame is barely more than the two rects
+static void DamageMoved(egl_display* Display, scene_rect* Before, scene_rect* After) {
+    int Left   = MIN(Before->X, After->X);
+    int Top    = MIN(Before->Y, After->Y);
+    int Right  = MAX(Before->X + Before->Size, After->X + After->Size);
+    int Bottom = MAX(Before->Y + Before->Size, After->Y + After->Size);
+    DamageDisplayRect(Display, Left, Top, Right - Left, Bottom - Top);
+}
+
+// Damages where the scene's rects were and are now
+static void DamageScene(egl_display* Display, scene* Last, scene* Scene) {
+    for (int SquareIndex = 0; SquareIndex < SQUARES_COUNT; SquareIndex++) {
+        DamageMoved(Display, &Last->Squares[SquareIndex], &Scene->Squares[SquareIndex]);
+    }
+    DamageMoved(Display, &Last->Sprite, &Scene->Sprite);
+}
+
+int main(int argc, char** argv) {
+    GetTime();
+
+    soft_options Options = DefaultSoftOptions();
+    bool Full = false;
+    bool DynamicResolution = false;
+    for (int ArgIndex = 1; ArgIndex < argc; ArgIndex++) {
+        if (strcmp(argv[ArgIndex], "--double") == 0) {
+            Options.Buffers = 2;
+        } else if (strcmp(argv[ArgIndex], "--workers") == 0 && ArgIndex + 1 < argc) {
+            Options.Workers = atoi(argv[++ArgIndex]);
+        } else if (strcmp(argv[ArgIndex], "--full") == 0) {
+            Full = true;
+        } else if (strcmp(argv[ArgIndex], "--dynamic-resolution") == 0) {
+            DynamicResolution = true;
+        } else {
+            Fatal("Unknown option %s\n", argv[ArgIndex]);
+        }
+    }
+
+    soft_state* Soft = SetupSoftware(Options);
+    egl_state* EGL = Soft->EGL;
+
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
+    scene*  Scenes = calloc(EGL->DisplaysCount, sizeof(scene));
+    dynres* DynRes = calloc(EGL->DisplaysCount, sizeof(dynres));
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        DrawSprite(Scenes[DisplayIndex].SpritePixels);
+        PlaceScene(&Scenes[DisplayIndex], Display->Width, Display->Height);
+        InitDynamicResolution(&DynRes[DisplayIndex], DefaultDynamicResolutionOptions());
+        if (!Full) {
+            EnableDamageTracking(Display);
+        }
+    }
+
+    double LastReport = GetTime();
+    while (1) {
+        // Blocks until a flip completes, which frees a buffer
+        EGLWaitVSync(EGL, 100);
+
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+            soft_display* SoftDisplay = &Soft->Displays[DisplayIndex];
+            scene* Scene = &Scenes[DisplayIndex];
+
+            FlushSoftFrame(Soft, Display);
+            if (!SoftFrameAvailable(Soft, Display)) {
+                continue;
+            }
+
+            scene Last = *Scene;
+            Scene->Time = GetTime();
+            PlaceScene(Scene, SoftDisplay->RenderWidth, SoftDisplay->RenderHeight);
+            DamageScene(Display, &Last, Scene);
+
+            damage_rect Damage[MAX_DAMAGE_RECTS];
+            int DamageCount = TakeDisplayDamage(Display, Damage);
+            if (DamageCount == 0) {
+                continue;
+            }
+
+            double RenderStart = GetTime();
+            RenderSoftFrame(Soft, Display, Damage, DamageCount, RenderTile, Scene);
+            double RenderMS = (GetTime() - RenderStart) * 1000;
+            PresentSoftFrame(Soft, Display);
+
+            if (DynamicResolution) {
+                dynres* Res = &DynRes[DisplayIndex];
+                double BudgetMS = GetRefreshPeriodNS(Display->Plane) / 1000000.0;
+                if (UpdateResolutionScale(Res, RenderMS, BudgetMS)) {
+                    SetSoftResolution(Soft, Display,
+                        Display->Width * Res->Scale, Display->Height * Res->Scale);
+                }
+            }
+        }
+
+        if (GetTime() - LastReport > 1) {
+            LastReport = GetTime();
+            ReportSoftFrames(Soft);
+            ReportDamage(EGL);
+        }
+    }
+
+    return 0;
+}
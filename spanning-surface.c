@@ -0,0 +1,128 @@
+/*
+Renders a scene spanning the wall of all displays.
+
+Alternates every few seconds between drawing the scene once into a
+spanning framebuffer that each display blits its part from (span.h),
+and the usual approach of making each display current and drawing the
+whole scene into it with an offset viewport.
+Prints the main thread's CPU time per wall frame for each.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <GL/glew.h>
+#include <math.h>
+
+#include "egl.h"
+#include "gldiag.h"
+#include "span.h"
+#include "threads.h"
+#include "utils.h"
+
+#define NUM_RECTS 200
+#define MODE_SECONDS 5
+
+// Draws a set of rectangles moving across the wall,
+// offset so the wall position (OffsetX, OffsetY) lands at the origin.
+static void DrawWall(int WallWidth, int WallHeight, int OffsetX, int OffsetY) {
+    glClearColor(0.1, 0.1, 0.1, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glEnable(GL_SCISSOR_TEST);
+    float Time = GetTime();
+    srand(1);
+    for (int RectIndex = 0; RectIndex < NUM_RECTS; RectIndex++) {
+        float Speed = RANDRANGE(50, 400);
+        int Size    = (int)RANDRANGE(20, 200);
+        int X = (int)(RANDFLOAT * WallWidth + Time * Speed) % WallWidth;
+        int Y = (int)(RANDFLOAT * WallHeight);
+        glScissor(X - OffsetX, Y - OffsetY, Size, Size);
+        glClearColor(RANDFLOAT, RANDFLOAT, RANDFLOAT, 1);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    glDisable(GL_SCISSOR_TEST);
+}
+
+int main() {
+    GetTime();
+
+    egl_state* EGL = SetupEGL();
+    EnableGLDebug();
+
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
+    int WallWidth = 0, WallHeight = 0;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        WallWidth  = MAX(WallWidth,  Display->X + Display->Width);
+        WallHeight = MAX(WallHeight, Display->Y + Display->Height);
+    }
+
+    // Too big a wall for one framebuffer only runs per display
+    span* Span = CreateSpan(EGL);
+
+    bool Spanning = Span != NULL;
+    float ModeStart = GetTime();
+    double CPUTime = 0;
+    int WallFrames = 0;
+
+    while (1) {
+
+        EGLUpdateVSync(EGL);
+
+        if (Span && !SpanReady(Span)) {
+            continue;
+        }
+
+        double Before = GetThreadCPUTime();
+
+        if (Spanning) {
+            BindSpan(Span);
+            DrawWall(WallWidth, WallHeight, 0, 0);
+            PresentSpan(Span);
+        } else {
+            for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+                egl_display* Display = &EGL->Displays[DisplayIndex];
+
+                if (EGLPageFlipPending(Display)) {
+                    continue;
+                }
+
+                eglMakeCurrent(Display->DisplayDevice,
+                    Display->Hot->Surface, Display->Hot->Surface,
+                    Display->Context);
+
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glViewport(0, 0,
+                    (GLint)Display->Width,
+                    (GLint)Display->Height);
+
+                DrawWall(WallWidth, WallHeight, Display->X, Display->Y);
+
+                EGLSwapFrame(Display);
+                EGLAcquireProduced(Display);
+            }
+        }
+
+        CPUTime += GetThreadCPUTime() - Before;
+        WallFrames++;
+
+        GLDiagnosticsEndFrame("Display Thread");
+
+        if (GetTime() - ModeStart > MODE_SECONDS) {
+            printf("%20s: %.3fms CPU per wall frame (%i displays, %i frames)\n",
+                Spanning ? "Spanning surface" : "Per display",
+                CPUTime / WallFrames * 1000,
+                EGL->DisplaysCount,
+                WallFrames);
+            Spanning   = Span && !Spanning;
+            ModeStart  = GetTime();
+            CPUTime    = 0;
+            WallFrames = 0;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,377 @@
+#include "color.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "utils.h"
+
+#define LUT_LANES 8
+
+typedef float    lut_floats  __attribute__((vector_size(LUT_LANES * sizeof(float))));
+typedef int32_t  lut_ints    __attribute__((vector_size(LUT_LANES * sizeof(int32_t))));
+typedef uint16_t lut_samples __attribute__((vector_size(LUT_LANES * sizeof(uint16_t))));
+
+// Fills Out[Start..End) with Y0 + (X - X0) * Slope, clamped to 0..1,
+// where X = Index * Scale.
+typedef void lut_span_fn(uint16_t* Out, int Start, int End, float Scale,
+    float X0, float Y0, float Slope);
+
+static void FillSpanScalar(uint16_t* Out, int Start, int End, float Scale,
+    float X0, float Y0, float Slope)
+{
+    for (int Index = Start; Index < End; Index++) {
+        float X = (float)Index * Scale;
+        float Y = Y0 + (X - X0) * Slope;
+        Y = Y < 0 ? 0 : Y;
+        Y = Y > 1 ? 1 : Y;
+        Out[Index] = (uint16_t)(Y * 65535.0f + 0.5f);
+    }
+}
+
+static void FillSpanVector(uint16_t* Out, int Start, int End, float Scale,
+    float X0, float Y0, float Slope)
+{
+    const lut_floats Lanes = { 0, 1, 2, 3, 4, 5, 6, 7 };
+    const lut_floats Zero  = { 0 };
+    const lut_floats One   = Zero + 1;
+
+    int Index = Start;
+    for (; Index + LUT_LANES <= End; Index += LUT_LANES) {
+        // (float)Index + Lane is exact, so this matches the scalar path
+        lut_floats X = ((float)Index + Lanes) * Scale;
+        lut_floats Y = Y0 + (X - X0) * Slope;
+
+        // Vector ?: is C++ only, so clamp with the comparison masks
+        lut_ints Under = Y < Zero;
+        lut_ints Over  = Y > One;
+        Y = (lut_floats)((lut_ints)Y & ~Under);
+        Y = (lut_floats)(((lut_ints)Y & ~Over) | ((lut_ints)One & Over));
+
+        lut_ints Rounded = __builtin_convertvector(Y * 65535.0f + 0.5f, lut_ints);
+        lut_samples Samples = __builtin_convertvector(Rounded, lut_samples);
+        memcpy(&Out[Index], &Samples, sizeof(Samples));
+    }
+    FillSpanScalar(Out, Index, End, Scale, X0, Y0, Slope);
+}
+
+// Index of the first of Size samples past X
+static int SampleAfter(float X, int Size) {
+    int After = (int)floorf(X * (Size - 1)) + 1;
+    return CLAMP(0, Size, After);
+}
+
+static void FillLUT(const color_curve* Curve, uint16_t* Out, int Size,
+    lut_span_fn* FillSpan)
+{
+    if (Size < 2) {
+        if (Size == 1) FillSpan(Out, 0, 1, 0, 0, Curve->Count ? Curve->Y[0] : 0, 0);
+        return;
+    }
+    float Scale = 1.0f / (Size - 1);
+
+    if (Curve->Count == 0) {
+        FillSpan(Out, 0, Size, Scale, 0, 0, 1);
+        return;
+    }
+
+    // Flat before the first point and after the last
+    int Start = SampleAfter(Curve->X[0], Size);
+    FillSpan(Out, 0, Start, Scale, 0, Curve->Y[0], 0);
+
+    for (int Point = 0; Point + 1 < Curve->Count; Point++) {
+        float X0 = Curve->X[Point],     Y0 = Curve->Y[Point];
+        float X1 = Curve->X[Point + 1], Y1 = Curve->Y[Point + 1];
+        float Slope = X1 > X0 ? (Y1 - Y0) / (X1 - X0) : 0;
+
+        int End = SampleAfter(X1, Size);
+        if (End > Start) {
+            FillSpan(Out, Start, End, Scale, X0, Y0, Slope);
+            Start = End;
+        }
+    }
+
+    FillSpan(Out, Start, Size, Scale, 0, Curve->Y[Curve->Count - 1], 0);
+}
+
+void GenerateLUT(const color_curve* Curve, uint16_t* Out, int Size) {
+    FillLUT(Curve, Out, Size, FillSpanVector);
+}
+
+void GenerateLUTScalar(const color_curve* Curve, uint16_t* Out, int Size) {
+    FillLUT(Curve, Out, Size, FillSpanScalar);
+}
+
+uint64_t CTMFixedPoint(float Value) {
+    uint64_t Sign = Value < 0 ? (1ULL << 63) : 0;
+    double Magnitude = fabs((double)Value) * 4294967296.0; // 2^32
+    return Sign | ((uint64_t)llround(Magnitude) & ~(1ULL << 63));
+}
+
+static color_profile* GetProfile(color_profiles* Profiles, const char* SerialNumber) {
+    for (int ProfileIndex = 0; ProfileIndex < Profiles->Count; ProfileIndex++) {
+        if (strcmp(Profiles->Profiles[ProfileIndex].SerialNumber, SerialNumber) == 0) {
+            return &Profiles->Profiles[ProfileIndex];
+        }
+    }
+    Profiles->Profiles = realloc(Profiles->Profiles,
+        (Profiles->Count + 1) * sizeof(color_profile));
+    color_profile* Profile = &Profiles->Profiles[Profiles->Count++];
+    memset(Profile, 0, sizeof(color_profile));
+    Profile->SerialNumber = strdup(SerialNumber);
+    return Profile;
+}
+
+static bool ParseCurve(char** Save, color_curve* Curve) {
+    Curve->Count = 0;
+    char* Token;
+    while ((Token = strtok_r(NULL, " \t\n", Save))) {
+        float X, Y;
+        if (sscanf(Token, "%f:%f", &X, &Y) != 2 ||
+            Curve->Count == MAX_CURVE_POINTS ||
+            X < 0 || X > 1 ||
+            (Curve->Count > 0 && X <= Curve->X[Curve->Count - 1])) {
+            return false;
+        }
+        Curve->X[Curve->Count] = X;
+        Curve->Y[Curve->Count] = Y;
+        Curve->Count++;
+    }
+    return Curve->Count > 0;
+}
+
+static bool ParseProfileLine(color_profiles* Profiles, char* Line) {
+    char* Save;
+    char* Serial = strtok_r(Line, " \t\n", &Save);
+    char* Stage  = strtok_r(NULL, " \t\n", &Save);
+    if (!Serial) return true; // Blank
+    if (!Stage) return false;
+
+    color_profile* Profile = GetProfile(Profiles, Serial);
+
+    if (strcmp(Stage, "ctm") == 0) {
+        for (int Index = 0; Index < 9; Index++) {
+            char* Token = strtok_r(NULL, " \t\n", &Save);
+            if (!Token || sscanf(Token, "%f", &Profile->CTM[Index]) != 1) {
+                return false;
+            }
+        }
+        Profile->HasCTM = true;
+        return strtok_r(NULL, " \t\n", &Save) == NULL;
+    }
+
+    color_curve* Curves;
+    if (strcmp(Stage, "gamma") == 0) {
+        Curves = Profile->Gamma;
+        Profile->HasGamma = true;
+    } else if (strcmp(Stage, "degamma") == 0) {
+        Curves = Profile->Degamma;
+        Profile->HasDegamma = true;
+    } else {
+        return false;
+    }
+
+    char* Channel = strtok_r(NULL, " \t\n", &Save);
+    if (!Channel) return false;
+
+    color_curve Curve;
+    if (!ParseCurve(&Save, &Curve)) return false;
+
+    if      (strcmp(Channel, "r") == 0)   Curves[COLOR_RED]   = Curve;
+    else if (strcmp(Channel, "g") == 0)   Curves[COLOR_GREEN] = Curve;
+    else if (strcmp(Channel, "b") == 0)   Curves[COLOR_BLUE]  = Curve;
+    else if (strcmp(Channel, "rgb") == 0) {
+        for (int Index = 0; Index < COLOR_CHANNELS; Index++) {
+            Curves[Index] = Curve;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool LoadColorProfiles(const char* Path, color_profiles* Profiles) {
+    memset(Profiles, 0, sizeof(color_profiles));
+
+    FILE* File = fopen(Path, "r");
+    if (!File) {
+        printf("Unable to open color profiles %s: %m\n", Path);
+        return false;
+    }
+
+    char* Line = NULL;
+    size_t Capacity = 0;
+    int LineNumber = 0;
+    bool OK = true;
+    while (OK && getline(&Line, &Capacity, File) != -1) {
+        LineNumber++;
+        char* Comment = strchr(Line, '#');
+        if (Comment) *Comment = '\0';
+        if (!ParseProfileLine(Profiles, Line)) {
+            printf("%s:%i: invalid color profile line\n", Path, LineNumber);
+            OK = false;
+        }
+    }
+    free(Line);
+    fclose(File);
+
+    if (!OK) {
+        FreeColorProfiles(Profiles);
+    }
+    return OK;
+}
+
+void FreeColorProfiles(color_profiles* Profiles) {
+    for (int ProfileIndex = 0; ProfileIndex < Profiles->Count; ProfileIndex++) {
+        free(Profiles->Profiles[ProfileIndex].SerialNumber);
+    }
+    free(Profiles->Profiles);
+    memset(Profiles, 0, sizeof(color_profiles));
+}
+
+color_profile* FindColorProfile(color_profiles* Profiles, const char* SerialNumber) {
+    color_profile* Fallback = NULL;
+    for (int ProfileIndex = 0; ProfileIndex < Profiles->Count; ProfileIndex++) {
+        color_profile* Profile = &Profiles->Profiles[ProfileIndex];
+        if (SerialNumber && SerialNumber[0] &&
+            strcmp(Profile->SerialNumber, SerialNumber) == 0) {
+            return Profile;
+        }
+        if (strcmp(Profile->SerialNumber, "*") == 0) {
+            Fallback = Profile;
+        }
+    }
+    return Fallback;
+}
+
+static uint32_t CreateLUTBlob(int drmFd, const color_curve* Curves, int Size) {
+    uint16_t* Channels = malloc(COLOR_CHANNELS * Size * sizeof(uint16_t));
+    for (int Channel = 0; Channel < COLOR_CHANNELS; Channel++) {
+        GenerateLUT(&Curves[Channel], &Channels[Channel * Size], Size);
+    }
+
+    struct drm_color_lut* LUT = calloc(Size, sizeof(struct drm_color_lut));
+    for (int Index = 0; Index < Size; Index++) {
+        LUT[Index].red   = Channels[COLOR_RED   * Size + Index];
+        LUT[Index].green = Channels[COLOR_GREEN * Size + Index];
+        LUT[Index].blue  = Channels[COLOR_BLUE  * Size + Index];
+    }
+
+    uint32_t blobID = 0;
+    if (drmModeCreatePropertyBlob(drmFd, LUT,
+            Size * sizeof(struct drm_color_lut), &blobID) != 0) {
+        printf("Unable to create LUT blob: %m\n");
+        blobID = 0;
+    }
+    free(LUT);
+    free(Channels);
+    return blobID;
+}
+
+static uint32_t CreateCTMBlob(int drmFd, const float* Matrix) {
+    struct drm_color_ctm CTM;
+    for (int Index = 0; Index < 9; Index++) {
+        CTM.matrix[Index] = CTMFixedPoint(Matrix[Index]);
+    }
+
+    uint32_t blobID = 0;
+    if (drmModeCreatePropertyBlob(drmFd, &CTM, sizeof(CTM), &blobID) != 0) {
+        printf("Unable to create CTM blob: %m\n");
+        blobID = 0;
+    }
+    return blobID;
+}
+
+bool ApplyColorProfile(int drmFd, kms_plane* Plane, const color_profile* Profile) {
+    uint32_t crtcID = Plane->CrtcID;
+    uint32_t degammaProperty = GetPropertyID(drmFd, crtcID, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT");
+    uint32_t ctmProperty     = GetPropertyID(drmFd, crtcID, DRM_MODE_OBJECT_CRTC, "CTM");
+    uint32_t gammaProperty   = GetPropertyID(drmFd, crtcID, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT");
+    uint64_t degammaSize = 0, gammaSize = 0;
+    FindPropertyValue(drmFd, crtcID, DRM_MODE_OBJECT_CRTC, "DEGAMMA_LUT_SIZE", &degammaSize);
+    FindPropertyValue(drmFd, crtcID, DRM_MODE_OBJECT_CRTC, "GAMMA_LUT_SIZE", &gammaSize);
+
+    const char* Name = Plane->EDID->MonitorName;
+    if (Profile && Profile->HasDegamma && !(degammaProperty && degammaSize)) {
+        printf("%s: CRTC %u has no DEGAMMA_LUT, skipping degamma\n", Name, crtcID);
+    }
+    if (Profile && Profile->HasCTM && !ctmProperty) {
+        printf("%s: CRTC %u has no CTM, skipping it\n", Name, crtcID);
+    }
+    if (Profile && Profile->HasGamma && !(gammaProperty && gammaSize)) {
+        printf("%s: CRTC %u has no GAMMA_LUT, skipping gamma\n", Name, crtcID);
+    }
+
+    /* A blob ID of 0 resets the stage to bypass. */
+    uint32_t degammaBlob = 0, ctmBlob = 0, gammaBlob = 0;
+    if (Profile && Profile->HasDegamma && degammaSize) {
+        degammaBlob = CreateLUTBlob(drmFd, Profile->Degamma, (int)degammaSize);
+    }
+    if (Profile && Profile->HasCTM) {
+        ctmBlob = CreateCTMBlob(drmFd, Profile->CTM);
+    }
+    if (Profile && Profile->HasGamma && gammaSize) {
+        gammaBlob = CreateLUTBlob(drmFd, Profile->Gamma, (int)gammaSize);
+    }
+
+    drmModeAtomicReqPtr pAtomic = drmModeAtomicAlloc();
+    if (degammaProperty) {
+        drmModeAtomicAddProperty(pAtomic, crtcID, degammaProperty, degammaBlob);
+    }
+    if (ctmProperty) {
+        drmModeAtomicAddProperty(pAtomic, crtcID, ctmProperty, ctmBlob);
+    }
+    if (gammaProperty) {
+        drmModeAtomicAddProperty(pAtomic, crtcID, gammaProperty, gammaBlob);
+    }
+
+    /*
+     * Blocking, so a pending page flip delays the commit instead of
+     * failing it with EBUSY.
+     */
+    int ret = drmModeAtomicCommit(drmFd, pAtomic, 0, NULL);
+    if (ret != 0) {
+        printf("%s: unable to commit color pipeline: %m\n", Name);
+    }
+    drmModeAtomicFree(pAtomic);
+
+    /* The CRTC state holds its own references to the blobs. */
+    if (degammaBlob) drmModeDestroyPropertyBlob(drmFd, degammaBlob);
+    if (ctmBlob)     drmModeDestroyPropertyBlob(drmFd, ctmBlob);
+    if (gammaBlob)   drmModeDestroyPropertyBlob(drmFd, gammaBlob);
+
+    return ret == 0;
+}
+
+int ApplyColorProfilesFile(const char* Path, int drmFd, kms_plane* Planes,
+    int NumPlanes)
+{
+    color_profiles Profiles;
+    if (!LoadColorProfiles(Path, &Profiles)) {
+        return 0;
+    }
+
+    int Applied = 0;
+    for (int PlaneIndex = 0; PlaneIndex < NumPlanes; PlaneIndex++) {
+        kms_plane* Plane = &Planes[PlaneIndex];
+        color_profile* Profile = FindColorProfile(&Profiles,
+            Plane->EDID->SerialNumber);
+        if (!Profile) {
+            printf("%s (serial %s): no color profile\n",
+                Plane->EDID->MonitorName, Plane->EDID->SerialNumber);
+            continue;
+        }
+        if (ApplyColorProfile(drmFd, Plane, Profile)) {
+            printf("%s (serial %s): applied color profile %s\n",
+                Plane->EDID->MonitorName, Plane->EDID->SerialNumber,
+                Profile->SerialNumber);
+            Applied++;
+        }
+    }
+
+    FreeColorProfiles(&Profiles);
+    return Applied;
+}
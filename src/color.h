@@ -0,0 +1,90 @@
+#if !defined(COLOR_H)
+#define COLOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "kms.h"
+
+// Per-display color correction done by the CRTC's color pipeline at
+// scanout, instead of by a full-screen shader pass every frame:
+//
+//   framebuffer -> DEGAMMA_LUT -> CTM -> GAMMA_LUT -> connector
+//
+// Profiles are keyed by the EDID serial number of the panel they were
+// measured on, so they follow the panel between connectors. They're
+// loaded from a text file with one stage per line:
+//
+//   # serial    stage    channel  x:y points (0..1, increasing x)
+//   A1B2C3      gamma    rgb      0:0 0.25:0.21 0.5:0.46 1:1
+//   A1B2C3      gamma    b        0:0 0.5:0.44 1:0.97
+//   A1B2C3      degamma  rgb      0:0 0.5:0.22 1:1
+//   A1B2C3      ctm      0.97 0.03 0  0 1 0  0 0.02 0.98
+//   *           gamma    rgb      0:0 1:1
+//
+// Curves are sparse and interpolated linearly into LUTs of the size
+// the CRTC reports. The "*" serial applies to displays without a
+// profile of their own. CRTCs without a stage's property skip it.
+//
+// SetupEGL applies the file named by COLOR_PROFILES, if set.
+
+#define MAX_CURVE_POINTS 64
+
+typedef struct {
+    int   Count;
+    float X[MAX_CURVE_POINTS];
+    float Y[MAX_CURVE_POINTS];
+} color_curve;
+
+typedef enum {
+    COLOR_RED,
+    COLOR_GREEN,
+    COLOR_BLUE,
+    COLOR_CHANNELS
+} color_channel;
+
+typedef struct {
+    char*       SerialNumber;
+    bool        HasDegamma;
+    bool        HasGamma;
+    bool        HasCTM;
+    color_curve Degamma[COLOR_CHANNELS];
+    color_curve Gamma[COLOR_CHANNELS];
+    // Row major, applied to column vectors of linear RGB
+    float       CTM[9];
+} color_profile;
+
+typedef struct {
+    color_profile* Profiles;
+    int            Count;
+} color_profiles;
+
+// Returns false (printing why) if the file can't be read or parsed.
+bool LoadColorProfiles(const char* Path, color_profiles* Profiles);
+void FreeColorProfiles(color_profiles* Profiles);
+
+// The profile for the serial number, else the "*" profile, else NULL.
+color_profile* FindColorProfile(color_profiles* Profiles, const char* SerialNumber);
+
+// Samples the curve at Size evenly spaced points from 0 to 1,
+// into 16 bit values. An empty curve is the identity.
+// GenerateLUT does 8 samples at a time with vector instructions;
+// GenerateLUTScalar is the reference it must match.
+void GenerateLUT(const color_curve* Curve, uint16_t* Out, int Size);
+void GenerateLUTScalar(const color_curve* Curve, uint16_t* Out, int Size);
+
+// Converts to the sign-magnitude S31.32 fixed point drm_color_ctm uses.
+uint64_t CTMFixedPoint(float Value);
+
+// Programs the plane's CRTC with the profile, or back to the default
+// (bypassed) pipeline if Profile is NULL. Returns false if the commit
+// was rejected.
+bool ApplyColorProfile(int drmFd, kms_plane* Plane, const color_profile* Profile);
+
+// Loads the profiles in Path and applies them to each plane's CRTC by
+// the EDID serial number of its display. Returns how many displays
+// were given a profile.
+int ApplyColorProfilesFile(const char* Path, int drmFd, kms_plane* Planes,
+    int NumPlanes);
+
+#endif /* COLOR_H */
@@ -0,0 +1,573 @@
+#include "copy.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COPY_X86 1
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define COPY_NEON 1
+#endif
+
+#include "utils.h"
+
+#define COPY_FORMATS          4
+// Bands per thread, so threads finishing early take more
+#define COPY_BANDS_PER_THREAD 4
+#define COPY_MIN_BAND_ROWS    8
+
+// Converts Width pixels of a row into BGRA. Chroma is NV12's UV row.
+// Stream asks for non-temporal stores where Dest is aligned for them.
+typedef void convert_row_fn(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream);
+
+typedef struct {
+    const char*     Name;
+    convert_row_fn* Rows[COPY_FORMATS];
+    bool            Streaming;
+} copy_kernels;
+
+// Scalar, from pixel Start on, which the vector kernels use for the
+// rest of each row too
+
+static inline int Clamp8(int Value) {
+    return Value < 0 ? 0 : Value > 255 ? 255 : Value;
+}
+
+// BT.601 limited range, in 8 bits of fraction
+static inline uint32_t YUVToBGRA(int Y, int U, int V) {
+    int C = 298 * (Y - 16) + 128;
+    int D = U - 128;
+    int E = V - 128;
+    return 0xFF000000 |
+        (uint32_t)Clamp8((C + 409 * E) >> 8) << 16 |
+        (uint32_t)Clamp8((C - 100 * D - 208 * E) >> 8) << 8 |
+        (uint32_t)Clamp8((C + 516 * D) >> 8);
+}
+
+static void CopyPixelsScalar(uint8_t* Dest, const uint8_t* Row, int Start, int Width) {
+    memcpy(Dest + Start * 4, Row + Start * 4, (size_t)(Width - Start) * 4);
+}
+
+static void RGB24PixelsScalar(uint8_t* Dest, const uint8_t* Row, int Start, int Width) {
+    uint32_t* Out = (uint32_t*)Dest;
+    for (int X = Start; X < Width; X++) {
+        const uint8_t* Pixel = Row + X * 3;
+        Out[X] = 0xFF000000 | (uint32_t)Pixel[0] << 16 | (uint32_t)Pixel[1] << 8 | Pixel[2];
+    }
+}
+
+static void YUYVPixelsScalar(uint8_t* Dest, const uint8_t* Row, int Start, int Width) {
+    uint32_t* Out = (uint32_t*)Dest;
+    for (int X = Start; X < Width; X++) {
+        const uint8_t* Pair = Row + (X / 2) * 4;
+        Out[X] = YUVToBGRA(Row[X * 2], Pair[1], Pair[3]);
+    }
+}
+
+static void NV12PixelsScalar(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Start, int Width)
+{
+    uint32_t* Out = (uint32_t*)Dest;
+    for (int X = Start; X < Width; X++) {
+        const uint8_t* UV = Chroma + (X / 2) * 2;
+        Out[X] = YUVToBGRA(Row[X], UV[0], UV[1]);
+    }
+}
+
+static void CopyRowScalar(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    CopyPixelsScalar(Dest, Row, 0, Width);
+}
+
+static void RGB24RowScalar(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    RGB24PixelsScalar(Dest, Row, 0, Width);
+}
+
+static void YUYVRowScalar(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    YUYVPixelsScalar(Dest, Row, 0, Width);
+}
+
+static void NV12RowScalar(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    NV12PixelsScalar(Dest, Row, Chroma, 0, Width);
+}
+
+#if COPY_X86
+// Built for AVX2 and AVX-512 regardless of the compiler flags, and
+// only called if the CPU has them.
+
+__attribute__((target("avx2")))
+static inline void Store256(uint8_t* Dest, __m256i Value, bool Stream) {
+    if (Stream) {
+        _mm256_stream_si256((__m256i*)Dest, Value);
+    } else {
+        _mm256_storeu_si256((__m256i*)Dest, Value);
+    }
+}
+
+// 8 pixels, one per 32 bit lane
+__attribute__((target("avx2")))
+static inline __m256i YUVToBGRA8(__m256i Y, __m256i U, __m256i V) {
+    __m256i C = _mm256_add_epi32(_mm256_mullo_epi32(
+        _mm256_sub_epi32(Y, _mm256_set1_epi32(16)), _mm256_set1_epi32(298)),
+        _mm256_set1_epi32(128));
+    __m256i D = _mm256_sub_epi32(U, _mm256_set1_epi32(128));
+    __m256i E = _mm256_sub_epi32(V, _mm256_set1_epi32(128));
+
+    __m256i R = _mm256_add_epi32(C, _mm256_mullo_epi32(E, _mm256_set1_epi32(409)));
+    __m256i G = _mm256_sub_epi32(_mm256_sub_epi32(C,
+        _mm256_mullo_epi32(D, _mm256_set1_epi32(100))),
+        _mm256_mullo_epi32(E, _mm256_set1_epi32(208)));
+    __m256i B = _mm256_add_epi32(C, _mm256_mullo_epi32(D, _mm256_set1_epi32(516)));
+
+    __m256i Zero = _mm256_setzero_si256();
+    __m256i Max  = _mm256_set1_epi32(255);
+    R = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(R, 8), Zero), Max);
+    G = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(G, 8), Zero), Max);
+    B = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(B, 8), Zero), Max);
+    return _mm256_or_si256(
+        _mm256_or_si256(B, _mm256_slli_epi32(G, 8)),
+        _mm256_or_si256(_mm256_slli_epi32(R, 16), _mm256_set1_epi32((int)0xFF000000)));
+}
+
+__attribute__((target("avx2")))
+static void CopyRowAVX2(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    Stream = Stream && ((uintptr_t)Dest & 31) == 0;
+    int Bytes = Width * 4;
+    int Index = 0;
+    for (; Index + 128 <= Bytes; Index += 128) {
+        __m256i A = _mm256_loadu_si256((const __m256i*)&Row[Index +  0]);
+        __m256i B = _mm256_loadu_si256((const __m256i*)&Row[Index + 32]);
+        __m256i C = _mm256_loadu_si256((const __m256i*)&Row[Index + 64]);
+        __m256i D = _mm256_loadu_si256((const __m256i*)&Row[Index + 96]);
+        Store256(&Dest[Index +  0], A, Stream);
+        Store256(&Dest[Index + 32], B, Stream);
+        Store256(&Dest[Index + 64], C, Stream);
+        Store256(&Dest[Index + 96], D, Stream);
+    }
+    for (; Index + 32 <= Bytes; Index += 32) {
+        Store256(&Dest[Index], _mm256_loadu_si256((const __m256i*)&Row[Index]), Stream);
+    }
+    CopyPixelsScalar(Dest, Row, Index / 4, Width);
+}
+
+__attribute__((target("avx2")))
+static void RGB24RowAVX2(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    Stream = Stream && ((uintptr_t)Dest & 31) == 0;
+    // 4 pixels from the first 12 bytes of each 128 bit lane
+    __m256i Shuffle = _mm256_setr_epi8(
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    __m256i Alpha = _mm256_set1_epi32((int)0xFF000000);
+    int X = 0;
+    // The second load reads 4 bytes past the 8 pixels
+    for (; X + 10 <= Width; X += 8) {
+        __m128i Low  = _mm_loadu_si128((const __m128i*)&Row[X * 3]);
+        __m128i High = _mm_loadu_si128((const __m128i*)&Row[X * 3 + 12]);
+        __m256i Pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(Low), High, 1);
+        Store256(&Dest[X * 4],
+            _mm256_or_si256(_mm256_shuffle_epi8(Pixels, Shuffle), Alpha), Stream);
+    }
+    RGB24PixelsScalar(Dest, Row, X, Width);
+}
+
+__attribute__((target("avx2")))
+static void YUYVRowAVX2(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    Stream = Stream && ((uintptr_t)Dest & 31) == 0;
+    __m128i YShuffle = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i UShuffle = _mm_setr_epi8(1, 1, 5, 5, 9, 9, 13, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i VShuffle = _mm_setr_epi8(3, 3, 7, 7, 11, 11, 15, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+    int X = 0;
+    for (; X + 8 <= Width; X += 8) {
+        __m128i Pairs = _mm_loadu_si128((const __m128i*)&Row[X * 2]);
+        __m256i Y = _mm256_cvtepu8_epi32(_mm_shuffle_epi8(Pairs, YShuffle));
+        __m256i U = _mm256_cvtepu8_epi32(_mm_shuffle_epi8(Pairs, UShuffle));
+        __m256i V = _mm256_cvtepu8_epi32(_mm_shuffle_epi8(Pairs, VShuffle));
+        Store256(&Dest[X * 4], YUVToBGRA8(Y, U, V), Stream);
+    }
+    YUYVPixelsScalar(Dest, Row, X, Width);
+}
+
+__attribute__((target("avx2")))
+static void NV12RowAVX2(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    Stream = Stream && ((uintptr_t)Dest & 31) == 0;
+    __m128i UShuffle = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i VShuffle = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+    int X = 0;
+    for (; X + 8 <= Width; X += 8) {
+        __m128i UV = _mm_loadl_epi64((const __m128i*)&Chroma[X]);
+        __m256i Y = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)&Row[X]));
+        __m256i U = _mm256_cvtepu8_epi32(_mm_shuffle_epi8(UV, UShuffle));
+        __m256i V = _mm256_cvtepu8_epi32(_mm_shuffle_epi8(UV, VShuffle));
+        Store256(&Dest[X * 4], YUVToBGRA8(Y, U, V), Stream);
+    }
+    NV12PixelsScalar(Dest, Row, Chroma, X, Width);
+}
+
+__attribute__((target("avx512f")))
+static inline void Store512(uint8_t* Dest, __m512i Value, bool Stream) {
+    if (Stream) {
+        _mm512_stream_si512((__m512i*)Dest, Value);
+    } else {
+        _mm512_storeu_si512((__m512i*)Dest, Value);
+    }
+}
+
+// 16 pixels, one per 32 bit lane
+__attribute__((target("avx512f")))
+static inline __m512i YUVToBGRA16(__m512i Y, __m512i U, __m512i V) {
+    __m512i C = _mm512_add_epi32(_mm512_mullo_epi32(
+        _mm512_sub_epi32(Y, _mm512_set1_epi32(16)), _mm512_set1_epi32(298)),
+        _mm512_set1_epi32(128));
+    __m512i D = _mm512_sub_epi32(U, _mm512_set1_epi32(128));
+    __m512i E = _mm512_sub_epi32(V, _mm512_set1_epi32(128));
+
+    __m512i R = _mm512_add_epi32(C, _mm512_mullo_epi32(E, _mm512_set1_epi32(409)));
+    __m512i G = _mm512_sub_epi32(_mm512_sub_epi32(C,
+        _mm512_mullo_epi32(D, _mm512_set1_epi32(100))),
+        _mm512_mullo_epi32(E, _mm512_set1_epi32(208)));
+    __m512i B = _mm512_add_epi32(C, _mm512_mullo_epi32(D, _mm512_set1_epi32(516)));
+
+    __m512i Zero = _mm512_setzero_si512();
+    __m512i Max  = _mm512_set1_epi32(255);
+    R = _mm512_min_epi32(_mm512_max_epi32(_mm512_srai_epi32(R, 8), Zero), Max);
+    G = _mm512_min_epi32(_mm512_max_epi32(_mm512_srai_epi32(G, 8), Zero), Max);
+    B = _mm512_min_epi32(_mm512_max_epi32(_mm512_srai_epi32(B, 8), Zero), Max);
+    return _mm512_or_si512(
+        _mm512_or_si512(B, _mm512_slli_epi32(G, 8)),
+        _mm512_or_si512(_mm512_slli_epi32(R, 16), _mm512_set1_epi32((int)0xFF000000)));
+}
+
+__attribute__((target("avx512f")))
+static void CopyRowAVX512(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    Stream = Stream && ((uintptr_t)Dest & 63) == 0;
+    int Bytes = Width * 4;
+    int Index = 0;
+    for (; Index + 256 <= Bytes; Index += 256) {
+        __m512i A = _mm512_loadu_si512((const void*)&Row[Index +   0]);
+        __m512i B = _mm512_loadu_si512((const void*)&Row[Index +  64]);
+        __m512i C = _mm512_loadu_si512((const void*)&Row[Index + 128]);
+        __m512i D = _mm512_loadu_si512((const void*)&Row[Index + 192]);
+        Store512(&Dest[Index +   0], A, Stream);
+        Store512(&Dest[Index +  64], B, Stream);
+        Store512(&Dest[Index + 128], C, Stream);
+        Store512(&Dest[Index + 192], D, Stream);
+    }
+    for (; Index + 64 <= Bytes; Index += 64) {
+        Store512(&Dest[Index], _mm512_loadu_si512((const void*)&Row[Index]), Stream);
+    }
+    CopyPixelsScalar(Dest, Row, Index / 4, Width);
+}
+
+__attribute__((target("avx512f,avx2")))
+static void YUYVRowAVX512(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    Stream = Stream && ((uintptr_t)Dest & 63) == 0;
+    // Per 128 bit lane, as for AVX2; the lanes' halves are joined after
+    __m256i YShuffle = _mm256_setr_epi8(
+        0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1,
+        0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i UShuffle = _mm256_setr_epi8(
+        1, 1, 5, 5, 9, 9, 13, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+        1, 1, 5, 5, 9, 9, 13, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i VShuffle = _mm256_setr_epi8(
+        3, 3, 7, 7, 11, 11, 15, 15, -1, -1, -1, -1, -1, -1, -1, -1,
+        3, 3, 7, 7, 11, 11, 15, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+    int X = 0;
+    for (; X + 16 <= Width; X += 16) {
+        __m256i Pairs = _mm256_loadu_si256((const __m256i*)&Row[X * 2]);
+        __m128i Y = _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+            _mm256_shuffle_epi8(Pairs, YShuffle), 0x08));
+        __m128i U = _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+            _mm256_shuffle_epi8(Pairs, UShuffle), 0x08));
+        __m128i V = _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+            _mm256_shuffle_epi8(Pairs, VShuffle), 0x08));
+        Store512(&Dest[X * 4], YUVToBGRA16(_mm512_cvtepu8_epi32(Y),
+            _mm512_cvtepu8_epi32(U), _mm512_cvtepu8_epi32(V)), Stream);
+    }
+    YUYVPixelsScalar(Dest, Row, X, Width);
+}
+
+__attribute__((target("avx512f,avx2")))
+static void NV12RowAVX512(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    Stream = Stream && ((uintptr_t)Dest & 63) == 0;
+    __m128i UShuffle = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14);
+    __m128i VShuffle = _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15);
+    int X = 0;
+    for (; X + 16 <= Width; X += 16) {
+        __m128i UV = _mm_loadu_si128((const __m128i*)&Chroma[X]);
+        __m512i Y = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)&Row[X]));
+        __m512i U = _mm512_cvtepu8_epi32(_mm_shuffle_epi8(UV, UShuffle));
+        __m512i V = _mm512_cvtepu8_epi32(_mm_shuffle_epi8(UV, VShuffle));
+        Store512(&Dest[X * 4], YUVToBGRA16(Y, U, V), Stream);
+    }
+    NV12PixelsScalar(Dest, Row, Chroma, X, Width);
+}
+#endif /* COPY_X86 */
+
+#if COPY_NEON
+// 8 pixels; saturating narrowing does the clamping
+static inline uint8x8x4_t YUVToBGRA8(uint8x8_t Y, uint8x8_t U, uint8x8_t V) {
+    int16x8_t C = vreinterpretq_s16_u16(vsubl_u8(Y, vdup_n_u8(16)));
+    int16x8_t D = vreinterpretq_s16_u16(vsubl_u8(U, vdup_n_u8(128)));
+    int16x8_t E = vreinterpretq_s16_u16(vsubl_u8(V, vdup_n_u8(128)));
+    int32x4_t Round = vdupq_n_s32(128);
+
+    int32x4_t CLow  = vmlal_n_s16(Round, vget_low_s16(C), 298);
+    int32x4_t CHigh = vmlal_n_s16(Round, vget_high_s16(C), 298);
+
+    int32x4_t RLow  = vmlal_n_s16(CLow,  vget_low_s16(E),  409);
+    int32x4_t RHigh = vmlal_n_s16(CHigh, vget_high_s16(E), 409);
+    int32x4_t GLow  = vmlsl_n_s16(vmlsl_n_s16(CLow,  vget_low_s16(D),  100), vget_low_s16(E),  208);
+    int32x4_t GHigh = vmlsl_n_s16(vmlsl_n_s16(CHigh, vget_high_s16(D), 100), vget_high_s16(E), 208);
+    int32x4_t BLow  = vmlal_n_s16(CLow,  vget_low_s16(D),  516);
+    int32x4_t BHigh = vmlal_n_s16(CHigh, vget_high_s16(D), 516);
+
+    uint8x8x4_t Pixels;
+    Pixels.val[0] = vqmovn_u16(vcombine_u16(vqshrun_n_s32(BLow, 8), vqshrun_n_s32(BHigh, 8)));
+    Pixels.val[1] = vqmovn_u16(vcombine_u16(vqshrun_n_s32(GLow, 8), vqshrun_n_s32(GHigh, 8)));
+    Pixels.val[2] = vqmovn_u16(vcombine_u16(vqshrun_n_s32(RLow, 8), vqshrun_n_s32(RHigh, 8)));
+    Pixels.val[3] = vdup_n_u8(0xFF);
+    return Pixels;
+}
+
+static void CopyRowNEON(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    int Bytes = Width * 4;
+    int Index = 0;
+    for (; Index + 64 <= Bytes; Index += 64) {
+        vst1q_u8_x4(&Dest[Index], vld1q_u8_x4(&Row[Index]));
+    }
+    for (; Index + 16 <= Bytes; Index += 16) {
+        vst1q_u8(&Dest[Index], vld1q_u8(&Row[Index]));
+    }
+    CopyPixelsScalar(Dest, Row, Index / 4, Width);
+}
+
+static void RGB24RowNEON(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    int X = 0;
+    for (; X + 8 <= Width; X += 8) {
+        uint8x8x3_t RGB = vld3_u8(&Row[X * 3]);
+        uint8x8x4_t BGRA = {{ RGB.val[2], RGB.val[1], RGB.val[0], vdup_n_u8(0xFF) }};
+        vst4_u8(&Dest[X * 4], BGRA);
+    }
+    RGB24PixelsScalar(Dest, Row, X, Width);
+}
+
+static void YUYVRowNEON(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    int X = 0;
+    for (; X + 16 <= Width; X += 16) {
+        // Even pixels' Y, U, odd pixels' Y, V
+        uint8x8x4_t Pairs = vld4_u8(&Row[X * 2]);
+        uint8x8x4_t Even = YUVToBGRA8(Pairs.val[0], Pairs.val[1], Pairs.val[3]);
+        uint8x8x4_t Odd  = YUVToBGRA8(Pairs.val[2], Pairs.val[1], Pairs.val[3]);
+        uint8x8x4_t First, Second;
+        for (int Channel = 0; Channel < 4; Channel++) {
+            uint8x8x2_t Zipped = vzip_u8(Even.val[Channel], Odd.val[Channel]);
+            First.val[Channel]  = Zipped.val[0];
+            Second.val[Channel] = Zipped.val[1];
+        }
+        vst4_u8(&Dest[X * 4], First);
+        vst4_u8(&Dest[X * 4 + 32], Second);
+    }
+    YUYVPixelsScalar(Dest, Row, X, Width);
+}
+
+static void NV12RowNEON(uint8_t* Dest, const uint8_t* Row, const uint8_t* Chroma,
+    int Width, bool Stream)
+{
+    int X = 0;
+    for (; X + 16 <= Width; X += 16) {
+        uint8x16_t Y   = vld1q_u8(&Row[X]);
+        uint8x8x2_t UV = vld2_u8(&Chroma[X]);
+        uint8x8x2_t U  = vzip_u8(UV.val[0], UV.val[0]);
+        uint8x8x2_t V  = vzip_u8(UV.val[1], UV.val[1]);
+        vst4_u8(&Dest[X * 4],      YUVToBGRA8(vget_low_u8(Y),  U.val[0], V.val[0]));
+        vst4_u8(&Dest[X * 4 + 32], YUVToBGRA8(vget_high_u8(Y), U.val[1], V.val[1]));
+    }
+    NV12PixelsScalar(Dest, Row, Chroma, X, Width);
+}
+#endif /* COPY_NEON */
+
+static const copy_kernels ScalarKernels =
+    { "scalar", { CopyRowScalar, RGB24RowScalar, YUYVRowScalar, NV12RowScalar }, false };
+
+static const copy_kernels AllKernels[] = {
+#if COPY_X86
+    // AVX-512 has no byte shuffle across the whole register without
+    // AVX512_VBMI, so RGB24 stays on AVX2
+    { "avx512", { CopyRowAVX512, RGB24RowAVX2, YUYVRowAVX512, NV12RowAVX512 }, true },
+    { "avx2",   { CopyRowAVX2,   RGB24RowAVX2, YUYVRowAVX2,   NV12RowAVX2   }, true },
+#endif
+#if COPY_NEON
+    { "neon",   { CopyRowNEON,   RGB24RowNEON, YUYVRowNEON,   NV12RowNEON   }, false },
+#endif
+    ScalarKernels,
+};
+
+static bool KernelsSupported(const copy_kernels* Kernels) {
+#if COPY_X86
+    if (strcmp(Kernels->Name, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(Kernels->Name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return true;
+}
+
+static pthread_once_t KernelsOnce = PTHREAD_ONCE_INIT;
+static const copy_kernels* Kernels;
+
+static void SelectKernels() {
+    const char* Forced = getenv("COPY_KERNELS");
+    for (int KernelsIndex = 0; KernelsIndex < ARRAY_LEN(AllKernels); KernelsIndex++) {
+        const copy_kernels* Candidate = &AllKernels[KernelsIndex];
+        if (!KernelsSupported(Candidate)) continue;
+        if (Forced && strcmp(Forced, Candidate->Name) != 0) continue;
+        Kernels = Candidate;
+        break;
+    }
+    if (!Kernels) {
+        printf("COPY_KERNELS=%s isn't available, using the default\n", Forced);
+        for (int KernelsIndex = 0; !Kernels; KernelsIndex++) {
+            if (KernelsSupported(&AllKernels[KernelsIndex])) {
+                Kernels = &AllKernels[KernelsIndex];
+            }
+        }
+    }
+}
+
+static inline const copy_kernels* GetKernels() {
+    pthread_once(&KernelsOnce, SelectKernels);
+    return Kernels;
+}
+
+size_t InitCopySource(copy_source* Source, copy_format Format, int Width, int Height,
+    const uint8_t* Pixels)
+{
+    static const int BytesPerPixel[COPY_FORMATS] = { 4, 3, 2, 1 };
+    *Source = (copy_source) {
+        .Format  = Format,
+        .Width   = Width,
+        .Height  = Height,
+        .Planes  = { Pixels },
+        .Strides = { Width * BytesPerPixel[Format] },
+    };
+    size_t Size = (size_t)Source->Strides[0] * Height;
+    if (Format == COPY_FORMAT_NV12) {
+        Source->Planes[1]  = Pixels ? Pixels + Size : NULL;
+        Source->Strides[1] = Width;
+        Size += (size_t)Width * (Height / 2);
+    }
+    return Size;
+}
+
+const char* CopyFormatName(copy_format Format) {
+    static const char* Names[COPY_FORMATS] = { "bgra", "rgb24", "yuyv", "nv12" };
+    return Names[Format];
+}
+
+const char* CopyKernelsName() {
+    return GetKernels()->Name;
+}
+
+typedef struct {
+    const copy_source*  Source;
+    const copy_kernels* Kernels;
+    uint8_t*            Dest;
+    int                 DestStride;
+    int                 BandRows;
+    bool                Stream;
+} copy_job;
+
+static void CopyBand(int Job, void* UserData) {
+    copy_job* Copy = UserData;
+    const copy_source* Source = Copy->Source;
+    convert_row_fn* ConvertRow = Copy->Kernels->Rows[Source->Format];
+
+    int FirstRow = Job * Copy->BandRows;
+    int LastRow  = MIN(FirstRow + Copy->BandRows, Source->Height);
+    for (int Y = FirstRow; Y < LastRow; Y++) {
+        const uint8_t* Chroma = Source->Format == COPY_FORMAT_NV12 ?
+            Source->Planes[1] + (size_t)(Y / 2) * Source->Strides[1] : NULL;
+        ConvertRow(Copy->Dest + (size_t)Y * Copy->DestStride,
+            Source->Planes[0] + (size_t)Y * Source->Strides[0], Chroma,
+            Source->Width, Copy->Stream);
+    }
+
+#if COPY_X86
+    // Non-temporal stores aren't ordered with the worker pool's
+    // atomics, so they're fenced before the band is reported done
+    if (Copy->Stream) {
+        _mm_sfence();
+    }
+#endif
+}
+
+static void RunCopy(worker_pool* Pool, const copy_source* Source,
+    const copy_kernels* Kernels, uint8_t* Dest, int DestStride)
+{
+    int Threads = Pool ? Pool->ThreadsCount + 1 : 1;
+    int Bands   = Threads * COPY_BANDS_PER_THREAD;
+    copy_job Copy = {
+        .Source     = Source,
+        .Kernels    = Kernels,
+        .Dest       = Dest,
+        .DestStride = DestStride,
+        .BandRows   = MAX((Source->Height + Bands - 1) / Bands, COPY_MIN_BAND_ROWS),
+        .Stream     = Kernels->Streaming &&
+            (size_t)DestStride * Source->Height >= COPY_STREAMING_BYTES,
+    };
+    int Jobs = (Source->Height + Copy.BandRows - 1) / Copy.BandRows;
+
+    if (Pool) {
+        RunWorkers(Pool, Jobs, CopyBand, &Copy);
+    } else {
+        for (int Job = 0; Job < Jobs; Job++) {
+            CopyBand(Job, &Copy);
+        }
+    }
+}
+
+void CopyFrame(worker_pool* Pool, const copy_source* Source,
+    uint8_t* Dest, int DestStride)
+{
+    RunCopy(Pool, Source, GetKernels(), Dest, DestStride);
+}
+
+void CopyFrameScalar(const copy_source* Source, uint8_t* Dest, int DestStride) {
+    RunCopy(NULL, Source, &ScalarKernels, Dest, DestStride);
+}
@@ -0,0 +1,65 @@
+#if !defined(COPY_H)
+#define COPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "workers.h"
+
+// Copies frames into upload buffers (see ingest.h), converting their
+// pixel format to BGRA (DRM_FORMAT_ARGB8888 order, as GL_BGRA uploads
+// take) and repacking their stride on the way, for when a frame can't
+// be imported without a copy (see dmabuf.h).
+//
+// Rows are split into bands run in parallel on a worker pool, and each
+// band's rows go through vector kernels picked for the CPU on first
+// use: AVX-512 or AVX2 on x86, NEON on ARM, or plain C. COPY_KERNELS=
+// scalar, avx2, avx512 or neon forces a set, e.g. to compare them.
+// Large frames are written with non-temporal stores on x86, so they
+// don't evict the cache on their way to memory the CPU won't read
+// again; NEON has no such stores and writes normally.
+//
+// YUV is converted as BT.601 limited range, as cameras produce, in
+// integer fixed point, so every kernel gives exactly the scalar
+// reference's result.
+
+typedef enum {
+    COPY_FORMAT_BGRA,  // 4 bytes B, G, R, A: a plain copy
+    COPY_FORMAT_RGB24, // 3 bytes R, G, B (V4L2_PIX_FMT_RGB24)
+    COPY_FORMAT_YUYV,  // Y0 U Y1 V for each pair of pixels
+    COPY_FORMAT_NV12,  // Y plane, then a plane of U V pairs at half
+                       // resolution both ways
+} copy_format;
+
+typedef struct {
+    copy_format    Format;
+    int            Width;  // Even for YUYV and NV12
+    int            Height; // Even for NV12
+    const uint8_t* Planes[2];
+    int            Strides[2]; // Bytes per row of each plane
+} copy_source;
+
+// Frames at least this big are written with non-temporal stores
+#define COPY_STREAMING_BYTES (1 << 20)
+
+// Fills Source for a tightly packed frame at Pixels (planes one after
+// another), returning its size in bytes; Pixels may be NULL just for that.
+size_t InitCopySource(copy_source* Source, copy_format Format, int Width, int Height,
+    const uint8_t* Pixels);
+
+// "bgra", "rgb24", "yuyv" or "nv12"
+const char* CopyFormatName(copy_format Format);
+
+// Name of the kernels in use
+const char* CopyKernelsName();
+
+// Converts Source into Dest, Width x Height BGRA pixels with rows
+// DestStride bytes apart, on the pool's threads and the caller's (or
+// just the caller's if Pool is NULL).
+void CopyFrame(worker_pool* Pool, const copy_source* Source,
+    uint8_t* Dest, int DestStride);
+
+// The reference CopyFrame must match, in plain C on the caller's thread.
+void CopyFrameScalar(const copy_source* Source, uint8_t* Dest, int DestStride);
+
+#endif /* COPY_H */
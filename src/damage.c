@@ -0,0 +1,186 @@
+#include "damage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "log.h"
+
+display_damage* CreateDisplayDamage(int Width, int Height) {
+    display_damage* Damage = aligned_alloc(CACHE_LINE_SIZE,
+        sizeof(display_damage));
+    memset(Damage, 0, sizeof(display_damage));
+    pthread_mutex_init(&Damage->Lock, NULL);
+    Damage->Width  = Width;
+    Damage->Height = Height;
+    Damage->LastReportNS = GetTimeNS();
+    return Damage;
+}
+
+void EnableDamageTracking(egl_display* Display) {
+    display_damage* Damage = Display->Damage;
+    pthread_mutex_lock(&Damage->Lock);
+    Damage->Tracking = true;
+    pthread_mutex_unlock(&Damage->Lock);
+    DamageDisplay(Display);
+}
+
+static bool ClipRect(display_damage* Damage, damage_rect* Rect) {
+    int X0 = MAX(Rect->X, 0);
+    int Y0 = MAX(Rect->Y, 0);
+    int X1 = MIN(Rect->X + Rect->Width,  Damage->Width);
+    int Y1 = MIN(Rect->Y + Rect->Height, Damage->Height);
+    if (X1 <= X0 || Y1 <= Y0) return false;
+    *Rect = (damage_rect){ X0, Y0, X1 - X0, Y1 - Y0 };
+    return true;
+}
+
+static damage_rect UnionRect(damage_rect A, damage_rect B) {
+    int X0 = MIN(A.X, B.X);
+    int Y0 = MIN(A.Y, B.Y);
+    int X1 = MAX(A.X + A.Width,  B.X + B.Width);
+    int Y1 = MAX(A.Y + A.Height, B.Y + B.Height);
+    return (damage_rect){ X0, Y0, X1 - X0, Y1 - Y0 };
+}
+
+void DamageDisplayRect(egl_display* Display, int X, int Y, int Width, int Height) {
+    display_damage* Damage = Display->Damage;
+    damage_rect Rect = { X, Y, Width, Height };
+    if (!ClipRect(Damage, &Rect)) return;
+
+    pthread_mutex_lock(&Damage->Lock);
+    if (Damage->Count < MAX_DAMAGE_RECTS) {
+        Damage->Rects[Damage->Count++] = Rect;
+    } else {
+        // Out of rects; grow the last one to cover this one too
+        Damage->Rects[MAX_DAMAGE_RECTS - 1] =
+            UnionRect(Damage->Rects[MAX_DAMAGE_RECTS - 1], Rect);
+    }
+    pthread_mutex_unlock(&Damage->Lock);
+
+    atomic_fetch_add_explicit(&Damage->Generation, 1, memory_order_release);
+    FutexWake(&Damage->Generation);
+}
+
+void DamageDisplay(egl_display* Display) {
+    DamageDisplayRect(Display, 0, 0, Display->Width, Display->Height);
+}
+
+void DamageWall(egl_state* EGL, int X, int Y, int Width, int Height) {
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        DamageDisplayRect(Display, X - Display->X, Y - Display->Y, Width, Height);
+    }
+}
+
+int TakeDisplayDamage(egl_display* Display, damage_rect* Rects) {
+    display_damage* Damage = Display->Damage;
+
+    pthread_mutex_lock(&Damage->Lock);
+    int Count;
+    if (!Damage->Tracking) {
+        Rects[0] = (damage_rect){ 0, 0, Display->Width, Display->Height };
+        Count = 1;
+    } else {
+        Count = Damage->Count;
+        memcpy(Rects, Damage->Rects, Count * sizeof(damage_rect));
+        Damage->Count = 0;
+    }
+    pthread_mutex_unlock(&Damage->Lock);
+
+    return Count;
+}
+
+bool WaitForDamage(egl_display* Display, int TimeoutMS) {
+    display_damage* Damage = Display->Damage;
+
+    uint32_t Generation = atomic_load_explicit(&Damage->Generation,
+        memory_order_acquire);
+    pthread_mutex_lock(&Damage->Lock);
+    bool Pending = !Damage->Tracking || Damage->Count > 0;
+    pthread_mutex_unlock(&Damage->Lock);
+    if (Pending) return true;
+
+    FutexWait(&Damage->Generation, Generation, TimeoutMS);
+    return atomic_load_explicit(&Damage->Generation,
+        memory_order_acquire) != Generation;
+}
+
+void SwapDisplayWithDamage(egl_display* Display, damage_rect* Rects, int Count) {
+    display_damage* Damage = Display->Damage;
+
+    // EGL wants a bottom left origin
+    EGLint EGLRects[MAX_DAMAGE_RECTS * 4];
+    uint64_t Pixels = 0;
+    for (int RectIndex = 0; RectIndex < Count; RectIndex++) {
+        damage_rect* Rect = &Rects[RectIndex];
+        EGLRects[RectIndex * 4 + 0] = Rect->X;
+        EGLRects[RectIndex * 4 + 1] = Display->Height - (Rect->Y + Rect->Height);
+        EGLRects[RectIndex * 4 + 2] = Rect->Width;
+        EGLRects[RectIndex * 4 + 3] = Rect->Height;
+        Pixels += (uint64_t)Rect->Width * Rect->Height;
+    }
+
+    // A full damage hint says nothing the plain swap doesn't
+    bool Full = Count == 1 && Pixels == (uint64_t)Display->Width * Display->Height;
+    EGLSwapFrameWithDamage(Display, EGLRects, Full ? 0 : Count);
+
+    atomic_fetch_add_explicit(&Damage->FramesPresented, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&Damage->PixelsHinted,
+        MIN(Pixels, (uint64_t)Display->Width * Display->Height),
+        memory_order_relaxed);
+}
+
+uint32_t CreateDamageClipsBlob(int drmFd, damage_rect* Rects, int Count) {
+    struct drm_mode_rect Clips[MAX_DAMAGE_RECTS];
+    Count = MIN(Count, MAX_DAMAGE_RECTS);
+    for (int RectIndex = 0; RectIndex < Count; RectIndex++) {
+        Clips[RectIndex].x1 = Rects[RectIndex].X;
+        Clips[RectIndex].y1 = Rects[RectIndex].Y;
+        Clips[RectIndex].x2 = Rects[RectIndex].X + Rects[RectIndex].Width;
+        Clips[RectIndex].y2 = Rects[RectIndex].Y + Rects[RectIndex].Height;
+    }
+
+    uint32_t BlobID = 0;
+    if (drmModeCreatePropertyBlob(drmFd, Clips,
+            Count * sizeof(struct drm_mode_rect), &BlobID) != 0) {
+        return 0;
+    }
+    return BlobID;
+}
+
+void ReportDamage(egl_state* EGL) {
+    uint64_t Now = GetTimeNS();
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        display_damage* Damage = Display->Damage;
+
+        uint64_t Presented = atomic_load_explicit(&Damage->FramesPresented,
+            memory_order_relaxed);
+        uint64_t Pixels = atomic_load_explicit(&Damage->PixelsHinted,
+            memory_order_relaxed);
+
+        uint64_t NewPresented = Presented - Damage->LastPresented;
+        uint64_t NewPixels    = Pixels    - Damage->LastPixels;
+
+        // Every refresh without a new frame is one the GPU, the
+        // stream and the flip were spared
+        uint64_t Refreshes = (Now - Damage->LastReportNS) /
+            GetRefreshPeriodNS(Display->Plane);
+        uint64_t Skipped = Refreshes > NewPresented ? Refreshes - NewPresented : 0;
+        double Hinted = NewPresented ?
+            (double)NewPixels / ((double)NewPresented * Display->Width * Display->Height) : 0;
+
+        LOG(LOG_INFO, "%20s presented %llu, skipped %llu refreshes, damage hint %.1f%%\n",
+            Display->MonitorName,
+            (unsigned long long)NewPresented,
+            (unsigned long long)Skipped,
+            Hinted * 100);
+
+        Damage->LastPresented = Presented;
+        Damage->LastPixels    = Pixels;
+        Damage->LastReportNS  = Now;
+    }
+}
@@ -0,0 +1,94 @@
+#if !defined(DAMAGE_H)
+#define DAMAGE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "egl.h"
+#include "utils.h"
+
+// Per-display damage tracking, so displays whose content hasn't
+// changed aren't rendered, swapped or flipped at all.
+//
+// Tracking is off by default, and then every frame counts as fully
+// damaged. Once enabled with EnableDamageTracking, a display only
+// renders after something damages it:
+//
+//   DamageDisplayRect(Display, X, Y, W, H);  // any thread
+//   ...
+//   damage_rect Rects[MAX_DAMAGE_RECTS];
+//   int Count = TakeDisplayDamage(Display, Rects);
+//   if (Count == 0) skip the frame
+//   else render, then SwapDisplayWithDamage(Display, Rects, Count)
+//
+// Rects are in display pixels with a top left origin, like KMS.
+
+#define MAX_DAMAGE_RECTS 8
+
+typedef struct {
+    int X;
+    int Y;
+    int Width;
+    int Height;
+} damage_rect;
+
+struct display_damage {
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t Lock;
+    bool        Tracking;
+    int         Width;
+    int         Height;
+    damage_rect Rects[MAX_DAMAGE_RECTS];
+    int         Count;
+    // Bumped by every damage, and a futex word for WaitForDamage
+    _Atomic uint32_t Generation;
+
+    // Counters, read by ReportDamage. PixelsHinted is the area of the
+    // damage passed on with each presented frame.
+    _Atomic uint64_t FramesPresented;
+    _Atomic uint64_t PixelsHinted;
+    uint64_t LastReportNS;
+    uint64_t LastPresented;
+    uint64_t LastPixels;
+};
+
+display_damage* CreateDisplayDamage(int Width, int Height);
+
+// Starts skipping frames with no damage. The display starts out
+// fully damaged so its first frame is drawn.
+void EnableDamageTracking(egl_display* Display);
+
+void DamageDisplay(egl_display* Display);
+void DamageDisplayRect(egl_display* Display, int X, int Y, int Width, int Height);
+
+// Damages a rect of the wall of all displays (see span.h),
+// clipped to each display it overlaps.
+void DamageWall(egl_state* EGL, int X, int Y, int Width, int Height);
+
+// Takes the display's accumulated damage, clearing it, and returns the
+// number of rects. Returns 0 if there's nothing to draw. Without tracking, always returns the whole display.
+int TakeDisplayDamage(egl_display* Display, damage_rect* Rects);
+
+// Blocks up to TimeoutMS until the display has damage.
+bool WaitForDamage(egl_display* Display, int TimeoutMS);
+
+// Swaps with the rects as the damage hint, and counts the presented
+// frame and the hint's pixels.
+void SwapDisplayWithDamage(egl_display* Display, damage_rect* Rects, int Count);
+
+// Creates a blob of the rects for a plane's FB_DAMAGE_CLIPS property
+// (see kms_plane.DamageClipsProperty), for backends that commit planes
+// themselves. EGLStreams flip the plane inside the driver, so there
+// the swap's damage hint is all we can pass on.
+// Returns 0 on failure; destroy with drmModeDestroyPropertyBlob.
+uint32_t CreateDamageClipsBlob(int drmFd, damage_rect* Rects, int Count);
+
+// Logs, per display since the last report: frames presented,
+// refreshes that showed no new frame (skipped), and the fraction of
+// the display covered by the damage hint per presented frame. That's
+// what the driver or KMS may limit its work to; the GL paths still
+// render every frame whole.
+void ReportDamage(egl_state* EGL);
+
+#endif /* DAMAGE_H */
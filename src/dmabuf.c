@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+
+#include "dmabuf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/dma-buf.h>
+#include <linux/udmabuf.h>
+#include <drm_fourcc.h>
+
+#include "egl.h"
+#include "log.h"
+#include "utils.h"
+
+typedef void (*egl_image_target_texture_2d)(GLenum Target, void* Image);
+
+static PFNEGLCREATEIMAGEKHRPROC    pEglCreateImageKHR;
+static PFNEGLDESTROYIMAGEKHRPROC   pEglDestroyImageKHR;
+static egl_image_target_texture_2d pGlEGLImageTargetTexture2DOES;
+
+// Per plane: fd, offset, pitch, modifier low and high bits
+static const EGLint PlaneAttribs[DMABUF_MAX_PLANES][5] = {
+    { EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE0_PITCH_EXT,
+      EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT },
+    { EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT,
+      EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT },
+    { EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT,
+      EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT },
+};
+
+static bool IsYUVFormat(uint32_t Format) {
+    switch (Format) {
+    case DRM_FORMAT_YUYV:
+    case DRM_FORMAT_UYVY:
+    case DRM_FORMAT_NV12:
+    case DRM_FORMAT_NV21:
+    case DRM_FORMAT_YUV420:
+    case DRM_FORMAT_P010:
+        return true;
+    default:
+        return false;
+    }
+}
+
+dmabuf_importer* CreateDmabufImporter(EGLDisplay Display) {
+    const char* Extensions = eglQueryString(Display, EGL_EXTENSIONS);
+    if (!Extensions || !ExtensionIsSupported(Extensions, "EGL_EXT_image_dma_buf_import")) {
+        printf("EGL_EXT_image_dma_buf_import not supported\n");
+        return NULL;
+    }
+
+    pEglCreateImageKHR  = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    pEglDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    pGlEGLImageTargetTexture2DOES =
+        (egl_image_target_texture_2d)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    if (!pEglCreateImageKHR || !pEglDestroyImageKHR || !pGlEGLImageTargetTexture2DOES) {
+        printf("EGLImage functions missing, can't import dma-bufs\n");
+        return NULL;
+    }
+
+    dmabuf_importer* Importer = calloc(1, sizeof(dmabuf_importer));
+    Importer->Display   = Display;
+    Importer->Modifiers = ExtensionIsSupported(Extensions,
+        "EGL_EXT_image_dma_buf_import_modifiers");
+    printf("dma-buf import%s\n", Importer->Modifiers ? ", with modifiers" : "");
+    return Importer;
+}
+
+static bool MakeKey(const dmabuf_frame* Frame, dmabuf_key* Key) {
+    memset(Key, 0, sizeof(dmabuf_key));
+    Key->Width    = Frame->Width;
+    Key->Height   = Frame->Height;
+    Key->Format   = Frame->Format;
+    Key->Modifier = Frame->Modifier;
+    for (int Plane = 0; Plane < Frame->PlanesCount; Plane++) {
+        // Planes usually share a buffer; only stat new fds
+        if (Plane > 0 && Frame->Planes[Plane].Fd == Frame->Planes[Plane - 1].Fd) {
+            Key->Devices[Plane] = Key->Devices[Plane - 1];
+            Key->Inodes[Plane]  = Key->Inodes[Plane - 1];
+        } else {
+            struct stat Stat;
+            if (fstat(Frame->Planes[Plane].Fd, &Stat) != 0) {
+                return false;
+            }
+            Key->Devices[Plane] = Stat.st_dev;
+            Key->Inodes[Plane]  = Stat.st_ino;
+        }
+        Key->Offsets[Plane] = Frame->Planes[Plane].Offset;
+        Key->Pitches[Plane] = Frame->Planes[Plane].Pitch;
+    }
+    return true;
+}
+
+// Field by field: the key has padding, which struct assignment
+// needn't copy, so memcmp could miss a match
+static bool KeysEqual(const dmabuf_key* A, const dmabuf_key* B) {
+    if (A->Width != B->Width || A->Height != B->Height ||
+        A->Format != B->Format || A->Modifier != B->Modifier) {
+        return false;
+    }
+    for (int Plane = 0; Plane < DMABUF_MAX_PLANES; Plane++) {
+        if (A->Devices[Plane] != B->Devices[Plane] ||
+            A->Inodes[Plane]  != B->Inodes[Plane] ||
+            A->Offsets[Plane] != B->Offsets[Plane] ||
+            A->Pitches[Plane] != B->Pitches[Plane]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void FreeEntry(dmabuf_importer* Importer, dmabuf_entry* Entry) {
+    glDeleteTextures(1, &Entry->Texture);
+    pEglDestroyImageKHR(Importer->Display, Entry->Image);
+    memset(Entry, 0, sizeof(dmabuf_entry));
+}
+
+static EGLImageKHR CreateImage(dmabuf_importer* Importer, const dmabuf_frame* Frame) {
+    EGLint Attribs[6 + DMABUF_MAX_PLANES * 10 + 1];
+    int Count = 0;
+    Attribs[Count++] = EGL_WIDTH;
+    Attribs[Count++] = Frame->Width;
+    Attribs[Count++] = EGL_HEIGHT;
+    Attribs[Count++] = Frame->Height;
+    Attribs[Count++] = EGL_LINUX_DRM_FOURCC_EXT;
+    Attribs[Count++] = Frame->Format;
+    for (int Plane = 0; Plane < Frame->PlanesCount; Plane++) {
+        Attribs[Count++] = PlaneAttribs[Plane][0];
+        Attribs[Count++] = Frame->Planes[Plane].Fd;
+        Attribs[Count++] = PlaneAttribs[Plane][1];
+        Attribs[Count++] = Frame->Planes[Plane].Offset;
+        Attribs[Count++] = PlaneAttribs[Plane][2];
+        Attribs[Count++] = Frame->Planes[Plane].Pitch;
+        if (Importer->Modifiers && Frame->Modifier != DRM_FORMAT_MOD_INVALID) {
+            Attribs[Count++] = PlaneAttribs[Plane][3];
+            Attribs[Count++] = (EGLint)(Frame->Modifier & 0xFFFFFFFF);
+            Attribs[Count++] = PlaneAttribs[Plane][4];
+            Attribs[Count++] = (EGLint)(Frame->Modifier >> 32);
+        }
+    }
+    Attribs[Count++] = EGL_NONE;
+
+    return pEglCreateImageKHR(Importer->Display, EGL_NO_CONTEXT,
+        EGL_LINUX_DMA_BUF_EXT, NULL, Attribs);
+}
+
+GLuint ImportDmabuf(dmabuf_importer* Importer, const dmabuf_frame* Frame,
+    GLenum* Target)
+{
+    Importer->Uses++;
+
+    dmabuf_key Key;
+    if (Frame->PlanesCount < 1 || Frame->PlanesCount > DMABUF_MAX_PLANES ||
+        !MakeKey(Frame, &Key)) {
+        Importer->Failures++;
+        return 0;
+    }
+
+    // Without the modifiers extension the driver assumes a linear
+    // layout, so a tiled or compressed buffer would import as garbage
+    if (!Importer->Modifiers && Frame->Modifier != DRM_FORMAT_MOD_LINEAR &&
+        Frame->Modifier != DRM_FORMAT_MOD_INVALID) {
+        LOG_RATE(LOG_WARN, 1000, "Couldn't import %ix%i dma-buf with modifier 0x%llx: "
+            "EGL_EXT_image_dma_buf_import_modifiers isn't supported\n",
+            Frame->Width, Frame->Height, (unsigned long long)Frame->Modifier);
+        Importer->Failures++;
+        return 0;
+    }
+
+    dmabuf_entry* Oldest = &Importer->Cache[0];
+    for (int Index = 0; Index < DMABUF_CACHE_SIZE; Index++) {
+        dmabuf_entry* Entry = &Importer->Cache[Index];
+        if (Entry->LastUsed && KeysEqual(&Entry->Key, &Key)) {
+            Entry->LastUsed = Importer->Uses;
+            Importer->Hits++;
+            *Target = Entry->Target;
+            return Entry->Texture;
+        }
+        if (Entry->LastUsed < Oldest->LastUsed) {
+            Oldest = Entry;
+        }
+    }
+
+    uint64_t StartNS = GetTimeNS();
+    EGLImageKHR Image = CreateImage(Importer, Frame);
+    if (Image == EGL_NO_IMAGE_KHR) {
+        LOG_RATE(LOG_WARN, 1000, "Couldn't import %ix%i dma-buf of format %.4s: %s\n",
+            Frame->Width, Frame->Height, (const char*)&Frame->Format,
+            EGLErrorString(eglGetError()));
+        Importer->Failures++;
+        return 0;
+    }
+
+    // Least recently used goes; its texture is deleted once the GPU
+    // is done with it
+    if (Oldest->LastUsed) {
+        FreeEntry(Importer, Oldest);
+        Importer->Evictions++;
+    }
+
+    GLenum ImageTarget = IsYUVFormat(Frame->Format) ?
+        GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D;
+    GLuint Texture;
+    glGenTextures(1, &Texture);
+    glBindTexture(ImageTarget, Texture);
+    pGlEGLImageTargetTexture2DOES(ImageTarget, Image);
+    glTexParameteri(ImageTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(ImageTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(ImageTarget, 0);
+
+    Oldest->Key      = Key;
+    Oldest->Image    = Image;
+    Oldest->Texture  = Texture;
+    Oldest->Target   = ImageTarget;
+    Oldest->LastUsed = Importer->Uses;
+    Importer->Imports++;
+    Importer->ImportNS += GetTimeNS() - StartNS;
+
+    *Target = ImageTarget;
+    return Texture;
+}
+
+void ForgetDmabuf(dmabuf_importer* Importer, int Fd) {
+    struct stat Stat;
+    if (fstat(Fd, &Stat) != 0) {
+        return;
+    }
+    for (int Index = 0; Index < DMABUF_CACHE_SIZE; Index++) {
+        dmabuf_entry* Entry = &Importer->Cache[Index];
+        if (!Entry->LastUsed) continue;
+        for (int Plane = 0; Plane < DMABUF_MAX_PLANES; Plane++) {
+            if (Entry->Key.Inodes[Plane] == Stat.st_ino &&
+                Entry->Key.Devices[Plane] == Stat.st_dev) {
+                FreeEntry(Importer, Entry);
+                break;
+            }
+        }
+    }
+}
+
+void ReportDmabufImporter(dmabuf_importer* Importer) {
+    LOG(LOG_INFO, "%20s: %lu cache hits, %lu imports (%.2fms each), %lu evictions, "
+        "%lu failures\n", "dma-buf import",
+        (unsigned long)Importer->Hits, (unsigned long)Importer->Imports,
+        Importer->Imports ? Importer->ImportNS / 1000000.0 / Importer->Imports : 0,
+        (unsigned long)Importer->Evictions, (unsigned long)Importer->Failures);
+    Importer->Hits      = 0;
+    Importer->Imports   = 0;
+    Importer->Evictions = 0;
+    Importer->Failures  = 0;
+    Importer->ImportNS  = 0;
+}
+
+void DestroyDmabufImporter(dmabuf_importer* Importer) {
+    for (int Index = 0; Index < DMABUF_CACHE_SIZE; Index++) {
+        if (Importer->Cache[Index].LastUsed) {
+            FreeEntry(Importer, &Importer->Cache[Index]);
+        }
+    }
+    free(Importer);
+}
+
+static void SyncDmabuf(int Fd, uint64_t Flags) {
+    struct dma_buf_sync Sync = { .flags = Flags };
+    while (ioctl(Fd, DMA_BUF_IOCTL_SYNC, &Sync) != 0) {
+        if (errno != EINTR && errno != EAGAIN) {
+            LOG_RATE(LOG_WARN, 1000, "DMA_BUF_IOCTL_SYNC failed: %s\n", strerror(errno));
+            return;
+        }
+    }
+}
+
+void BeginDmabufWrite(int Fd) {
+    SyncDmabuf(Fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+}
+
+void EndDmabufWrite(int Fd) {
+    SyncDmabuf(Fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+}
+
+bool CreateUdmabuf(size_t Size, udmabuf* Buffer) {
+    memset(Buffer, 0, sizeof(udmabuf));
+    long PageSize = sysconf(_SC_PAGESIZE);
+    Size = (Size + PageSize - 1) / PageSize * PageSize;
+
+    int DeviceFd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (DeviceFd < 0) {
+        printf("Couldn't open /dev/udmabuf: %m (modprobe udmabuf?)\n");
+        return false;
+    }
+
+    // udmabuf needs the memory's size sealed
+    int MemFd = memfd_create("udmabuf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (MemFd < 0 || ftruncate(MemFd, Size) != 0 ||
+        fcntl(MemFd, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+        printf("Couldn't create udmabuf memory: %m\n");
+        if (MemFd >= 0) close(MemFd);
+        close(DeviceFd);
+        return false;
+    }
+
+    struct udmabuf_create Create = {
+        .memfd  = MemFd,
+        .flags  = UDMABUF_FLAGS_CLOEXEC,
+        .offset = 0,
+        .size   = Size,
+    };
+    int Fd = ioctl(DeviceFd, UDMABUF_CREATE, &Create);
+    close(DeviceFd);
+    if (Fd < 0) {
+        printf("UDMABUF_CREATE failed: %m\n");
+        close(MemFd);
+        return false;
+    }
+
+    void* Pixels = mmap(0, Size, PROT_READ | PROT_WRITE, MAP_SHARED, MemFd, 0);
+    if (Pixels == MAP_FAILED) {
+        printf("Failed to mmap(2) udmabuf: %m\n");
+        close(Fd);
+        close(MemFd);
+        return false;
+    }
+
+    Buffer->Fd     = Fd;
+    Buffer->MemFd  = MemFd;
+    Buffer->Size   = Size;
+    Buffer->Pixels = Pixels;
+    return true;
+}
+
+void DestroyUdmabuf(udmabuf* Buffer) {
+    munmap(Buffer->Pixels, Buffer->Size);
+    close(Buffer->Fd);
+    close(Buffer->MemFd);
+    memset(Buffer, 0, sizeof(udmabuf));
+}
@@ -0,0 +1,131 @@
+#if !defined(DMABUF_H)
+#define DMABUF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+
+// Imports frames from other devices and processes (V4L2 cameras, video
+// decoders, other clients) as GL textures without copying them, by
+// wrapping their dma-buf file descriptors in EGLImages
+// (EGL_EXT_image_dma_buf_import).
+//
+// Producers usually cycle through a few buffers, so imports are cached,
+// keyed by the dma-buf's inode rather than its fd: fd numbers are
+// reused and the same buffer arrives under different fds, but a
+// dma-buf's inode is its own for as long as it exists, and an EGLImage
+// keeps its buffer alive. A cached texture shows whatever the buffer
+// holds when it's sampled, so importing a recurring buffer again costs
+// only an fstat(2).
+//
+// Writes by other devices are synchronized implicitly by the kernel.
+// CPU writers bracket their writes with BeginDmabufWrite and
+// EndDmabufWrite. Either way, the producer mustn't reuse a buffer
+// until the frames sampling it are done on the GPU (fence them).
+//
+//   dmabuf_importer* Importer = CreateDmabufImporter(EGL->DisplayDevice);
+//   ...per frame, with a context current:
+//   dmabuf_frame Frame = { .Width = ..., .Format = DRM_FORMAT_XRGB8888,
+//       .PlanesCount = 1, .Planes = {{ Fd, 0, Pitch }} };
+//   GLenum Target;
+//   GLuint Texture = ImportDmabuf(Importer, &Frame, &Target);
+
+#define DMABUF_MAX_PLANES 3
+#define DMABUF_CACHE_SIZE 32
+
+#if !defined(GL_TEXTURE_EXTERNAL_OES)
+#define GL_TEXTURE_EXTERNAL_OES 0x8D65
+#endif
+
+typedef struct {
+    int      Fd;
+    uint32_t Offset;
+    uint32_t Pitch;
+} dmabuf_plane;
+
+typedef struct {
+    int          Width;
+    int          Height;
+    uint32_t     Format;   // DRM_FORMAT_*
+    uint64_t     Modifier; // DRM_FORMAT_MOD_INVALID if implicit
+    int          PlanesCount;
+    dmabuf_plane Planes[DMABUF_MAX_PLANES];
+} dmabuf_frame;
+
+typedef struct {
+    dev_t    Devices[DMABUF_MAX_PLANES];
+    ino_t    Inodes[DMABUF_MAX_PLANES];
+    int      Width;
+    int      Height;
+    uint32_t Format;
+    uint64_t Modifier;
+    uint32_t Offsets[DMABUF_MAX_PLANES];
+    uint32_t Pitches[DMABUF_MAX_PLANES];
+} dmabuf_key;
+
+typedef struct {
+    dmabuf_key  Key;
+    EGLImageKHR Image;
+    GLuint      Texture;
+    GLenum      Target;
+    uint64_t    LastUsed; // 0 if the entry is empty
+} dmabuf_entry;
+
+typedef struct {
+    EGLDisplay   Display;
+    bool         Modifiers; // EGL_EXT_image_dma_buf_import_modifiers
+    dmabuf_entry Cache[DMABUF_CACHE_SIZE];
+    uint64_t     Uses;
+
+    // For ReportDmabufImporter
+    uint64_t Hits;
+    uint64_t Imports;
+    uint64_t Evictions;
+    uint64_t Failures;
+    uint64_t ImportNS;
+} dmabuf_importer;
+
+// Returns NULL (printing why) if the display can't import dma-bufs.
+dmabuf_importer* CreateDmabufImporter(EGLDisplay Display);
+
+// Returns the frame's texture, importing it unless it's cached, with a
+// context current. Target is GL_TEXTURE_2D for RGB formats, or
+// GL_TEXTURE_EXTERNAL_OES for YUV ones, which only external samplers
+// can sample (GL_OES_EGL_image_external), converting to RGB as they do.
+// Returns 0 if the import fails; the driver may not support the
+// format, modifier or the memory behind the buffer.
+GLuint ImportDmabuf(dmabuf_importer* Importer, const dmabuf_frame* Frame,
+    GLenum* Target);
+
+// Drops the cached imports of the buffer behind Fd, so it can be freed;
+// otherwise the cache keeps it alive until evicted.
+void ForgetDmabuf(dmabuf_importer* Importer, int Fd);
+
+// Logs cache hits, imports and evictions since the last report.
+void ReportDmabufImporter(dmabuf_importer* Importer);
+
+void DestroyDmabufImporter(dmabuf_importer* Importer);
+
+// CPU access to a dma-buf's mapping (DMA_BUF_IOCTL_SYNC), so caches
+// and other devices' accesses are synchronized with it.
+void BeginDmabufWrite(int Fd);
+void EndDmabufWrite(int Fd);
+
+// Host memory exported as a dma-buf through /dev/udmabuf, for testing
+// without a camera or decoder. Pixels maps it for the CPU.
+typedef struct {
+    int      Fd;
+    int      MemFd;
+    size_t   Size;
+    uint8_t* Pixels;
+} udmabuf;
+
+// Returns false (printing why) without udmabuf support.
+bool CreateUdmabuf(size_t Size, udmabuf* Buffer);
+void DestroyUdmabuf(udmabuf* Buffer);
+
+#endif /* DMABUF_H */
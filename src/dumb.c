@@ -0,0 +1,73 @@
+#include "dumb.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+bool CreateDumbBuffer(int drmFd, int Width, int Height, uint32_t Format,
+    dumb_buffer* Buffer)
+{
+    memset(Buffer, 0, sizeof(dumb_buffer));
+    Buffer->drmFd  = drmFd;
+    Buffer->Width  = Width;
+    Buffer->Height = Height;
+    Buffer->Format = Format;
+
+    struct drm_mode_create_dumb CreateRequest = {
+        .width  = Width,
+        .height = Height,
+        .bpp    = 32,
+    };
+    if (drmIoctl(drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &CreateRequest) < 0) {
+        printf("Unable to create %ix%i dumb buffer: %m\n", Width, Height);
+        return false;
+    }
+    Buffer->Handle = CreateRequest.handle;
+    Buffer->Pitch  = CreateRequest.pitch;
+    Buffer->Size   = CreateRequest.size;
+
+    uint32_t Handles[4] = { Buffer->Handle };
+    uint32_t Pitches[4] = { Buffer->Pitch };
+    uint32_t Offsets[4] = { 0 };
+    if (drmModeAddFB2(drmFd, Width, Height, Format,
+            Handles, Pitches, Offsets, &Buffer->Framebuffer, 0) != 0) {
+        printf("Unable to add framebuffer for dumb buffer: %m\n");
+        DestroyDumbBuffer(Buffer);
+        return false;
+    }
+
+    struct drm_mode_map_dumb MapRequest = { .handle = Buffer->Handle };
+    if (drmIoctl(drmFd, DRM_IOCTL_MODE_MAP_DUMB, &MapRequest) != 0) {
+        printf("Unable to map dumb buffer: %m\n");
+        DestroyDumbBuffer(Buffer);
+        return false;
+    }
+
+    void* Pixels = mmap(0, Buffer->Size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        drmFd, MapRequest.offset);
+    if (Pixels == MAP_FAILED) {
+        printf("Failed to mmap(2) dumb buffer: %m\n");
+        DestroyDumbBuffer(Buffer);
+        return false;
+    }
+    Buffer->Pixels = Pixels;
+    memset(Buffer->Pixels, 0, Buffer->Size);
+
+    return true;
+}
+
+void DestroyDumbBuffer(dumb_buffer* Buffer) {
+    if (Buffer->Pixels) {
+        munmap(Buffer->Pixels, Buffer->Size);
+    }
+    if (Buffer->Framebuffer) {
+        drmModeRmFB(Buffer->drmFd, Buffer->Framebuffer);
+    }
+    if (Buffer->Handle) {
+        struct drm_mode_destroy_dumb DestroyRequest = { .handle = Buffer->Handle };
+        drmIoctl(Buffer->drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &DestroyRequest);
+    }
+    memset(Buffer, 0, sizeof(dumb_buffer));
+}
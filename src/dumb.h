@@ -0,0 +1,31 @@
+#if !defined(DUMB_H)
+#define DUMB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A CPU-mapped KMS "dumb" buffer with a framebuffer for scanout.
+// Dumb buffers work on every KMS driver, GPU or not.
+typedef struct {
+    int      drmFd;
+    int      Width;
+    int      Height;
+    uint32_t Format;      // DRM_FORMAT_*, 32 bits per pixel
+    uint32_t Handle;
+    uint32_t Pitch;       // Bytes per row
+    uint64_t Size;
+    uint32_t Framebuffer; // FB ID for the FB_ID plane property
+    uint8_t* Pixels;
+} dumb_buffer;
+
+// Returns false (printing why) if the driver can't provide the buffer.
+bool CreateDumbBuffer(int drmFd, int Width, int Height, uint32_t Format,
+    dumb_buffer* Buffer);
+
+void DestroyDumbBuffer(dumb_buffer* Buffer);
+
+static inline uint32_t* DumbBufferRow(dumb_buffer* Buffer, int Y) {
+    return (uint32_t*)(Buffer->Pixels + (uint64_t)Y * Buffer->Pitch);
+}
+
+#endif /* DUMB_H */
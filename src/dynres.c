@@ -0,0 +1,143 @@
+#include "dynres.h"
+
+#include "log.h"
+#include "utils.h"
+
+dynres_options DefaultDynamicResolutionOptions() {
+    return (dynres_options){
+        .MinScale     = 0.5,
+        .MaxScale     = 1.0,
+        .Step         = 0.125,
+        .ShrinkAbove  = 0.9,
+        .GrowBelow    = 0.7,
+        .ShrinkFrames = 3,
+        .GrowFrames   = 60,
+    };
+}
+
+void InitDynamicResolution(dynres* DynRes, dynres_options Options) {
+    *DynRes = (dynres){
+        .Options = Options,
+        .Scale   = Options.MaxScale,
+    };
+}
+
+bool UpdateResolutionScale(dynres* DynRes, double FrameMS, double BudgetMS) {
+    dynres_options* Options = &DynRes->Options;
+
+    if (FrameMS > BudgetMS * Options->ShrinkAbove) {
+        DynRes->OverFrames++;
+        DynRes->UnderFrames = 0;
+    } else {
+        DynRes->OverFrames = 0;
+
+        // Predict the frame time one step up from the pixel count
+        float Larger = MIN(DynRes->Scale + Options->Step, Options->MaxScale);
+        double Ratio = (Larger * Larger) / (DynRes->Scale * DynRes->Scale);
+        if (FrameMS * Ratio < BudgetMS * Options->GrowBelow) {
+            DynRes->UnderFrames++;
+        } else {
+            DynRes->UnderFrames = 0;
+        }
+    }
+
+    float Scale = DynRes->Scale;
+    if (DynRes->OverFrames >= Options->ShrinkFrames) {
+        Scale = MAX(Scale - Options->Step, Options->MinScale);
+        DynRes->OverFrames = 0;
+    } else if (DynRes->UnderFrames >= Options->GrowFrames) {
+        Scale = MIN(Scale + Options->Step, Options->MaxScale);
+        DynRes->UnderFrames = 0;
+    }
+
+    if (Scale == DynRes->Scale) return false;
+    DynRes->Scale = Scale;
+    return true;
+}
+
+static void ResizeScaledTarget(dynres* DynRes, int Width, int Height) {
+    if (!DynRes->Framebuffer) {
+        glGenRenderbuffers(1, &DynRes->Renderbuffer);
+        glGenFramebuffers(1, &DynRes->Framebuffer);
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, DynRes->Renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, Width, Height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, DynRes->Framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, DynRes->Renderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        Fatal("Dynamic resolution framebuffer is incomplete\n");
+    }
+
+    DynRes->Width  = Width;
+    DynRes->Height = Height;
+}
+
+// Feeds every scene pass whose queries have completed to the
+// controller, without waiting on the GPU.
+static void ResolveScenePasses(dynres* DynRes, egl_display* Display) {
+    double BudgetMS = GetRefreshPeriodNS(Display->Plane) / 1000000.0;
+
+    while (DynRes->Resolved < DynRes->Frame) {
+        GLuint* Queries = DynRes->Queries[DynRes->Resolved % GPU_TIMER_FRAMES];
+
+        // Queries complete in order, so only check the end one
+        GLint Available = 0;
+        glGetQueryObjectiv(Queries[1], GL_QUERY_RESULT_AVAILABLE, &Available);
+        if (!Available) break;
+
+        GLuint64 GPUStart, GPUEnd;
+        glGetQueryObjectui64v(Queries[0], GL_QUERY_RESULT, &GPUStart);
+        glGetQueryObjectui64v(Queries[1], GL_QUERY_RESULT, &GPUEnd);
+        DynRes->LastSceneMS = (GPUEnd - GPUStart) / 1000000.0;
+        DynRes->Resolved++;
+
+        if (UpdateResolutionScale(DynRes, DynRes->LastSceneMS, BudgetMS)) {
+            LOG(LOG_INFO, "%20s resolution scale %.3f (scene gpu %.2fms, budget %.2fms)\n",
+                Display->MonitorName, DynRes->Scale,
+                DynRes->LastSceneMS, BudgetMS);
+        }
+    }
+
+    // Drop the oldest rather than reuse queries still pending
+    if (DynRes->Frame - DynRes->Resolved >= GPU_TIMER_FRAMES) {
+        DynRes->Resolved = DynRes->Frame - GPU_TIMER_FRAMES + 1;
+    }
+}
+
+void BeginScaledFrame(dynres* DynRes, egl_display* Display) {
+    if (DynRes->Queries[0][0] == 0) {
+        glGenQueries(GPU_TIMER_FRAMES * 2, &DynRes->Queries[0][0]);
+    }
+    ResolveScenePasses(DynRes, Display);
+
+    // Keep sizes even, which some scalers prefer
+    int Width  = (int)(Display->Width  * DynRes->Scale) & ~1;
+    int Height = (int)(Display->Height * DynRes->Scale) & ~1;
+    Width  = MAX(Width,  2);
+    Height = MAX(Height, 2);
+    if (Width != DynRes->Width || Height != DynRes->Height) {
+        ResizeScaledTarget(DynRes, Width, Height);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, DynRes->Framebuffer);
+    glViewport(0, 0, DynRes->Width, DynRes->Height);
+    glQueryCounter(DynRes->Queries[DynRes->Frame % GPU_TIMER_FRAMES][0], GL_TIMESTAMP);
+}
+
+void EndScaledFrame(dynres* DynRes, egl_display* Display) {
+    glQueryCounter(DynRes->Queries[DynRes->Frame % GPU_TIMER_FRAMES][1], GL_TIMESTAMP);
+    DynRes->Frame++;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, DynRes->Framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(
+        0, 0, DynRes->Width, DynRes->Height,
+        0, 0, Display->Width, Display->Height,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, Display->Width, Display->Height);
+}
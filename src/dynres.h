@@ -0,0 +1,78 @@
+#if !defined(DYNRES_H)
+#define DYNRES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <GL/glew.h>
+
+#include "egl.h"
+
+// Dynamic resolution: renders a display at a reduced resolution when
+// its frames don't fit in a refresh period, and scales the result up
+// to the display, so a heavy scene degrades in sharpness rather than
+// in dropped frames.
+//
+// The controller watches the GPU time of the scene pass alone, timed
+// with its own GL_TIMESTAMP queries between BeginScaledFrame and
+// EndScaledFrame, so the upscale blit (which doesn't shrink with the
+// scale) isn't mistaken for scene cost. It compares that against the
+// refresh period. It shrinks the scale one step once
+// ShrinkFrames frames in a row went over ShrinkAbove of the budget,
+// and grows it one step once GrowFrames frames in a row would still
+// have fit under GrowBelow of the budget at the larger scale (render
+// time is assumed to follow the pixel count). The two thresholds and
+// the longer wait before growing keep it from oscillating.
+//
+// The EGLOutputLayer owns the plane, so we can't set its SRC_W/SRC_H
+// to use the display hardware's scaler; instead the frame is rendered
+// into an offscreen framebuffer and blitted up with GL_LINEAR.
+
+typedef struct {
+    float MinScale;
+    float MaxScale;
+    float Step;
+    float ShrinkAbove; // Fractions of the refresh period
+    float GrowBelow;
+    int   ShrinkFrames;
+    int   GrowFrames;
+} dynres_options;
+
+dynres_options DefaultDynamicResolutionOptions();
+
+typedef struct {
+    dynres_options Options;
+    float    Scale;
+    int      OverFrames;
+    int      UnderFrames;
+
+    // Timestamps around each frame's scene pass, read back a few
+    // frames later without blocking, as frame.c does
+    GLuint   Queries[GPU_TIMER_FRAMES][2];
+    uint64_t Frame;    // Scene passes ended so far
+    uint64_t Resolved; // Scene passes whose queries were read back
+    double   LastSceneMS;
+
+    // The reduced resolution render target, in the display's context
+    int      Width;
+    int      Height;
+    GLuint   Framebuffer;
+    GLuint   Renderbuffer;
+} dynres;
+
+void InitDynamicResolution(dynres* DynRes, dynres_options Options);
+
+// Feeds one frame time to the controller; returns true if the scale
+// changed. Separate from the GL side so it can be driven by anything.
+bool UpdateResolutionScale(dynres* DynRes, double FrameMS, double BudgetMS);
+
+// Updates the scale from the scene passes timed since the last call,
+// then binds a framebuffer of the scaled size with a matching
+// viewport. Call after BeginFrame, from the display's render thread.
+void BeginScaledFrame(dynres* DynRes, egl_display* Display);
+
+// Ends the timed scene pass, scales the frame up to the display's
+// surface, and restores its framebuffer and viewport.
+// Call before EndFrame.
+void EndScaledFrame(dynres* DynRes, egl_display* Display);
+
+#endif /* DYNRES_H */
@@ -24,6 +24,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
@@ -32,6 +36,8 @@
 
 #include "utils.h"
 #include "egl.h"
+#include "color.h"
+#include "damage.h"
 
 /* XXX khronos eglext.h does not yet have EGL_DRM_MASTER_FD_EXT */
 #if !defined(EGL_DRM_MASTER_FD_EXT)
@@ -50,6 +56,10 @@
 #define EGL_RESOURCE_BUSY_EXT                        0x3353
 #endif
 
+#if !defined(EGL_TIMEOUT_EXPIRED_KHR)
+#define EGL_TIMEOUT_EXPIRED_KHR           0x30F5
+#endif
+
 #if !defined(EGL_BAD_STATE_KHR)
 #define EGL_BAD_STATE_KHR                 0x321C
 #endif
@@ -112,11 +122,14 @@ PFNEGLCREATESTREAMKHRPROC pEglCreateStreamKHR = NULL;
 PFNEGLSTREAMCONSUMEROUTPUTEXTPROC pEglStreamConsumerOutputEXT = NULL;
 PFNEGLCREATESTREAMPRODUCERSURFACEKHRPROC pEglCreateStreamProducerSurfaceKHR = NULL;
 PFNEGLQUERYSTREAMKHRPROC pEglQueryStreamKHR = NULL;
+PFNEGLDESTROYSTREAMKHRPROC pEglDestroyStreamKHR = NULL;
 PFNEGLSTREAMCONSUMERACQUIREATTRIBNVPROC pEglStreamConsumerAcquireAttribNV = NULL;
 PFNEGLSTREAMCONSUMERRELEASEATTRIBNVPROC pEglStreamConsumerReleaseAttribNV = NULL;
 PFNEGLCREATESTREAMATTRIBNVPROC pEglCreateStreamAttribNV = NULL;
 PFNEGLOUTPUTLAYERATTRIBEXTPROC pEglOutputLayerAttribEXT = NULL;
 PFNEGLQUERYOUTPUTLAYERATTRIBEXTPROC pEglQueryOutputLayerAttribEXT = NULL;
+// Optional; NULL without EGL_KHR/EXT_swap_buffers_with_damage
+PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC pEglSwapBuffersWithDamageKHR = NULL;
 
 void GetEglExtensionFunctionPointers(void)
 {
@@ -144,6 +157,9 @@ void GetEglExtensionFunctionPointers(void)
     pEglQueryStreamKHR = (PFNEGLQUERYSTREAMKHRPROC)
         GetProcAddress("eglQueryStreamKHR");
 
+    pEglDestroyStreamKHR = (PFNEGLDESTROYSTREAMKHRPROC)
+        GetProcAddress("eglDestroyStreamKHR");
+
     pEglStreamConsumerAcquireAttribNV = (PFNEGLSTREAMCONSUMERACQUIREATTRIBNVPROC)
         GetProcAddress("eglStreamConsumerAcquireAttribNV");
 
@@ -402,6 +418,19 @@ EGLConfig GetEglConfig(EGLDisplay eglDpy) {
         Fatal("EGL_KHR_stream_producer_eglsurface not found.\n");
     }
 
+    /*
+     * Damage passed to eglSwapBuffersWithDamage lets the driver skip
+     * unchanged regions when composing and scanning out.
+     */
+
+    if (ExtensionIsSupported(extensionString, "EGL_KHR_swap_buffers_with_damage")) {
+        pEglSwapBuffersWithDamageKHR = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            GetProcAddress("eglSwapBuffersWithDamageKHR");
+    } else if (ExtensionIsSupported(extensionString, "EGL_EXT_swap_buffers_with_damage")) {
+        pEglSwapBuffersWithDamageKHR = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            GetProcAddress("eglSwapBuffersWithDamageEXT");
+    }
+
     /* Bind full OpenGL as EGL's client API. */
 
     eglBindAPI(EGL_OPENGL_API);
@@ -419,10 +448,15 @@ EGLConfig GetEglConfig(EGLDisplay eglDpy) {
 }
 
 EGLContext GetEglContext(EGLDisplay eglDpy, EGLConfig eglConfig) {
+    return GetSharedEglContext(eglDpy, eglConfig, EGL_NO_CONTEXT);
+}
+
+EGLContext GetSharedEglContext(EGLDisplay eglDpy, EGLConfig eglConfig,
+    EGLContext ShareContext) {
     /* Create an EGL context using the EGL config. */
     EGLint contextAttribs[] = { EGL_NONE };
     EGLContext eglContext =
-        eglCreateContext(eglDpy, eglConfig, EGL_NO_CONTEXT, contextAttribs);
+        eglCreateContext(eglDpy, eglConfig, ShareContext, contextAttribs);
 
     if (eglContext == NULL) {
         Fatal("eglCreateContext() failed.\n");
@@ -430,11 +464,25 @@ EGLContext GetEglContext(EGLDisplay eglDpy, EGLConfig eglConfig) {
     return eglContext;
 }
 
+void EGLMakeRootCurrent(egl_state* EGL) {
+    EGLBoolean ret = eglMakeCurrent(EGL->DisplayDevice,
+        EGL_NO_SURFACE, EGL_NO_SURFACE,
+        EGL->RootContext);
+    if (!ret) Fatal("Couldn't make root context current without a surface\n");
+}
+
 void PrintDisplayLayerSwapInterval(egl_display* Display) {
+    // Called every frame, so only make the query when
+    // the message would actually be written
+    static log_site Site = LOG_SITE(LOG_DEBUG, 1000);
+    if (!LogSiteReady(&Site)) {
+        return;
+    }
+
     EGLAttrib SwapInterval;
     pEglQueryOutputLayerAttribEXT(Display->DisplayDevice, Display->Layer,
         EGL_SWAP_INTERVAL_EXT, &SwapInterval);
-    printf("Swap interval for %s is %li\n",
+    LogWriteReady(&Site, "Swap interval for %s is %li\n",
         Display->MonitorName,
         SwapInterval);
 }
@@ -443,7 +491,88 @@ void EGLUpdateVSync(egl_state* EGL) {
     drmHandleEvent(EGL->DRMFD, &EGL->DRMEventContext);
 }
 
-void EGLStreamAcquire(egl_display* Display) {
+static void DRMEventCallback(void* UserData) {
+    EGLUpdateVSync(UserData);
+}
+
+event_source* EGLAttachEventLoop(egl_state* EGL, event_loop* Loop) {
+    return EventLoopAddFD(Loop, EGL->DRMFD, DRMEventCallback, EGL);
+}
+
+void EGLWaitVSync(egl_state* EGL, int TimeoutMS) {
+    struct pollfd PollFD = { .fd = EGL->DRMFD, .events = POLLIN };
+    if (poll(&PollFD, 1, TimeoutMS) > 0) {
+        drmHandleEvent(EGL->DRMFD, &EGL->DRMEventContext);
+    }
+}
+
+// Wakes a consumer blocked in EGLWaitConsumerEvents
+static void SignalConsumer(egl_display* Display) {
+    egl_consumer_signal* Signal = Display->ConsumerSignal;
+    // Sequentially consistent against the consumer's store to Waiting
+    // and reload in EGLWaitConsumerEvents
+    atomic_fetch_add_explicit(&Signal->Events, 1, memory_order_seq_cst);
+    if (atomic_exchange_explicit(&Signal->Waiting, 0, memory_order_seq_cst)) {
+        FutexWake(&Signal->Events);
+    }
+}
+
+void EGLCancelPageFlipPending(egl_display* Display) {
+    uint32_t State = atomic_exchange_explicit(&Display->Hot->PageFlipPending, 0,
+        memory_order_release);
+    if (State == PAGE_FLIP_PENDING_WAITERS) {
+        FutexWake(&Display->Hot->PageFlipPending);
+    }
+}
+
+void EGLClearPageFlipPending(egl_display* Display) {
+    EGLCancelPageFlipPending(Display);
+    // A frame produced during the flip can be acquired now
+    SignalConsumer(Display);
+}
+
+bool EGLSetPageFlipPending(egl_display* Display) {
+    _Atomic uint32_t* Pending = &Display->Hot->PageFlipPending;
+    if (atomic_load_explicit(Pending, memory_order_relaxed) != 0) {
+        return false;
+    }
+    // Stored first, so the watchdog never sees the flip pending since
+    // an older time. Losing the race below only makes it a little
+    // later for the flip that won.
+    atomic_store_explicit(&Display->Hot->AcquireTimeNS, GetTimeNS(),
+        memory_order_relaxed);
+    // From 0 only: a pending flip's PAGE_FLIP_PENDING_WAITERS mustn't
+    // be overwritten, or its waiters would never be woken
+    uint32_t Idle = 0;
+    return atomic_compare_exchange_strong_explicit(Pending, &Idle, PAGE_FLIP_PENDING,
+        memory_order_acq_rel, memory_order_relaxed);
+}
+
+// Lets go of a stream pinned by BeginStreamUse
+static void EndStreamUse(egl_display* Display) {
+    uint32_t Users = atomic_fetch_sub_explicit(&Display->Hot->StreamUsers, 1,
+        memory_order_release);
+    // The last user out wakes the recreating thread
+    if (Users == (STREAM_RECREATING | 1)) {
+        FutexWake(&Display->Hot->StreamUsers);
+    }
+}
+
+// Pins the display's stream for a call on it, so EGLRecreateStream
+// waits for the call before destroying it. Returns EGL_NO_STREAM_KHR,
+// with nothing to end, while the stream is being recreated.
+static EGLStreamKHR BeginStreamUse(egl_display* Display) {
+    uint32_t Users = atomic_fetch_add_explicit(&Display->Hot->StreamUsers, 1,
+        memory_order_acquire);
+    if (Users & STREAM_RECREATING) {
+        // Undone like any other use, as this may be the last one out
+        EndStreamUse(Display);
+        return EGL_NO_STREAM_KHR;
+    }
+    return atomic_load_explicit(&Display->Hot->Stream, memory_order_acquire);
+}
+
+static acquire_status StreamAcquire(egl_display* Display) {
     // Ask the Display's EGLStream to acquire the new frame,
     // and pass a data pointer to pass along to drmHandleEvent
     EGLAttrib AcquireAttribs[] = {
@@ -451,29 +580,418 @@ void EGLStreamAcquire(egl_display* Display) {
         EGL_NONE
     };
 
+    EGLStreamKHR Stream = BeginStreamUse(Display);
+    if (Stream == EGL_NO_STREAM_KHR) {
+        // Being recreated; its frames are gone, so look again later
+        return ACQUIRE_NO_FRAME;
+    }
+
+    // Mark the flip pending before acquiring, since its event may be
+    // dispatched on another thread before the acquire call returns.
+    // If another thread's overlay or software commit got there first,
+    // its flip is still coming, so this is the same as a busy stream.
+    if (!EGLSetPageFlipPending(Display)) {
+        EndStreamUse(Display);
+        atomic_fetch_add_explicit(&Display->Hot->AcquireBusy, 1,
+            memory_order_relaxed);
+        return ACQUIRE_BUSY;
+    }
+
+    atomic_fetch_add_explicit(&Display->Hot->EGLCalls, 1, memory_order_relaxed);
     EGLBoolean Result = pEglStreamConsumerAcquireAttribNV(
         Display->DisplayDevice,
-        Display->Stream,
+        Stream,
         AcquireAttribs);
-    if (Result == EGL_FALSE) {
-        EGLCheck("eglStreamConsumerAcquireAttribNV");
+    EGLint Error = Result == EGL_TRUE ? EGL_SUCCESS : eglGetError();
+    EndStreamUse(Display);
+    if (Result == EGL_TRUE) {
+        return ACQUIRE_OK;
+    }
+
+    // No flip is coming. Nothing changed for the consumer either, so
+    // it isn't signalled: a consumer retrying a busy stream would see
+    // its own failure as an event and spin.
+    EGLCancelPageFlipPending(Display);
+
+    switch (Error) {
+        case EGL_RESOURCE_BUSY_EXT:
+            atomic_fetch_add_explicit(&Display->Hot->AcquireBusy, 1,
+                memory_order_relaxed);
+            return ACQUIRE_BUSY;
+        case EGL_TIMEOUT_EXPIRED_KHR:
+            atomic_fetch_add_explicit(&Display->Hot->AcquireTimeouts, 1,
+                memory_order_relaxed);
+            return ACQUIRE_TIMEOUT;
+        case EGL_BAD_STATE_KHR:
+            // Nothing new in the stream to acquire
+            return ACQUIRE_NO_FRAME;
+    }
+    LOG(LOG_ERROR, "%20s eglStreamConsumerAcquireAttribNV: %s\n",
+        Display->MonitorName, EGLErrorString(Error));
+    return ACQUIRE_FATAL;
+}
+
+acquire_status EGLStreamAcquire(egl_display* Display) {
+    acquire_status Status = StreamAcquire(Display);
+
+    // Both are transient: the previous flip (or an overlay commit)
+    // hasn't landed, or the stream's acquire timeout expired before the
+    // frame was ready. Sleeping here would stall every other display a
+    // single-threaded loop drives, so the caller retries next time.
+    if (Status != ACQUIRE_BUSY && Status != ACQUIRE_TIMEOUT) {
+        Display->Hot->AcquireRetries = 0;
+        return Status;
+    }
+
+    if (++Display->Hot->AcquireRetries >= ACQUIRE_WARN_RETRIES) {
+        LOG_RATE(LOG_WARN, 1000, "%20s acquire still %s after %u tries "
+            "(%llu busy, %llu timeouts so far)\n",
+            Display->MonitorName,
+            Status == ACQUIRE_BUSY ? "busy" : "timing out",
+            Display->Hot->AcquireRetries,
+            (unsigned long long)atomic_load(&Display->Hot->AcquireBusy),
+            (unsigned long long)atomic_load(&Display->Hot->AcquireTimeouts));
+    }
+    return Status;
+}
+
+EGLint EGLQueryDisplayStreamState(egl_display* Display) {
+    EGLStreamKHR Stream = BeginStreamUse(Display);
+    if (Stream == EGL_NO_STREAM_KHR) {
+        return 0;
+    }
+    EGLint State = 0;
+    atomic_fetch_add_explicit(&Display->Hot->EGLCalls, 1, memory_order_relaxed);
+    if (!pEglQueryStreamKHR(Display->DisplayDevice, Stream,
+            EGL_STREAM_STATE_KHR, &State)) {
+        State = 0;
+    }
+    EndStreamUse(Display);
+    return State;
+}
+
+static EGLint QueryStreamState(egl_display* Display) {
+    EGLStreamKHR Stream = BeginStreamUse(Display);
+    if (Stream == EGL_NO_STREAM_KHR) {
+        // The new stream will start out connecting
+        Display->Hot->StreamState = EGL_STREAM_STATE_CONNECTING_KHR;
+        return Display->Hot->StreamState;
+    }
+    atomic_fetch_add_explicit(&Display->Hot->EGLCalls, 1, memory_order_relaxed);
+    Display->Hot->StreamState = EGLQueryStreamState(Display->DisplayDevice, Stream);
+    EndStreamUse(Display);
+    return Display->Hot->StreamState;
+}
+
+static void FrameProduced(egl_display* Display) {
+    // Sequentially consistent against the consumer's store to
+    // ConsumerWaiting and reload in EGLWaitFrameProduced
+    atomic_fetch_add_explicit(&Display->Hot->FramesProduced, 1,
+        memory_order_seq_cst);
+    // Only make the futex syscall if the consumer is blocked
+    if (atomic_exchange_explicit(&Display->Hot->ConsumerWaiting, 0,
+            memory_order_seq_cst)) {
+        FutexWake(&Display->Hot->FramesProduced);
+    }
+    SignalConsumer(Display);
+}
+
+void EGLSwapFrame(egl_display* Display) {
+    atomic_fetch_add_explicit(&Display->Hot->EGLCalls, 1, memory_order_relaxed);
+    eglSwapBuffers(Display->DisplayDevice, Display->Hot->Surface);
+    FrameProduced(Display);
+}
+
+void EGLSwapFrameWithDamage(egl_display* Display, EGLint* Rects, int Count) {
+    if (!pEglSwapBuffersWithDamageKHR || Count == 0) {
+        EGLSwapFrame(Display);
+        return;
+    }
+    atomic_fetch_add_explicit(&Display->Hot->EGLCalls, 1, memory_order_relaxed);
+    pEglSwapBuffersWithDamageKHR(Display->DisplayDevice, Display->Hot->Surface,
+        Rects, Count);
+    FrameProduced(Display);
+}
+
+bool EGLAcquireProduced(egl_display* Display) {
+    uint32_t Produced = atomic_load_explicit(&Display->Hot->FramesProduced,
+        memory_order_acquire);
+    if (Produced == Display->Hot->FramesConsumed &&
+        Display->Hot->StreamState != EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR) {
+        return false;
+    }
+
+    // The stream is a mailbox, so one acquire takes the newest frame
+    // of however many were produced.
+    acquire_status Status = EGLStreamAcquire(Display);
+    switch (Status) {
+        case ACQUIRE_OK:
+            Display->Hot->FramesConsumed = Produced;
+            Display->Hot->StreamState = EGL_STREAM_STATE_OLD_FRAME_AVAILABLE_KHR;
+            return true;
+        case ACQUIRE_BUSY:
+        case ACQUIRE_TIMEOUT:
+            // Leave the frame counted as unconsumed to retry next time
+            return false;
+        case ACQUIRE_NO_FRAME:
+            // Our count and the stream disagree (e.g. the frame counted
+            // here was already taken by the previous acquire), so ask.
+            Display->Hot->FramesConsumed = Produced;
+            QueryStreamState(Display);
+            return false;
+        case ACQUIRE_FATAL:
+            break;
+    }
+    Fatal("%s: acquiring from the stream failed\n", Display->MonitorName);
+    return false;
+}
+
+bool EGLWaitFrameProduced(egl_display* Display, int TimeoutMS) {
+    _Atomic uint32_t* Produced = &Display->Hot->FramesProduced;
+    uint32_t Consumed = Display->Hot->FramesConsumed;
+
+    if (atomic_load_explicit(Produced, memory_order_acquire) != Consumed) {
+        return true;
+    }
+
+    atomic_store_explicit(&Display->Hot->ConsumerWaiting, 1, memory_order_seq_cst);
+    // Recheck after announcing ourselves, or a frame produced
+    // in between wouldn't wake us.
+    if (atomic_load_explicit(Produced, memory_order_seq_cst) == Consumed) {
+        FutexWait(Produced, Consumed, TimeoutMS);
+    }
+    atomic_store_explicit(&Display->Hot->ConsumerWaiting, 0, memory_order_relaxed);
+
+    if (atomic_load_explicit(Produced, memory_order_acquire) != Consumed) {
+        return true;
+    }
+    return QueryStreamState(Display) == EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR;
+}
+
+bool EGLFrameUnconsumed(egl_display* Display) {
+    return atomic_load_explicit(&Display->Hot->FramesProduced, memory_order_acquire) !=
+        Display->Hot->FramesConsumed;
+}
+
+uint32_t EGLConsumerEvents(egl_state* EGL) {
+    return atomic_load_explicit(&EGL->Displays->ConsumerSignal->Events,
+        memory_order_acquire);
+}
+
+void EGLWaitConsumerEvents(egl_state* EGL, uint32_t Seen, int TimeoutMS) {
+    egl_consumer_signal* Signal = EGL->Displays->ConsumerSignal;
+    if (atomic_load_explicit(&Signal->Events, memory_order_acquire) != Seen) {
+        return;
+    }
+
+    atomic_store_explicit(&Signal->Waiting, 1, memory_order_seq_cst);
+    // Recheck after announcing ourselves, as in EGLWaitFrameProduced
+    if (atomic_load_explicit(&Signal->Events, memory_order_seq_cst) == Seen) {
+        FutexWait(&Signal->Events, Seen, TimeoutMS);
+    }
+    atomic_store_explicit(&Signal->Waiting, 0, memory_order_relaxed);
+}
+
+void EGLWaitForPageFlip(egl_display* Display) {
+    uint32_t State = atomic_load_explicit(&Display->Hot->PageFlipPending,
+        memory_order_acquire);
+    while (State != 0) {
+        // Tell the event handler someone needs waking
+        if (State == PAGE_FLIP_PENDING &&
+            !atomic_compare_exchange_weak_explicit(&Display->Hot->PageFlipPending,
+                &State, PAGE_FLIP_PENDING_WAITERS,
+                memory_order_acquire, memory_order_acquire)) {
+            continue;
+        }
+        FutexWait(&Display->Hot->PageFlipPending, PAGE_FLIP_PENDING_WAITERS, -1);
+        State = atomic_load_explicit(&Display->Hot->PageFlipPending,
+            memory_order_acquire);
     }
-    Display->PageFlipPending = true;
 }
 
 void EGLSwapDisplay(egl_display* Display) {
 
     NEWTIME(eglSwapBuffers);
-    eglSwapBuffers(Display->DisplayDevice, Display->Surface);
+    EGLSwapFrame(Display);
     ENDTIME(eglSwapBuffers);
 
     NEWTIME(StreamAcquire);
-    EGLStreamAcquire(Display);
+    EGLAcquireProduced(Display);
     ENDTIME(StreamAcquire);
 
 
 }
 
+/*
+ * Connect a new EGLStream to the display's EGLOutputLayer,
+ * with a new EGLSurface producing into it.
+ */
+static bool CreateLayerStream(egl_display* Display) {
+    EGLDisplay eglDpy = Display->DisplayDevice;
+    EGLOutputLayerEXT eglLayer = Display->Layer;
+
+    EGLAttrib streamAttribs[] = {
+        EGL_STREAM_FIFO_LENGTH_KHR, 0,
+        EGL_CONSUMER_AUTO_ACQUIRE_EXT, EGL_FALSE,
+        EGL_CONSUMER_ACQUIRE_TIMEOUT_USEC_KHR, ACQUIRE_TIMEOUT_USEC,
+        EGL_NONE,
+    };
+
+    EGLint surfaceAttribs[] = {
+        EGL_WIDTH,  Display->Width,
+        EGL_HEIGHT, Display->Height,
+        EGL_NONE
+    };
+
+    /* Create an EGLStream. */
+    EGLStreamKHR eglStream = pEglCreateStreamAttribNV(eglDpy, streamAttribs);
+
+    if (eglStream == EGL_NO_STREAM_KHR) {
+        LOG(LOG_ERROR, "Unable to create stream: %s\n",
+            EGLErrorString(eglGetError()));
+        return false;
+    }
+
+    /* Set the EGLOutputLayer as the consumer of the EGLStream. */
+
+    EGLBoolean ret = pEglStreamConsumerOutputEXT(eglDpy, eglStream, eglLayer);
+
+    if (!ret) {
+        LOG(LOG_ERROR, "Unable to create EGLOutput stream consumer: %s\n",
+            EGLErrorString(eglGetError()));
+        pEglDestroyStreamKHR(eglDpy, eglStream);
+        return false;
+    }
+
+    /*
+     * EGL_KHR_stream defines that normally stream consumers need to
+     * explicitly retrieve frames from the stream.  That may be useful
+     * when we attempt to better integrate
+     * EGL_EXT_stream_consumer_egloutput with DRM atomic KMS requests.
+     * But, EGL_EXT_stream_consumer_egloutput defines that by default:
+     *
+     *   On success, <layer> is bound to <stream>, <stream> is placed
+     *   in the EGL_STREAM_STATE_CONNECTING_KHR state, and EGL_TRUE is
+     *   returned.  Initially, no changes occur to the image displayed
+     *   on <layer>. When the <stream> enters state
+     *   EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR, <layer> will begin
+     *   displaying frames, without further action required on the
+     *   application's part, as they become available, taking into
+     *   account any timestamps, swap intervals, or other limitations
+     *   imposed by the stream or producer attributes.
+     *
+     * So, eglSwapBuffers() (to produce new frames) is sufficient for
+     * the frames to be displayed.  That behavior can be altered with
+     * the EGL_EXT_stream_acquire_mode extension.
+     */
+
+    /*
+     * Create an EGLSurface as the producer of the EGLStream.  Once
+     * the stream's producer and consumer are defined, the stream is
+     * ready to use.  eglSwapBuffers() calls for the EGLSurface will
+     * deliver to the stream's consumer, i.e., the DRM KMS plane
+     * corresponding to the EGLOutputLayer.
+     */
+
+    EGLSurface eglSurface = pEglCreateStreamProducerSurfaceKHR(eglDpy, Display->Config,
+                                                    eglStream, surfaceAttribs);
+    if (eglSurface == EGL_NO_SURFACE) {
+        LOG(LOG_ERROR, "Unable to create EGLSurface stream producer: %s\n",
+            EGLErrorString(eglGetError()));
+        pEglDestroyStreamKHR(eglDpy, eglStream);
+        return false;
+    }
+
+    Display->Hot->Surface = eglSurface;
+    // Release, so threads that see the stream see it connected
+    atomic_store_explicit(&Display->Hot->Stream, eglStream, memory_order_release);
+    return true;
+}
+
+bool EGLRecreateStream(egl_display* Display) {
+    EGLDisplay eglDpy = Display->DisplayDevice;
+
+    // Keep the context (and its state) current, but let go of the
+    // surface so it can be destroyed.
+    EGLContext Context = eglGetCurrentContext();
+    if (Context != EGL_NO_CONTEXT) {
+        eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, Context);
+    }
+
+    // Turn away new users of the stream, then wait out the consumer or
+    // watchdog calls already made on it. Frames produced into the old
+    // stream are gone with it; the consumer finds that out from its
+    // next acquire (ACQUIRE_NO_FRAME), so its counts aren't touched here.
+    _Atomic uint32_t* Users = &Display->Hot->StreamUsers;
+    uint32_t Pinned = atomic_fetch_or_explicit(Users, STREAM_RECREATING,
+        memory_order_acquire) | STREAM_RECREATING;
+    while (Pinned != STREAM_RECREATING) {
+        FutexWait(Users, Pinned, -1);
+        Pinned = atomic_load_explicit(Users, memory_order_acquire);
+    }
+
+    eglDestroySurface(eglDpy, Display->Hot->Surface);
+    pEglDestroyStreamKHR(eglDpy, atomic_load_explicit(&Display->Hot->Stream,
+        memory_order_relaxed));
+    Display->Hot->Surface = EGL_NO_SURFACE;
+    atomic_store_explicit(&Display->Hot->Stream, EGL_NO_STREAM_KHR,
+        memory_order_relaxed);
+    EGLClearPageFlipPending(Display);
+
+    bool Created = CreateLayerStream(Display);
+    atomic_fetch_and_explicit(Users, ~STREAM_RECREATING, memory_order_release);
+    if (!Created) {
+        return false;
+    }
+
+    if (Context != EGL_NO_CONTEXT) {
+        eglMakeCurrent(eglDpy, Display->Hot->Surface, Display->Hot->Surface, Context);
+    }
+    LOG(LOG_WARN, "%20s recreated its EGLStream and surface\n",
+        Display->MonitorName);
+    return true;
+}
+
+egl_display* CreateDisplays(kms_plane* Planes, int NumPlanes)
+{
+    egl_display* Displays = calloc(NumPlanes, sizeof(egl_display));
+    egl_display_hot* DisplaysHot = aligned_alloc(CACHE_LINE_SIZE,
+        sizeof(egl_display_hot) * NumPlanes);
+    memset(DisplaysHot, 0, sizeof(egl_display_hot) * NumPlanes);
+    egl_consumer_signal* ConsumerSignal = aligned_alloc(CACHE_LINE_SIZE,
+        sizeof(egl_consumer_signal));
+    atomic_init(&ConsumerSignal->Events, 0);
+    atomic_init(&ConsumerSignal->Waiting, 0);
+    int WallX = 0;
+    for (int PlaneIndex = 0; PlaneIndex < NumPlanes; PlaneIndex++) {
+        kms_plane* Plane = &Planes[PlaneIndex];
+
+        Displays[PlaneIndex].EDID            = Plane->EDID;
+        Displays[PlaneIndex].Width           = Plane->Width;
+        Displays[PlaneIndex].Height          = Plane->Height;
+        Displays[PlaneIndex].X               = WallX;
+        Displays[PlaneIndex].Y               = 0;
+        Displays[PlaneIndex].MonitorName     = strdup(Plane->EDID->MonitorName);
+        Displays[PlaneIndex].SerialNumber    = strdup(Plane->EDID->SerialNumber);
+        Displays[PlaneIndex].Hot             = &DisplaysHot[PlaneIndex];
+        Displays[PlaneIndex].Index           = PlaneIndex;
+        Displays[PlaneIndex].CrtcID          = Plane->CrtcID;
+        Displays[PlaneIndex].Plane           = Plane;
+        Displays[PlaneIndex].Damage          = CreateDisplayDamage(Plane->Width,
+                                                                   Plane->Height);
+        Displays[PlaneIndex].ConsumerSignal  = ConsumerSignal;
+        atomic_init(&DisplaysHot[PlaneIndex].PageFlipPending, 0);
+        atomic_init(&DisplaysHot[PlaneIndex].LastPageFlip, 0);
+        atomic_init(&DisplaysHot[PlaneIndex].Stream, EGL_NO_STREAM_KHR);
+        atomic_init(&DisplaysHot[PlaneIndex].StreamUsers, 0);
+        DisplaysHot[PlaneIndex].Surface = EGL_NO_SURFACE;
+
+        WallX += Plane->Width;
+    }
+
+    return Displays;
+}
+
 /*
  * Set up EGL to present to a DRM KMS plane through an EGLStream.
  */
@@ -486,7 +1004,7 @@ egl_display* SetupEGLDisplays(
 
     EGLBoolean ret;
 
-    egl_display* Displays = malloc(sizeof(egl_display) * NumPlanes);
+    egl_display* Displays = CreateDisplays(Planes, NumPlanes);
     for (int PlaneIndex = 0; PlaneIndex < NumPlanes; PlaneIndex++) {
         kms_plane* Plane = &Planes[PlaneIndex];
 
@@ -497,19 +1015,6 @@ egl_display* SetupEGLDisplays(
         };
         printf("Setting up plane ID: %i\n", Plane->PlaneID);
 
-        EGLAttrib streamAttribs[] = {
-            EGL_STREAM_FIFO_LENGTH_KHR, 0,
-            EGL_CONSUMER_AUTO_ACQUIRE_EXT, EGL_FALSE,
-            EGL_CONSUMER_ACQUIRE_TIMEOUT_USEC_KHR, 0,
-            EGL_NONE,
-        };
-
-        EGLint surfaceAttribs[] = {
-            EGL_WIDTH,  Plane->Width,
-            EGL_HEIGHT, Plane->Height,
-            EGL_NONE
-        };
-
         /* Find the EGLOutputLayer that corresponds to the DRM KMS plane. */
         EGLOutputLayerEXT eglLayer;
         EGLint n = 0;
@@ -526,74 +1031,16 @@ egl_display* SetupEGLDisplays(
             Fatal("Unable to set EGLOutputLayer's swap interval\n");
         }
 
-        /* Create an EGLStream. */
-        EGLStreamKHR eglStream = pEglCreateStreamAttribNV(eglDpy, streamAttribs);
-
-        if (eglStream == EGL_NO_STREAM_KHR) {
-            EGLCheck("eglCreateStreamAttribNV");
-            Fatal("Unable to create stream.\n");
-        }
-
-        /* Set the EGLOutputLayer as the consumer of the EGLStream. */
-
-        ret = pEglStreamConsumerOutputEXT(eglDpy, eglStream, eglLayer);
-
-        if (!ret) {
-            Fatal("Unable to create EGLOutput stream consumer.\n");
-        }
-
-        /*
-         * EGL_KHR_stream defines that normally stream consumers need to
-         * explicitly retrieve frames from the stream.  That may be useful
-         * when we attempt to better integrate
-         * EGL_EXT_stream_consumer_egloutput with DRM atomic KMS requests.
-         * But, EGL_EXT_stream_consumer_egloutput defines that by default:
-         *
-         *   On success, <layer> is bound to <stream>, <stream> is placed
-         *   in the EGL_STREAM_STATE_CONNECTING_KHR state, and EGL_TRUE is
-         *   returned.  Initially, no changes occur to the image displayed
-         *   on <layer>. When the <stream> enters state
-         *   EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR, <layer> will begin
-         *   displaying frames, without further action required on the
-         *   application's part, as they become available, taking into
-         *   account any timestamps, swap intervals, or other limitations
-         *   imposed by the stream or producer attributes.
-         *
-         * So, eglSwapBuffers() (to produce new frames) is sufficient for
-         * the frames to be displayed.  That behavior can be altered with
-         * the EGL_EXT_stream_acquire_mode extension.
-         */
-
-        /*
-         * Create an EGLSurface as the producer of the EGLStream.  Once
-         * the stream's producer and consumer are defined, the stream is
-         * ready to use.  eglSwapBuffers() calls for the EGLSurface will
-         * deliver to the stream's consumer, i.e., the DRM KMS plane
-         * corresponding to the EGLOutputLayer.
-         */
-
-        EGLSurface eglSurface = pEglCreateStreamProducerSurfaceKHR(eglDpy, eglConfig,
-                                                        eglStream, surfaceAttribs);
-        if (eglSurface == EGL_NO_SURFACE) {
-            Fatal("Unable to create EGLSurface stream producer.\n");
-        }
-
-        /*
-         * Make current to the EGLSurface, so that OpenGL rendering is
-         * directed to it.
-         */
-        Displays[PlaneIndex].EDID            = Plane->EDID;
-        Displays[PlaneIndex].Width           = Plane->Width;
-        Displays[PlaneIndex].Height          = Plane->Height;
-        Displays[PlaneIndex].MonitorName     = strdup(Plane->EDID->MonitorName);
-        Displays[PlaneIndex].SerialNumber    = strdup(Plane->EDID->SerialNumber);
         Displays[PlaneIndex].DisplayDevice   = eglDpy;
-        Displays[PlaneIndex].Surface         = eglSurface;
         Displays[PlaneIndex].Context         = eglContext;
         Displays[PlaneIndex].Config          = eglConfig;
-        Displays[PlaneIndex].Stream          = eglStream;
         Displays[PlaneIndex].Layer           = eglLayer;
-        Displays[PlaneIndex].PageFlipPending = false;
+
+        if (!CreateLayerStream(&Displays[PlaneIndex])) {
+            Fatal("Unable to create the EGLStream for plane 0x%08x\n",
+                Plane->PlaneID);
+        }
+        Displays[PlaneIndex].Hot->StreamState = EGL_STREAM_STATE_CONNECTING_KHR;
     }
 
 
@@ -612,32 +1059,130 @@ void InitGLEW() {
     }
 }
 
-// static void VBlankEventHandler(int fd, unsigned int frame,
-//                     unsigned int sec, unsigned int usec,
-//                     void *data) {
-//     printf("VBLANK\n");
-// }
+typedef struct {
+    egl_display*    Display;
+    vblank_callback Callback;
+    void*           UserData;
+} vblank_request;
 
-static void PageFlipEventHandler(int fd, unsigned int frame,
-                    unsigned int sec, unsigned int usec,
-                    void *data)
+static void SequenceEventHandler(int fd, uint64_t sequence,
+                    uint64_t ns, uint64_t user_data)
 {
-    egl_display* Display = (egl_display*)data;
-    (void)fd; (void)frame; (void)sec; (void)usec; (void)data;
-    Display->PageFlipPending = false;
+    vblank_request* Request = (vblank_request*)(uintptr_t)user_data;
+    (void)fd;
+    Request->Callback(Request->Display, sequence, ns, Request->UserData);
+    free(Request);
+}
+
+bool EGLGetVBlank(egl_state* EGL, egl_display* Display,
+    uint64_t* Sequence, uint64_t* TimeNS) {
+    return drmCrtcGetSequence(EGL->DRMFD, Display->CrtcID, Sequence, TimeNS) == 0;
+}
+
+static bool QueueVBlank(egl_state* EGL, egl_display* Display,
+    uint32_t Flags, uint64_t Sequence,
+    vblank_callback Callback, void* UserData, uint64_t* Queued) {
+
+    vblank_request* Request = malloc(sizeof(vblank_request));
+    Request->Display  = Display;
+    Request->Callback = Callback;
+    Request->UserData = UserData;
+
+    uint64_t QueuedSequence = 0;
+    int ret = drmCrtcQueueSequence(EGL->DRMFD, Display->CrtcID,
+        Flags, Sequence, &QueuedSequence, (uint64_t)(uintptr_t)Request);
+    if (ret != 0) {
+        LOG(LOG_WARN, "%20s: couldn't queue vblank event: %s\n",
+            Display->MonitorName, strerror(errno));
+        free(Request);
+        return false;
+    }
+    if (Queued) {
+        *Queued = QueuedSequence;
+    }
+    return true;
+}
+
+bool EGLQueueVBlank(egl_state* EGL, egl_display* Display, uint64_t Delta,
+    vblank_callback Callback, void* UserData, uint64_t* Queued) {
+    return QueueVBlank(EGL, Display, DRM_CRTC_SEQUENCE_RELATIVE, Delta,
+        Callback, UserData, Queued);
+}
+
+bool EGLQueueVBlankAt(egl_state* EGL, egl_display* Display, uint64_t Sequence,
+    vblank_callback Callback, void* UserData, uint64_t* Queued) {
+    return QueueVBlank(EGL, Display, DRM_CRTC_SEQUENCE_NEXT_ON_MISS, Sequence,
+        Callback, UserData, Queued);
+}
+
+void EGLPageFlipCompleted(egl_display* Display, uint64_t TimeNS) {
+    // Fault injection: lose the event, as a driver bug would
+    uint32_t Drops = atomic_load_explicit(&Display->Hot->InjectDroppedFlips,
+        memory_order_relaxed);
+    if (Drops > 0) {
+        atomic_store_explicit(&Display->Hot->InjectDroppedFlips, Drops - 1,
+            memory_order_relaxed);
+        return;
+    }
 
     float Now = GetTime();
-    if (Display->LastPageFlip > 0) {
-        printf("%20s page flip interval: %.2fms\n",
+    float LastPageFlip = atomic_load_explicit(&Display->Hot->LastPageFlip,
+        memory_order_relaxed);
+    if (LastPageFlip > 0) {
+        LOG(LOG_INFO, "%20s page flip interval: %.2fms\n",
             Display->EDID->MonitorName,
-            (Now - Display->LastPageFlip) * 1000);
+            (Now - LastPageFlip) * 1000);
+    }
+    atomic_store_explicit(&Display->Hot->LastPageFlip, Now, memory_order_relaxed);
+
+    uint64_t Flips = atomic_load_explicit(&Display->Hot->Flips, memory_order_relaxed);
+    atomic_store_explicit(&Display->Hot->FlipTimeNS[Flips % FLIP_HISTORY],
+        TimeNS, memory_order_relaxed);
+    atomic_store_explicit(&Display->Hot->Flips, Flips + 1, memory_order_release);
+
+    // Only makes the futex syscall if a thread is blocked on the flip
+    EGLClearPageFlipPending(Display);
+}
+
+// Tags the low bit of an (aligned) egl_display pointer passed as
+// flip event data, see EGLOverlayCommitData
+#define FLIP_DATA_OVERLAY 1
+
+void* EGLOverlayCommitData(egl_display* Display) {
+    return (void*)((uintptr_t)Display | FLIP_DATA_OVERLAY);
+}
+
+static void PageFlipEventHandler(int fd, unsigned int frame,
+                    unsigned int sec, unsigned int usec,
+                    void *data)
+{
+    (void)fd; (void)frame;
+    uintptr_t Data = (uintptr_t)data;
+    egl_display* Display = (egl_display*)(Data & ~(uintptr_t)FLIP_DATA_OVERLAY);
+    if (Data & FLIP_DATA_OVERLAY) {
+        EGLClearPageFlipPending(Display);
+        return;
     }
+    EGLPageFlipCompleted(Display, sec * 1000000000ULL + usec * 1000ULL);
+}
 
-    Display->LastPageFlip = Now;
+void EGLInitDRMEvents(egl_state* EGL) {
+    // Create a drmEventContext configured to
+    // call our PageFlipEventHandler function
+    // when a page flip occurs, and SequenceEventHandler
+    // for vblanks queued with EGLQueueVBlank
+    EGL->DRMEventContext.page_flip_handler = PageFlipEventHandler;
+    EGL->DRMEventContext.sequence_handler  = SequenceEventHandler;
+    EGL->DRMEventContext.version           = 4;
 }
 
 egl_state* SetupEGL() {
+    return SetupEGLWithOptions((egl_options){ 0 });
+}
+
+egl_state* SetupEGLWithOptions(egl_options Options) {
     egl_state* EGL = calloc(1, sizeof(egl_state));
+    EGL->Options = Options;
 
     // Setup global EGL state
     GetEglExtensionFunctionPointers();
@@ -648,6 +1193,12 @@ egl_state* SetupEGL() {
     // Set up EGL state for each connected display
     kms_plane* Planes = SetDisplayModes(drmFd, &EGL->DisplaysCount);
 
+    // Color correction at scanout (see color.h)
+    const char* ColorProfilesPath = getenv("COLOR_PROFILES");
+    if (ColorProfilesPath) {
+        ApplyColorProfilesFile(ColorProfilesPath, drmFd, Planes, EGL->DisplaysCount);
+    }
+
     EGL->DRMFD         = drmFd;
     EGL->DisplayDevice = GetEglDisplay(EGL->Device, drmFd);
     EGL->Config        = GetEglConfig(EGL->DisplayDevice);
@@ -657,8 +1208,15 @@ egl_state* SetupEGL() {
     EGL->Displays     = SetupEGLDisplays(EGL->DisplayDevice,
         EGL->Config, EGL->RootContext, Planes, EGL->DisplaysCount);
 
+    if (Options.ContextPerDisplay) {
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            EGL->Displays[DisplayIndex].Context = GetSharedEglContext(
+                EGL->DisplayDevice, EGL->Config, EGL->RootContext);
+        }
+    }
+
     EGLBoolean ret = eglMakeCurrent(EGL->DisplayDevice,
-        EGL->Displays->Surface, EGL->Displays->Surface,
+        EGL->Displays->Hot->Surface, EGL->Displays->Hot->Surface,
         EGL->RootContext);
     if (!ret) Fatal("Couldn't make main context current\n");
 
@@ -669,17 +1227,21 @@ egl_state* SetupEGL() {
     for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
         egl_display* Display = &EGL->Displays[DisplayIndex];
         eglMakeCurrent(Display->DisplayDevice,
-            Display->Surface, Display->Surface,
+            Display->Hot->Surface, Display->Hot->Surface,
             Display->Context);
         eglSwapInterval(Display->DisplayDevice, 0);
     }
 
-    // Create a drmEventContext configured to
-    // call our PageFlipEventHandler function
-    // when a page flip occurs
-    EGL->DRMEventContext.page_flip_handler = PageFlipEventHandler;
-    // EGL->DRMEventContext.vblank_handler    = VBlankEventHandler;
-    EGL->DRMEventContext.version           = 2;
+    EGLInitDRMEvents(EGL);
+
+    // Each display's context will be made current on its own render
+    // thread, and a surface may only be current on one thread at a time,
+    // so release the display surfaces from this thread.
+    if (Options.ContextPerDisplay) {
+        eglMakeCurrent(EGL->DisplayDevice,
+            EGL_NO_SURFACE, EGL_NO_SURFACE,
+            EGL_NO_CONTEXT);
+    }
 
     return EGL;
 }
@@ -719,54 +1281,48 @@ const char* EGLStreamStateToString(EGLint StreamState) {
     return "Unrecognized EGL Stream State";
 }
 
+const char* EGLErrorString(EGLint Error) {
+    switch (Error) {
+        case EGL_NOT_INITIALIZED:
+            return "EGL is not initialized, or could not be initialized, for the specified EGL display connection.";
+        case EGL_BAD_ACCESS:
+            return "EGL cannot access a requested resource (for example a context is bound in another thread).";
+        case EGL_BAD_ALLOC:
+            return "EGL failed to allocate resources for the requested operation.";
+        case EGL_BAD_ATTRIBUTE:
+            return "An unrecognized attribute or attribute value was passed in the attribute list.";
+        case EGL_BAD_CONTEXT:
+            return "An EGLContext argument does not name a valid EGL rendering context.";
+        case EGL_BAD_CONFIG:
+            return "An EGLConfig argument does not name a valid EGL frame buffer configuration.";
+        case EGL_BAD_CURRENT_SURFACE:
+            return "The current surface of the calling thread is a window, pixel buffer or pixmap that is no longer valid.";
+        case EGL_BAD_DISPLAY:
+            return "An EGLDisplay argument does not name a valid EGL display connection.";
+        case EGL_BAD_SURFACE:
+            return "An EGLSurface argument does not name a valid surface (window, pixel buffer or pixmap) configured for GL rendering.";
+        case EGL_BAD_MATCH:
+            return "Arguments are inconsistent (for example, a valid context requires buffers not supplied by a valid surface).";
+        case EGL_BAD_PARAMETER:
+            return "One or more argument values are invalid.";
+        case EGL_BAD_NATIVE_PIXMAP:
+            return "A NativePixmapType argument does not refer to a valid native pixmap.";
+        case EGL_BAD_NATIVE_WINDOW:
+            return "A NativeWindowType argument does not refer to a valid native window.";
+        case EGL_CONTEXT_LOST:
+            return "A power management event has occurred. The application must destroy all contexts and reinitialise OpenGL ES state and objects to continue rendering.";
+        case EGL_RESOURCE_BUSY_EXT:
+            return "A resource is busy (for example a page flip is still pending).";
+        case EGL_BAD_STATE_KHR:
+            return "The EGLStream is in the wrong state for the operation.";
+    }
+    return "Unrecognized EGL error";
+}
+
 void EGLCheck(const char* name) {
     EGLint err = eglGetError();
     if (err != EGL_SUCCESS) {
-        printf("%s: ", name);
-        switch (err) {
-            case EGL_NOT_INITIALIZED:
-                printf("EGL is not initialized, or could not be initialized, for the specified EGL display connection.\n");
-                break;
-            case EGL_BAD_ACCESS:
-                printf("EGL cannot access a requested resource (for example a context is bound in another thread).\n");
-                break;
-            case EGL_BAD_ALLOC:
-                printf("EGL failed to allocate resources for the requested operation.\n");
-                break;
-            case EGL_BAD_ATTRIBUTE:
-                printf("An unrecognized attribute or attribute value was passed in the attribute list.\n");
-                break;
-            case EGL_BAD_CONTEXT:
-                printf("An EGLContext argument does not name a valid EGL rendering context.\n");
-                break;
-            case EGL_BAD_CONFIG:
-                printf("An EGLConfig argument does not name a valid EGL frame buffer configuration.\n");
-                break;
-            case EGL_BAD_CURRENT_SURFACE:
-                printf("The current surface of the calling thread is a window, pixel buffer or pixmap that is no longer valid.\n");
-                break;
-            case EGL_BAD_DISPLAY:
-                printf("An EGLDisplay argument does not name a valid EGL display connection.\n");
-                break;
-            case EGL_BAD_SURFACE:
-                printf("An EGLSurface argument does not name a valid surface (window, pixel buffer or pixmap) configured for GL rendering.\n");
-                break;
-            case EGL_BAD_MATCH:
-                printf("Arguments are inconsistent (for example, a valid context requires buffers not supplied by a valid surface).\n");
-                break;
-            case EGL_BAD_PARAMETER:
-                printf("One or more argument values are invalid.\n");
-                break;
-            case EGL_BAD_NATIVE_PIXMAP:
-                printf("A NativePixmapType argument does not refer to a valid native pixmap.\n");
-                break;
-            case EGL_BAD_NATIVE_WINDOW:
-                printf("A NativeWindowType argument does not refer to a valid native window.\n");
-                break;
-            case EGL_CONTEXT_LOST:
-                printf("A power management event has occurred. The application must destroy all contexts and reinitialise OpenGL ES state and objects to continue rendering.\n");
-                break;
-        }
+        printf("%s: %s\n", name, EGLErrorString(err));
         exit(1);
     }
 }
@@ -24,28 +24,132 @@
 #define EGL_H
 
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
+#include "events.h"
+#include "frame.h"
 #include "kms.h"
+#include "utils.h"
 #include <xf86drm.h>
 
+#define FLIP_HISTORY 8
+
+// Defined in damage.h
+typedef struct display_damage display_damage;
+
+// Per-frame display state, touched by the render, acquire and event
+// threads every frame. Each display's block gets its own cache line(s)
+// so threads driving different displays don't false-share.
+typedef struct {
+    // Written by the thread dispatching DRM events and read by
+    // render/acquire threads, so these are atomics.
+    // PageFlipPending is also a futex word (see EGLWaitForPageFlip):
+    // 0 when idle, PAGE_FLIP_PENDING after an acquire,
+    // PAGE_FLIP_PENDING_WAITERS once a thread blocks on it.
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t PageFlipPending;
+    _Atomic float LastPageFlip;
+    // When PageFlipPending was last set (CLOCK_MONOTONIC)
+    _Atomic uint64_t AcquireTimeNS;
+    // Set by the watchdog (see watchdog.h) for the rendering thread
+    _Atomic uint32_t RecreateStreamRequested;
+    // Fault injection: page flip events to drop before handling them
+    _Atomic uint32_t InjectDroppedFlips;
+    // Timestamps (CLOCK_MONOTONIC) of the last FLIP_HISTORY flips,
+    // indexed by flip number, so frames can be matched to their flip.
+    // Flips is incremented after the timestamp is written.
+    _Atomic uint64_t Flips;
+    _Atomic uint64_t FlipTimeNS[FLIP_HISTORY];
+
+    // Written by the producer (rendering) thread once per frame and read
+    // by the consumer (acquiring) thread, so the consumer knows a new
+    // frame is in the stream without asking EGL (see EGLSwapFrame).
+    // FramesProduced is also a futex word for EGLWaitFrameProduced.
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t FramesProduced;
+    _Atomic uint32_t ConsumerWaiting;
+    // Stream and driver calls made for the display, for reporting
+    _Atomic uint64_t EGLCalls;
+    // Acquires that failed with a retryable error
+    _Atomic uint64_t AcquireBusy;
+    _Atomic uint64_t AcquireTimeouts;
+    // The display's EGLStream, replaced by EGLRecreateStream while the
+    // consumer and the watchdog may be using it. Only use it between
+    // BeginStreamUse and EndStreamUse (see egl.c): StreamUsers counts
+    // the threads doing so, plus STREAM_RECREATING while it's replaced.
+    // StreamUsers is also a futex word, for the recreating thread.
+    _Atomic(EGLStreamKHR) Stream;
+    _Atomic uint32_t StreamUsers;
+    // Only touched by the consumer
+    uint32_t FramesConsumed;
+    uint32_t AcquireRetries; // Retryable failures in a row
+    EGLint   StreamState; // Last known, refreshed only on mismatch
+
+    // Only touched by the thread rendering the display
+    _Alignas(CACHE_LINE_SIZE) EGLSurface Surface;
+    frame_timing Timing;
+} egl_display_hot;
+
+#define PAGE_FLIP_PENDING         1
+#define PAGE_FLIP_PENDING_WAITERS 2
+
+#define STREAM_RECREATING 0x80000000u
+
+// Shared by all displays, so a single consumer thread can block until
+// any display has a frame to acquire (see EGLWaitConsumerEvents).
+typedef struct {
+    // Bumped for every frame produced and flip completed; a futex word
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t Events;
+    _Atomic uint32_t Waiting;
+} egl_consumer_signal;
+
+// How long an acquire may wait for the producer's frame to land in the
+// stream (EGL_CONSUMER_ACQUIRE_TIMEOUT_USEC_KHR), and after how many
+// retryable failures in a row a display's acquires are logged as stuck.
+#define ACQUIRE_TIMEOUT_USEC 1000
+#define ACQUIRE_WARN_RETRIES 8
+
+typedef enum {
+    ACQUIRE_OK,
+    ACQUIRE_NO_FRAME, // Nothing new in the stream
+    ACQUIRE_BUSY,     // EGL_RESOURCE_BUSY_EXT, the last flip is pending
+    ACQUIRE_TIMEOUT,  // The stream's acquire timeout expired
+    ACQUIRE_FATAL,
+} acquire_status;
+
+// Display descriptor: set up once and then only read.
 typedef struct {
+    egl_display_hot* Hot;
+    int Index;
+    uint32_t CrtcID;
+    kms_plane* Plane;
+    display_damage* Damage;
+    egl_consumer_signal* ConsumerSignal;
     drm_edid* EDID;
     int Width;
     int Height;
+    // Position of the display within the wall of all displays,
+    // which are laid out left to right (see span.h)
+    int X;
+    int Y;
     char* MonitorName;
     char* SerialNumber;
-    EGLSurface Surface;
     EGLContext Context;
     EGLDisplay DisplayDevice;
     EGLConfig Config;
-    EGLStreamKHR Stream;
     EGLOutputLayerEXT Layer;
-    bool PageFlipPending;
-    float LastPageFlip;
 } egl_display;
 
 typedef struct {
+    // Give each display its own EGLContext (sharing objects with
+    // RootContext) instead of sharing RootContext between all of them,
+    // so each display can be rendered from its own thread.
+    // See threads.h.
+    bool ContextPerDisplay;
+} egl_options;
+
+typedef struct {
+    egl_options     Options;
     egl_display*    Displays;
     int             DisplaysCount;
     EGLContext      RootContext;
@@ -60,6 +164,7 @@ typedef struct {
 
 // One call to do all of the below
 egl_state* SetupEGL();
+egl_state* SetupEGLWithOptions(egl_options Options);
 
 // Components of SetupEGL
 
@@ -82,6 +187,20 @@ EGLConfig GetEglConfig(EGLDisplay eglDpy);
 // Creates a root OpenGL context.
 EGLContext GetEglContext(EGLDisplay eglDpy, EGLConfig eglConfig);
 
+// Creates an OpenGL context sharing objects (textures, buffers...)
+// with ShareContext.
+EGLContext GetSharedEglContext(EGLDisplay eglDpy, EGLConfig eglConfig,
+    EGLContext ShareContext);
+
+// Makes RootContext current without a surface, for creating shared
+// resources when each display has its own context.
+// Requires EGL_KHR_surfaceless_context.
+void EGLMakeRootCurrent(egl_state* EGL);
+
+// Creates a display for each kms_plane passed in, with everything
+// but its EGL objects, for backends presenting without EGL (see soft.h).
+egl_display* CreateDisplays(kms_plane* Planes, int NumPlanes);
+
 // Creates a display for each kms_plane passed in.
 egl_display* SetupEGLDisplays(
     EGLDisplay eglDpy,
@@ -92,13 +211,143 @@ egl_display* SetupEGLDisplays(
 
 void InitGLEW();
 
+// Checks for a whole extension name in a space separated list.
+EGLBoolean ExtensionIsSupported(const char* extensionString,
+    const char* extension);
+
 void PrintDisplayLayerSwapInterval();
 void GetEglExtensionFunctionPointers(void);
+// Exits with a description of the EGL error, if there is one.
 void EGLCheck(const char* name);
+const char* EGLErrorString(EGLint Error);
 EGLint EGLQueryStreamState(EGLDisplay eglDpy, EGLStreamKHR eglStream);
 const char* EGLStreamStateToString(EGLint streamState);
-void EGLStreamAcquire(egl_display* Display);
+// Acquires the stream's newest frame for flipping. BUSY and TIMEOUT
+// are counted per display and returned at once, without waiting, for
+// the caller to retry on its next iteration. Never exits; the caller
+// decides what to do with a failure.
+acquire_status EGLStreamAcquire(egl_display* Display);
+
+// Producer side: swaps the display's surface, then tells the consumer
+// a new frame is in the stream.
+void EGLSwapFrame(egl_display* Display);
+
+// Like EGLSwapFrame, passing the changed parts of the frame as
+// Count x/y/width/height rects (bottom left origin) to
+// eglSwapBuffersWithDamage where supported.
+void EGLSwapFrameWithDamage(egl_display* Display, EGLint* Rects, int Count);
+
+// Consumer side: acquires the newest frame if one was produced since
+// the last acquire, without querying the stream.
+// Only one thread may consume each display.
+// Returns true if a frame was acquired. A frame that couldn't be
+// acquired for a retryable reason is tried again on the next call;
+// only ACQUIRE_FATAL exits.
+bool EGLAcquireProduced(egl_display* Display);
+
+// Consumer side: blocks up to TimeoutMS until a frame was produced
+// since the last acquire. On timeout, asks the stream directly in case
+// a producer swapped without EGLSwapFrame.
+bool EGLWaitFrameProduced(egl_display* Display, int TimeoutMS);
+
+// Consumer side, for one thread consuming every display: true if a
+// frame was produced since the display's last acquire.
+bool EGLFrameUnconsumed(egl_display* Display);
+
+// Consumer side, for one thread consuming every display: a count of
+// the frames produced and flips completed on any display so far. Take
+// it before looking at the displays, then pass it to
+// EGLWaitConsumerEvents, which blocks up to TimeoutMS until the count
+// moves on, so nothing that happened in between is missed.
+uint32_t EGLConsumerEvents(egl_state* EGL);
+void EGLWaitConsumerEvents(egl_state* EGL, uint32_t Seen, int TimeoutMS);
+
+// Points EGL->DRMEventContext at the handlers that record page flips
+// on the display passed as the event's user data, and dispatch
+// EGLQueueVBlank callbacks. Done by SetupEGL.
+void EGLInitDRMEvents(egl_state* EGL);
+
 void EGLUpdateVSync(egl_state* EGL);
+// Like EGLUpdateVSync, but blocks up to TimeoutMS for an event to arrive.
+void EGLWaitVSync(egl_state* EGL, int TimeoutMS);
+// Called from DRM event dispatch when a queued vblank arrives.
+// TimeNS is the vblank's CLOCK_MONOTONIC timestamp.
+typedef void (*vblank_callback)(egl_display* Display,
+    uint64_t Sequence, uint64_t TimeNS, void* UserData);
+
+// Gets the display's current vblank sequence number and its time.
+bool EGLGetVBlank(egl_state* EGL, egl_display* Display,
+    uint64_t* Sequence, uint64_t* TimeNS);
+
+// Calls Callback at vblank "current + Delta" of the display's CRTC,
+// delivered through the same DRM event dispatch as page flips.
+// Returns false if it couldn't be queued; otherwise sets Queued (if
+// not NULL) to the absolute sequence number queued. Any number,
+// including 0, is a valid sequence.
+bool EGLQueueVBlank(egl_state* EGL, egl_display* Display, uint64_t Delta,
+    vblank_callback Callback, void* UserData, uint64_t* Queued);
+
+// Like EGLQueueVBlank, but for an absolute sequence number.
+// If that vblank already passed, the callback fires at the next one.
+bool EGLQueueVBlankAt(egl_state* EGL, egl_display* Display, uint64_t Sequence,
+    vblank_callback Callback, void* UserData, uint64_t* Queued);
+
+// Dispatches DRM events from Loop as soon as they arrive,
+// instead of polling with EGLUpdateVSync.
+event_source* EGLAttachEventLoop(egl_state* EGL, event_loop* Loop);
 void EGLSwapDisplay(egl_display* Display);
 
+// True while the display's last acquired frame hasn't been flipped.
+static inline bool EGLPageFlipPending(egl_display* Display) {
+    return atomic_load_explicit(&Display->Hot->PageFlipPending,
+        memory_order_acquire) != 0;
+}
+
+// Marks the display's flip pending, as an acquire does, atomically
+// with checking it isn't already. Returns false, changing nothing, if
+// a flip is already pending; the caller must not flip then.
+bool EGLSetPageFlipPending(egl_display* Display);
+
+// Clears the display's pending flip as if it had landed,
+// waking threads blocked on it and signalling the consumer.
+void EGLClearPageFlipPending(egl_display* Display);
+// Clears a pending flip that never started (its acquire or commit
+// failed), waking threads blocked on it, without signalling the
+// consumer, as nothing landed.
+void EGLCancelPageFlipPending(egl_display* Display);
+
+// Records a page flip event for the display, as the DRM event handler
+// does, unless a dropped flip is being injected. TimeNS is the flip's
+// CLOCK_MONOTONIC timestamp.
+void EGLPageFlipCompleted(egl_display* Display, uint64_t TimeNS);
+
+// User data for a DRM_MODE_PAGE_FLIP_EVENT commit of other planes on
+// the display's CRTC (see overlay.h). Its event only clears the
+// display's pending flip, without counting as a flip of the display.
+void* EGLOverlayCommitData(egl_display* Display);
+
+// Destroys the display's EGLStream and surface and connects new ones
+// to its output layer. Call from the thread that renders the display,
+// with its context current or none at all; the context stays current
+// with the new surface. Waits for other threads to finish any stream
+// call already underway; until the new stream is published, they see
+// no stream (acquires fail as retryable, queries return 0).
+bool EGLRecreateStream(egl_display* Display);
+
+// Like EGLQueryStreamState, but returns 0 on error or with no stream,
+// rather than exiting. Safe from any thread.
+EGLint EGLQueryDisplayStreamState(egl_display* Display);
+
+// Frame hooks, see frame.h
+void BeginFrame(egl_display* Display);
+void EndFrame(egl_display* Display);
+// Frees the display's frame timing queries and fences, with the
+// context they were made in current, and starts its timing over, so
+// the display can be rendered from another context.
+void ResetFrameTiming(egl_display* Display);
+
+// Blocks until the display's pending page flip (if any) lands.
+// Another thread must be dispatching DRM events.
+void EGLWaitForPageFlip(egl_display* Display);
+
 #endif /* EGL_H */
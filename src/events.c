@@ -0,0 +1,187 @@
+#include "events.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "utils.h"
+
+// How many ready events are dispatched per epoll_wait
+#define MAX_EVENTS 32
+
+event_loop* CreateEventLoop() {
+    event_loop* Loop = calloc(1, sizeof(event_loop));
+    Loop->EpollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (Loop->EpollFD < 0) {
+        Fatal("Unable to create epoll instance.\n");
+    }
+    atomic_init(&Loop->Stop, false);
+    return Loop;
+}
+
+static event_source* AddSource(event_loop* Loop, event_source_kind Kind, int FD,
+    event_callback Callback, void* UserData) {
+
+    event_source* Source = calloc(1, sizeof(event_source));
+    Source->Loop     = Loop;
+    Source->Kind     = Kind;
+    Source->FD       = FD;
+    Source->Callback = Callback;
+    Source->UserData = UserData;
+
+    struct epoll_event Event = {
+        .events   = EPOLLIN,
+        .data.ptr = Source
+    };
+    if (epoll_ctl(Loop->EpollFD, EPOLL_CTL_ADD, FD, &Event) != 0) {
+        Fatal("Unable to add fd %i to event loop: %s\n", FD, strerror(errno));
+    }
+    return Source;
+}
+
+event_source* EventLoopAddFD(event_loop* Loop, int FD,
+    event_callback Callback, void* UserData) {
+    return AddSource(Loop, EVENT_SOURCE_FD, FD, Callback, UserData);
+}
+
+event_source* EventLoopAddTimer(event_loop* Loop,
+    event_callback Callback, void* UserData) {
+    int FD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (FD < 0) {
+        Fatal("Unable to create timerfd.\n");
+    }
+    return AddSource(Loop, EVENT_SOURCE_TIMER, FD, Callback, UserData);
+}
+
+static struct timespec NSToTimespec(uint64_t NS) {
+    return (struct timespec){
+        .tv_sec  = NS / 1000000000ULL,
+        .tv_nsec = NS % 1000000000ULL
+    };
+}
+
+void EventLoopArmTimer(event_source* Timer, uint64_t DeadlineNS, uint64_t IntervalNS) {
+    struct itimerspec Spec = {
+        .it_value    = NSToTimespec(DeadlineNS),
+        .it_interval = NSToTimespec(IntervalNS)
+    };
+    timerfd_settime(Timer->FD, TFD_TIMER_ABSTIME, &Spec, NULL);
+}
+
+event_source* EventLoopAddNotifier(event_loop* Loop,
+    event_callback Callback, void* UserData) {
+    int FD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (FD < 0) {
+        Fatal("Unable to create eventfd.\n");
+    }
+    return AddSource(Loop, EVENT_SOURCE_NOTIFIER, FD, Callback, UserData);
+}
+
+void EventLoopNotify(event_source* Notifier) {
+    uint64_t One = 1;
+    // Can only fail if the counter would overflow,
+    // in which case the loop has a wakeup pending anyway
+    ssize_t Written = write(Notifier->FD, &One, sizeof(One));
+    UNUSED(Written);
+}
+
+event_source* EventLoopAddHotplug(event_loop* Loop,
+    event_callback Callback, void* UserData) {
+    int FD = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        NETLINK_KOBJECT_UEVENT);
+    if (FD < 0) {
+        Fatal("Unable to create uevent socket.\n");
+    }
+
+    // Group 1 carries the kernel's uevents
+    struct sockaddr_nl Address = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = 1
+    };
+    if (bind(FD, (struct sockaddr*)&Address, sizeof(Address)) != 0) {
+        Fatal("Unable to bind uevent socket.\n");
+    }
+    return AddSource(Loop, EVENT_SOURCE_HOTPLUG, FD, Callback, UserData);
+}
+
+// Uevents are a header followed by NUL separated KEY=VALUE strings
+static bool IsDRMHotplug(const char* Message, ssize_t Length) {
+    bool IsDRM = false, IsHotplug = false;
+    for (ssize_t Offset = 0; Offset < Length; Offset += strlen(Message + Offset) + 1) {
+        const char* Field = Message + Offset;
+        IsDRM     |= strcmp(Field, "SUBSYSTEM=drm") == 0;
+        IsHotplug |= strcmp(Field, "HOTPLUG=1") == 0;
+    }
+    return IsDRM && IsHotplug;
+}
+
+void EventLoopRemove(event_source* Source) {
+    epoll_ctl(Source->Loop->EpollFD, EPOLL_CTL_DEL, Source->FD, NULL);
+    if (Source->Kind != EVENT_SOURCE_FD) {
+        close(Source->FD);
+    }
+    free(Source);
+}
+
+static void Dispatch(event_source* Source) {
+    char Message[4096];
+    ssize_t Length;
+
+    Source->Count = 1;
+    switch (Source->Kind) {
+        case EVENT_SOURCE_FD:
+            break;
+        case EVENT_SOURCE_TIMER:
+        case EVENT_SOURCE_NOTIFIER:
+            // Reset the expiration/notification count
+            if (read(Source->FD, &Source->Count, sizeof(Source->Count)) != sizeof(Source->Count)) {
+                return;
+            }
+            break;
+        case EVENT_SOURCE_HOTPLUG:
+            Length = recv(Source->FD, Message, sizeof(Message) - 1, 0);
+            if (Length <= 0) {
+                return;
+            }
+            Message[Length] = '\0';
+            if (!IsDRMHotplug(Message, Length)) {
+                return;
+            }
+            break;
+    }
+
+    Source->Callback(Source->UserData);
+}
+
+int EventLoopRunOnce(event_loop* Loop, int TimeoutMS) {
+    struct epoll_event Events[MAX_EVENTS];
+    int Count = epoll_wait(Loop->EpollFD, Events, MAX_EVENTS, TimeoutMS);
+    if (Count < 0) {
+        if (errno != EINTR) {
+            Fatal("epoll_wait failed: %s\n", strerror(errno));
+        }
+        return 0;
+    }
+
+    for (int EventIndex = 0; EventIndex < Count; EventIndex++) {
+        Dispatch(Events[EventIndex].data.ptr);
+    }
+    return Count;
+}
+
+void EventLoopRun(event_loop* Loop) {
+    while (!atomic_load_explicit(&Loop->Stop, memory_order_relaxed)) {
+        EventLoopRunOnce(Loop, -1);
+    }
+}
+
+void EventLoopStop(event_loop* Loop) {
+    atomic_store(&Loop->Stop, true);
+}
@@ -0,0 +1,87 @@
+#if !defined(EVENTS_H)
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// A central epoll based event loop, so DRM events, deadlines, wakeups
+// from worker threads and hotplug notifications are all dispatched as
+// soon as they arrive instead of when some loop happens to poll.
+//
+// Callbacks run on the thread calling EventLoopRunOnce/EventLoopRun,
+// and should be short, since they delay every other event behind them.
+
+typedef void (*event_callback)(void* UserData);
+
+typedef enum {
+    EVENT_SOURCE_FD,
+    EVENT_SOURCE_TIMER,
+    EVENT_SOURCE_NOTIFIER,
+    EVENT_SOURCE_HOTPLUG,
+} event_source_kind;
+
+typedef struct event_loop event_loop;
+
+typedef struct {
+    event_loop*       Loop;
+    event_source_kind Kind;
+    int               FD;
+    event_callback    Callback;
+    void*             UserData;
+    // Timer expirations or notifications coalesced into the
+    // current callback
+    uint64_t          Count;
+} event_source;
+
+struct event_loop {
+    int         EpollFD;
+    atomic_bool Stop;
+};
+
+event_loop* CreateEventLoop();
+
+// Calls Callback whenever FD is readable. The caller keeps ownership
+// of FD and must consume whatever made it readable.
+event_source* EventLoopAddFD(event_loop* Loop, int FD,
+    event_callback Callback, void* UserData);
+
+// A timer on CLOCK_MONOTONIC, disarmed until EventLoopArmTimer.
+event_source* EventLoopAddTimer(event_loop* Loop,
+    event_callback Callback, void* UserData);
+
+// Fires the timer at the absolute CLOCK_MONOTONIC time DeadlineNS
+// (see GetTimeNS), then every IntervalNS if that's non-zero.
+// DeadlineNS of 0 disarms it.
+void EventLoopArmTimer(event_source* Timer, uint64_t DeadlineNS, uint64_t IntervalNS);
+
+// An eventfd other threads can use to wake the loop with
+// EventLoopNotify. Several notifications may be coalesced into one
+// callback.
+event_source* EventLoopAddNotifier(event_loop* Loop,
+    event_callback Callback, void* UserData);
+
+// Safe to call from any thread.
+void EventLoopNotify(event_source* Notifier);
+
+// Calls Callback when a DRM device is hotplugged
+// (a kernel uevent with SUBSYSTEM=drm and HOTPLUG=1).
+event_source* EventLoopAddHotplug(event_loop* Loop,
+    event_callback Callback, void* UserData);
+
+// Unregisters and frees the source, closing any fd the loop created.
+// Only call this from a callback for the source being dispatched.
+void EventLoopRemove(event_source* Source);
+
+// Waits up to TimeoutMS (-1 for forever) for events and dispatches all
+// that are ready. Returns the number of events dispatched.
+int EventLoopRunOnce(event_loop* Loop, int TimeoutMS);
+
+// Dispatches events until EventLoopStop is called.
+void EventLoopRun(event_loop* Loop);
+
+// Safe to call from any thread, though the loop only notices when it
+// next wakes up (use a notifier to wake it immediately).
+void EventLoopStop(event_loop* Loop);
+
+#endif /* EVENTS_H */
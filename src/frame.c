@@ -0,0 +1,229 @@
+#include "frame.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <GL/glew.h>
+
+#include "egl.h"
+#include "log.h"
+#include "utils.h"
+
+#define FRAME_REPORT_INTERVAL_NS 1000000000ULL
+// Give up on a frame's fence after this long rather than hang the
+// render loop on a wedged GPU.
+#define FRAME_FENCE_TIMEOUT_NS   100000000ULL
+
+void StatAdd(frame_stat* Stat, double Value) {
+    if (Stat->Count == 0 || Value < Stat->Min) Stat->Min = Value;
+    if (Stat->Count == 0 || Value > Stat->Max) Stat->Max = Value;
+    Stat->Sum += Value;
+    Stat->Count++;
+}
+
+void StatReset(frame_stat* Stat) {
+    Stat->Count = 0;
+    Stat->Sum   = 0;
+    Stat->Min   = 0;
+    Stat->Max   = 0;
+}
+
+double StatAverage(frame_stat* Stat) {
+    return Stat->Count ? Stat->Sum / Stat->Count : 0;
+}
+
+int GetFramesInFlight(int Index) {
+    char IndexedName[128];
+    snprintf(IndexedName, sizeof(IndexedName), "FRAMES_IN_FLIGHT_%i", Index);
+    const char* Value = getenv(IndexedName);
+    if (!Value) Value = getenv("FRAMES_IN_FLIGHT");
+    if (!Value) return DEFAULT_FRAMES_IN_FLIGHT;
+
+    int Depth = atoi(Value);
+    if (Depth < 1) Depth = 1;
+    if (Depth > MAX_FRAMES_IN_FLIGHT) Depth = MAX_FRAMES_IN_FLIGHT;
+    return Depth;
+}
+
+// GL_TIMESTAMP values are in the GPU's timebase; measure its offset
+// from CLOCK_MONOTONIC so GPU times can be compared with flip times.
+static void CalibrateGPUClock(frame_timing* Timing) {
+    GLint64 GPUNow;
+    glGetInteger64v(GL_TIMESTAMP, &GPUNow);
+    Timing->GPUToCPUOffsetNS = (int64_t)GetTimeNS() - GPUNow;
+}
+
+// Reads back every frame whose queries have completed, without
+// waiting on the GPU.
+static void ResolveFrames(egl_display* Display) {
+    frame_timing* Timing = &Display->Hot->Timing;
+
+    while (Timing->Resolved < Timing->Frame) {
+        int Slot = Timing->Resolved % GPU_TIMER_FRAMES;
+        GLuint* Queries = Timing->Queries[Slot];
+
+        // Queries complete in order, so only check the end one
+        GLint Available = 0;
+        glGetQueryObjectiv(Queries[1], GL_QUERY_RESULT_AVAILABLE, &Available);
+        if (!Available) break;
+
+        // Wait for the frame's flip too, to measure time to it
+        uint64_t Flip  = Timing->QueryFlip[Slot];
+        uint64_t Flips = atomic_load_explicit(&Display->Hot->Flips,
+            memory_order_acquire);
+        if (Flip >= Flips) break;
+
+        GLuint64 GPUStart, GPUEnd;
+        glGetQueryObjectui64v(Queries[0], GL_QUERY_RESULT, &GPUStart);
+        glGetQueryObjectui64v(Queries[1], GL_QUERY_RESULT, &GPUEnd);
+        Timing->LastGPURenderMS = (GPUEnd - GPUStart) / 1000000.0;
+        Timing->GPUSamples++;
+        StatAdd(&Timing->GPURender, Timing->LastGPURenderMS);
+
+        // Older flips have been overwritten in the history
+        if (Flips - Flip <= FLIP_HISTORY) {
+            uint64_t FlipNS = atomic_load_explicit(
+                &Display->Hot->FlipTimeNS[Flip % FLIP_HISTORY],
+                memory_order_relaxed);
+            int64_t EndNS = (int64_t)GPUEnd + Timing->GPUToCPUOffsetNS;
+            StatAdd(&Timing->GPUToFlip, ((int64_t)FlipNS - EndNS) / 1000000.0);
+        }
+
+        Timing->Resolved++;
+    }
+
+    // Don't let a stalled display hold its queries forever
+    if (Timing->Frame - Timing->Resolved >= GPU_TIMER_FRAMES) {
+        Timing->Resolved = Timing->Frame - GPU_TIMER_FRAMES + 1;
+    }
+}
+
+// Blocks until fewer than FramesInFlight frames are queued on the GPU.
+static void WaitFramesInFlight(egl_display* Display) {
+    frame_timing* Timing = &Display->Hot->Timing;
+
+    uint64_t WaitNS = 0;
+    while (Timing->FencesCount >= Timing->FramesInFlight) {
+        GLsync Fence = Timing->Fences[Timing->FencesStart];
+
+        uint64_t Start = GetTimeNS();
+        GLenum Result = glClientWaitSync(Fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+            FRAME_FENCE_TIMEOUT_NS);
+        WaitNS += GetTimeNS() - Start;
+        if (Result == GL_TIMEOUT_EXPIRED || Result == GL_WAIT_FAILED) {
+            LOG_RATE(LOG_WARN, 1000, "%20s frame fence %s, not waiting for it\n",
+                Display->MonitorName,
+                Result == GL_WAIT_FAILED ? "wait failed" : "timed out");
+        }
+
+        glDeleteSync(Fence);
+        Timing->FencesStart = (Timing->FencesStart + 1) % MAX_FRAMES_IN_FLIGHT;
+        Timing->FencesCount--;
+    }
+    StatAdd(&Timing->FenceWait, WaitNS / 1000000.0);
+}
+
+static void ReportFrames(egl_display* Display, uint64_t Now) {
+    frame_timing* Timing = &Display->Hot->Timing;
+
+    if (Timing->LastReportNS == 0) {
+        Timing->LastReportNS = Now;
+        return;
+    }
+    if (Now - Timing->LastReportNS < FRAME_REPORT_INTERVAL_NS) return;
+    Timing->LastReportNS = Now;
+
+    uint64_t Flips = atomic_load_explicit(&Display->Hot->Flips,
+        memory_order_relaxed);
+    uint64_t EGLCalls = atomic_load_explicit(&Display->Hot->EGLCalls,
+        memory_order_relaxed);
+    uint64_t NewFlips = Flips - Timing->LastReportFlips;
+    double EGLCallsPerFrame = NewFlips ?
+        (double)(EGLCalls - Timing->LastReportEGLCalls) / NewFlips : 0;
+    Timing->LastReportFlips    = Flips;
+    Timing->LastReportEGLCalls = EGLCalls;
+
+    LOG(LOG_INFO, "%20s cpu %.2fms (max %.2f) gpu %.2fms (max %.2f) "
+        "gpu-to-flip %.2fms (min %.2f max %.2f) "
+        "fence wait %.2fms (max %.2f, %i in flight) "
+        "egl calls/frame %.2f acquire busy %llu timeouts %llu\n",
+        Display->MonitorName,
+        StatAverage(&Timing->CPUFrame),  Timing->CPUFrame.Max,
+        StatAverage(&Timing->GPURender), Timing->GPURender.Max,
+        StatAverage(&Timing->GPUToFlip), Timing->GPUToFlip.Min,
+        Timing->GPUToFlip.Max,
+        StatAverage(&Timing->FenceWait), Timing->FenceWait.Max,
+        Timing->FramesInFlight,
+        EGLCallsPerFrame,
+        (unsigned long long)atomic_load_explicit(&Display->Hot->AcquireBusy,
+            memory_order_relaxed),
+        (unsigned long long)atomic_load_explicit(&Display->Hot->AcquireTimeouts,
+            memory_order_relaxed));
+    if (Timing->Readback.Count > 0) {
+        LOG(LOG_INFO, "%20s readback %.2fms per frame (max %.2f)\n",
+            Display->MonitorName,
+            StatAverage(&Timing->Readback), Timing->Readback.Max);
+    }
+    StatReset(&Timing->CPUFrame);
+    StatReset(&Timing->FenceWait);
+    StatReset(&Timing->Readback);
+    StatReset(&Timing->GPURender);
+    StatReset(&Timing->GPUToFlip);
+
+    // GPU and CPU clocks drift apart over time
+    CalibrateGPUClock(Timing);
+}
+
+void BeginFrame(egl_display* Display) {
+    frame_timing* Timing = &Display->Hot->Timing;
+
+    if (atomic_exchange_explicit(&Display->Hot->RecreateStreamRequested, 0,
+            memory_order_acquire)) {
+        EGLRecreateStream(Display);
+    }
+
+    if (Timing->Queries[0][0] == 0) {
+        glGenQueries(GPU_TIMER_FRAMES * 2, &Timing->Queries[0][0]);
+        CalibrateGPUClock(Timing);
+        Timing->FramesInFlight = GetFramesInFlight(Display->Index);
+    }
+
+    WaitFramesInFlight(Display);
+    ResolveFrames(Display);
+
+    // Frames are rendered once the previous flip has landed, so this
+    // frame will be shown by the next flip.
+    int Slot = Timing->Frame % GPU_TIMER_FRAMES;
+    Timing->QueryFlip[Slot] = atomic_load_explicit(&Display->Hot->Flips,
+        memory_order_acquire);
+    Timing->FrameStartNS = GetTimeNS();
+    glQueryCounter(Timing->Queries[Slot][0], GL_TIMESTAMP);
+}
+
+void EndFrame(egl_display* Display) {
+    frame_timing* Timing = &Display->Hot->Timing;
+
+    int Slot = Timing->Frame % GPU_TIMER_FRAMES;
+    glQueryCounter(Timing->Queries[Slot][1], GL_TIMESTAMP);
+    Timing->Frame++;
+
+    // Fenced before the swap, so the swap's own copy isn't covered
+    int FenceIndex = (Timing->FencesStart + Timing->FencesCount) % MAX_FRAMES_IN_FLIGHT;
+    Timing->Fences[FenceIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    Timing->FencesCount++;
+
+    uint64_t Now = GetTimeNS();
+    StatAdd(&Timing->CPUFrame, (Now - Timing->FrameStartNS) / 1000000.0);
+    ReportFrames(Display, Now);
+}
+
+void ResetFrameTiming(egl_display* Display) {
+    frame_timing* Timing = &Display->Hot->Timing;
+    for (int Index = 0; Index < Timing->FencesCount; Index++) {
+        glDeleteSync(Timing->Fences[(Timing->FencesStart + Index) % MAX_FRAMES_IN_FLIGHT]);
+    }
+    if (Timing->Queries[0][0] != 0) {
+        glDeleteQueries(GPU_TIMER_FRAMES * 2, &Timing->Queries[0][0]);
+    }
+    memset(Timing, 0, sizeof(frame_timing));
+}
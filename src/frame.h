@@ -0,0 +1,85 @@
+#if !defined(FRAME_H)
+#define FRAME_H
+
+#include <stdint.h>
+
+// Per-display frame hooks, called by whichever thread renders the
+// display, with the display's context current:
+//
+//   BeginFrame(Display);
+//   ...render...
+//   EndFrame(Display);
+//   eglSwapBuffers(...); EGLStreamAcquire(Display);
+//
+// These measure CPU frame time, GPU render time (GL_TIMESTAMP queries
+// around the frame, read back a few frames later without blocking),
+// and GPU-to-flip latency (from the end of the frame's GPU work to the
+// page flip that showed it), and log them once a second per display.
+//
+// BeginFrame also bounds how many frames each display may have queued
+// on the GPU: it blocks on the fence of the oldest frame in flight
+// until fewer than the display's depth remain. The depth comes from
+// FRAMES_IN_FLIGHT_<Index> or FRAMES_IN_FLIGHT (default 2, at most
+// MAX_FRAMES_IN_FLIGHT); the time spent blocked is reported too,
+// as are the EGL stream calls made per presented frame.
+//
+// The queries belong to the context they were made in; before a
+// display is rendered from another context, ResetFrameTiming (egl.h)
+// frees them, with the old context still current.
+
+#define GPU_TIMER_FRAMES 4
+#define MAX_FRAMES_IN_FLIGHT 4
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+
+// Same as GLsync, which needs GL headers
+typedef struct __GLsync* frame_fence;
+
+typedef struct {
+    uint64_t Count;
+    double   Sum;
+    double   Min;
+    double   Max;
+} frame_stat;
+
+void StatAdd(frame_stat* Stat, double Value);
+void StatReset(frame_stat* Stat);
+double StatAverage(frame_stat* Stat);
+
+// Reads the frames-in-flight depth for the display with the given index.
+int GetFramesInFlight(int Index);
+
+// Owned by the thread rendering the display
+typedef struct {
+    // Timestamp queries from the context the display is rendered with;
+    // query objects aren't shared between contexts.
+    uint32_t    Queries[GPU_TIMER_FRAMES][2];
+    // Flip number expected to show each slot's frame
+    uint64_t    QueryFlip[GPU_TIMER_FRAMES];
+    uint64_t    Frame;      // Frames ended so far
+    uint64_t    Resolved;   // Frames whose queries were read back
+    int64_t     GPUToCPUOffsetNS;
+
+    // Fences of the frames still in flight, oldest at FencesStart
+    int         FramesInFlight;
+    frame_fence Fences[MAX_FRAMES_IN_FLIGHT];
+    int         FencesStart;
+    int         FencesCount;
+
+    uint64_t    FrameStartNS;
+    uint64_t    LastReportNS;
+    uint64_t    LastReportFlips;
+    uint64_t    LastReportEGLCalls;
+    frame_stat  CPUFrame;
+    frame_stat  GPURender;
+    frame_stat  GPUToFlip;
+    frame_stat  FenceWait;
+    // Render thread time spent on async readback (see readback.h)
+    frame_stat  Readback;
+
+    // Latest GPU render time read back, for callers comparing render
+    // modes (see overlay-planes.c); GPUSamples counts them.
+    double      LastGPURenderMS;
+    uint64_t    GPUSamples;
+} frame_timing;
+
+#endif /* FRAME_H */
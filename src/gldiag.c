@@ -0,0 +1,103 @@
+#include "gldiag.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "log.h"
+#include "utils.h"
+
+static _Atomic uint64_t Frame;
+
+static __thread gl_diag_mode CurrentMode = GL_DIAG_OFF;
+
+static log_severity DebugSeverityToLogSeverity(GLenum Severity) {
+    switch (Severity) {
+        case GL_DEBUG_SEVERITY_HIGH:   return LOG_ERROR;
+        case GL_DEBUG_SEVERITY_MEDIUM: return LOG_WARN;
+        case GL_DEBUG_SEVERITY_LOW:    return LOG_INFO;
+    }
+    return LOG_DEBUG;
+}
+
+// One log site per severity, indexed by log_severity
+static log_site DebugSites[] = {
+    LOG_SITE(LOG_DEBUG, 0),
+    LOG_SITE(LOG_INFO,  0),
+    LOG_SITE(LOG_WARN,  0),
+    LOG_SITE(LOG_ERROR, 0),
+};
+
+// Messages go through the async logger (log.h), which only copies them
+// into the calling thread's lock-free queue, so the driver's thread
+// never blocks on stdout. The first error gets a slot of its own, so
+// it's reported even if the queue is full.
+static void GLAPIENTRY AsyncDebugCallback(GLenum Source, GLenum Type,
+    GLuint ID, GLenum Severity, GLsizei Length,
+    const GLchar* Message, const void* UserParam) {
+
+    uint64_t MessageFrame = GLDiagnosticsFrame();
+
+    if (Type == GL_DEBUG_TYPE_ERROR) {
+        LOG_ONCE(LOG_ERROR, "===OPENGL FIRST ERROR 0x%X (frame %lu): %s\n",
+            ID, (unsigned long)MessageFrame, Message);
+    }
+
+    LogWrite(&DebugSites[DebugSeverityToLogSeverity(Severity)],
+        "===OPENGL DEBUG 0x%X (frame %lu): %s\n",
+        ID, (unsigned long)MessageFrame, Message);
+}
+
+static void GLAPIENTRY StrictDebugCallback(GLenum Source, GLenum Type,
+    GLuint ID, GLenum Severity, GLsizei Length,
+    const GLchar* Message, const void* UserParam) {
+    printf("===OPENGL DEBUG 0x%X (frame %lu): %s\n",
+        ID, (unsigned long)GLDiagnosticsFrame(), Message);
+}
+
+void SetGLDiagnosticsMode(gl_diag_mode Mode) {
+    switch (Mode) {
+        case GL_DIAG_OFF:
+            glDisable(GL_DEBUG_OUTPUT);
+            glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+            break;
+        case GL_DIAG_ASYNC:
+            glDebugMessageCallback(AsyncDebugCallback, NULL);
+            glDebugMessageControl(GL_DONT_CARE,
+                GL_DONT_CARE, GL_DONT_CARE, 0, 0, GL_TRUE);
+            glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+            glEnable(GL_DEBUG_OUTPUT);
+            break;
+        case GL_DIAG_STRICT:
+            glDebugMessageCallback(StrictDebugCallback, NULL);
+            glDebugMessageControl(GL_DONT_CARE,
+                GL_DONT_CARE, GL_DONT_CARE, 0, 0, GL_TRUE);
+            glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+            glEnable(GL_DEBUG_OUTPUT);
+            break;
+    }
+
+    // Debug output state is per-context, and a context is only current
+    // on one thread, so remember the mode per thread.
+    CurrentMode = Mode;
+}
+
+gl_diag_mode GetGLDiagnosticsMode() {
+    const char* Mode = getenv("GL_DIAG");
+    if (Mode && strcmp(Mode, "off") == 0)    return GL_DIAG_OFF;
+    if (Mode && strcmp(Mode, "strict") == 0) return GL_DIAG_STRICT;
+    return GL_DIAG_ASYNC;
+}
+
+void GLDiagnosticsEndFrame(const char* Name) {
+    atomic_fetch_add_explicit(&Frame, 1, memory_order_relaxed);
+
+    if (CurrentMode == GL_DIAG_STRICT) {
+        GLCheck(Name);
+    }
+}
+
+uint64_t GLDiagnosticsFrame() {
+    return atomic_load_explicit(&Frame, memory_order_relaxed);
+}
@@ -0,0 +1,39 @@
+#if !defined(GLDIAG_H)
+#define GLDIAG_H
+
+#include <stdint.h>
+#include <GL/glew.h>
+
+// GL error and debug message reporting, in one of three modes:
+//
+// GL_DIAG_OFF:    nothing is checked.
+// GL_DIAG_ASYNC:  debug output is enabled but asynchronous, and the
+//                 driver's debug callback only queues messages to the
+//                 async logger (log.h), so nothing on the frame path
+//                 queries GL errors synchronously.
+//                 The first error is still reported with its frame number.
+// GL_DIAG_STRICT: debug output is synchronous (so messages arrive from
+//                 within the offending call), and glGetError is checked
+//                 every frame, exiting on error.
+typedef enum {
+    GL_DIAG_OFF,
+    GL_DIAG_ASYNC,
+    GL_DIAG_STRICT,
+} gl_diag_mode;
+
+// Sets the mode for the current context. Debug output state is
+// per-context, so call this on each context that should be checked.
+void SetGLDiagnosticsMode(gl_diag_mode Mode);
+
+// Reads the mode from the GL_DIAG environment variable
+// ("off", "async" or "strict"), defaulting to async.
+gl_diag_mode GetGLDiagnosticsMode();
+
+// Call once per frame in place of GLCheck.
+// Counts frames, and in strict mode checks glGetError.
+void GLDiagnosticsEndFrame(const char* Name);
+
+// Frames ended so far across all threads.
+uint64_t GLDiagnosticsFrame();
+
+#endif /* GLDIAG_H */
@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+
+#include "ingest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "threads.h"
+#include "utils.h"
+
+// How long DestroyIngest waits for uploads in flight
+#define INGEST_DRAIN_TIMEOUT_NS 1000000000ULL
+// Threads helping the producer copy, unless INGEST_WORKERS says
+#define INGEST_DEFAULT_WORKERS  2
+
+// Sources
+
+// Sleeps until the frame's due time, paced from the first frame so
+// late frames don't push back the ones after them.
+static void WaitFrameTime(uint64_t StartNS, uint64_t Frame, int FPS) {
+    uint64_t DueNS = StartNS + Frame * 1000000000ULL / FPS;
+    struct timespec Due = {
+        .tv_sec  = DueNS / 1000000000ULL,
+        .tv_nsec = DueNS % 1000000000ULL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Due, NULL) != 0) {}
+}
+
+typedef struct {
+    ingest_source Source;
+    copy_format   Format;
+    uint8_t*      Pixels;
+    int           FPS;
+    uint64_t      Frame;
+    uint64_t      StartNS;
+} synthetic_source;
+
+// One row of the pattern: Shade's color, white from BarX to BarEnd
+static void FillSyntheticRow(copy_source* Frame, int Y, int Shade, int BarX, int BarEnd) {
+    uint8_t* Row = (uint8_t*)Frame->Planes[0] + (size_t)Y * Frame->Strides[0];
+    // The YUV formats get about the same colors as the RGB ones
+    uint8_t Luma = 16 + Shade * 219 / 255;
+    uint8_t U = 64 + Shade / 2;
+    uint8_t V = 192 - Shade / 2;
+
+    for (int X = 0; X < Frame->Width; X++) {
+        bool Bar = X >= BarX && X < BarEnd;
+        switch (Frame->Format) {
+        case COPY_FORMAT_BGRA:
+            ((uint32_t*)Row)[X] = Bar ? 0xFFFFFFFF :
+                0xFF000000 | Shade << 16 | (255 - Shade) << 8 | 0x40;
+            break;
+        case COPY_FORMAT_RGB24:
+            Row[X * 3 + 0] = Bar ? 255 : Shade;
+            Row[X * 3 + 1] = Bar ? 255 : 255 - Shade;
+            Row[X * 3 + 2] = Bar ? 255 : 0x40;
+            break;
+        case COPY_FORMAT_YUYV:
+            Row[X * 2]     = Bar ? 235 : Luma;
+            Row[X * 2 + 1] = Bar ? 128 : X & 1 ? V : U;
+            break;
+        case COPY_FORMAT_NV12:
+            Row[X] = Bar ? 235 : Luma;
+            if ((Y & 1) == 0) {
+                uint8_t* Chroma = (uint8_t*)Frame->Planes[1] + (size_t)(Y / 2) * Frame->Strides[1];
+                Chroma[X] = Bar ? 128 : X & 1 ? V : U;
+            }
+            break;
+        }
+    }
+}
+
+static bool NextSyntheticFrame(ingest_source* Source, copy_source* Frame,
+    uint64_t* CaptureNS)
+{
+    synthetic_source* Synthetic = (synthetic_source*)Source;
+    int Width  = Source->Width;
+    int Height = Source->Height;
+
+    if (Synthetic->Frame == 0) {
+        Synthetic->StartNS = GetTimeNS();
+    }
+    WaitFrameTime(Synthetic->StartNS, Synthetic->Frame, Synthetic->FPS);
+
+    // A vertical gradient scrolling down, with a bar sweeping across
+    InitCopySource(Frame, Synthetic->Format, Width, Height, Synthetic->Pixels);
+    uint32_t Index = (uint32_t)Synthetic->Frame++;
+    int BarX     = (Index * 8) % Width;
+    int BarWidth = MIN(Width / 32 + 1, Width - BarX);
+    for (int Y = 0; Y < Height; Y++) {
+        int Shade = ((Y + Index * 4) * 255 / Height) & 0xFF;
+        FillSyntheticRow(Frame, Y, Shade, BarX, BarX + BarWidth);
+    }
+
+    *CaptureNS = GetTimeNS();
+    return true;
+}
+
+static void DestroySyntheticSource(ingest_source* Source) {
+    synthetic_source* Synthetic = (synthetic_source*)Source;
+    free(Synthetic->Pixels);
+    free(Synthetic);
+}
+
+ingest_source* CreateSyntheticSource(copy_format Format, int Width, int Height, int FPS) {
+    copy_source Frame;
+    size_t Size = InitCopySource(&Frame, Format, Width, Height, NULL);
+
+    synthetic_source* Synthetic = calloc(1, sizeof(synthetic_source));
+    Synthetic->Source.Width   = Width;
+    Synthetic->Source.Height  = Height;
+    Synthetic->Source.Next    = NextSyntheticFrame;
+    Synthetic->Source.Destroy = DestroySyntheticSource;
+    Synthetic->Format = Format;
+    Synthetic->Pixels = aligned_alloc(CACHE_LINE_SIZE,
+        (Size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+    Synthetic->FPS = MAX(FPS, 1);
+    return &Synthetic->Source;
+}
+
+typedef struct {
+    ingest_source Source;
+    copy_format   Format;
+    uint8_t*      Mapped;
+    size_t        Size;
+    size_t        FrameSize;
+    int           FramesCount;
+    int           FPS;
+    uint64_t      Frame;
+    uint64_t      StartNS;
+} file_source;
+
+static bool NextFileFrame(ingest_source* Source, copy_source* Frame,
+    uint64_t* CaptureNS)
+{
+    file_source* File = (file_source*)Source;
+
+    if (File->Frame == 0) {
+        File->StartNS = GetTimeNS();
+    }
+    WaitFrameTime(File->StartNS, File->Frame, File->FPS);
+
+    int Index = File->Frame++ % File->FramesCount;
+    InitCopySource(Frame, File->Format, Source->Width, Source->Height,
+        File->Mapped + Index * File->FrameSize);
+    *CaptureNS = GetTimeNS();
+    return true;
+}
+
+static void DestroyFileSource(ingest_source* Source) {
+    file_source* File = (file_source*)Source;
+    munmap(File->Mapped, File->Size);
+    free(File);
+}
+
+ingest_source* CreateFileSource(const char* Path, copy_format Format,
+    int Width, int Height, int FPS)
+{
+    int FD = open(Path, O_RDONLY | O_CLOEXEC);
+    if (FD < 0) {
+        printf("Couldn't open %s: %m\n", Path);
+        return NULL;
+    }
+    struct stat Stat;
+    copy_source Frame;
+    size_t FrameSize = InitCopySource(&Frame, Format, Width, Height, NULL);
+    if (fstat(FD, &Stat) != 0 || Stat.st_size < (off_t)FrameSize ||
+        Stat.st_size % FrameSize != 0) {
+        printf("%s doesn't hold whole %ix%i %s frames\n", Path, Width, Height,
+            CopyFormatName(Format));
+        close(FD);
+        return NULL;
+    }
+
+    // Populated up front, so the first loop doesn't time page faults
+    void* Mapped = mmap(0, Stat.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, FD, 0);
+    close(FD);
+    if (Mapped == MAP_FAILED) {
+        printf("Failed to mmap(2) %s: %m\n", Path);
+        return NULL;
+    }
+
+    file_source* File = calloc(1, sizeof(file_source));
+    File->Source.Width   = Width;
+    File->Source.Height  = Height;
+    File->Source.Next    = NextFileFrame;
+    File->Source.Destroy = DestroyFileSource;
+    File->Format      = Format;
+    File->Mapped      = Mapped;
+    File->Size        = Stat.st_size;
+    File->FrameSize   = FrameSize;
+    File->FramesCount = Stat.st_size / FrameSize;
+    File->FPS         = MAX(FPS, 1);
+    printf("%s: %i %s frames of %ix%i\n", Path, File->FramesCount,
+        CopyFormatName(Format), Width, Height);
+    return &File->Source;
+}
+
+// Producer
+
+static ingest_slot* AcquireFreeSlot(ingest* Ingest) {
+    for (int SlotIndex = 0; SlotIndex < INGEST_SLOTS; SlotIndex++) {
+        ingest_slot* Slot = &Ingest->Slots[SlotIndex];
+        uint32_t Expected = INGEST_SLOT_FREE;
+        // Acquire, so the upload's reads are done before we write
+        if (atomic_compare_exchange_strong_explicit(&Slot->State, &Expected,
+                INGEST_SLOT_WRITING, memory_order_acquire, memory_order_relaxed)) {
+            return Slot;
+        }
+    }
+    return NULL;
+}
+
+static void* IngestProducerMain(void* Arg) {
+    ingest* Ingest = Arg;
+    ingest_source* Source = Ingest->Source;
+
+    ApplyThreadProfile("Ingest", GetThreadProfile("INGEST_THREAD_PROFILE", -1));
+
+    uint64_t Sequence = 0;
+    while (!atomic_load_explicit(&Ingest->Stop, memory_order_relaxed)) {
+        copy_source Frame;
+        uint64_t CaptureNS;
+        if (!Source->Next(Source, &Frame, &CaptureNS)) {
+            LOG(LOG_INFO, "Ingest source ended after %lu frames\n", (unsigned long)Sequence);
+            break;
+        }
+        Sequence++;
+        atomic_fetch_add_explicit(&Ingest->Produced, 1, memory_order_relaxed);
+
+        ingest_slot* Slot = AcquireFreeSlot(Ingest);
+        if (!Slot) {
+            atomic_fetch_add_explicit(&Ingest->Dropped, 1, memory_order_relaxed);
+            continue;
+        }
+
+        uint64_t CopyStartNS = GetTimeNS();
+        CopyFrame(Ingest->Workers, &Frame, Slot->Mapped, Ingest->Pitch);
+        uint64_t PostNS = GetTimeNS();
+
+        uint64_t CopyNS = PostNS - CopyStartNS;
+        atomic_fetch_add_explicit(&Ingest->CopyNS, CopyNS, memory_order_relaxed);
+        if (CopyNS > atomic_load_explicit(&Ingest->CopyMaxNS, memory_order_relaxed)) {
+            atomic_store_explicit(&Ingest->CopyMaxNS, CopyNS, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&Ingest->CaptureToPostNS, PostNS - CaptureNS,
+            memory_order_relaxed);
+
+        Slot->Sequence  = Sequence;
+        Slot->CaptureNS = CaptureNS;
+        Slot->PostNS    = PostNS;
+        atomic_store_explicit(&Slot->State, INGEST_SLOT_POSTED, memory_order_relaxed);
+
+        // Release, so the copy and the fields above are visible to the
+        // render thread taking the slot
+        uint32_t SlotIndex = Slot - Ingest->Slots;
+        uint32_t Previous = atomic_exchange_explicit(&Ingest->Mailbox, SlotIndex + 1,
+            memory_order_acq_rel);
+        if (Previous) {
+            atomic_store_explicit(&Ingest->Slots[Previous - 1].State, INGEST_SLOT_FREE,
+                memory_order_relaxed);
+            atomic_fetch_add_explicit(&Ingest->Superseded, 1, memory_order_relaxed);
+        }
+    }
+    return NULL;
+}
+
+// Render thread
+
+ingest* CreateIngest(ingest_source* Source) {
+    GLint Major = 0, Minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &Major);
+    glGetIntegerv(GL_MINOR_VERSION, &Minor);
+    if (Major * 10 + Minor < 44) {
+        printf("Ingest needs GL 4.4 for persistent mapping, have %i.%i\n", Major, Minor);
+        return NULL;
+    }
+
+    ingest* Ingest = calloc(1, sizeof(ingest));
+    Ingest->Source = Source;
+    Ingest->Width  = Source->Width;
+    Ingest->Height = Source->Height;
+    Ingest->Pitch  = Source->Width * 4;
+    Ingest->CurrentTexture = -1;
+    atomic_init(&Ingest->Mailbox, 0);
+    atomic_init(&Ingest->Stop, false);
+    atomic_init(&Ingest->Produced, 0);
+    atomic_init(&Ingest->Dropped, 0);
+    atomic_init(&Ingest->Superseded, 0);
+    atomic_init(&Ingest->CopyNS, 0);
+    atomic_init(&Ingest->CopyMaxNS, 0);
+    atomic_init(&Ingest->CaptureToPostNS, 0);
+    StatReset(&Ingest->CaptureToUpload);
+    StatReset(&Ingest->CaptureToReady);
+    StatReset(&Ingest->UploadTime);
+
+    GLsizeiptr Size = (GLsizeiptr)Ingest->Pitch * Ingest->Height;
+    GLbitfield Flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (int SlotIndex = 0; SlotIndex < INGEST_SLOTS; SlotIndex++) {
+        ingest_slot* Slot = &Ingest->Slots[SlotIndex];
+        glGenBuffers(1, &Slot->Buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Slot->Buffer);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, Size, NULL, Flags);
+        Slot->Mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, Size, Flags);
+        if (!Slot->Mapped) {
+            Fatal("Couldn't map ingest buffer\n");
+        }
+        atomic_init(&Slot->State, INGEST_SLOT_FREE);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    glGenTextures(INGEST_TEXTURES, Ingest->Textures);
+    for (int TextureIndex = 0; TextureIndex < INGEST_TEXTURES; TextureIndex++) {
+        glBindTexture(GL_TEXTURE_2D, Ingest->Textures[TextureIndex]);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, Ingest->Width, Ingest->Height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    const char* Workers = getenv("INGEST_WORKERS");
+    int WorkersCount = Workers ? atoi(Workers) : INGEST_DEFAULT_WORKERS;
+    if (WorkersCount > 0) {
+        Ingest->Workers = CreateWorkerPool(WorkersCount);
+    }
+
+    if (pthread_create(&Ingest->Producer, NULL, IngestProducerMain, Ingest)) {
+        Fatal("Couldn't create ingest thread\n");
+    }
+    printf("Ingest: %i buffers of %ix%i, copying with %s kernels on %i threads\n",
+        INGEST_SLOTS, Ingest->Width, Ingest->Height, CopyKernelsName(),
+        Ingest->Workers ? Ingest->Workers->ThreadsCount + 1 : 1);
+    return Ingest;
+}
+
+// Returns slots whose uploads have completed to the producer.
+static void RecycleSlots(ingest* Ingest, GLuint64 TimeoutNS) {
+    for (int SlotIndex = 0; SlotIndex < INGEST_SLOTS; SlotIndex++) {
+        ingest_slot* Slot = &Ingest->Slots[SlotIndex];
+        if (atomic_load_explicit(&Slot->State, memory_order_relaxed) !=
+            INGEST_SLOT_UPLOADING) {
+            continue;
+        }
+
+        GLenum Result = glClientWaitSync(Slot->Fence, 0, TimeoutNS);
+        if (Result == GL_TIMEOUT_EXPIRED) {
+            continue;
+        }
+        if (Result == GL_WAIT_FAILED) {
+            LOG_RATE(LOG_WARN, 1000, "Ingest upload fence wait failed\n");
+        }
+        glDeleteSync(Slot->Fence);
+        Slot->Fence = NULL;
+        StatAdd(&Ingest->CaptureToReady, (GetTimeNS() - Slot->CaptureNS) / 1000000.0);
+        atomic_store_explicit(&Slot->State, INGEST_SLOT_FREE, memory_order_release);
+    }
+}
+
+bool UpdateIngest(ingest* Ingest) {
+    uint64_t StartNS = GetTimeNS();
+
+    RecycleSlots(Ingest, 0);
+
+    uint32_t Posted = atomic_exchange_explicit(&Ingest->Mailbox, 0, memory_order_acquire);
+    if (!Posted) {
+        return false;
+    }
+    ingest_slot* Slot = &Ingest->Slots[Posted - 1];
+    atomic_store_explicit(&Slot->State, INGEST_SLOT_UPLOADING, memory_order_relaxed);
+
+    int TextureIndex = (Ingest->CurrentTexture + 1) % INGEST_TEXTURES;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Slot->Buffer);
+    glBindTexture(GL_TEXTURE_2D, Ingest->Textures[TextureIndex]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, Ingest->Pitch / 4);
+    // Top row first, so the texture is upside down in GL's terms;
+    // drawing flips it back
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, Ingest->Width, Ingest->Height,
+        GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    Slot->Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    Slot->UploadNS = GetTimeNS();
+    Ingest->CurrentTexture  = TextureIndex;
+    Ingest->CurrentSequence = Slot->Sequence;
+    Ingest->Uploads++;
+    StatAdd(&Ingest->CaptureToUpload, (Slot->UploadNS - Slot->CaptureNS) / 1000000.0);
+    StatAdd(&Ingest->UploadTime, (Slot->UploadNS - StartNS) / 1000000.0);
+    return true;
+}
+
+GLuint IngestTexture(ingest* Ingest) {
+    if (Ingest->CurrentTexture < 0) {
+        return 0;
+    }
+    return Ingest->Textures[Ingest->CurrentTexture];
+}
+
+void ReportIngest(ingest* Ingest) {
+    uint64_t Produced   = atomic_exchange_explicit(&Ingest->Produced, 0, memory_order_relaxed);
+    uint64_t Dropped    = atomic_exchange_explicit(&Ingest->Dropped, 0, memory_order_relaxed);
+    uint64_t Superseded = atomic_exchange_explicit(&Ingest->Superseded, 0, memory_order_relaxed);
+    uint64_t CopyNS     = atomic_exchange_explicit(&Ingest->CopyNS, 0, memory_order_relaxed);
+    uint64_t CopyMaxNS  = atomic_exchange_explicit(&Ingest->CopyMaxNS, 0, memory_order_relaxed);
+    uint64_t PostNS     = atomic_exchange_explicit(&Ingest->CaptureToPostNS, 0,
+        memory_order_relaxed);
+    uint64_t Copied = Produced - Dropped;
+
+    LOG(LOG_INFO, "%20s: %lu produced, %lu uploaded, %lu superseded, %lu dropped, "
+        "copy %.2fms (max %.2f)\n", "Ingest",
+        (unsigned long)Produced, (unsigned long)Ingest->Uploads,
+        (unsigned long)Superseded, (unsigned long)Dropped,
+        Copied ? CopyNS / 1000000.0 / Copied : 0, CopyMaxNS / 1000000.0);
+    LOG(LOG_INFO, "%20s  capture to post %.2fms, upload %.2fms (max %.2f), "
+        "ready %.2fms (max %.2f), render thread %.2fms per upload\n", "",
+        Copied ? PostNS / 1000000.0 / Copied : 0,
+        StatAverage(&Ingest->CaptureToUpload), Ingest->CaptureToUpload.Max,
+        StatAverage(&Ingest->CaptureToReady), Ingest->CaptureToReady.Max,
+        StatAverage(&Ingest->UploadTime));
+
+    Ingest->Uploads = 0;
+    StatReset(&Ingest->CaptureToUpload);
+    StatReset(&Ingest->CaptureToReady);
+    StatReset(&Ingest->UploadTime);
+}
+
+void DestroyIngest(ingest* Ingest) {
+    // The producer notices Stop after its source's next frame
+    atomic_store_explicit(&Ingest->Stop, true, memory_order_relaxed);
+    pthread_join(Ingest->Producer, NULL);
+    if (Ingest->Workers) {
+        DestroyWorkerPool(Ingest->Workers);
+    }
+
+    RecycleSlots(Ingest, INGEST_DRAIN_TIMEOUT_NS);
+    for (int SlotIndex = 0; SlotIndex < INGEST_SLOTS; SlotIndex++) {
+        ingest_slot* Slot = &Ingest->Slots[SlotIndex];
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Slot->Buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glDeleteBuffers(1, &Slot->Buffer);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteTextures(INGEST_TEXTURES, Ingest->Textures);
+    free(Ingest);
+}
@@ -0,0 +1,148 @@
+#if !defined(INGEST_H)
+#define INGEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <GL/glew.h>
+
+#include "copy.h"
+#include "frame.h"
+#include "workers.h"
+
+// Streams video frames (a camera, a file...) into a GL texture without
+// stalling either side.
+//
+// A producer thread takes each frame from its source and copies it into
+// one of INGEST_SLOTS persistently mapped pixel unpack buffers (GL 4.4 /
+// ARB_buffer_storage), converting it to BGRA on the way with CopyFrame
+// (see copy.h) split across INGEST_WORKERS threads (2 by default, 0 for
+// the producer alone), then posts the slot in a one-frame mailbox. The
+// render thread's UpdateIngest takes the newest posted slot, if any,
+// and uploads it into the texture from the buffer, which the GPU does
+// asynchronously; a fence returns the slot to the producer once the
+// upload has read it.
+//
+// Slots go FREE -> WRITING (producer) -> POSTED -> UPLOADING (render
+// thread) -> FREE. With three slots the producer always has one to
+// write while one is posted and one uploads. A posted frame replaced by
+// a newer one before the render thread took it is superseded; a frame
+// arriving while no slot is free (uploads backed up on the GPU) is
+// dropped. Neither side ever waits for the other.
+//
+// Uploads alternate between INGEST_TEXTURES textures, so an upload
+// doesn't write the texture the previous frame, likely still queued on
+// the GPU, samples.
+//
+//   ingest_source* Source = CreateSyntheticSource(COPY_FORMAT_YUYV, 1920, 1080, 60);
+//   ingest* Ingest = CreateIngest(Source);   // context current
+//   ...each frame, before drawing:
+//   if (UpdateIngest(Ingest)) { ...the texture changed... }
+//   glBindTexture(GL_TEXTURE_2D, IngestTexture(Ingest));
+//
+// Latencies are measured end to end, from the source's capture
+// timestamp to the producer's copy being posted, the upload being
+// issued, and the upload completing on the GPU; ReportIngest logs them.
+
+#define INGEST_SLOTS    3
+#define INGEST_TEXTURES 2
+
+typedef struct ingest_source ingest_source;
+
+// Frames are top row first, in any format CopyFrame converts.
+struct ingest_source {
+    int Width;
+    int Height;
+    // Blocks until the next frame is available and describes it in
+    // Frame, with when it was captured (CLOCK_MONOTONIC). The frame
+    // stays valid until the next call. Returns false at the end of the
+    // stream.
+    bool (*Next)(ingest_source* Source, copy_source* Frame, uint64_t* CaptureNS);
+    void (*Destroy)(ingest_source* Source);
+};
+
+// Test patterns generated at FPS frames per second, from a moving
+// gradient, in the source's own buffer as a camera driver would.
+ingest_source* CreateSyntheticSource(copy_format Format, int Width, int Height, int FPS);
+
+// Raw, tightly packed frames of Width x Height read from a file,
+// looped, at FPS frames per second. Returns NULL (printing why) if the
+// file can't be read or doesn't hold whole frames.
+ingest_source* CreateFileSource(const char* Path, copy_format Format,
+    int Width, int Height, int FPS);
+
+typedef enum {
+    INGEST_SLOT_FREE,
+    INGEST_SLOT_WRITING,
+    INGEST_SLOT_POSTED,
+    INGEST_SLOT_UPLOADING,
+} ingest_slot_state;
+
+typedef struct {
+    GLuint           Buffer;
+    uint8_t*         Mapped;
+    _Atomic uint32_t State;
+    frame_fence      Fence;     // Render thread only
+    uint64_t         Sequence;  // Written by the producer before posting
+    uint64_t         CaptureNS;
+    uint64_t         PostNS;
+    uint64_t         UploadNS;  // Render thread only
+} ingest_slot;
+
+typedef struct {
+    ingest_source* Source;
+    int            Width;
+    int            Height;
+    int            Pitch;
+    ingest_slot    Slots[INGEST_SLOTS];
+
+    // Index + 1 of the newest posted slot, 0 if none
+    _Atomic uint32_t Mailbox;
+
+    GLuint   Textures[INGEST_TEXTURES];
+    int      CurrentTexture;
+    uint64_t CurrentSequence;
+    uint64_t Uploads;
+
+    atomic_bool  Stop;
+    pthread_t    Producer;
+    worker_pool* Workers; // Helping the producer copy, or NULL
+
+    // Render thread counters, for ReportIngest
+    frame_stat CaptureToUpload;
+    frame_stat CaptureToReady;
+    frame_stat UploadTime;
+
+    // Producer counters
+    _Atomic uint64_t Produced;
+    _Atomic uint64_t Dropped;
+    _Atomic uint64_t Superseded;
+    _Atomic uint64_t CopyNS;
+    _Atomic uint64_t CopyMaxNS;
+    _Atomic uint64_t CaptureToPostNS;
+} ingest;
+
+// Creates the buffers and textures, with a context current, and starts
+// the producer thread on Source. Returns NULL (printing why) without GL
+// 4.4 or ARB_buffer_storage.
+ingest* CreateIngest(ingest_source* Source);
+
+// On the render thread, before drawing: recycles slots whose uploads
+// have completed, and uploads the newest posted frame, if any. Returns
+// true if IngestTexture changed.
+bool UpdateIngest(ingest* Ingest);
+
+// The texture holding the newest uploaded frame (0 before the first).
+// Its upload is ordered before any later GL commands in the context.
+GLuint IngestTexture(ingest* Ingest);
+
+// Logs frames produced, uploaded, superseded and dropped, copy time
+// and the latencies since the last report, from the render thread.
+void ReportIngest(ingest* Ingest);
+
+// Stops the producer, waits for uploads in flight, and frees
+// everything but the source; with the context current.
+void DestroyIngest(ingest* Ingest);
+
+#endif /* INGEST_H */
@@ -71,6 +71,29 @@ struct PropertyIDs {
     } connector;
 };
 
+// Planes in use, by the displays or by ClaimPlane
+#define MAX_CLAIMED_PLANES 64
+static uint32_t ClaimedPlanes[MAX_CLAIMED_PLANES];
+static int ClaimedPlanesCount;
+
+static bool PlaneIsClaimed(uint32_t planeID) {
+    for (int i = 0; i < ClaimedPlanesCount; i++) {
+        if (ClaimedPlanes[i] == planeID) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false if the table is full
+static bool MarkPlaneClaimed(uint32_t planeID) {
+    if (ClaimedPlanesCount == MAX_CLAIMED_PLANES) {
+        return false;
+    }
+    ClaimedPlanes[ClaimedPlanesCount++] = planeID;
+    return true;
+}
+
 struct PropertyIDAddresses {
     const char *name;
     uint32_t *ptr;
@@ -161,10 +184,8 @@ static drmModePropertyBlobPtr GetPropertyBlobValue(
 
     drmModeFreeObjectProperties(pModeObjectProperties);
 
-    if (!found) {
-        Fatal("Unable to find value for property \'%s\'.\n", propName);
-    }
-
+    // Missing blobs are left to the caller: virtual connectors
+    // (e.g. vkms) have no EDID.
     return value;
 }
 
@@ -210,11 +231,23 @@ static bool PickConnector(int drmFd,
 
         // Parse the EDID blob into useful strings
         drm_edid* edid = calloc(1, sizeof(drm_edid));
-        int rc = edid_parse(edid,
-                edidBlobPtr->data,
-                edidBlobPtr->length);
-        // Free the blob; we've extracted what we needed.
-        drmModeFreePropertyBlob(edidBlobPtr);
+        int rc = -1;
+        if (edidBlobPtr) {
+            rc = edid_parse(edid,
+                    edidBlobPtr->data,
+                    edidBlobPtr->length);
+            // Free the blob; we've extracted what we needed.
+            drmModeFreePropertyBlob(edidBlobPtr);
+        }
+
+        // Connectors without a (valid) EDID are still usable,
+        // named after their connector ID instead.
+        if (!edid->MonitorName) {
+            edid->MonitorName = malloc(32);
+            snprintf(edid->MonitorName, 32, "Connector-%u", pConfig->connectorID);
+        }
+        if (!edid->SerialNumber) edid->SerialNumber = strdup("");
+        if (!edid->PNPID)        edid->PNPID        = strdup("");
 
         pConfig->edid = edid;
 
@@ -615,9 +648,19 @@ kms_plane* SetDisplayModes(int drmFd, int *NumPlanes) {
         }
 
         Planes[PlaneIndex].PlaneID = config.planeID;
+        Planes[PlaneIndex].CrtcID = config.crtcID;
+        Planes[PlaneIndex].CrtcIndex = config.crtcIndex;
+        Planes[PlaneIndex].ConnectorID = config.connectorID;
         Planes[PlaneIndex].Width = config.width;
         Planes[PlaneIndex].Height = config.height;
         Planes[PlaneIndex].EDID = config.edid;
+        Planes[PlaneIndex].Mode = config.mode;
+        Planes[PlaneIndex].Framebuffer = fb;
+        Planes[PlaneIndex].DamageClipsProperty = GetPropertyID(drmFd,
+            config.planeID, DRM_MODE_OBJECT_PLANE, "FB_DAMAGE_CLIPS");
+        if (!MarkPlaneClaimed(config.planeID)) {
+            Fatal("More than %i planes claimed\n", MAX_CLAIMED_PLANES);
+        }
 
         PlaneIndex++;
     }
@@ -627,3 +670,180 @@ kms_plane* SetDisplayModes(int drmFd, int *NumPlanes) {
 
     return Planes;
 }
+
+uint32_t GetPropertyID(int drmFd, uint32_t ObjectID, uint32_t ObjectType,
+    const char* Name)
+{
+    uint32_t propertyID = 0;
+    drmModeObjectPropertiesPtr pModeObjectProperties =
+        drmModeObjectGetProperties(drmFd, ObjectID, ObjectType);
+    if (pModeObjectProperties == NULL) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < pModeObjectProperties->count_props && !propertyID; i++) {
+        drmModePropertyPtr pProperty =
+            drmModeGetProperty(drmFd, pModeObjectProperties->props[i]);
+        if (pProperty == NULL) {
+            continue;
+        }
+        if (strcmp(Name, pProperty->name) == 0) {
+            propertyID = pProperty->prop_id;
+        }
+        drmModeFreeProperty(pProperty);
+    }
+
+    drmModeFreeObjectProperties(pModeObjectProperties);
+    return propertyID;
+}
+
+bool FindPropertyValue(int drmFd, uint32_t ObjectID, uint32_t ObjectType,
+    const char* Name, uint64_t* Value)
+{
+    bool found = false;
+    drmModeObjectPropertiesPtr pModeObjectProperties =
+        drmModeObjectGetProperties(drmFd, ObjectID, ObjectType);
+    if (pModeObjectProperties == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < pModeObjectProperties->count_props && !found; i++) {
+        drmModePropertyPtr pProperty =
+            drmModeGetProperty(drmFd, pModeObjectProperties->props[i]);
+        if (pProperty == NULL) {
+            continue;
+        }
+        if (strcmp(Name, pProperty->name) == 0) {
+            *Value = pModeObjectProperties->prop_values[i];
+            found = true;
+        }
+        drmModeFreeProperty(pProperty);
+    }
+
+    drmModeFreeObjectProperties(pModeObjectProperties);
+    return found;
+}
+
+void GetPlanePropertyIDs(int drmFd, uint32_t PlaneID, kms_plane_properties* Props)
+{
+    memset(Props, 0, sizeof(*Props));
+
+    struct PropertyIDAddresses planeTable[] = {
+        { "FB_ID",   &Props->FbID   },
+        { "CRTC_ID", &Props->CrtcID },
+        { "SRC_X",   &Props->SrcX   },
+        { "SRC_Y",   &Props->SrcY   },
+        { "SRC_W",   &Props->SrcW   },
+        { "SRC_H",   &Props->SrcH   },
+        { "CRTC_X",  &Props->CrtcX  },
+        { "CRTC_Y",  &Props->CrtcY  },
+        { "CRTC_W",  &Props->CrtcW  },
+        { "CRTC_H",  &Props->CrtcH  },
+    };
+
+    AssignPropertyIDsOneType(drmFd, PlaneID, DRM_MODE_OBJECT_PLANE,
+                             planeTable, ARRAY_LEN(planeTable));
+
+    // Optional
+    Props->ZPos = GetPropertyID(drmFd, PlaneID, DRM_MODE_OBJECT_PLANE, "zpos");
+}
+
+void AddPlaneRects(drmModeAtomicReqPtr Request, uint32_t PlaneID,
+    const kms_plane_properties* Props, int SrcW, int SrcH,
+    int CrtcX, int CrtcY, int CrtcW, int CrtcH)
+{
+    /* Source coordinates are in 16.16 fixed point. */
+    drmModeAtomicAddProperty(Request, PlaneID, Props->SrcX, 0);
+    drmModeAtomicAddProperty(Request, PlaneID, Props->SrcY, 0);
+    drmModeAtomicAddProperty(Request, PlaneID, Props->SrcW, (uint64_t)SrcW << 16);
+    drmModeAtomicAddProperty(Request, PlaneID, Props->SrcH, (uint64_t)SrcH << 16);
+
+    /* CRTC_X/CRTC_Y are signed, so planes can hang off the edges. */
+    drmModeAtomicAddProperty(Request, PlaneID, Props->CrtcX, (uint64_t)(int64_t)CrtcX);
+    drmModeAtomicAddProperty(Request, PlaneID, Props->CrtcY, (uint64_t)(int64_t)CrtcY);
+    drmModeAtomicAddProperty(Request, PlaneID, Props->CrtcW, CrtcW);
+    drmModeAtomicAddProperty(Request, PlaneID, Props->CrtcH, CrtcH);
+}
+
+uint32_t ClaimPlane(int drmFd, int CrtcIndex, uint64_t Type)
+{
+    drmModePlaneResPtr pPlaneRes = drmModeGetPlaneResources(drmFd);
+    uint32_t planeID = 0;
+
+    if (pPlaneRes == NULL) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < pPlaneRes->count_planes && !planeID; i++) {
+        uint32_t candidate = pPlaneRes->planes[i];
+        if (PlaneIsClaimed(candidate)) {
+            continue;
+        }
+
+        drmModePlanePtr pPlane = drmModeGetPlane(drmFd, candidate);
+        if (pPlane == NULL) {
+            continue;
+        }
+        uint32_t crtcs = pPlane->possible_crtcs;
+        drmModeFreePlane(pPlane);
+
+        if ((crtcs & (1 << CrtcIndex)) == 0) {
+            continue;
+        }
+
+        if (GetPropertyValue(drmFd, candidate, DRM_MODE_OBJECT_PLANE, "type") == Type) {
+            planeID = candidate;
+        }
+    }
+
+    drmModeFreePlaneResources(pPlaneRes);
+
+    // Handing out a plane we can't keep track of would let the next
+    // call hand it out again
+    if (planeID && !MarkPlaneClaimed(planeID)) {
+        printf("Can't claim plane %u: %i planes are claimed already\n",
+            planeID, MAX_CLAIMED_PLANES);
+        return 0;
+    }
+    return planeID;
+}
+
+uint64_t GetRefreshPeriodNS(kms_plane* Plane) {
+    const drmModeModeInfo* mode = &Plane->Mode;
+    if (mode->clock == 0) {
+        // Unknown; assume 60Hz
+        return 1000000000ULL / 60;
+    }
+    // clock is in kHz
+    return (uint64_t)mode->htotal * mode->vtotal * 1000000ULL / mode->clock;
+}
+
+bool RecommitPlane(int drmFd, kms_plane* Plane) {
+    struct Config config = { 0 };
+    config.connectorID = Plane->ConnectorID;
+    config.crtcID      = Plane->CrtcID;
+    config.planeID     = Plane->PlaneID;
+    config.mode        = Plane->Mode;
+    config.edid        = Plane->EDID;
+    config.width       = Plane->Width;
+    config.height      = Plane->Height;
+
+    // Not CreateModeID, which exits: recovery must be able to fail
+    uint32_t modeID = 0;
+    if (drmModeCreatePropertyBlob(drmFd, &config.mode, sizeof(config.mode),
+            &modeID) != 0) {
+        return false;
+    }
+
+    drmModeAtomicReqPtr pAtomic = drmModeAtomicAlloc();
+
+    AssignAtomicRequest(drmFd, pAtomic, &config, modeID, Plane->Framebuffer);
+
+    int ret = drmModeAtomicCommit(drmFd, pAtomic,
+                                  DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+
+    drmModeAtomicFree(pAtomic);
+    drmModeDestroyPropertyBlob(drmFd, modeID);
+
+    return ret == 0;
+}
@@ -22,14 +22,73 @@
 
 #if !defined(KMS_H)
 #define KMS_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
 #include "edid.h"
 typedef struct {
     uint32_t PlaneID;
+    uint32_t CrtcID;
+    int CrtcIndex;
+    uint32_t ConnectorID;
     int Width;
     int Height;
     drm_edid* EDID;
+    drmModeModeInfo Mode;
+    // The blank dumb buffer the plane was first committed with
+    uint32_t Framebuffer;
+    // Property ID of the plane's FB_DAMAGE_CLIPS, or 0 if unsupported
+    uint32_t DamageClipsProperty;
 } kms_plane;
 
 kms_plane* SetDisplayModes(int drmFd, int* NumPlanes);
 
+// Property IDs needed to place a plane with an atomic commit.
+// ZPos is 0 if the plane has no zpos property.
+typedef struct {
+    uint32_t FbID;
+    uint32_t CrtcID;
+    uint32_t SrcX;
+    uint32_t SrcY;
+    uint32_t SrcW;
+    uint32_t SrcH;
+    uint32_t CrtcX;
+    uint32_t CrtcY;
+    uint32_t CrtcW;
+    uint32_t CrtcH;
+    uint32_t ZPos;
+} kms_plane_properties;
+
+void GetPlanePropertyIDs(int drmFd, uint32_t PlaneID, kms_plane_properties* Props);
+
+// Adds the plane's source rect (SrcW x SrcH from the framebuffer's top
+// left) and its destination rect on the CRTC to an atomic request.
+// A destination larger than the source uses the plane's scaler.
+void AddPlaneRects(drmModeAtomicReqPtr Request, uint32_t PlaneID,
+    const kms_plane_properties* Props, int SrcW, int SrcH,
+    int CrtcX, int CrtcY, int CrtcW, int CrtcH);
+
+// Finds a plane of the given DRM_PLANE_TYPE_* that can be used with
+// the CRTC, and isn't already used by a display or an earlier call.
+// Returns 0 if there are none left, or if MAX_CLAIMED_PLANES (kms.c)
+// planes are claimed already.
+uint32_t ClaimPlane(int drmFd, int CrtcIndex, uint64_t Type);
+
+// Looks up a KMS object's property by name; returns 0 if it has none.
+uint32_t GetPropertyID(int drmFd, uint32_t ObjectID, uint32_t ObjectType,
+    const char* Name);
+
+// Reads a KMS object's property value by name; returns false if it
+// has no such property.
+bool FindPropertyValue(int drmFd, uint32_t ObjectID, uint32_t ObjectType,
+    const char* Name, uint64_t* Value);
+
+// Duration of one refresh of the plane's mode.
+uint64_t GetRefreshPeriodNS(kms_plane* Plane);
+
+// Commits the plane's mode, connector and blank framebuffer again,
+// as SetDisplayModes did, touching no other CRTC.
+// Returns false instead of exiting if the commit fails.
+bool RecommitPlane(int drmFd, kms_plane* Plane);
+
 #endif /* KMS_H */
@@ -0,0 +1,218 @@
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "utils.h"
+
+#define LOG_QUEUE_SIZE   256
+
+typedef struct {
+    log_severity Severity;
+    char         Text[LOG_MESSAGE_SIZE];
+} log_entry;
+
+// Single producer (the owning thread), single consumer (the writer).
+typedef struct log_queue {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t Head;  // Written by producer
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t Tail;  // Written by consumer
+    _Atomic uint64_t  Dropped;
+    uint64_t          ReportedDropped;
+    struct log_queue* Next;
+    log_entry         Entries[LOG_QUEUE_SIZE];
+} log_queue;
+
+static _Atomic(log_queue*) Queues;
+// LOG_ONCE messages, added once their text is written
+static _Atomic(log_once*) Onces;
+static __thread log_queue* ThreadQueue;
+
+static pthread_once_t  LogOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t DrainLock = PTHREAD_MUTEX_INITIALIZER;
+static log_severity    LogLevel = LOG_INFO;
+
+static const char* SeverityPrefix(log_severity Severity) {
+    switch (Severity) {
+        case LOG_DEBUG: return "[debug] ";
+        case LOG_INFO:  return "";
+        case LOG_WARN:  return "[warn] ";
+        case LOG_ERROR: return "[error] ";
+    }
+    return "";
+}
+
+// Writes out everything in the queues.
+// Serialized, since each queue only supports one consumer.
+static bool DrainQueues() {
+    bool Wrote = false;
+    pthread_mutex_lock(&DrainLock);
+    for (log_once* Once = atomic_load(&Onces); Once; Once = Once->Next) {
+        if (!Once->Written) {
+            fputs(SeverityPrefix(Once->Severity), stdout);
+            fputs(Once->Text, stdout);
+            Once->Written = true;
+            Wrote = true;
+        }
+    }
+    for (log_queue* Queue = atomic_load(&Queues); Queue; Queue = Queue->Next) {
+        uint64_t Tail = atomic_load_explicit(&Queue->Tail, memory_order_relaxed);
+        uint64_t Head = atomic_load_explicit(&Queue->Head, memory_order_acquire);
+        for (; Tail < Head; Tail++) {
+            log_entry* Entry = &Queue->Entries[Tail % LOG_QUEUE_SIZE];
+            fputs(SeverityPrefix(Entry->Severity), stdout);
+            fputs(Entry->Text, stdout);
+            Wrote = true;
+        }
+        atomic_store_explicit(&Queue->Tail, Tail, memory_order_release);
+
+        uint64_t Dropped = atomic_load_explicit(&Queue->Dropped, memory_order_relaxed);
+        if (Dropped != Queue->ReportedDropped) {
+            printf("[warn] log: %lu lines dropped\n",
+                (unsigned long)(Dropped - Queue->ReportedDropped));
+            Queue->ReportedDropped = Dropped;
+        }
+    }
+    if (Wrote) fflush(stdout);
+    pthread_mutex_unlock(&DrainLock);
+    return Wrote;
+}
+
+static void* WriterThreadMain(void* Arg) {
+    while (1) {
+        if (!DrainQueues()) {
+            usleep(2000);
+        }
+    }
+    return NULL;
+}
+
+void FlushLog() {
+    DrainQueues();
+}
+
+log_severity GetLogLevel() {
+    const char* Level = getenv("LOG_LEVEL");
+    if (Level == NULL)                 return LOG_INFO;
+    if (strcmp(Level, "debug") == 0)   return LOG_DEBUG;
+    if (strcmp(Level, "warn") == 0)    return LOG_WARN;
+    if (strcmp(Level, "error") == 0)   return LOG_ERROR;
+    return LOG_INFO;
+}
+
+static void StartWriterThread() {
+    LogLevel = GetLogLevel();
+    atexit(FlushLog);
+
+    pthread_t WriterThread;
+    pthread_create(&WriterThread, NULL, WriterThreadMain, NULL);
+    pthread_detach(WriterThread);
+}
+
+// Each thread gets a queue the first time it logs.
+// Queues are never freed, so the writer can walk the list without locks.
+static log_queue* GetThreadQueue() {
+    if (ThreadQueue) return ThreadQueue;
+
+    pthread_once(&LogOnce, StartWriterThread);
+
+    log_queue* Queue = aligned_alloc(CACHE_LINE_SIZE, sizeof(log_queue));
+    memset(Queue, 0, sizeof(log_queue));
+
+    log_queue* Head = atomic_load(&Queues);
+    do {
+        Queue->Next = Head;
+    } while (!atomic_compare_exchange_weak(&Queues, &Head, Queue));
+
+    ThreadQueue = Queue;
+    return Queue;
+}
+
+bool LogSiteReady(log_site* Site) {
+    pthread_once(&LogOnce, StartWriterThread);
+    if (Site->Severity < LogLevel) {
+        return false;
+    }
+    if (Site->IntervalNS == 0) {
+        return true;
+    }
+
+    uint64_t Now  = GetTimeNS();
+    uint64_t Last = atomic_load_explicit(&Site->LastNS, memory_order_relaxed);
+    if ((Last != 0 && Now - Last < Site->IntervalNS) ||
+        !atomic_compare_exchange_strong(&Site->LastNS, &Last, Now)) {
+        atomic_fetch_add_explicit(&Site->Suppressed, 1, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+static void LogWriteV(log_site* Site, const char* Format, va_list Args) {
+    log_queue* Queue = GetThreadQueue();
+
+    uint64_t Head = atomic_load_explicit(&Queue->Head, memory_order_relaxed);
+    uint64_t Tail = atomic_load_explicit(&Queue->Tail, memory_order_acquire);
+    if (Head - Tail >= LOG_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&Queue->Dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    log_entry* Entry = &Queue->Entries[Head % LOG_QUEUE_SIZE];
+    Entry->Severity = Site->Severity;
+
+    int Length = vsnprintf(Entry->Text, LOG_MESSAGE_SIZE, Format, Args);
+    Length = CLAMP(0, LOG_MESSAGE_SIZE - 1, Length);
+
+    uint64_t Suppressed = atomic_exchange_explicit(&Site->Suppressed, 0,
+        memory_order_relaxed);
+    if (Suppressed) {
+        // Insert the count before the trailing newline, if there's room
+        if (Length > 0 && Entry->Text[Length - 1] == '\n') Length--;
+        snprintf(Entry->Text + Length, LOG_MESSAGE_SIZE - Length,
+            " (%lu suppressed)\n", (unsigned long)Suppressed);
+    }
+
+    atomic_store_explicit(&Queue->Head, Head + 1, memory_order_release);
+}
+
+void LogWrite(log_site* Site, const char* Format, ...) {
+    if (!LogSiteReady(Site)) {
+        return;
+    }
+
+    va_list Args;
+    va_start(Args, Format);
+    LogWriteV(Site, Format, Args);
+    va_end(Args);
+}
+
+void LogWriteReady(log_site* Site, const char* Format, ...) {
+    va_list Args;
+    va_start(Args, Format);
+    LogWriteV(Site, Format, Args);
+    va_end(Args);
+}
+
+bool LogWriteOnce(log_once* Once, const char* Format, ...) {
+    pthread_once(&LogOnce, StartWriterThread);
+    if (atomic_exchange_explicit(&Once->Claimed, true, memory_order_relaxed)) {
+        return false;
+    }
+
+    va_list Args;
+    va_start(Args, Format);
+    vsnprintf(Once->Text, LOG_MESSAGE_SIZE, Format, Args);
+    va_end(Args);
+
+    // Release, so the writer finding it in the list sees the text
+    log_once* Head = atomic_load_explicit(&Onces, memory_order_relaxed);
+    do {
+        Once->Next = Head;
+    } while (!atomic_compare_exchange_weak_explicit(&Onces, &Head, Once,
+        memory_order_release, memory_order_relaxed));
+    return true;
+}
@@ -0,0 +1,95 @@
+#if !defined(LOG_H)
+#define LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Asynchronous logging for render, acquire and event threads.
+//
+// Each thread formats its messages into its own lock-free queue, and a
+// background thread writes them to stdout, so a slow reader on the
+// other end of stdout can never stall a frame. When a thread's queue
+// is full its messages are dropped and counted instead.
+//
+// Each LOG call site can be rate limited; suppressed messages are
+// counted and reported with the next one that gets through.
+//
+// LOG_ONCE call sites keep their message in a slot of their own
+// instead, so it's written even if the thread's queue is full.
+
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR,
+} log_severity;
+
+typedef struct {
+    log_severity     Severity;
+    uint64_t         IntervalNS;  // Minimum time between messages, or 0
+    _Atomic uint64_t LastNS;
+    _Atomic uint64_t Suppressed;
+} log_site;
+
+#define LOG_SITE(Severity, IntervalMS) { (Severity), (IntervalMS) * 1000000ULL, 0, 0 }
+
+#define LOG_MESSAGE_SIZE 240
+
+// A message written at most once, from any thread, never dropped
+typedef struct log_once {
+    log_severity     Severity;
+    atomic_bool      Claimed;
+    bool             Written; // Only touched by the writer
+    struct log_once* Next;
+    char             Text[LOG_MESSAGE_SIZE];
+} log_once;
+
+#define LOG_ONCE_SITE(Severity) { (Severity), false, false, NULL, "" }
+
+#define LOG(Severity, ...) do { \
+    static log_site LogSite_ = LOG_SITE(Severity, 0); \
+    LogWrite(&LogSite_, __VA_ARGS__); \
+} while (0)
+
+// At most one message every IntervalMS from this call site
+#define LOG_RATE(Severity, IntervalMS, ...) do { \
+    static log_site LogSite_ = LOG_SITE(Severity, IntervalMS); \
+    LogWrite(&LogSite_, __VA_ARGS__); \
+} while (0)
+
+// Only the first message from this call site, whatever the log level
+#define LOG_ONCE(Severity, ...) do { \
+    static log_once LogOnce_ = LOG_ONCE_SITE(Severity); \
+    LogWriteOnce(&LogOnce_, __VA_ARGS__); \
+} while (0)
+
+// Writes a message from Site (usually via LOG/LOG_RATE),
+// unless it's below the log level or rate limited.
+void LogWrite(log_site* Site, const char* Format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// True if a message from Site would be written now. Lets call sites
+// skip expensive work (e.g. queries) for messages that would be dropped.
+// Claims the site's rate limit slot, so follow it with LogWriteReady.
+bool LogSiteReady(log_site* Site);
+
+// Writes a message from a Site already checked with LogSiteReady.
+void LogWriteReady(log_site* Site, const char* Format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Writes Once's message if no thread has yet, without blocking. Returns
+// true for the call that did.
+bool LogWriteOnce(log_once* Once, const char* Format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Messages below this severity are discarded at the call site.
+// Set from the LOG_LEVEL environment variable
+// (debug, info, warn or error), defaulting to info.
+log_severity GetLogLevel();
+
+// Writes out everything queued so far, from the calling thread.
+// Called automatically at exit.
+void FlushLog();
+
+#endif /* LOG_H */
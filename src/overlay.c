@@ -0,0 +1,221 @@
+#include "overlay.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "log.h"
+#include "utils.h"
+
+overlay_plane* CreateOverlayPlane(int drmFd, egl_display* Display,
+    overlay_kind Kind, int Width, int Height)
+{
+    kms_plane* Plane = Display->Plane;
+    uint64_t Type = (Kind == OVERLAY_KIND_CURSOR) ?
+        DRM_PLANE_TYPE_CURSOR : DRM_PLANE_TYPE_OVERLAY;
+
+    if (Kind == OVERLAY_KIND_CURSOR && (Width == 0 || Height == 0)) {
+        uint64_t CursorWidth = 64, CursorHeight = 64;
+        drmGetCap(drmFd, DRM_CAP_CURSOR_WIDTH, &CursorWidth);
+        drmGetCap(drmFd, DRM_CAP_CURSOR_HEIGHT, &CursorHeight);
+        Width  = (int)CursorWidth;
+        Height = (int)CursorHeight;
+    }
+
+    uint32_t PlaneID = ClaimPlane(drmFd, Plane->CrtcIndex, Type);
+    if (!PlaneID) {
+        printf("No free %s plane for CRTC %u\n",
+            Kind == OVERLAY_KIND_CURSOR ? "cursor" : "overlay",
+            Plane->CrtcID);
+        return NULL;
+    }
+
+    overlay_plane* Overlay = calloc(1, sizeof(overlay_plane));
+    Overlay->drmFd   = drmFd;
+    Overlay->Display = Display;
+    Overlay->Kind    = Kind;
+    Overlay->PlaneID = PlaneID;
+    Overlay->CrtcID  = Plane->CrtcID;
+    Overlay->Width   = Width;
+    Overlay->Height  = Height;
+    Overlay->ZPos    = -1;
+    Overlay->Visible = true;
+    Overlay->Dirty   = true;
+    GetPlanePropertyIDs(drmFd, PlaneID, &Overlay->Props);
+
+    for (int BufferIndex = 0; BufferIndex < OVERLAY_BUFFERS; BufferIndex++) {
+        if (!CreateDumbBuffer(drmFd, Width, Height, DRM_FORMAT_ARGB8888,
+                &Overlay->Buffers[BufferIndex])) {
+            DestroyOverlayPlane(Overlay);
+            return NULL;
+        }
+    }
+
+    printf("Using %s plane %u (%ix%i) on CRTC %u\n",
+        Kind == OVERLAY_KIND_CURSOR ? "cursor" : "overlay",
+        PlaneID, Width, Height, Plane->CrtcID);
+    return Overlay;
+}
+
+void DestroyOverlayPlane(overlay_plane* Overlay) {
+    if (Overlay->Commits > 0) {
+        drmModeAtomicReqPtr Request = drmModeAtomicAlloc();
+        drmModeAtomicAddProperty(Request, Overlay->PlaneID, Overlay->Props.FbID, 0);
+        drmModeAtomicAddProperty(Request, Overlay->PlaneID, Overlay->Props.CrtcID, 0);
+        drmModeAtomicCommit(Overlay->drmFd, Request, 0, NULL);
+        drmModeAtomicFree(Request);
+    }
+    for (int BufferIndex = 0; BufferIndex < OVERLAY_BUFFERS; BufferIndex++) {
+        DestroyDumbBuffer(&Overlay->Buffers[BufferIndex]);
+    }
+    free(Overlay);
+}
+
+dumb_buffer* BeginOverlayUpdate(overlay_plane* Overlay) {
+    // A finished buffer that was never committed hasn't been scanned
+    // out, so it can be redrawn; otherwise take the one after the
+    // shown buffer, which was shown two commits ago.
+    if (Overlay->Front != Overlay->Shown) {
+        return &Overlay->Buffers[Overlay->Front];
+    }
+    return &Overlay->Buffers[(Overlay->Shown + 1) % OVERLAY_BUFFERS];
+}
+
+void EndOverlayUpdate(overlay_plane* Overlay) {
+    if (Overlay->Front == Overlay->Shown) {
+        Overlay->Front = (Overlay->Shown + 1) % OVERLAY_BUFFERS;
+    }
+    Overlay->Dirty = true;
+}
+
+void MoveOverlay(overlay_plane* Overlay, int X, int Y) {
+    if (Overlay->X == X && Overlay->Y == Y) return;
+    Overlay->X     = X;
+    Overlay->Y     = Y;
+    Overlay->Dirty = true;
+}
+
+void SetOverlayVisible(overlay_plane* Overlay, bool Visible) {
+    if (Overlay->Visible == Visible) return;
+    Overlay->Visible = Visible;
+    Overlay->Dirty   = true;
+}
+
+bool SetOverlayZPos(overlay_plane* Overlay, int ZPos) {
+    if (ZPos < 0) {
+        printf("Plane %u: zpos %i is negative\n", Overlay->PlaneID, ZPos);
+        return false;
+    }
+    if (!Overlay->Props.ZPos) {
+        printf("Plane %u has no zpos property\n", Overlay->PlaneID);
+        return false;
+    }
+
+    bool Immutable = true;
+    drmModePropertyPtr pProperty = drmModeGetProperty(Overlay->drmFd,
+        Overlay->Props.ZPos);
+    if (pProperty) {
+        Immutable = (pProperty->flags & DRM_MODE_PROP_IMMUTABLE) != 0;
+        drmModeFreeProperty(pProperty);
+    }
+
+    if (Immutable) {
+        printf("Plane %u has a fixed zpos\n", Overlay->PlaneID);
+        return false;
+    }
+
+    Overlay->ZPos  = ZPos;
+    Overlay->Dirty = true;
+    return true;
+}
+
+static void AddOverlayState(drmModeAtomicReqPtr Request, overlay_plane* Overlay) {
+    uint32_t PlaneID = Overlay->PlaneID;
+    kms_plane_properties* Props = &Overlay->Props;
+
+    if (!Overlay->Visible) {
+        drmModeAtomicAddProperty(Request, PlaneID, Props->FbID, 0);
+        drmModeAtomicAddProperty(Request, PlaneID, Props->CrtcID, 0);
+    } else {
+        drmModeAtomicAddProperty(Request, PlaneID, Props->FbID,
+            Overlay->Buffers[Overlay->Front].Framebuffer);
+        drmModeAtomicAddProperty(Request, PlaneID, Props->CrtcID, Overlay->CrtcID);
+        AddPlaneRects(Request, PlaneID, Props,
+            Overlay->Width, Overlay->Height,
+            Overlay->X, Overlay->Y, Overlay->Width, Overlay->Height);
+        if (Props->ZPos && Overlay->ZPos >= 0) {
+            drmModeAtomicAddProperty(Request, PlaneID, Props->ZPos, Overlay->ZPos);
+        }
+    }
+}
+
+bool FlushOverlays(overlay_plane** Overlays, int Count) {
+    overlay_plane* Dirty[Count];
+    int DirtyCount = 0;
+    for (int OverlayIndex = 0; OverlayIndex < Count; OverlayIndex++) {
+        if (Overlays[OverlayIndex]->Dirty) {
+            Dirty[DirtyCount++] = Overlays[OverlayIndex];
+        }
+    }
+    if (DirtyCount == 0) return true;
+
+    // Take turns with the display's EGL flips rather than collide.
+    // Pending until the commit's flip event, so the display's loop
+    // doesn't acquire meanwhile. Marked before committing, since the
+    // event may be dispatched on another thread before the commit
+    // returns, and atomically with checking, as the acquire may be
+    // on another thread too.
+    egl_display* Display = Dirty[0]->Display;
+    if (!EGLSetPageFlipPending(Display)) {
+        for (int OverlayIndex = 0; OverlayIndex < DirtyCount; OverlayIndex++) {
+            Dirty[OverlayIndex]->DeferredCommits++;
+        }
+        return false;
+    }
+
+    drmModeAtomicReqPtr Request = drmModeAtomicAlloc();
+    for (int OverlayIndex = 0; OverlayIndex < DirtyCount; OverlayIndex++) {
+        AddOverlayState(Request, Dirty[OverlayIndex]);
+    }
+
+    int ret = drmModeAtomicCommit(Dirty[0]->drmFd, Request,
+        DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT,
+        EGLOverlayCommitData(Display));
+    int Error = errno;
+    drmModeAtomicFree(Request);
+
+    if (ret != 0) {
+        // No flip is coming
+        EGLCancelPageFlipPending(Display);
+    }
+
+    for (int OverlayIndex = 0; OverlayIndex < DirtyCount; OverlayIndex++) {
+        overlay_plane* Overlay = Dirty[OverlayIndex];
+        if (ret != 0 && Error == EBUSY) {
+            // A commit for the CRTC is still pending; try again later
+            Overlay->BusyCommits++;
+            continue;
+        }
+        if (ret != 0) {
+            // Retrying an invalid configuration won't help
+            LOG_RATE(LOG_ERROR, 1000, "Plane %u commit failed: %s\n",
+                Overlay->PlaneID, strerror(Error));
+            Overlay->Dirty  = false;
+            Overlay->Failed = true;
+            continue;
+        }
+        Overlay->Shown  = Overlay->Front;
+        Overlay->Dirty  = false;
+        Overlay->Failed = false;
+        Overlay->Commits++;
+    }
+    return ret == 0;
+}
+
+bool FlushOverlay(overlay_plane* Overlay) {
+    return FlushOverlays(&Overlay, 1);
+}
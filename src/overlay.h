@@ -0,0 +1,112 @@
+#if !defined(OVERLAY_H)
+#define OVERLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dumb.h"
+#include "egl.h"
+#include "kms.h"
+
+// Extra KMS planes stacked over a display's primary plane, so small
+// layers (HUD, cursor, logo) are composited by the display hardware
+// and update without re-rendering the display's full-screen frame:
+//
+//   overlay_plane* HUD = CreateOverlayPlane(EGL->DRMFD, Display,
+//                                           OVERLAY_KIND_OVERLAY, 256, 64);
+//   dumb_buffer* Pixels = BeginOverlayUpdate(HUD);
+//   ...draw into Pixels (ARGB8888)...
+//   EndOverlayUpdate(HUD);
+//   MoveOverlay(HUD, X, Y);
+//   ...and FlushOverlays(&HUD, 1) once per loop.
+//
+// Changes are only recorded until flushed, and FlushOverlays commits
+// every changed overlay of a display in one atomic commit, touching
+// only the overlay planes' properties.
+//
+// EGL flips the primary plane with a commit of its own inside the
+// driver, and a CRTC takes one nonblocking commit per vblank, so the
+// two would collide (EBUSY here, EGL_RESOURCE_BUSY_EXT there). Instead
+// they take turns on the display's pending flip: overlay commits wait
+// until the display's flip has landed, then hold it pending until
+// their own flip event arrives, which keeps the display's loop from
+// acquiring in between (see EGLOverlayCommitData). When both change
+// every refresh they alternate vblanks.
+//
+// Overlays are only fed from dumb buffers. An EGLStream of their own
+// would flip the CRTC with its own driver commits, outside those turns.
+
+// Buffers per overlay. A nonblocking commit only succeeds once the
+// previous one has latched, so the buffer shown two commits ago is
+// never scanned out again and can be drawn into without tearing.
+#define OVERLAY_BUFFERS 3
+
+typedef enum {
+    OVERLAY_KIND_OVERLAY, // DRM_PLANE_TYPE_OVERLAY
+    OVERLAY_KIND_CURSOR,  // DRM_PLANE_TYPE_CURSOR
+} overlay_kind;
+
+typedef struct {
+    int                  drmFd;
+    // The display on whose CRTC the plane is, and whose flips its
+    // commits take turns with
+    egl_display*         Display;
+    overlay_kind         Kind;
+    uint32_t             PlaneID;
+    uint32_t             CrtcID;
+    kms_plane_properties Props;
+    int                  Width;
+    int                  Height;
+
+    // Position on the CRTC, may be partly off screen
+    int                  X;
+    int                  Y;
+    int                  ZPos;     // -1 leaves the plane's as it is
+    bool                 Visible;
+
+    dumb_buffer          Buffers[OVERLAY_BUFFERS];
+    int                  Front;    // Latest finished buffer
+    int                  Shown;    // Latest committed buffer
+
+    // The state above changed since the last successful commit
+    bool                 Dirty;
+    bool                 Failed;   // The last commit was rejected
+
+    uint64_t             Commits;
+    uint64_t             BusyCommits;
+    // Flushes put off until the display's flip landed
+    uint64_t             DeferredCommits;
+} overlay_plane;
+
+// Claims a free plane of the given kind that can be shown on the
+// display's CRTC, and gives it blank buffers of the given size, placed
+// at the top left. A Width/Height of 0 uses the driver's cursor size
+// (DRM_CAP_CURSOR_WIDTH/HEIGHT) for cursors.
+// Returns NULL if the CRTC has no plane of that kind left, or no more
+// planes can be claimed (see ClaimPlane).
+overlay_plane* CreateOverlayPlane(int drmFd, egl_display* Display,
+    overlay_kind Kind, int Width, int Height);
+
+void DestroyOverlayPlane(overlay_plane* Overlay);
+
+// Returns the buffer to draw the overlay's next contents into.
+// Its previous contents are undefined.
+dumb_buffer* BeginOverlayUpdate(overlay_plane* Overlay);
+// Shows the buffer returned by BeginOverlayUpdate, once flushed.
+void EndOverlayUpdate(overlay_plane* Overlay);
+
+// Moving doesn't redraw the overlay, so it's all a cursor needs
+void MoveOverlay(overlay_plane* Overlay, int X, int Y);
+void SetOverlayVisible(overlay_plane* Overlay, bool Visible);
+// ZPos must be 0 or more. Returns false if the plane's zpos can't be
+// changed.
+bool SetOverlayZPos(overlay_plane* Overlay, int ZPos);
+
+// Commits the pending changes of Count overlays of the same display,
+// if any, in one commit. Returns false if they're still pending
+// because the display's flip hasn't landed or the CRTC was busy, or
+// the commit was rejected.
+bool FlushOverlays(overlay_plane** Overlays, int Count);
+bool FlushOverlay(overlay_plane* Overlay);
+
+#endif /* OVERLAY_H */
@@ -0,0 +1,245 @@
+#include "pixels.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXELS_X86 1
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define PIXELS_NEON 1
+#endif
+
+#include "utils.h"
+
+typedef void fill_row_fn(uint32_t* Dest, uint32_t Color, int Count);
+typedef void copy_row_fn(uint32_t* Dest, const uint32_t* Source, int Count);
+
+typedef struct {
+    const char*  Name;
+    fill_row_fn* Fill;
+    copy_row_fn* Copy;
+} pixel_kernels;
+
+static void FillRowScalar(uint32_t* Dest, uint32_t Color, int Count) {
+    for (int Index = 0; Index < Count; Index++) {
+        Dest[Index] = Color;
+    }
+}
+
+static void CopyRowScalar(uint32_t* Dest, const uint32_t* Source, int Count) {
+    for (int Index = 0; Index < Count; Index++) {
+        Dest[Index] = Source[Index];
+    }
+}
+
+#if PIXELS_X86
+static void FillRowSSE2(uint32_t* Dest, uint32_t Color, int Count) {
+    __m128i Value = _mm_set1_epi32((int)Color);
+    int Index = 0;
+    for (; Index + 16 <= Count; Index += 16) {
+        _mm_storeu_si128((__m128i*)&Dest[Index +  0], Value);
+        _mm_storeu_si128((__m128i*)&Dest[Index +  4], Value);
+        _mm_storeu_si128((__m128i*)&Dest[Index +  8], Value);
+        _mm_storeu_si128((__m128i*)&Dest[Index + 12], Value);
+    }
+    for (; Index + 4 <= Count; Index += 4) {
+        _mm_storeu_si128((__m128i*)&Dest[Index], Value);
+    }
+    FillRowScalar(&Dest[Index], Color, Count - Index);
+}
+
+static void CopyRowSSE2(uint32_t* Dest, const uint32_t* Source, int Count) {
+    int Index = 0;
+    for (; Index + 16 <= Count; Index += 16) {
+        __m128i A = _mm_loadu_si128((const __m128i*)&Source[Index +  0]);
+        __m128i B = _mm_loadu_si128((const __m128i*)&Source[Index +  4]);
+        __m128i C = _mm_loadu_si128((const __m128i*)&Source[Index +  8]);
+        __m128i D = _mm_loadu_si128((const __m128i*)&Source[Index + 12]);
+        _mm_storeu_si128((__m128i*)&Dest[Index +  0], A);
+        _mm_storeu_si128((__m128i*)&Dest[Index +  4], B);
+        _mm_storeu_si128((__m128i*)&Dest[Index +  8], C);
+        _mm_storeu_si128((__m128i*)&Dest[Index + 12], D);
+    }
+    for (; Index + 4 <= Count; Index += 4) {
+        _mm_storeu_si128((__m128i*)&Dest[Index],
+            _mm_loadu_si128((const __m128i*)&Source[Index]));
+    }
+    CopyRowScalar(&Dest[Index], &Source[Index], Count - Index);
+}
+
+// Built for AVX2 regardless of the compiler flags, and only called
+// if the CPU has it.
+__attribute__((target("avx2")))
+static void FillRowAVX2(uint32_t* Dest, uint32_t Color, int Count) {
+    __m256i Value = _mm256_set1_epi32((int)Color);
+    int Index = 0;
+    for (; Index + 32 <= Count; Index += 32) {
+        _mm256_storeu_si256((__m256i*)&Dest[Index +  0], Value);
+        _mm256_storeu_si256((__m256i*)&Dest[Index +  8], Value);
+        _mm256_storeu_si256((__m256i*)&Dest[Index + 16], Value);
+        _mm256_storeu_si256((__m256i*)&Dest[Index + 24], Value);
+    }
+    for (; Index + 8 <= Count; Index += 8) {
+        _mm256_storeu_si256((__m256i*)&Dest[Index], Value);
+    }
+    FillRowScalar(&Dest[Index], Color, Count - Index);
+}
+
+__attribute__((target("avx2")))
+static void CopyRowAVX2(uint32_t* Dest, const uint32_t* Source, int Count) {
+    int Index = 0;
+    for (; Index + 32 <= Count; Index += 32) {
+        __m256i A = _mm256_loadu_si256((const __m256i*)&Source[Index +  0]);
+        __m256i B = _mm256_loadu_si256((const __m256i*)&Source[Index +  8]);
+        __m256i C = _mm256_loadu_si256((const __m256i*)&Source[Index + 16]);
+        __m256i D = _mm256_loadu_si256((const __m256i*)&Source[Index + 24]);
+        _mm256_storeu_si256((__m256i*)&Dest[Index +  0], A);
+        _mm256_storeu_si256((__m256i*)&Dest[Index +  8], B);
+        _mm256_storeu_si256((__m256i*)&Dest[Index + 16], C);
+        _mm256_storeu_si256((__m256i*)&Dest[Index + 24], D);
+    }
+    for (; Index + 8 <= Count; Index += 8) {
+        _mm256_storeu_si256((__m256i*)&Dest[Index],
+            _mm256_loadu_si256((const __m256i*)&Source[Index]));
+    }
+    CopyRowScalar(&Dest[Index], &Source[Index], Count - Index);
+}
+#endif /* PIXELS_X86 */
+
+#if PIXELS_NEON
+static void FillRowNEON(uint32_t* Dest, uint32_t Color, int Count) {
+    uint32x4_t Value = vdupq_n_u32(Color);
+    int Index = 0;
+    for (; Index + 16 <= Count; Index += 16) {
+        vst1q_u32(&Dest[Index +  0], Value);
+        vst1q_u32(&Dest[Index +  4], Value);
+        vst1q_u32(&Dest[Index +  8], Value);
+        vst1q_u32(&Dest[Index + 12], Value);
+    }
+    for (; Index + 4 <= Count; Index += 4) {
+        vst1q_u32(&Dest[Index], Value);
+    }
+    FillRowScalar(&Dest[Index], Color, Count - Index);
+}
+
+static void CopyRowNEON(uint32_t* Dest, const uint32_t* Source, int Count) {
+    int Index = 0;
+    for (; Index + 16 <= Count; Index += 16) {
+        uint32x4x4_t Block = vld1q_u32_x4(&Source[Index]);
+        vst1q_u32_x4(&Dest[Index], Block);
+    }
+    for (; Index + 4 <= Count; Index += 4) {
+        vst1q_u32(&Dest[Index], vld1q_u32(&Source[Index]));
+    }
+    CopyRowScalar(&Dest[Index], &Source[Index], Count - Index);
+}
+#endif /* PIXELS_NEON */
+
+static const pixel_kernels AllKernels[] = {
+#if PIXELS_X86
+    { "avx2",   FillRowAVX2,   CopyRowAVX2   },
+    { "sse2",   FillRowSSE2,   CopyRowSSE2   },
+#endif
+#if PIXELS_NEON
+    { "neon",   FillRowNEON,   CopyRowNEON   },
+#endif
+    { "scalar", FillRowScalar, CopyRowScalar },
+};
+
+static bool KernelsSupported(const pixel_kernels* Kernels) {
+#if PIXELS_X86
+    if (strcmp(Kernels->Name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return true;
+}
+
+static pthread_once_t KernelsOnce = PTHREAD_ONCE_INIT;
+static const pixel_kernels* Kernels;
+
+static void SelectKernels() {
+    const char* Forced = getenv("PIXEL_KERNELS");
+    for (int KernelsIndex = 0; KernelsIndex < ARRAY_LEN(AllKernels); KernelsIndex++) {
+        const pixel_kernels* Candidate = &AllKernels[KernelsIndex];
+        if (!KernelsSupported(Candidate)) continue;
+        if (Forced && strcmp(Forced, Candidate->Name) != 0) continue;
+        Kernels = Candidate;
+        break;
+    }
+    if (!Kernels) {
+        printf("PIXEL_KERNELS=%s isn't available, using the default\n", Forced);
+        for (int KernelsIndex = 0; !Kernels; KernelsIndex++) {
+            if (KernelsSupported(&AllKernels[KernelsIndex])) {
+                Kernels = &AllKernels[KernelsIndex];
+            }
+        }
+    }
+}
+
+static inline const pixel_kernels* GetKernels() {
+    pthread_once(&KernelsOnce, SelectKernels);
+    return Kernels;
+}
+
+const char* PixelKernelsName() {
+    return GetKernels()->Name;
+}
+
+void FillRow(uint32_t* Dest, uint32_t Color, int Count) {
+    GetKernels()->Fill(Dest, Color, Count);
+}
+
+void CopyRow(uint32_t* Dest, const uint32_t* Source, int Count) {
+    GetKernels()->Copy(Dest, Source, Count);
+}
+
+// Clips the rect to the tile; returns false if nothing is left.
+// SkipX/SkipY are how much was cut off the left and top.
+static bool ClipRect(pixel_tile* Tile, int* X, int* Y, int* Width, int* Height,
+    int* SkipX, int* SkipY)
+{
+    int X0 = MAX(*X, Tile->X);
+    int Y0 = MAX(*Y, Tile->Y);
+    int X1 = MIN(*X + *Width,  Tile->X + Tile->Width);
+    int Y1 = MIN(*Y + *Height, Tile->Y + Tile->Height);
+    if (X1 <= X0 || Y1 <= Y0) return false;
+
+    *SkipX  = X0 - *X;
+    *SkipY  = Y0 - *Y;
+    *X      = X0;
+    *Y      = Y0;
+    *Width  = X1 - X0;
+    *Height = Y1 - Y0;
+    return true;
+}
+
+void FillRect(pixel_tile* Tile, int X, int Y, int Width, int Height, uint32_t Color) {
+    int SkipX, SkipY;
+    if (!ClipRect(Tile, &X, &Y, &Width, &Height, &SkipX, &SkipY)) return;
+
+    fill_row_fn* Fill = GetKernels()->Fill;
+    for (int Row = Y; Row < Y + Height; Row++) {
+        Fill(&Tile->Pixels[(size_t)Row * Tile->Stride + X], Color, Width);
+    }
+}
+
+void BlitRect(pixel_tile* Tile, int X, int Y, int Width, int Height,
+    const uint32_t* Source, int SourceStride)
+{
+    int SkipX, SkipY;
+    if (!ClipRect(Tile, &X, &Y, &Width, &Height, &SkipX, &SkipY)) return;
+
+    copy_row_fn* Copy = GetKernels()->Copy;
+    Source += (size_t)SkipY * SourceStride + SkipX;
+    for (int Row = 0; Row < Height; Row++) {
+        Copy(&Tile->Pixels[(size_t)(Y + Row) * Tile->Stride + X],
+            &Source[(size_t)Row * SourceStride], Width);
+    }
+}
@@ -0,0 +1,34 @@
+#if !defined(PIXELS_H)
+#define PIXELS_H
+
+#include <stdint.h>
+
+// CPU drawing into 32 bit per pixel framebuffers (e.g. dumb buffers,
+// see soft.h). The row kernels are picked for the CPU on first use:
+// AVX2 or SSE2 on x86, NEON on ARM, or plain C. PIXEL_KERNELS=scalar,
+// sse2, avx2 or neon forces a set, e.g. to compare them.
+
+// Part of a framebuffer to draw into, e.g. one tile of a frame.
+// Drawing is clipped to the tile, so tiles can be drawn in parallel
+// with the same calls.
+typedef struct {
+    uint32_t* Pixels; // Top left of the framebuffer
+    int       Stride; // Pixels per row
+    int       X;
+    int       Y;
+    int       Width;
+    int       Height;
+} pixel_tile;
+
+// Name of the kernels in use
+const char* PixelKernelsName();
+
+void FillRow(uint32_t* Dest, uint32_t Color, int Count);
+void CopyRow(uint32_t* Dest, const uint32_t* Source, int Count);
+
+// Rects are in framebuffer pixels and clipped to the tile
+void FillRect(pixel_tile* Tile, int X, int Y, int Width, int Height, uint32_t Color);
+void BlitRect(pixel_tile* Tile, int X, int Y, int Width, int Height,
+    const uint32_t* Source, int SourceStride);
+
+#endif /* PIXELS_H */
@@ -0,0 +1,292 @@
+#include "readback.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "threads.h"
+#include "utils.h"
+
+// How long DestroyReadback waits for the GPU and consumers
+#define READBACK_DRAIN_TIMEOUT_NS 1000000000ULL
+
+static void* ReadbackWorkerMain(void* Arg) {
+    readback* Readback = Arg;
+
+    char Name[32];
+    snprintf(Name, sizeof(Name), "Readback %i", Readback->Display->Index);
+    ApplyThreadProfile(Name,
+        GetThreadProfile("READBACK_THREAD_PROFILE", Readback->Display->Index));
+
+    uint32_t Tail = 0;
+    while (1) {
+        uint32_t Head;
+        while ((Head = atomic_load_explicit(&Readback->QueueHead,
+                    memory_order_acquire)) == Tail) {
+            if (atomic_load_explicit(&Readback->Stop, memory_order_relaxed)) {
+                return NULL;
+            }
+            FutexWait(&Readback->QueueHead, Tail, 100);
+        }
+
+        for (; Tail != Head; Tail++) {
+            readback_slot* Slot = &Readback->Slots[Readback->Queue[Tail % READBACK_SLOTS]];
+
+            uint64_t StartNS = GetTimeNS();
+            for (int Index = 0; Index < Readback->ConsumersCount; Index++) {
+                Readback->Consumers[Index](&Slot->Frame, Readback->ConsumersData[Index]);
+            }
+            atomic_fetch_add_explicit(&Readback->ConsumerNS, GetTimeNS() - StartNS,
+                memory_order_relaxed);
+            atomic_fetch_add_explicit(&Readback->Delivered, 1, memory_order_relaxed);
+
+            // The pipeline's reference
+            ReleaseReadbackFrame(&Slot->Frame);
+        }
+        atomic_store_explicit(&Readback->QueueTail, Tail, memory_order_release);
+    }
+}
+
+readback* CreateReadback(egl_display* Display) {
+    GLint Major = 0, Minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &Major);
+    glGetIntegerv(GL_MINOR_VERSION, &Minor);
+    if (Major * 10 + Minor < 44) {
+        printf("%s: readback needs GL 4.4 for persistent mapping, have %i.%i\n",
+            Display->MonitorName, Major, Minor);
+        return NULL;
+    }
+
+    readback* Readback = calloc(1, sizeof(readback));
+    Readback->Display = Display;
+    Readback->Width   = Display->Width;
+    Readback->Height  = Display->Height;
+    atomic_init(&Readback->Continuous, false);
+    atomic_init(&Readback->Interval, 1);
+    atomic_init(&Readback->Requested, 0);
+    atomic_init(&Readback->QueueHead, 0);
+    atomic_init(&Readback->QueueTail, 0);
+    atomic_init(&Readback->Stop, false);
+    atomic_init(&Readback->Delivered, 0);
+    atomic_init(&Readback->ConsumerNS, 0);
+    StatReset(&Readback->Latency);
+
+    int Pitch = Readback->Width * 4;
+    GLsizeiptr Size = (GLsizeiptr)Pitch * Readback->Height;
+    GLbitfield Flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (int SlotIndex = 0; SlotIndex < READBACK_SLOTS; SlotIndex++) {
+        readback_slot* Slot = &Readback->Slots[SlotIndex];
+        glGenBuffers(1, &Slot->Buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, Slot->Buffer);
+        glBufferStorage(GL_PIXEL_PACK_BUFFER, Size, NULL, Flags);
+        Slot->Mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, Size, Flags);
+        if (!Slot->Mapped) {
+            Fatal("%s: couldn't map readback buffer\n", Display->MonitorName);
+        }
+        atomic_init(&Slot->Refs, 0);
+
+        readback_frame* Frame = &Slot->Frame;
+        Frame->Pixels   = Slot->Mapped + (size_t)(Readback->Height - 1) * Pitch;
+        Frame->Stride   = -Pitch;
+        Frame->Width    = Readback->Width;
+        Frame->Height   = Readback->Height;
+        Frame->Readback = Readback;
+        Frame->Slot     = SlotIndex;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if (pthread_create(&Readback->Worker, NULL, ReadbackWorkerMain, Readback)) {
+        Fatal("Couldn't create readback thread\n");
+    }
+    printf("%s: readback with %i buffers of %ix%i\n", Display->MonitorName,
+        READBACK_SLOTS, Readback->Width, Readback->Height);
+    return Readback;
+}
+
+void AddReadbackConsumer(readback* Readback, const char* Name,
+    readback_consumer Consumer, void* UserData)
+{
+    if (Readback->ConsumersCount == READBACK_MAX_CONSUMERS) {
+        Fatal("Too many readback consumers\n");
+    }
+    int Index = Readback->ConsumersCount++;
+    Readback->Consumers[Index]      = Consumer;
+    Readback->ConsumersData[Index]  = UserData;
+    Readback->ConsumersNames[Index] = Name;
+}
+
+void SetReadbackContinuous(readback* Readback, bool Continuous) {
+    atomic_store_explicit(&Readback->Continuous, Continuous, memory_order_relaxed);
+}
+
+void SetReadbackInterval(readback* Readback, int Interval) {
+    atomic_store_explicit(&Readback->Interval, MAX(Interval, 1), memory_order_relaxed);
+}
+
+void RequestReadback(readback* Readback, int Count) {
+    atomic_fetch_add_explicit(&Readback->Requested, Count, memory_order_relaxed);
+}
+
+// Passes slots whose fences have signalled to the worker, oldest
+// first, so frames reach the consumers in order.
+static void CollectReadbacks(readback* Readback) {
+    while (1) {
+        readback_slot* Oldest = NULL;
+        for (int SlotIndex = 0; SlotIndex < READBACK_SLOTS; SlotIndex++) {
+            readback_slot* Slot = &Readback->Slots[SlotIndex];
+            if (Slot->InFlight &&
+                (!Oldest || Slot->Frame.Frame < Oldest->Frame.Frame)) {
+                Oldest = Slot;
+            }
+        }
+        if (!Oldest) {
+            return;
+        }
+
+        GLenum Result = glClientWaitSync(Oldest->Fence, 0, 0);
+        if (Result == GL_TIMEOUT_EXPIRED) {
+            return;
+        }
+        if (Result == GL_WAIT_FAILED) {
+            LOG_RATE(LOG_WARN, 1000, "%20s readback fence wait failed\n",
+                Readback->Display->MonitorName);
+        }
+        glDeleteSync(Oldest->Fence);
+        Oldest->Fence    = NULL;
+        Oldest->InFlight = false;
+        Oldest->Frame.ReadyNS = GetTimeNS();
+        StatAdd(&Readback->Latency,
+            (Oldest->Frame.ReadyNS - Oldest->Frame.ReadNS) / 1000000.0);
+
+        uint32_t Head = atomic_load_explicit(&Readback->QueueHead, memory_order_relaxed);
+        Readback->Queue[Head % READBACK_SLOTS] = Oldest->Frame.Slot;
+        atomic_store_explicit(&Readback->QueueHead, Head + 1, memory_order_release);
+        FutexWake(&Readback->QueueHead);
+    }
+}
+
+static readback_slot* FindFreeSlot(readback* Readback) {
+    for (int SlotIndex = 0; SlotIndex < READBACK_SLOTS; SlotIndex++) {
+        readback_slot* Slot = &Readback->Slots[SlotIndex];
+        if (!Slot->InFlight &&
+            atomic_load_explicit(&Slot->Refs, memory_order_acquire) == 0) {
+            return Slot;
+        }
+    }
+    return NULL;
+}
+
+// One-off requests are only used up once there's a slot to capture
+// into, so they're never dropped.
+static bool ReadbackDue(readback* Readback, uint64_t Frame, bool CanCapture) {
+    uint32_t Requested = atomic_load_explicit(&Readback->Requested, memory_order_relaxed);
+    while (Requested > 0) {
+        if (!CanCapture) {
+            return true;
+        }
+        if (atomic_compare_exchange_weak_explicit(&Readback->Requested,
+                &Requested, Requested - 1, memory_order_relaxed, memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return atomic_load_explicit(&Readback->Continuous, memory_order_relaxed) &&
+        Frame % atomic_load_explicit(&Readback->Interval, memory_order_relaxed) == 0;
+}
+
+void CaptureReadback(readback* Readback) {
+    uint64_t StartNS = GetTimeNS();
+    egl_display* Display = Readback->Display;
+
+    CollectReadbacks(Readback);
+
+    uint64_t Frame = Display->Hot->Timing.Frame;
+    readback_slot* Free = FindFreeSlot(Readback);
+    if (ReadbackDue(Readback, Frame, Free != NULL)) {
+        if (Free) {
+            atomic_store_explicit(&Free->Refs, 1, memory_order_relaxed);
+            Free->InFlight     = true;
+            Free->Frame.Frame  = Frame;
+            Free->Frame.ReadNS = GetTimeNS();
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, Free->Buffer);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, Readback->Width, Readback->Height,
+                GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            Free->Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // Without a swap after it (e.g. surfaceless), nothing else
+            // would submit the fence
+            glFlush();
+            Readback->Captured++;
+        } else {
+            Readback->Dropped++;
+        }
+    }
+
+    StatAdd(&Display->Hot->Timing.Readback, (GetTimeNS() - StartNS) / 1000000.0);
+}
+
+void RetainReadbackFrame(readback_frame* Frame) {
+    atomic_fetch_add_explicit(&Frame->Readback->Slots[Frame->Slot].Refs, 1,
+        memory_order_relaxed);
+}
+
+void ReleaseReadbackFrame(readback_frame* Frame) {
+    // Release, so the consumer's reads finish before the slot is reused
+    atomic_fetch_sub_explicit(&Frame->Readback->Slots[Frame->Slot].Refs, 1,
+        memory_order_release);
+}
+
+void ReportReadback(readback* Readback) {
+    uint64_t Delivered  = atomic_exchange_explicit(&Readback->Delivered, 0,
+        memory_order_relaxed);
+    uint64_t ConsumerNS = atomic_exchange_explicit(&Readback->ConsumerNS, 0,
+        memory_order_relaxed);
+    LOG(LOG_INFO, "%20s readback: %lu captured, %lu dropped, %lu delivered, "
+        "read-to-ready %.2fms (max %.2f), consumers %.2fms per frame\n",
+        Readback->Display->MonitorName,
+        (unsigned long)Readback->Captured, (unsigned long)Readback->Dropped,
+        (unsigned long)Delivered,
+        StatAverage(&Readback->Latency), Readback->Latency.Max,
+        Delivered ? ConsumerNS / 1000000.0 / Delivered : 0);
+    StatReset(&Readback->Latency);
+    Readback->Captured = 0;
+    Readback->Dropped  = 0;
+}
+
+void DestroyReadback(readback* Readback) {
+    for (int SlotIndex = 0; SlotIndex < READBACK_SLOTS; SlotIndex++) {
+        readback_slot* Slot = &Readback->Slots[SlotIndex];
+        if (Slot->InFlight) {
+            glClientWaitSync(Slot->Fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                READBACK_DRAIN_TIMEOUT_NS);
+        }
+    }
+    CollectReadbacks(Readback);
+
+    // Wait for the worker to run everything queued
+    uint64_t DeadlineNS = GetTimeNS() + READBACK_DRAIN_TIMEOUT_NS;
+    while (atomic_load_explicit(&Readback->QueueTail, memory_order_acquire) !=
+           atomic_load_explicit(&Readback->QueueHead, memory_order_relaxed) &&
+           GetTimeNS() < DeadlineNS) {
+        usleep(1000);
+    }
+    atomic_store_explicit(&Readback->Stop, true, memory_order_relaxed);
+    FutexWake(&Readback->QueueHead);
+    pthread_join(Readback->Worker, NULL);
+
+    for (int SlotIndex = 0; SlotIndex < READBACK_SLOTS; SlotIndex++) {
+        readback_slot* Slot = &Readback->Slots[SlotIndex];
+        if (atomic_load_explicit(&Slot->Refs, memory_order_acquire) != 0) {
+            printf("%s: readback frame still retained at exit\n",
+                Readback->Display->MonitorName);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, Slot->Buffer);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glDeleteBuffers(1, &Slot->Buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    free(Readback);
+}
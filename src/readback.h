@@ -0,0 +1,139 @@
+#if !defined(READBACK_H)
+#define READBACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <GL/glew.h>
+
+#include "egl.h"
+
+// Reads frames back from a display without stalling its render loop.
+//
+// CaptureReadback, called by the display's render thread after drawing
+// a frame, issues glReadPixels into one of a ring of pixel buffer
+// objects and fences it; nothing waits for the GPU there. Each later
+// call checks the fences without blocking, and hands finished buffers
+// to the display's readback worker thread, which runs the consumers
+// (file writers, checksums, encoders...) on them.
+//
+// The buffers are persistently mapped (GL 4.4 / ARB_buffer_storage), so
+// consumers read the pixels straight from the mapping, with no copy.
+// A buffer returns to the ring once every consumer is done with it;
+// while all are busy, frames due for capture are dropped (counted)
+// rather than waited for.
+//
+//   readback* Readback = CreateReadback(Display);  // context current
+//   AddReadbackConsumer(Readback, "checksum", Checksum, NULL);
+//   SetReadbackContinuous(Readback, true);
+//   ...
+//   BeginFrame(Display); ...render...
+//   CaptureReadback(Readback);
+//   EndFrame(Display); swap
+//
+// The render thread's cost per frame shows in the frame stats (see
+// frame.h); ReportReadback logs the rest.
+
+#define READBACK_SLOTS        4
+#define READBACK_MAX_CONSUMERS 4
+
+typedef struct readback readback;
+
+// A captured frame in BGRA (DRM_FORMAT_ARGB8888 order), pointing into
+// its buffer's mapping. GL reads bottom up, so Pixels is the top row
+// and Stride (in bytes) is negative: row Y is at Pixels + Y * Stride.
+typedef struct {
+    const uint8_t* Pixels;
+    int            Stride;
+    int            Width;
+    int            Height;
+    uint64_t       Frame;   // The display's frame number (see frame.h)
+    uint64_t       ReadNS;  // When glReadPixels was issued
+    uint64_t       ReadyNS; // When its fence was seen signalled
+    readback*      Readback;
+    int            Slot;
+} readback_frame;
+
+// Called on the worker thread for every captured frame, in order.
+// The frame is only valid until the consumer returns, unless it takes
+// a reference with RetainReadbackFrame, to be released later, from
+// any thread, with ReleaseReadbackFrame.
+typedef void (*readback_consumer)(readback_frame* Frame, void* UserData);
+
+typedef struct {
+    GLuint           Buffer;
+    uint8_t*         Mapped;
+    frame_fence      Fence;
+    bool             InFlight; // Render thread only
+    // References: the pipeline's until its consumers have run, plus
+    // those consumers retained. 0 when the slot is free.
+    _Atomic uint32_t Refs;
+    readback_frame   Frame;
+} readback_slot;
+
+struct readback {
+    egl_display*  Display;
+    int           Width;
+    int           Height;
+    readback_slot Slots[READBACK_SLOTS];
+
+    readback_consumer Consumers[READBACK_MAX_CONSUMERS];
+    void*             ConsumersData[READBACK_MAX_CONSUMERS];
+    const char*       ConsumersNames[READBACK_MAX_CONSUMERS];
+    int               ConsumersCount;
+
+    // Control, from any thread
+    atomic_bool      Continuous;
+    _Atomic uint32_t Interval;  // Continuous capture every Nth frame
+    _Atomic uint32_t Requested; // One-off captures still to take
+
+    // Slots finished on the GPU, from the render thread to the worker.
+    // Head is also the futex the worker waits on.
+    int              Queue[READBACK_SLOTS];
+    _Atomic uint32_t QueueHead;
+    _Atomic uint32_t QueueTail;
+    atomic_bool      Stop;
+    pthread_t        Worker;
+
+    // Counters, for ReportReadback
+    frame_stat       Latency; // Render thread: ms from read to fence
+    uint64_t         Captured;
+    uint64_t         Dropped;
+    _Atomic uint64_t Delivered;  // Worker thread
+    _Atomic uint64_t ConsumerNS;
+};
+
+// Creates the display's buffers and starts its worker thread, with the
+// display's context current. Frames are read from the framebuffer bound
+// for reading when CaptureReadback is called, at the display's size.
+// Returns NULL (printing why) without GL 4.4 or ARB_buffer_storage.
+readback* CreateReadback(egl_display* Display);
+
+// Consumers are added before capturing starts.
+void AddReadbackConsumer(readback* Readback, const char* Name,
+    readback_consumer Consumer, void* UserData);
+
+// Runtime control, from any thread: capture every Interval'th frame
+// while continuous, and/or the next Count frames once.
+void SetReadbackContinuous(readback* Readback, bool Continuous);
+void SetReadbackInterval(readback* Readback, int Interval);
+void RequestReadback(readback* Readback, int Count);
+
+// On the render thread, after drawing the frame (before swapping):
+// hands finished readbacks to the worker, and reads this frame back if
+// it's due for capture.
+void CaptureReadback(readback* Readback);
+
+void RetainReadbackFrame(readback_frame* Frame);
+void ReleaseReadbackFrame(readback_frame* Frame);
+
+// Logs captures, drops, and latency and consumer time since the last
+// report, from the render thread.
+void ReportReadback(readback* Readback);
+
+// Waits for outstanding readbacks and consumers, then frees
+// everything; with the display's context current.
+void DestroyReadback(readback* Readback);
+
+#endif /* READBACK_H */
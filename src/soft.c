@@ -0,0 +1,417 @@
+#include "soft.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "color.h"
+#include "utils.h"
+
+static int GetEnvInt(const char* Name, int Default) {
+    const char* Value = getenv(Name);
+    return Value ? atoi(Value) : Default;
+}
+
+soft_options DefaultSoftOptions() {
+    soft_options Options = {
+        .Buffers = CLAMP(2, SOFT_MAX_BUFFERS, GetEnvInt("SOFT_BUFFERS", SOFT_MAX_BUFFERS)),
+        .Workers = GetEnvInt("SOFT_WORKERS", 0),
+    };
+    return Options;
+}
+
+static bool HasConnectors(int drmFd) {
+    drmModeResPtr pModeRes = drmModeGetResources(drmFd);
+    if (pModeRes == NULL) {
+        return false;
+    }
+    bool Result = pModeRes->count_connectors > 0;
+    drmModeFreeResources(pModeRes);
+    return Result;
+}
+
+static int OpenDumbDevice() {
+    // Open with nonblock, as GetDrmFd does, so drmHandleEvent can
+    // be polled without blocking
+    const char* Path = getenv("DRI_DEVICE");
+    if (Path) {
+        int fd = open(Path, O_RDWR | O_NONBLOCK, 0);
+        if (fd < 0) {
+            Fatal("Unable to open %s: %m\n", Path);
+        }
+        printf("Device file: %s\n", Path);
+        return fd;
+    }
+
+    for (int CardIndex = 0; CardIndex < 16; CardIndex++) {
+        char CardPath[32];
+        snprintf(CardPath, sizeof(CardPath), "/dev/dri/card%i", CardIndex);
+        int fd = open(CardPath, O_RDWR | O_NONBLOCK, 0);
+        if (fd < 0) {
+            continue;
+        }
+        uint64_t HasDumb = 0;
+        if (drmGetCap(fd, DRM_CAP_DUMB_BUFFER, &HasDumb) == 0 && HasDumb &&
+            HasConnectors(fd)) {
+            printf("Device file: %s\n", CardPath);
+            return fd;
+        }
+        close(fd);
+    }
+    Fatal("No DRM device with dumb buffers and connectors found\n");
+    return -1;
+}
+
+soft_state* SetupSoftware(soft_options Options) {
+    soft_state* Soft = calloc(1, sizeof(soft_state));
+    Soft->Options = Options;
+
+    int drmFd = OpenDumbDevice();
+
+    egl_state* EGL = calloc(1, sizeof(egl_state));
+    kms_plane* Planes = SetDisplayModes(drmFd, &EGL->DisplaysCount);
+    if (EGL->DisplaysCount == 0) {
+        Fatal("No connected displays\n");
+    }
+
+    // Color correction at scanout (see color.h)
+    const char* ColorProfilesPath = getenv("COLOR_PROFILES");
+    if (ColorProfilesPath) {
+        ApplyColorProfilesFile(ColorProfilesPath, drmFd, Planes, EGL->DisplaysCount);
+    }
+
+    EGL->DRMFD    = drmFd;
+    EGL->Displays = CreateDisplays(Planes, EGL->DisplaysCount);
+    EGLInitDRMEvents(EGL);
+    Soft->EGL = EGL;
+
+    Soft->Displays = calloc(EGL->DisplaysCount, sizeof(soft_display));
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display*  Display     = &EGL->Displays[DisplayIndex];
+        soft_display* SoftDisplay = &Soft->Displays[DisplayIndex];
+
+        SoftDisplay->Display      = Display;
+        SoftDisplay->BuffersCount = Options.Buffers;
+        SoftDisplay->Shown        = -1;
+        SoftDisplay->Replaced     = -1;
+        SoftDisplay->Queued       = -1;
+        SoftDisplay->Back         = -1;
+        SoftDisplay->RenderWidth  = Display->Width;
+        SoftDisplay->RenderHeight = Display->Height;
+        GetPlanePropertyIDs(drmFd, Display->Plane->PlaneID, &SoftDisplay->Props);
+
+        for (int BufferIndex = 0; BufferIndex < Options.Buffers; BufferIndex++) {
+            if (!CreateDumbBuffer(drmFd, Display->Width, Display->Height,
+                    DRM_FORMAT_XRGB8888, &SoftDisplay->Buffers[BufferIndex])) {
+                Fatal("Unable to create framebuffers for %s\n", Display->MonitorName);
+            }
+        }
+
+        int TilesX = (Display->Width  + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+        int TilesY = (Display->Height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+        SoftDisplay->Tiles = calloc(TilesX * TilesY, sizeof(int));
+        StatReset(&SoftDisplay->RenderTime);
+    }
+
+    Soft->Workers = CreateWorkerPool(Options.Workers);
+
+    printf("Software rendering: %i buffers per display, %i workers, %s kernels\n",
+        Options.Buffers, Soft->Workers->ThreadsCount + 1, PixelKernelsName());
+    return Soft;
+}
+
+static bool BufferFree(soft_display* SoftDisplay, int BufferIndex) {
+    if (BufferIndex == SoftDisplay->Shown || BufferIndex == SoftDisplay->Queued) {
+        return false;
+    }
+    // Scanned out until the flip away from it completes
+    return BufferIndex != SoftDisplay->Replaced ||
+        !EGLPageFlipPending(SoftDisplay->Display);
+}
+
+// The free buffer rendered most recently, so the fewest frames of
+// damage need catching up; -1 if none is free.
+static int PickBackBuffer(soft_display* SoftDisplay) {
+    int Back = -1;
+    for (int BufferIndex = 0; BufferIndex < SoftDisplay->BuffersCount; BufferIndex++) {
+        if (!BufferFree(SoftDisplay, BufferIndex)) continue;
+        if (Back < 0 ||
+            SoftDisplay->BufferFrame[BufferIndex] > SoftDisplay->BufferFrame[Back]) {
+            Back = BufferIndex;
+        }
+    }
+    return Back;
+}
+
+bool SoftFrameAvailable(soft_state* Soft, egl_display* Display) {
+    return PickBackBuffer(&Soft->Displays[Display->Index]) >= 0;
+}
+
+static bool RectsOverlap(damage_rect* A, damage_rect* B) {
+    return A->X < B->X + B->Width  && B->X < A->X + A->Width &&
+           A->Y < B->Y + B->Height && B->Y < A->Y + A->Height;
+}
+
+typedef struct {
+    soft_display*    SoftDisplay;
+    dumb_buffer*     Buffer;
+    int              TilesX;
+    soft_render_func Render;
+    void*            UserData;
+} soft_frame_jobs;
+
+static void RenderTileJob(int Job, void* UserData) {
+    soft_frame_jobs* Jobs = UserData;
+    soft_display* SoftDisplay = Jobs->SoftDisplay;
+    int Tile = SoftDisplay->Tiles[Job];
+
+    pixel_tile PixelTile = {
+        .Pixels = (uint32_t*)Jobs->Buffer->Pixels,
+        .Stride = Jobs->Buffer->Pitch / sizeof(uint32_t),
+        .X      = (Tile % Jobs->TilesX) * SOFT_TILE_SIZE,
+        .Y      = (Tile / Jobs->TilesX) * SOFT_TILE_SIZE,
+    };
+    PixelTile.Width  = MIN(SOFT_TILE_SIZE, SoftDisplay->RenderWidth  - PixelTile.X);
+    PixelTile.Height = MIN(SOFT_TILE_SIZE, SoftDisplay->RenderHeight - PixelTile.Y);
+
+    Jobs->Render(SoftDisplay->Display, &PixelTile, Jobs->UserData);
+}
+
+bool RenderSoftFrame(soft_state* Soft, egl_display* Display,
+    damage_rect* Rects, int Count, soft_render_func Render, void* UserData)
+{
+    soft_display* SoftDisplay = &Soft->Displays[Display->Index];
+    int Back = PickBackBuffer(SoftDisplay);
+    if (Back < 0) {
+        return false;
+    }
+    uint64_t StartNS = GetTimeNS();
+
+    SoftDisplay->Back = Back;
+    uint64_t Frame = ++SoftDisplay->Frame;
+    damage_rect Full = { 0, 0, SoftDisplay->RenderWidth, SoftDisplay->RenderHeight };
+
+    // This frame's rects, remembered for the other buffers
+    int Slot = Frame % SOFT_MAX_BUFFERS;
+    damage_rect* Current = SoftDisplay->History[Slot];
+    int CurrentCount = MIN(Count, MAX_DAMAGE_RECTS);
+    if (CurrentCount == 0) {
+        Current[0] = Full;
+        CurrentCount = 1;
+    } else {
+        memcpy(Current, Rects, CurrentCount * sizeof(damage_rect));
+    }
+    SoftDisplay->HistoryCount[Slot] = CurrentCount;
+
+    // Plus what the frames since this buffer was last rendered changed
+    damage_rect Needed[MAX_DAMAGE_RECTS * SOFT_MAX_BUFFERS];
+    int NeededCount = 0;
+    uint64_t BufferFrame = SoftDisplay->BufferFrame[Back];
+    if (BufferFrame == 0 || Frame - BufferFrame > SOFT_MAX_BUFFERS) {
+        Needed[NeededCount++] = Full;
+    } else {
+        for (uint64_t Past = BufferFrame + 1; Past <= Frame; Past++) {
+            int PastSlot = Past % SOFT_MAX_BUFFERS;
+            for (int RectIndex = 0; RectIndex < SoftDisplay->HistoryCount[PastSlot]; RectIndex++) {
+                Needed[NeededCount++] = SoftDisplay->History[PastSlot][RectIndex];
+            }
+        }
+    }
+
+    int TilesX = (SoftDisplay->RenderWidth  + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    int TilesY = (SoftDisplay->RenderHeight + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    int TilesCount = 0;
+    for (int Tile = 0; Tile < TilesX * TilesY; Tile++) {
+        damage_rect TileRect = {
+            (Tile % TilesX) * SOFT_TILE_SIZE, (Tile / TilesX) * SOFT_TILE_SIZE,
+            SOFT_TILE_SIZE, SOFT_TILE_SIZE
+        };
+        for (int RectIndex = 0; RectIndex < NeededCount; RectIndex++) {
+            if (RectsOverlap(&TileRect, &Needed[RectIndex])) {
+                SoftDisplay->Tiles[TilesCount++] = Tile;
+                break;
+            }
+        }
+    }
+
+    soft_frame_jobs Jobs = {
+        .SoftDisplay = SoftDisplay,
+        .Buffer      = &SoftDisplay->Buffers[Back],
+        .TilesX      = TilesX,
+        .Render      = Render,
+        .UserData    = UserData,
+    };
+    RunWorkers(Soft->Workers, TilesCount, RenderTileJob, &Jobs);
+
+    SoftDisplay->BufferFrame[Back] = Frame;
+    SoftDisplay->Queued = Back;
+    SoftDisplay->Back   = -1;
+    memcpy(SoftDisplay->QueuedRects, Current, CurrentCount * sizeof(damage_rect));
+    SoftDisplay->QueuedCount = CurrentCount;
+
+    StatAdd(&SoftDisplay->RenderTime, (GetTimeNS() - StartNS) / 1000000.0);
+    return true;
+}
+
+// Forgets the buffers' contents, so the next frames are fully rendered
+static void InvalidateBuffers(soft_display* SoftDisplay) {
+    memset(SoftDisplay->BufferFrame, 0, sizeof(SoftDisplay->BufferFrame));
+}
+
+static bool CommitQueued(soft_state* Soft, soft_display* SoftDisplay) {
+    egl_display* Display = SoftDisplay->Display;
+    kms_plane* Plane = Display->Plane;
+    kms_plane_properties* Props = &SoftDisplay->Props;
+    int drmFd = Soft->EGL->DRMFD;
+    bool Scaled = SoftDisplay->RenderWidth  != Display->Width ||
+                  SoftDisplay->RenderHeight != Display->Height;
+
+    // Mark the flip pending before committing, since its event may be
+    // dispatched on another thread before the commit returns. If an
+    // overlay commit beat us to it, the frame stays queued.
+    if (!EGLSetPageFlipPending(Display)) {
+        return false;
+    }
+
+    drmModeAtomicReqPtr pAtomic = drmModeAtomicAlloc();
+    drmModeAtomicAddProperty(pAtomic, Plane->PlaneID, Props->FbID,
+        SoftDisplay->Buffers[SoftDisplay->Queued].Framebuffer);
+    drmModeAtomicAddProperty(pAtomic, Plane->PlaneID, Props->CrtcID, Plane->CrtcID);
+    AddPlaneRects(pAtomic, Plane->PlaneID, Props,
+        SoftDisplay->RenderWidth, SoftDisplay->RenderHeight,
+        0, 0, Display->Width, Display->Height);
+
+    // Damage is in display pixels, so only meaningful unscaled
+    uint32_t Clips = 0;
+    if (Plane->DamageClipsProperty && !Scaled) {
+        Clips = CreateDamageClipsBlob(drmFd, SoftDisplay->QueuedRects,
+            SoftDisplay->QueuedCount);
+        if (Clips) {
+            drmModeAtomicAddProperty(pAtomic, Plane->PlaneID,
+                Plane->DamageClipsProperty, Clips);
+        }
+    }
+
+    writeback_capture* Capture = SoftDisplay->Capture;
+    if (Capture) {
+        AddWritebackCapture(Capture, pAtomic);
+    }
+
+    uint64_t CommitNS = GetTimeNS();
+
+    int ret = drmModeAtomicCommit(drmFd, pAtomic,
+        DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, Display);
+    int Error = errno;
+    drmModeAtomicFree(pAtomic);
+    if (Clips) {
+        drmModeDestroyPropertyBlob(drmFd, Clips);
+    }
+    if (Capture) {
+        // Frames are stamped with their soft frame number
+        FinishWritebackCommit(Capture, ret == 0, CommitNS);
+        if (ret == 0) {
+            RecordFrameStamp(Capture,
+                (uint32_t)SoftDisplay->BufferFrame[SoftDisplay->Queued], CommitNS);
+        }
+    }
+
+    if (ret != 0) {
+        EGLCancelPageFlipPending(Display);
+        if (Error == EBUSY) {
+            // Another commit for the CRTC is pending; stays queued
+            SoftDisplay->BusyCommits++;
+            return false;
+        }
+
+        if (Scaled) {
+            LOG(LOG_WARN, "%20s can't scale its plane, rendering at full resolution\n",
+                Display->MonitorName);
+            SoftDisplay->ScalingUnsupported = true;
+            SoftDisplay->RenderWidth  = Display->Width;
+            SoftDisplay->RenderHeight = Display->Height;
+        } else {
+            LOG_RATE(LOG_ERROR, 1000, "%20s page flip commit failed: %s\n",
+                Display->MonitorName, strerror(Error));
+        }
+        // Drop the frame and draw it again
+        SoftDisplay->Queued = -1;
+        InvalidateBuffers(SoftDisplay);
+        DamageDisplay(Display);
+        return false;
+    }
+
+    SoftDisplay->Replaced = SoftDisplay->Shown;
+    SoftDisplay->Shown    = SoftDisplay->Queued;
+    SoftDisplay->Queued   = -1;
+    SoftDisplay->Presented++;
+
+    uint64_t Pixels = 0;
+    for (int RectIndex = 0; RectIndex < SoftDisplay->QueuedCount; RectIndex++) {
+        Pixels += (uint64_t)SoftDisplay->QueuedRects[RectIndex].Width *
+                  SoftDisplay->QueuedRects[RectIndex].Height;
+    }
+    uint64_t DisplayPixels = (uint64_t)Display->Width * Display->Height;
+    atomic_fetch_add_explicit(&Display->Damage->FramesPresented, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&Display->Damage->PixelsHinted,
+        MIN(Pixels, DisplayPixels), memory_order_relaxed);
+    return true;
+}
+
+bool FlushSoftFrame(soft_state* Soft, egl_display* Display) {
+    soft_display* SoftDisplay = &Soft->Displays[Display->Index];
+    if (SoftDisplay->Queued < 0 || EGLPageFlipPending(Display)) {
+        return false;
+    }
+    return CommitQueued(Soft, SoftDisplay);
+}
+
+void PresentSoftFrame(soft_state* Soft, egl_display* Display) {
+    FlushSoftFrame(Soft, Display);
+}
+
+void SetSoftResolution(soft_state* Soft, egl_display* Display, int Width, int Height) {
+    soft_display* SoftDisplay = &Soft->Displays[Display->Index];
+    if (SoftDisplay->ScalingUnsupported) {
+        return;
+    }
+    Width  = CLAMP(16, Display->Width,  Width);
+    Height = CLAMP(16, Display->Height, Height);
+    if (Width == SoftDisplay->RenderWidth && Height == SoftDisplay->RenderHeight) {
+        return;
+    }
+    SoftDisplay->RenderWidth  = Width;
+    SoftDisplay->RenderHeight = Height;
+    InvalidateBuffers(SoftDisplay);
+    DamageDisplay(Display);
+}
+
+void ReportSoftFrames(soft_state* Soft) {
+    uint64_t Now = GetTimeNS();
+    for (int DisplayIndex = 0; DisplayIndex < Soft->EGL->DisplaysCount; DisplayIndex++) {
+        soft_display* SoftDisplay = &Soft->Displays[DisplayIndex];
+        double Seconds = (Now - SoftDisplay->LastReportNS) / 1e9;
+        if (SoftDisplay->LastReportNS == 0 || Seconds <= 0) {
+            SoftDisplay->LastReportNS        = Now;
+            SoftDisplay->LastReportPresented = SoftDisplay->Presented;
+            continue;
+        }
+
+        frame_stat* Render = &SoftDisplay->RenderTime;
+        LOG(LOG_INFO, "%20s: %5.1f fps, render %.2fms (%.2f-%.2f) at %ix%i, %lu busy commits\n",
+            SoftDisplay->Display->MonitorName,
+            (SoftDisplay->Presented - SoftDisplay->LastReportPresented) / Seconds,
+            StatAverage(Render), Render->Count ? Render->Min : 0, Render->Max,
+            SoftDisplay->RenderWidth, SoftDisplay->RenderHeight,
+            (unsigned long)SoftDisplay->BusyCommits);
+
+        StatReset(Render);
+        SoftDisplay->LastReportNS        = Now;
+        SoftDisplay->LastReportPresented = SoftDisplay->Presented;
+    }
+}
@@ -0,0 +1,147 @@
+#if !defined(SOFT_H)
+#define SOFT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "damage.h"
+#include "dumb.h"
+#include "egl.h"
+#include "kms.h"
+#include "pixels.h"
+#include "workers.h"
+#include "writeback.h"
+
+// A CPU rendering backend for machines without a GPU (or EGLStreams),
+// e.g. vkms on CI hosts. Frames are rendered in tiles by a worker pool
+// (see workers.h, pixels.h) into dumb buffers (see dumb.h), and shown
+// with atomic page flips requesting flip events.
+//
+// Displays are the same egl_display/egl_state as the EGLStreams path,
+// minus their EGL objects, and flips are handled the same way: the
+// commit marks the display's flip pending, and EGLUpdateVSync,
+// EGLWaitVSync or EGLAttachEventLoop dispatch the event that clears
+// it. So flip tracking (pending flips, flip history, the watchdog),
+// event dispatch and damage tracking are shared. The frame hooks
+// (BeginFrame/EndFrame, see frame.h) are GL only, so soft frames are
+// timed and reported by ReportSoftFrames instead:
+//
+//   soft_state* Soft = SetupSoftware(DefaultSoftOptions());
+//   while (1) {
+//       EGLWaitVSync(Soft->EGL, 100);
+//       for each Display in Soft->EGL->Displays:
+//           FlushSoftFrame(Soft, Display);
+//           damage_rect Rects[MAX_DAMAGE_RECTS];
+//           if (!SoftFrameAvailable(Soft, Display)) continue;
+//           int Count = TakeDisplayDamage(Display, Rects);
+//           if (Count == 0) continue;
+//           RenderSoftFrame(Soft, Display, Rects, Count, Render, UserData);
+//           PresentSoftFrame(Soft, Display);
+//   }
+//
+// With double buffering a frame can only be rendered once the last
+// flip completes. With triple buffering the next frame is rendered
+// while the flip is pending, and queued until it completes
+// (FlushSoftFrame then commits it).
+
+#define SOFT_MAX_BUFFERS 3
+#define SOFT_TILE_SIZE   128
+
+typedef struct {
+    // Dumb buffers per display, 2 or 3 (SOFT_BUFFERS, default 3)
+    int Buffers;
+    // Worker threads rendering tiles (SOFT_WORKERS, default 0:
+    // one per CPU besides the rendering thread's)
+    int Workers;
+} soft_options;
+
+// Reads the options from the environment.
+soft_options DefaultSoftOptions();
+
+typedef struct {
+    egl_display*         Display;
+    kms_plane_properties Props;
+    dumb_buffer          Buffers[SOFT_MAX_BUFFERS];
+    int                  BuffersCount;
+    // Buffer indices, or -1: the last committed buffer, the one it
+    // replaced (still scanned out until the flip completes), the
+    // rendered buffer waiting for a commit, and the one being rendered.
+    int                  Shown;
+    int                  Replaced;
+    int                  Queued;
+    int                  Back;
+
+    // Size frames are rendered at, from the top left of the buffers.
+    // The plane scales it to the mode (SRC_W/SRC_H), if it can.
+    int                  RenderWidth;
+    int                  RenderHeight;
+
+    // Rects rendered by recent frames, indexed by frame number, so a
+    // buffer last rendered a few frames ago is brought up to date
+    uint64_t             Frame;
+    uint64_t             BufferFrame[SOFT_MAX_BUFFERS]; // 0 if never rendered
+    damage_rect          History[SOFT_MAX_BUFFERS][MAX_DAMAGE_RECTS];
+    int                  HistoryCount[SOFT_MAX_BUFFERS];
+    // The queued frame's rects, for FB_DAMAGE_CLIPS
+    damage_rect          QueuedRects[MAX_DAMAGE_RECTS];
+    int                  QueuedCount;
+    bool                 ScalingUnsupported;
+    // Tile indices to render, one job each
+    int*                 Tiles;
+    // If set, every commit also captures the scanout, and the frame
+    // committed is recorded as stamp Frame (see writeback.h)
+    writeback_capture*   Capture;
+
+    // Counters, for reporting
+    frame_stat           RenderTime;
+    uint64_t             Presented;
+    uint64_t             BusyCommits;
+    uint64_t             LastReportNS;
+    uint64_t             LastReportPresented;
+} soft_display;
+
+typedef struct {
+    // DRMFD, Displays and DRMEventContext; no EGL objects
+    egl_state*    EGL;
+    soft_display* Displays;
+    worker_pool*  Workers;
+    soft_options  Options;
+} soft_state;
+
+// Opens DRI_DEVICE, or the first /dev/dri/card* with dumb buffers,
+// sets the modes of every connected display and gives each its
+// buffers. COLOR_PROFILES is applied as SetupEGL does (see color.h).
+soft_state* SetupSoftware(soft_options Options);
+
+// Renders a tile of a display's frame; called in parallel from the
+// worker threads, so it must only draw within the tile.
+typedef void (*soft_render_func)(egl_display* Display, pixel_tile* Tile, void* UserData);
+
+// True if a buffer is free to render the display's next frame into.
+bool SoftFrameAvailable(soft_state* Soft, egl_display* Display);
+
+// Renders the display's next frame into a free buffer, in parallel
+// tiles. Only tiles touching the rects (plus whatever changed since
+// the buffer was last rendered) are rendered; pass no rects to render
+// every tile. Returns false if no buffer is free.
+bool RenderSoftFrame(soft_state* Soft, egl_display* Display,
+    damage_rect* Rects, int Count, soft_render_func Render, void* UserData);
+
+// Shows the rendered frame: commits it now if no flip is pending,
+// else queues it for FlushSoftFrame. The frame's rects are passed on
+// as FB_DAMAGE_CLIPS where the plane supports it.
+void PresentSoftFrame(soft_state* Soft, egl_display* Display);
+
+// Commits the queued frame once the display's last flip completes.
+// Returns true if one was committed.
+bool FlushSoftFrame(soft_state* Soft, egl_display* Display);
+
+// Renders at a lower resolution and lets the plane scale it up, e.g.
+// from UpdateResolutionScale (see dynres.h). Falls back to full
+// resolution if the plane rejects scaling.
+void SetSoftResolution(soft_state* Soft, egl_display* Display, int Width, int Height);
+
+// Logs each display's average render time and presented frames.
+void ReportSoftFrames(soft_state* Soft);
+
+#endif /* SOFT_H */
@@ -0,0 +1,117 @@
+#include "span.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+
+span* CreateSpan(egl_state* EGL) {
+    if (EGL->Options.ContextPerDisplay) {
+        Fatal("Spanning surfaces need the displays to share RootContext\n");
+    }
+
+    span* Span = calloc(1, sizeof(span));
+    Span->EGL = EGL;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        Span->Width  = MAX(Span->Width,  Display->X + Display->Width);
+        Span->Height = MAX(Span->Height, Display->Y + Display->Height);
+    }
+
+    // Framebuffer objects belong to the context that created them
+    eglMakeCurrent(EGL->DisplayDevice,
+        EGL->Displays->Hot->Surface, EGL->Displays->Hot->Surface,
+        EGL->RootContext);
+
+    GLint MaxRenderbufferSize = 0;
+    GLint MaxViewport[2] = { 0 };
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &MaxRenderbufferSize);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, MaxViewport);
+    int MaxWidth  = MIN(MaxRenderbufferSize, MaxViewport[0]);
+    int MaxHeight = MIN(MaxRenderbufferSize, MaxViewport[1]);
+    if (Span->Width > MaxWidth || Span->Height > MaxHeight) {
+        printf("Spanning surface %ix%i exceeds GL's limit of %ix%i\n",
+            Span->Width, Span->Height, MaxWidth, MaxHeight);
+        free(Span);
+        return NULL;
+    }
+    printf("Spanning surface: %ix%i\n", Span->Width, Span->Height);
+
+    glGenRenderbuffers(1, &Span->Renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, Span->Renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, Span->Width, Span->Height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &Span->Framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, Span->Framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, Span->Renderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        Fatal("Spanning framebuffer is incomplete\n");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return Span;
+}
+
+bool SpanReady(span* Span) {
+    egl_state* EGL = Span->EGL;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        if (EGLPageFlipPending(&EGL->Displays[DisplayIndex])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BindSpan(span* Span) {
+    egl_state* EGL = Span->EGL;
+    if (eglGetCurrentContext() != EGL->RootContext) {
+        eglMakeCurrent(EGL->DisplayDevice,
+            EGL->Displays->Hot->Surface, EGL->Displays->Hot->Surface,
+            EGL->RootContext);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, Span->Framebuffer);
+    glViewport(0, 0, Span->Width, Span->Height);
+}
+
+void PresentSpan(span* Span) {
+    egl_state* EGL = Span->EGL;
+
+    // Starting from the display that's current, which BindSpan or the
+    // last frame left so, saves switching to it
+    EGLSurface Current = eglGetCurrentSurface(EGL_DRAW);
+    int First = 0;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        if (EGL->Displays[DisplayIndex].Hot->Surface == Current) {
+            First = DisplayIndex;
+        }
+    }
+
+    for (int Presented = 0; Presented < EGL->DisplaysCount; Presented++) {
+        egl_display* Display = &EGL->Displays[(First + Presented) % EGL->DisplaysCount];
+
+        if (EGLPageFlipPending(Display)) {
+            continue;
+        }
+
+        // Same context, so this only switches the draw surface
+        if (Display->Hot->Surface != Current) {
+            eglMakeCurrent(Display->DisplayDevice,
+                Display->Hot->Surface, Display->Hot->Surface,
+                EGL->RootContext);
+            Current = Display->Hot->Surface;
+        }
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, Span->Framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(
+            Display->X, Display->Y,
+            Display->X + Display->Width, Display->Y + Display->Height,
+            0, 0, Display->Width, Display->Height,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+        EGLSwapFrame(Display);
+        EGLAcquireProduced(Display);
+    }
+}
@@ -0,0 +1,47 @@
+#if !defined(SPAN_H)
+#define SPAN_H
+
+#include <stdbool.h>
+#include <GL/glew.h>
+
+#include "egl.h"
+
+// A "spanning surface": one framebuffer covering the wall of all
+// displays (see egl_display.X/Y), rendered once per frame.
+// Each display is then presented by blitting its sub-rectangle to its
+// EGLStream producer surface, so scene draw calls aren't repeated per
+// display and RootContext is never switched, only its draw surface.
+// EGL only draws to a surface while it's current, so that still takes
+// one eglMakeCurrent per display after the first; the display left
+// current by one frame is presented first in the next.
+//
+// (EGLOutputLayers don't expose the plane's SRC_X/SRC_Y, and a stream
+// has a single consumer, so the planes can't scan out sub-rectangles of
+// one shared stream directly.)
+typedef struct {
+    egl_state* EGL;
+    int        Width;
+    int        Height;
+    GLuint     Framebuffer;
+    GLuint     Renderbuffer;
+} span;
+
+// Requires the displays to share RootContext
+// (i.e. not egl_options.ContextPerDisplay). Returns NULL (printing why)
+// if the wall is bigger than GL's renderbuffers or viewports can be.
+span* CreateSpan(egl_state* EGL);
+
+// True when no display is waiting for a page flip, so a new wall
+// frame can be presented on every display at once.
+bool SpanReady(span* Span);
+
+// Makes RootContext current, unless it is already, and binds the
+// spanning framebuffer for drawing, with a viewport covering the whole
+// wall.
+void BindSpan(span* Span);
+
+// Blits each display's part of the wall to its surface, swaps and
+// acquires it.
+void PresentSpan(span* Span);
+
+#endif /* SPAN_H */
@@ -0,0 +1,101 @@
+#include "surfaceless.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+// Framebuffers standing in for each display's surface
+static GLuint* Framebuffers;
+
+egl_state* SetupSurfaceless(int DisplaysCount, int Width, int Height) {
+    const char* ClientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (!ExtensionIsSupported(ClientExtensions, "EGL_MESA_platform_surfaceless")) {
+        Fatal("EGL_MESA_platform_surfaceless not found.\n");
+    }
+    PFNEGLGETPLATFORMDISPLAYEXTPROC GetPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!GetPlatformDisplay) {
+        Fatal("eglGetProcAddress(eglGetPlatformDisplayEXT) failed.\n");
+    }
+
+    EGLDisplay eglDpy = GetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+        EGL_DEFAULT_DISPLAY, NULL);
+    if (eglDpy == EGL_NO_DISPLAY || !eglInitialize(eglDpy, NULL, NULL)) {
+        Fatal("Couldn't initialize the surfaceless EGL display.\n");
+    }
+    eglBindAPI(EGL_OPENGL_API);
+
+    // No window surfaces here, so any surface type will do
+    EGLint ConfigAttribs[] = {
+        EGL_SURFACE_TYPE,    0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE,
+    };
+    EGLConfig eglConfig;
+    EGLint ConfigsCount = 0;
+    if (!eglChooseConfig(eglDpy, ConfigAttribs, &eglConfig, 1, &ConfigsCount) ||
+        ConfigsCount == 0) {
+        Fatal("No surfaceless EGL config.\n");
+    }
+    EGLContext eglContext = GetEglContext(eglDpy, eglConfig);
+    if (!eglMakeCurrent(eglDpy, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+        Fatal("Couldn't make the surfaceless context current.\n");
+    }
+    InitGLEW();
+    printf("Surfaceless GL: %s, %s\n",
+        (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+
+    // Planes with only what CreateDisplays reads
+    kms_plane* Planes = calloc(DisplaysCount, sizeof(kms_plane));
+    for (int PlaneIndex = 0; PlaneIndex < DisplaysCount; PlaneIndex++) {
+        drm_edid* EDID = calloc(1, sizeof(drm_edid));
+        EDID->MonitorName = malloc(32);
+        snprintf(EDID->MonitorName, 32, "Surfaceless-%i", PlaneIndex);
+        EDID->SerialNumber = strdup("");
+        EDID->PNPID        = strdup("");
+        Planes[PlaneIndex].EDID   = EDID;
+        Planes[PlaneIndex].Width  = Width;
+        Planes[PlaneIndex].Height = Height;
+    }
+
+    egl_state* EGL = calloc(1, sizeof(egl_state));
+    EGL->DRMFD         = -1;
+    EGL->DisplayDevice = eglDpy;
+    EGL->Config        = eglConfig;
+    EGL->RootContext   = eglContext;
+    EGL->DisplaysCount = DisplaysCount;
+    EGL->Displays      = CreateDisplays(Planes, DisplaysCount);
+
+    Framebuffers = calloc(DisplaysCount, sizeof(GLuint));
+    glGenFramebuffers(DisplaysCount, Framebuffers);
+    for (int DisplayIndex = 0; DisplayIndex < DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        Display->DisplayDevice = eglDpy;
+        Display->Config        = eglConfig;
+        Display->Context       = eglContext;
+
+        GLuint Renderbuffer;
+        glGenRenderbuffers(1, &Renderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, Renderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, Width, Height);
+        glBindFramebuffer(GL_FRAMEBUFFER, Framebuffers[DisplayIndex]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_RENDERBUFFER, Renderbuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            Fatal("Surfaceless framebuffer %i is incomplete\n", DisplayIndex);
+        }
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return EGL;
+}
+
+void BindSurfacelessDisplay(egl_state* EGL, egl_display* Display) {
+    if (eglGetCurrentContext() != Display->Context) {
+        eglMakeCurrent(EGL->DisplayDevice, EGL_NO_SURFACE, EGL_NO_SURFACE,
+            Display->Context);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, Framebuffers[Display->Index]);
+}
@@ -0,0 +1,25 @@
+#if !defined(SURFACELESS_H)
+#define SURFACELESS_H
+
+#include <GL/glew.h>
+
+#include "egl.h"
+
+// Runs the GL side without displays or a GPU: an EGL context on Mesa's
+// surfaceless platform (EGL_MESA_platform_surfaceless), with a
+// framebuffer object standing in for each display's surface. With
+// LIBGL_ALWAYS_SOFTWARE=1 Mesa renders with llvmpipe, so per-display GL
+// code (frame.h, readback.h...) can be tested on any machine.
+//
+// The displays come from CreateDisplays with made-up planes, so they
+// have no CRTC, stream or flips; DRMFD is -1.
+
+// Creates DisplaysCount displays of Width x Height, sharing one
+// context, which is left current.
+egl_state* SetupSurfaceless(int DisplaysCount, int Width, int Height);
+
+// Makes the display's context current and binds its framebuffer,
+// in place of its surface.
+void BindSurfacelessDisplay(egl_state* EGL, egl_display* Display);
+
+#endif /* SURFACELESS_H */
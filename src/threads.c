@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+
+#include "threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <sys/mman.h>
+
+#include "damage.h"
+#include "gldiag.h"
+
+static void* RenderThreadMain(void* Arg) {
+    render_thread* Thread = Arg;
+    egl_display* Display = Thread->Display;
+
+    ApplyThreadProfile(Display->MonitorName,
+        GetThreadProfile("RENDER_THREAD_PROFILE", Display->Index));
+
+    EGLBoolean ret = eglMakeCurrent(Display->DisplayDevice,
+        Display->Hot->Surface, Display->Hot->Surface,
+        Display->Context);
+    if (!ret) Fatal("Couldn't make display context current on render thread\n");
+
+    EnableGLDebug();
+
+    // The viewport is per-context state, so with a context per display
+    // it only needs setting once.
+    glViewport(0, 0,
+        (GLint)Display->Width,
+        (GLint)Display->Height);
+
+    while (!atomic_load_explicit(&Thread->Stop, memory_order_relaxed)) {
+        EGLWaitForPageFlip(Display);
+
+        // A swapped frame whose acquire was BUSY or TIMEOUT is retried
+        // first; waiting for damage would leave it unshown until some
+        // arrives, which for a static scene may be a while.
+        if (EGLFrameUnconsumed(Display)) {
+            if (EGLAcquireProduced(Display)) {
+                atomic_fetch_add_explicit(&Thread->Frames, 1, memory_order_relaxed);
+            } else if (EGLFrameUnconsumed(Display)) {
+                usleep(1000);
+            }
+            continue;
+        }
+
+        // Undamaged displays aren't rendered, swapped or flipped.
+        // Wake up now and then to notice Stop.
+        if (!WaitForDamage(Display, 100)) {
+            continue;
+        }
+        damage_rect Damage[MAX_DAMAGE_RECTS];
+        int DamageCount = TakeDisplayDamage(Display, Damage);
+        if (DamageCount == 0) {
+            continue;
+        }
+
+        BeginFrame(Display);
+        Thread->Render(Display, Thread->UserData);
+        EndFrame(Display);
+
+        SwapDisplayWithDamage(Display, Damage, DamageCount);
+
+        bool Acquired = EGLAcquireProduced(Display);
+
+        GLDiagnosticsEndFrame(Display->MonitorName);
+
+        // Frames that failed to acquire are counted once they're retried
+        if (Acquired) {
+            atomic_fetch_add_explicit(&Thread->Frames, 1, memory_order_relaxed);
+        }
+    }
+
+    // Its queries are this context's, and it may be rendered from
+    // another next
+    ResetFrameTiming(Display);
+    eglMakeCurrent(Display->DisplayDevice,
+        EGL_NO_SURFACE, EGL_NO_SURFACE,
+        EGL_NO_CONTEXT);
+
+    return NULL;
+}
+
+render_thread* StartRenderThreads(egl_state* EGL, int Count,
+    render_func Render, void* UserData) {
+
+    if (!EGL->Options.ContextPerDisplay) {
+        Fatal("Render threads need egl_options.ContextPerDisplay\n");
+    }
+
+    render_thread* Threads = aligned_alloc(CACHE_LINE_SIZE,
+        sizeof(render_thread) * Count);
+    memset(Threads, 0, sizeof(render_thread) * Count);
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        render_thread* Thread = &Threads[ThreadIndex];
+        Thread->Display  = &EGL->Displays[ThreadIndex];
+        Thread->Render   = Render;
+        Thread->UserData = UserData;
+        atomic_init(&Thread->Stop, false);
+        atomic_init(&Thread->Frames, 0);
+
+        if (pthread_create(&Thread->Thread, NULL, RenderThreadMain, Thread)) {
+            Fatal("Couldn't create render thread\n");
+        }
+    }
+    return Threads;
+}
+
+void StopRenderThreads(render_thread* Threads, int Count) {
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        atomic_store(&Threads[ThreadIndex].Stop, true);
+    }
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        pthread_join(Threads[ThreadIndex].Thread, NULL);
+    }
+    free(Threads);
+}
+
+void InitSharedFence(shared_fence* Fence) {
+    pthread_mutex_init(&Fence->Lock, NULL);
+    Fence->Sync       = NULL;
+    Fence->Generation = 0;
+}
+
+void PublishSharedFence(shared_fence* Fence) {
+    GLsync Sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Make sure the fence reaches the GPU, or waiters in other
+    // contexts could wait on it forever.
+    glFlush();
+
+    pthread_mutex_lock(&Fence->Lock);
+    GLsync OldSync = Fence->Sync;
+    Fence->Sync = Sync;
+    Fence->Generation++;
+    pthread_mutex_unlock(&Fence->Lock);
+
+    // Deletion is deferred by GL until no waits are pending on it
+    if (OldSync) glDeleteSync(OldSync);
+}
+
+void WaitSharedFence(shared_fence* Fence) {
+    pthread_mutex_lock(&Fence->Lock);
+    if (Fence->Sync) {
+        glWaitSync(Fence->Sync, 0, GL_TIMEOUT_IGNORED);
+    }
+    pthread_mutex_unlock(&Fence->Lock);
+}
+
+thread_profile DefaultThreadProfile() {
+    return (thread_profile){
+        .Policy        = SCHED_OTHER,
+        .Priority      = 0,
+        .CPU           = -1,
+        .LockMemory    = false,
+        .PrefaultStack = 0
+    };
+}
+
+thread_profile ParseThreadProfile(const char* Spec) {
+    thread_profile Profile = DefaultThreadProfile();
+
+    char* SpecCopy = strdup(Spec);
+    char* SavePtr;
+    for (char* Token = strtok_r(SpecCopy, ",", &SavePtr);
+         Token != NULL;
+         Token = strtok_r(NULL, ",", &SavePtr)) {
+        if (strcmp(Token, "other") == 0) {
+            Profile.Policy = SCHED_OTHER;
+        } else if (strncmp(Token, "fifo:", 5) == 0) {
+            Profile.Policy   = SCHED_FIFO;
+            Profile.Priority = atoi(Token + 5);
+        } else if (strncmp(Token, "rr:", 3) == 0) {
+            Profile.Policy   = SCHED_RR;
+            Profile.Priority = atoi(Token + 3);
+        } else if (strncmp(Token, "cpu:", 4) == 0) {
+            Profile.CPU = atoi(Token + 4);
+        } else if (strcmp(Token, "mlock") == 0) {
+            Profile.LockMemory = true;
+        } else if (strncmp(Token, "stack:", 6) == 0) {
+            Profile.PrefaultStack = strtoul(Token + 6, NULL, 0);
+        } else {
+            printf("Ignoring unknown thread profile option '%s'\n", Token);
+        }
+    }
+    free(SpecCopy);
+
+    return Profile;
+}
+
+thread_profile GetThreadProfile(const char* EnvName, int Index) {
+    const char* Spec = NULL;
+    if (Index >= 0) {
+        char IndexedName[128];
+        snprintf(IndexedName, sizeof(IndexedName), "%s_%i", EnvName, Index);
+        Spec = getenv(IndexedName);
+    }
+    if (!Spec) {
+        Spec = getenv(EnvName);
+    }
+    return Spec ? ParseThreadProfile(Spec) : DefaultThreadProfile();
+}
+
+static const char* PolicyToString(int Policy) {
+    switch (Policy) {
+        case SCHED_OTHER: return "SCHED_OTHER";
+        case SCHED_FIFO:  return "SCHED_FIFO";
+        case SCHED_RR:    return "SCHED_RR";
+    }
+    return "Unrecognized policy";
+}
+
+// Stack left below the caller's frame, minus STACK_MARGIN for the
+// frames called later, or 0 if it can't be told.
+#define STACK_MARGIN (64 * 1024)
+static size_t AvailableStack() {
+    pthread_attr_t Attr;
+    if (pthread_getattr_np(pthread_self(), &Attr) != 0) {
+        return 0;
+    }
+    void* StackAddr;
+    size_t StackSize;
+    int Error = pthread_attr_getstack(&Attr, &StackAddr, &StackSize);
+    pthread_attr_destroy(&Attr);
+    if (Error) {
+        return 0;
+    }
+
+    // The stack grows down from StackAddr + StackSize
+    char Here;
+    size_t Below = (size_t)(&Here - (char*)StackAddr);
+    return Below > STACK_MARGIN ? Below - STACK_MARGIN : 0;
+}
+
+// Touch the stack now so page faults don't happen mid-frame.
+// Kept out of line so the alloca'd memory is released on return,
+// while the pages stay mapped.
+static __attribute__((noinline)) void PrefaultStack(size_t Size) {
+    volatile char* Stack = alloca(Size);
+    for (size_t Offset = 0; Offset < Size; Offset += 4096) {
+        Stack[Offset] = 0;
+    }
+}
+
+bool ApplyThreadProfile(const char* Name, thread_profile Profile) {
+    bool Achieved = true;
+
+    struct sched_param Param = { .sched_priority = Profile.Priority };
+    int SchedError = pthread_setschedparam(pthread_self(), Profile.Policy, &Param);
+
+    int AffinityError = 0;
+    if (Profile.CPU >= 0) {
+        cpu_set_t CPUs;
+        CPU_ZERO(&CPUs);
+        CPU_SET(Profile.CPU, &CPUs);
+        AffinityError = pthread_setaffinity_np(pthread_self(), sizeof(CPUs), &CPUs);
+    }
+
+    int LockError = 0;
+    if (Profile.LockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        LockError = errno;
+    }
+
+    size_t StackLimit = 0;
+    if (Profile.PrefaultStack) {
+        // alloca past the end of the stack would crash
+        StackLimit = AvailableStack();
+        PrefaultStack(MIN(Profile.PrefaultStack, StackLimit));
+    }
+
+    // Report what we actually got
+    int Policy;
+    pthread_getschedparam(pthread_self(), &Policy, &Param);
+    cpu_set_t CPUs;
+    pthread_getaffinity_np(pthread_self(), sizeof(CPUs), &CPUs);
+
+    printf("%20s thread: requested %s prio %i, CPU %i%s; got %s prio %i, %i CPUs allowed\n",
+        Name,
+        PolicyToString(Profile.Policy), Profile.Priority,
+        Profile.CPU,
+        Profile.LockMemory ? ", mlockall" : "",
+        PolicyToString(Policy), Param.sched_priority,
+        CPU_COUNT(&CPUs));
+
+    if (SchedError) {
+        printf("%20s thread: couldn't set scheduling policy: %s\n", Name, strerror(SchedError));
+        Achieved = false;
+    }
+    if (AffinityError) {
+        printf("%20s thread: couldn't set CPU affinity: %s\n", Name, strerror(AffinityError));
+        Achieved = false;
+    }
+    if (LockError) {
+        printf("%20s thread: couldn't lock memory: %s\n", Name, strerror(LockError));
+        Achieved = false;
+    }
+    if (Profile.PrefaultStack > StackLimit) {
+        printf("%20s thread: only %zu of %zu stack bytes can be prefaulted\n",
+            Name, StackLimit, Profile.PrefaultStack);
+        Achieved = false;
+    }
+
+    return Achieved;
+}
@@ -0,0 +1,90 @@
+#if !defined(THREADS_H)
+#define THREADS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <GL/glew.h>
+
+#include "egl.h"
+#include "utils.h"
+
+// Called once per frame on a display's render thread, with the
+// display's own context current and its viewport already set.
+typedef void (*render_func)(egl_display* Display, void* UserData);
+
+// Aligned so each thread's frame counter sits on its own cache line(s).
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_t Thread;
+    egl_display* Display;
+    render_func  Render;
+    void*        UserData;
+    atomic_bool  Stop;
+    atomic_uint_fast64_t Frames; // Acquired
+} render_thread;
+
+// Starts one render thread for each of the first Count displays.
+// Requires egl_options.ContextPerDisplay, since each thread keeps its
+// display's context current for its whole lifetime.
+// The calling thread is expected to keep dispatching page flip events
+// (e.g. with EGLWaitVSync).
+render_thread* StartRenderThreads(egl_state* EGL, int Count,
+    render_func Render, void* UserData);
+
+// Stops and joins the threads and frees them.
+void StopRenderThreads(render_thread* Threads, int Count);
+
+// Objects shared between contexts (textures, buffers) must be
+// synchronized explicitly: the context that modifies an object
+// publishes a fence afterwards, and other contexts make their GPU
+// queue wait on that fence before using the object.
+typedef struct {
+    pthread_mutex_t Lock;
+    GLsync          Sync;
+    uint64_t        Generation;
+} shared_fence;
+
+void InitSharedFence(shared_fence* Fence);
+
+// Called by the writing context after modifying the shared objects.
+void PublishSharedFence(shared_fence* Fence);
+
+// Called by a reading context before using the shared objects.
+// Only waits on the GPU; the calling thread doesn't block.
+void WaitSharedFence(shared_fence* Fence);
+
+// Scheduling and placement for a latency sensitive thread.
+typedef struct {
+    int    Policy;        // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int    Priority;      // 1-99 for SCHED_FIFO and SCHED_RR
+    int    CPU;           // CPU to pin the thread to, or -1 for any
+    bool   LockMemory;    // mlockall() the whole process
+    size_t PrefaultStack; // Bytes of stack to touch up front
+} thread_profile;
+
+// The default: SCHED_OTHER, any CPU, nothing locked or prefaulted.
+thread_profile DefaultThreadProfile();
+
+// Parses a comma separated profile, e.g. "fifo:80,cpu:2,mlock,stack:262144".
+// Tokens: "other", "fifo:<prio>", "rr:<prio>", "cpu:<n>", "mlock",
+// "stack:<bytes>". ApplyThreadProfile prefaults at most what the
+// thread's stack has left.
+thread_profile ParseThreadProfile(const char* Spec);
+
+// Reads the profile for a thread from the environment.
+// <EnvName>_<Index> (e.g. ACQUIRE_THREAD_PROFILE_1) takes precedence
+// over <EnvName>, so threads of the same kind can be placed on
+// different CPUs. Pass Index -1 for unique threads.
+// Used names: RENDER_THREAD_PROFILE, ACQUIRE_THREAD_PROFILE,
+// EVENT_THREAD_PROFILE.
+thread_profile GetThreadProfile(const char* EnvName, int Index);
+
+// Applies the profile to the calling thread, and prints what was
+// requested alongside what was actually achieved
+// (e.g. SCHED_FIFO falls back to SCHED_OTHER without CAP_SYS_NICE).
+// Returns true if everything requested was achieved.
+bool ApplyThreadProfile(const char* Name, thread_profile Profile);
+
+#endif /* THREADS_H */
@@ -7,12 +7,21 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <sys/time.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <GL/glew.h>
 
+#include "gldiag.h"
+
 void Fatal(const char *format, ...)
 {
     va_list ap;
 
+    // Get out whatever was logged before the error
+    FlushLog();
+
     fprintf(stderr, "ERROR: ");
 
     va_start(ap, format);
@@ -44,6 +53,20 @@ float GetTime()
     return (TimeSinceStart.tv_sec + (TimeSinceStart.tv_usec / 1000000.0));
 }
 
+double GetThreadCPUTime()
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Now);
+    return Now.tv_sec + Now.tv_nsec / 1000000000.0;
+}
+
+uint64_t GetTimeNS()
+{
+    struct timespec Now;
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec * 1000000000ULL + Now.tv_nsec;
+}
+
 fps MakeFPS(char* Name) {
     struct timeval Now;
     gettimeofday(&Now, NULL);
@@ -62,7 +85,7 @@ void TickFPS(fps* FPS) {
 
     int NowSecond = Now.tv_sec;
     if (NowSecond > FPS->CurrentSecond) {
-        printf("%40s: %i FPS\n", FPS->Name, FPS->Frames);
+        LOG(LOG_INFO, "%40s: %i FPS\n", FPS->Name, FPS->Frames);
         FPS->Frames = 0;
         FPS->CurrentSecond = NowSecond;
     }
@@ -89,17 +112,8 @@ void GLCheck(const char* name) {
     }
 }
 
-void GLAPIENTRY DebugCallback(GLenum Source, GLenum Type,
-    GLuint ID, GLenum Severity, GLsizei Length,
-    const GLchar* Message, const void* UserParam) {
-    printf("===OPENGL DEBUG 0x%X: %s\n", ID, Message);
-}
-
 void EnableGLDebug() {
-    glDebugMessageCallback(DebugCallback, NULL);
-    glDebugMessageControl(GL_DONT_CARE,
-        GL_DONT_CARE, GL_DONT_CARE, 0, 0, GL_TRUE);
-    glEnable(GL_DEBUG_OUTPUT);
+    SetGLDiagnosticsMode(GetGLDiagnosticsMode());
 }
 
 int NextPowerOfTwo(int x) {
@@ -112,3 +126,17 @@ int NextPowerOfTwo(int x) {
     x++;
     return x;
 }
+
+void FutexWait(_Atomic uint32_t* Word, uint32_t Expected, int TimeoutMS) {
+    struct timespec Timeout = {
+        .tv_sec  = TimeoutMS / 1000,
+        .tv_nsec = (TimeoutMS % 1000) * 1000000L
+    };
+    syscall(SYS_futex, (uint32_t*)Word, FUTEX_WAIT_PRIVATE, Expected,
+        TimeoutMS < 0 ? NULL : &Timeout, NULL, 0);
+}
+
+void FutexWake(_Atomic uint32_t* Word) {
+    syscall(SYS_futex, (uint32_t*)Word, FUTEX_WAKE_PRIVATE, INT_MAX,
+        NULL, NULL, 0);
+}
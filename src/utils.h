@@ -2,32 +2,52 @@
 #if !defined(UTILS_H)
 #define UTILS_H
 
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "log.h"
+
 
 #define ARRAY_LEN(_arr) ((int)sizeof(_arr) / (int)sizeof(*_arr))
 #define UNUSED(x) (void)(x)
 #define RANDFLOAT ((float)rand()/(float)(RAND_MAX))
 #define RANDRANGE(low,hi) (RANDFLOAT*(hi-low) + low)
 
+#define CACHE_LINE_SIZE 64
+
 #define MAX(a,b) (a > b ? a : b)
 #define MIN(a,b) (a < b ? a : b)
 #define CLAMP(l,h,a) (MAX(l, MIN(h, a)))
 
 void Fatal(const char *format, ...);
 float GetTime();
+// CPU time consumed by the calling thread, in seconds.
+// Unlike GetTime, this doesn't advance while the thread is blocked.
+double GetThreadCPUTime();
+// CLOCK_MONOTONIC in nanoseconds, the clock DRM event timestamps,
+// timerfds and clock_nanosleep deadlines use.
+uint64_t GetTimeNS();
 
 void GLCheck(const char* name);
 
-// Turns on basic OpenGL 4.3 Debugging output.
+// Turns on basic OpenGL 4.3 Debugging output,
+// in the mode given by the GL_DIAG environment variable (see gldiag.h).
 // Lots more fancy options available,
-// like synchronous output, debug groups,
-// object naming, see here page 65:
+// like debug groups, object naming, see here page 65:
 // https://www.slideshare.net/Mark_Kilgard/opengl-45-update-for-nvidia-gpus
 void EnableGLDebug();
 
 int NextPowerOfTwo(int x);
 
+// Blocks while *Word == Expected, until woken by FutexWake
+// or TimeoutMS passes (-1 waits forever).
+// May return spuriously, so callers should re-check their condition.
+void FutexWait(_Atomic uint32_t* Word, uint32_t Expected, int TimeoutMS);
+// Wakes all threads blocked in FutexWait on Word.
+void FutexWake(_Atomic uint32_t* Word);
+
 #define NEWTIME(name) float __##name##Before = GetTime();
-#define ENDTIME(name) printf("%20s took: %.2fms\n", #name, (GetTime() - __##name##Before) * 1000);
+#define ENDTIME(name) LOG(LOG_INFO, "%20s took: %.2fms\n", #name, (GetTime() - __##name##Before) * 1000);
 #define GRAPHTIME(name, sym) printf("%20s", #name); Graph(sym, (GetTime() - __##name##Before) * 1000);
 
 void Graph(char* sym, int N);
@@ -0,0 +1,128 @@
+#include "watchdog.h"
+
+#include <stdlib.h>
+
+#include "kms.h"
+#include "log.h"
+#include "utils.h"
+
+static const char* WatchdogStepToString(watchdog_step Step) {
+    switch (Step) {
+        case WATCHDOG_REACQUIRE:       return "re-acquiring";
+        case WATCHDOG_RECREATE_STREAM: return "recreating stream and surface";
+        case WATCHDOG_RECOMMIT_PLANE:  return "re-committing plane";
+    }
+    return "unknown";
+}
+
+watchdog* CreateWatchdog(egl_state* EGL, int StuckPeriods) {
+    watchdog* Watchdog = calloc(1, sizeof(watchdog));
+    Watchdog->EGL          = EGL;
+    Watchdog->StuckPeriods = StuckPeriods > 0 ? StuckPeriods : DEFAULT_WATCHDOG_PERIODS;
+    Watchdog->Displays     = calloc(EGL->DisplaysCount, sizeof(watchdog_display));
+    return Watchdog;
+}
+
+static void LogStuckDisplay(watchdog* Watchdog, egl_display* Display,
+    uint64_t PendingNS, uint64_t Flips)
+{
+    uint64_t Sequence = 0, VBlankNS = 0;
+    EGLGetVBlank(Watchdog->EGL, Display, &Sequence, &VBlankNS);
+    EGLint StreamState = EGLQueryDisplayStreamState(Display);
+
+    LOG(LOG_ERROR, "%20s page flip pending for %.1fms (%i refresh periods): "
+        "stream %s, %llu flips, vblank sequence %llu, produced %u consumed %u\n",
+        Display->MonitorName,
+        PendingNS / 1000000.0,
+        (int)(PendingNS / GetRefreshPeriodNS(Display->Plane)),
+        StreamState ? EGLStreamStateToString(StreamState) : "query failed",
+        (unsigned long long)Flips,
+        (unsigned long long)Sequence,
+        atomic_load_explicit(&Display->Hot->FramesProduced, memory_order_relaxed),
+        Display->Hot->FramesConsumed);
+}
+
+static void RecoverDisplay(watchdog* Watchdog, egl_display* Display,
+    watchdog_step Step)
+{
+    switch (Step) {
+        case WATCHDOG_REACQUIRE:
+            break;
+        case WATCHDOG_RECREATE_STREAM:
+            atomic_store_explicit(&Display->Hot->RecreateStreamRequested, 1,
+                memory_order_release);
+            break;
+        case WATCHDOG_RECOMMIT_PLANE:
+            if (!RecommitPlane(Watchdog->EGL->DRMFD, Display->Plane)) {
+                LOG(LOG_ERROR, "%20s re-committing plane %u failed\n",
+                    Display->MonitorName, Display->Plane->PlaneID);
+            }
+            break;
+    }
+    // Every step ends by letting the display's loop run again
+    EGLClearPageFlipPending(Display);
+}
+
+void WatchdogCheck(watchdog* Watchdog) {
+    uint64_t Now = GetTimeNS();
+
+    for (int DisplayIndex = 0; DisplayIndex < Watchdog->EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &Watchdog->EGL->Displays[DisplayIndex];
+        watchdog_display* State = &Watchdog->Displays[DisplayIndex];
+
+        uint64_t Flips = atomic_load_explicit(&Display->Hot->Flips,
+            memory_order_acquire);
+        if (Flips != State->FlipsAtRecovery) {
+            // Flipping again; start over at the gentlest step next time
+            State->NextStep        = WATCHDOG_REACQUIRE;
+            State->FlipsAtRecovery = Flips;
+        }
+
+        if (!EGLPageFlipPending(Display)) {
+            continue;
+        }
+
+        uint64_t AcquireNS = atomic_load_explicit(&Display->Hot->AcquireTimeNS,
+            memory_order_relaxed);
+        uint64_t Limit = Watchdog->StuckPeriods * GetRefreshPeriodNS(Display->Plane);
+        if (Now < AcquireNS || Now - AcquireNS < Limit) {
+            continue;
+        }
+
+        LogStuckDisplay(Watchdog, Display, Now - AcquireNS, Flips);
+        LOG(LOG_WARN, "%20s recovering: %s\n",
+            Display->MonitorName, WatchdogStepToString(State->NextStep));
+
+        RecoverDisplay(Watchdog, Display, State->NextStep);
+        State->Recoveries++;
+        if (State->NextStep < WATCHDOG_RECOMMIT_PLANE) {
+            State->NextStep++;
+        }
+    }
+}
+
+static void WatchdogTimerCallback(void* UserData) {
+    WatchdogCheck(UserData);
+}
+
+event_source* WatchdogAttachEventLoop(watchdog* Watchdog, event_loop* Loop) {
+    uint64_t IntervalNS = 0;
+    for (int DisplayIndex = 0; DisplayIndex < Watchdog->EGL->DisplaysCount; DisplayIndex++) {
+        uint64_t PeriodNS = GetRefreshPeriodNS(Watchdog->EGL->Displays[DisplayIndex].Plane);
+        if (IntervalNS == 0 || PeriodNS < IntervalNS) {
+            IntervalNS = PeriodNS;
+        }
+    }
+    if (IntervalNS == 0) {
+        IntervalNS = 1000000000ULL / 60;
+    }
+
+    event_source* Timer = EventLoopAddTimer(Loop, WatchdogTimerCallback, Watchdog);
+    EventLoopArmTimer(Timer, GetTimeNS() + IntervalNS, IntervalNS);
+    return Timer;
+}
+
+void WatchdogInjectDroppedFlips(egl_display* Display, uint32_t Count) {
+    atomic_fetch_add_explicit(&Display->Hot->InjectDroppedFlips, Count,
+        memory_order_relaxed);
+}
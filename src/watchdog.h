@@ -0,0 +1,62 @@
+#if !defined(WATCHDOG_H)
+#define WATCHDOG_H
+
+#include <stdint.h>
+
+#include "egl.h"
+#include "events.h"
+
+// Detects displays whose page flip event never arrived (which would
+// otherwise freeze them, since every loop skips a display with a flip
+// pending) and recovers them one at a time, leaving the other
+// displays alone.
+//
+// A flip is stuck once it's been pending for StuckPeriods refreshes of
+// its display. Each time the same display is found stuck again without
+// a flip landing in between, recovery escalates:
+//   1. Clear the pending flip, so the display's loop renders and
+//      acquires again.
+//   2. Have the display's render thread recreate its EGLStream and
+//      surface (in BeginFrame).
+//   3. Re-commit the display's mode and plane.
+// Step 3 is then repeated until a flip lands.
+//
+// Step 2 works whichever thread acquires the display: the render
+// thread waits out acquires already underway before replacing the
+// stream, and later ones find no stream until it's published again
+// (see EGLRecreateStream).
+
+typedef enum {
+    WATCHDOG_REACQUIRE,
+    WATCHDOG_RECREATE_STREAM,
+    WATCHDOG_RECOMMIT_PLANE,
+} watchdog_step;
+
+typedef struct {
+    watchdog_step NextStep;
+    uint64_t      FlipsAtRecovery;
+    uint64_t      Recoveries;
+} watchdog_display;
+
+typedef struct {
+    egl_state*        EGL;
+    int               StuckPeriods;
+    watchdog_display* Displays;
+} watchdog;
+
+#define DEFAULT_WATCHDOG_PERIODS 8
+
+watchdog* CreateWatchdog(egl_state* EGL, int StuckPeriods);
+
+// Checks every display once. Call periodically from a loop,
+// or use WatchdogAttachEventLoop.
+void WatchdogCheck(watchdog* Watchdog);
+
+// Runs WatchdogCheck on Loop every refresh period of the fastest display.
+event_source* WatchdogAttachEventLoop(watchdog* Watchdog, event_loop* Loop);
+
+// Fault injection: the display's next Count page flip events are
+// dropped, as if the driver had lost them.
+void WatchdogInjectDroppedFlips(egl_display* Display, uint32_t Count);
+
+#endif /* WATCHDOG_H */
@@ -0,0 +1,120 @@
+#include "workers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "threads.h"
+
+typedef struct {
+    worker_pool* Pool;
+    int          Index;
+} worker_arg;
+
+static void RunJobs(worker_pool* Pool) {
+    int Job;
+    while ((Job = atomic_fetch_add_explicit(&Pool->NextJob, 1,
+                memory_order_relaxed)) < Pool->Jobs) {
+        Pool->Job(Job, Pool->UserData);
+    }
+}
+
+static void CheckOut(worker_pool* Pool) {
+    // Release, so the batch's results are visible to RunWorkers
+    if (atomic_fetch_sub_explicit(&Pool->Busy, 1, memory_order_release) == 1) {
+        FutexWake(&Pool->Busy);
+    }
+}
+
+static void* WorkerThreadMain(void* Arg) {
+    worker_arg* Worker = Arg;
+    worker_pool* Pool = Worker->Pool;
+
+    char Name[32];
+    snprintf(Name, sizeof(Name), "Worker %i", Worker->Index);
+    ApplyThreadProfile(Name, GetThreadProfile("WORKER_THREAD_PROFILE", Worker->Index));
+    free(Worker);
+
+    // From the pool's first generation, not the current one: a batch
+    // may have started before this thread did, and it's counted on
+    uint32_t Seen = 0;
+    while (1) {
+        uint32_t Generation;
+        while ((Generation = atomic_load_explicit(&Pool->Generation,
+                    memory_order_acquire)) == Seen) {
+            FutexWait(&Pool->Generation, Seen, -1);
+        }
+        Seen = Generation;
+
+        if (atomic_load_explicit(&Pool->Stop, memory_order_relaxed)) {
+            break;
+        }
+        RunJobs(Pool);
+        CheckOut(Pool);
+    }
+    return NULL;
+}
+
+worker_pool* CreateWorkerPool(int Count) {
+    if (Count <= 0) {
+        Count = MAX((int)sysconf(_SC_NPROCESSORS_ONLN) - 1, 1);
+    }
+
+    worker_pool* Pool = aligned_alloc(CACHE_LINE_SIZE,
+        (sizeof(worker_pool) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+    memset(Pool, 0, sizeof(worker_pool));
+    atomic_init(&Pool->Generation, 0);
+    atomic_init(&Pool->Stop, false);
+    atomic_init(&Pool->NextJob, 0);
+    atomic_init(&Pool->Busy, 0);
+
+    Pool->Threads      = calloc(Count, sizeof(pthread_t));
+    Pool->ThreadsCount = Count;
+    for (int ThreadIndex = 0; ThreadIndex < Count; ThreadIndex++) {
+        worker_arg* Worker = malloc(sizeof(worker_arg));
+        Worker->Pool  = Pool;
+        Worker->Index = ThreadIndex;
+        if (pthread_create(&Pool->Threads[ThreadIndex], NULL, WorkerThreadMain, Worker)) {
+            Fatal("Couldn't create worker thread\n");
+        }
+    }
+    return Pool;
+}
+
+void RunWorkers(worker_pool* Pool, int Jobs, worker_job Job, void* UserData) {
+    if (Jobs <= 0) return;
+
+    // Not worth waking anyone for
+    if (Jobs == 1) {
+        Job(0, UserData);
+        return;
+    }
+
+    Pool->Job      = Job;
+    Pool->UserData = UserData;
+    Pool->Jobs     = Jobs;
+    atomic_store_explicit(&Pool->NextJob, 0, memory_order_relaxed);
+    atomic_store_explicit(&Pool->Busy, Pool->ThreadsCount, memory_order_relaxed);
+    // Release, so threads seeing the new generation see the batch
+    atomic_fetch_add_explicit(&Pool->Generation, 1, memory_order_release);
+    FutexWake(&Pool->Generation);
+
+    RunJobs(Pool);
+
+    uint32_t Busy;
+    while ((Busy = atomic_load_explicit(&Pool->Busy, memory_order_acquire)) != 0) {
+        FutexWait(&Pool->Busy, Busy, -1);
+    }
+}
+
+void DestroyWorkerPool(worker_pool* Pool) {
+    atomic_store_explicit(&Pool->Stop, true, memory_order_relaxed);
+    atomic_fetch_add_explicit(&Pool->Generation, 1, memory_order_release);
+    FutexWake(&Pool->Generation);
+    for (int ThreadIndex = 0; ThreadIndex < Pool->ThreadsCount; ThreadIndex++) {
+        pthread_join(Pool->Threads[ThreadIndex], NULL);
+    }
+    free(Pool->Threads);
+    free(Pool);
+}
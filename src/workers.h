@@ -0,0 +1,50 @@
+#if !defined(WORKERS_H)
+#define WORKERS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "utils.h"
+
+// A fixed pool of threads for splitting CPU work (e.g. tiles of a
+// software rendered frame) into jobs run in parallel:
+//
+//   worker_pool* Pool = CreateWorkerPool(0);
+//   RunWorkers(Pool, TilesCount, RenderTile, &Frame);
+//
+// RunWorkers returns once every job has run. The calling thread runs
+// jobs too, so a pool of N threads runs N+1 jobs at a time.
+// Only one thread may call RunWorkers on a pool at a time.
+
+typedef void (*worker_job)(int Job, void* UserData);
+
+typedef struct {
+    pthread_t* Threads;
+    int        ThreadsCount;
+
+    // Futex word bumped to start each batch of jobs
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t Generation;
+    atomic_bool Stop;
+    worker_job  Job;
+    void*       UserData;
+    int         Jobs;
+
+    // Claimed by each thread in turn
+    _Alignas(CACHE_LINE_SIZE) atomic_int NextJob;
+
+    // Threads still working on the batch; a futex word RunWorkers
+    // waits on. Every thread checks in for every batch, so no thread
+    // can still be looking at a batch when the next one is set up.
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t Busy;
+} worker_pool;
+
+// Count threads, or one per online CPU except the caller's if Count
+// is 0. Each thread is placed with GetThreadProfile("WORKER_THREAD_PROFILE", i).
+worker_pool* CreateWorkerPool(int Count);
+
+void RunWorkers(worker_pool* Pool, int Jobs, worker_job Job, void* UserData);
+
+void DestroyWorkerPool(worker_pool* Pool);
+
+#endif /* WORKERS_H */
@@ -0,0 +1,384 @@
+#include "writeback.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/sync_file.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "log.h"
+#include "utils.h"
+
+static bool SupportsFormat(int drmFd, uint32_t ConnectorID, uint32_t Format) {
+    uint64_t BlobID = 0;
+    if (!FindPropertyValue(drmFd, ConnectorID, DRM_MODE_OBJECT_CONNECTOR,
+            "WRITEBACK_PIXEL_FORMATS", &BlobID) || BlobID == 0) {
+        return false;
+    }
+    drmModePropertyBlobPtr Blob = drmModeGetPropertyBlob(drmFd, (uint32_t)BlobID);
+    if (!Blob) {
+        return false;
+    }
+    bool Found = false;
+    const uint32_t* Formats = Blob->data;
+    for (uint32_t Index = 0; Index < Blob->length / sizeof(uint32_t); Index++) {
+        Found = Found || Formats[Index] == Format;
+    }
+    drmModeFreePropertyBlob(Blob);
+    return Found;
+}
+
+// A writeback connector that can be routed to the CRTC and isn't in
+// use by another; 0 if there is none.
+static uint32_t FindWritebackConnector(int drmFd, kms_plane* Plane) {
+    drmModeResPtr pModeRes = drmModeGetResources(drmFd);
+    if (!pModeRes) {
+        return 0;
+    }
+
+    uint32_t Found = 0;
+    for (int i = 0; i < pModeRes->count_connectors && !Found; i++) {
+        drmModeConnectorPtr pConnector =
+            drmModeGetConnector(drmFd, pModeRes->connectors[i]);
+        if (!pConnector) {
+            continue;
+        }
+        if (pConnector->connector_type == DRM_MODE_CONNECTOR_WRITEBACK) {
+            uint64_t CrtcID = 0;
+            FindPropertyValue(drmFd, pConnector->connector_id,
+                DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", &CrtcID);
+
+            bool Routable = false;
+            for (int j = 0; j < pConnector->count_encoders; j++) {
+                drmModeEncoderPtr pEncoder =
+                    drmModeGetEncoder(drmFd, pConnector->encoders[j]);
+                if (pEncoder) {
+                    Routable = Routable ||
+                        (pEncoder->possible_crtcs & (1 << Plane->CrtcIndex));
+                    drmModeFreeEncoder(pEncoder);
+                }
+            }
+
+            if (Routable && (CrtcID == 0 || CrtcID == Plane->CrtcID)) {
+                Found = pConnector->connector_id;
+            }
+        }
+        drmModeFreeConnector(pConnector);
+    }
+    drmModeFreeResources(pModeRes);
+    return Found;
+}
+
+writeback_capture* CreateWritebackCapture(int drmFd, kms_plane* Plane, int FramesCount) {
+    if (drmSetClientCap(drmFd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1) != 0) {
+        printf("The driver doesn't expose writeback connectors\n");
+        return NULL;
+    }
+
+    uint32_t ConnectorID = FindWritebackConnector(drmFd, Plane);
+    if (!ConnectorID) {
+        printf("No writeback connector for CRTC %u\n", Plane->CrtcID);
+        return NULL;
+    }
+    if (!SupportsFormat(drmFd, ConnectorID, DRM_FORMAT_XRGB8888)) {
+        printf("Writeback connector %u can't write XRGB8888\n", ConnectorID);
+        return NULL;
+    }
+
+    writeback_capture* Capture = calloc(1, sizeof(writeback_capture));
+    Capture->drmFd       = drmFd;
+    Capture->Plane       = Plane;
+    Capture->ConnectorID = ConnectorID;
+    Capture->Adding      = -1;
+    Capture->FbIDProperty = GetPropertyID(drmFd, ConnectorID,
+        DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_FB_ID");
+    Capture->OutFencePtrProperty = GetPropertyID(drmFd, ConnectorID,
+        DRM_MODE_OBJECT_CONNECTOR, "WRITEBACK_OUT_FENCE_PTR");
+    StatReset(&Capture->Latency);
+
+    // Buffers must match the mode
+    Capture->FramesCount = CLAMP(2, WRITEBACK_MAX_FRAMES, FramesCount);
+    for (int FrameIndex = 0; FrameIndex < Capture->FramesCount; FrameIndex++) {
+        writeback_frame* Frame = &Capture->Frames[FrameIndex];
+        Frame->OutFence = -1;
+        if (!CreateDumbBuffer(drmFd, Plane->Width, Plane->Height,
+                DRM_FORMAT_XRGB8888, &Frame->Buffer)) {
+            Capture->FramesCount = FrameIndex;
+            DestroyWritebackCapture(Capture);
+            return NULL;
+        }
+    }
+
+    // Routing a connector to the CRTC is a modeset; afterwards each
+    // capture only needs a framebuffer in the flip's commit.
+    drmModeAtomicReqPtr pAtomic = drmModeAtomicAlloc();
+    drmModeAtomicAddProperty(pAtomic, ConnectorID,
+        GetPropertyID(drmFd, ConnectorID, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID"),
+        Plane->CrtcID);
+    int ret = drmModeAtomicCommit(drmFd, pAtomic, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+    drmModeAtomicFree(pAtomic);
+    if (ret != 0) {
+        printf("Unable to attach writeback connector %u to CRTC %u: %s\n",
+            ConnectorID, Plane->CrtcID, strerror(errno));
+        DestroyWritebackCapture(Capture);
+        return NULL;
+    }
+
+    printf("Capturing CRTC %u with writeback connector %u (%i buffers)\n",
+        Plane->CrtcID, ConnectorID, Capture->FramesCount);
+    return Capture;
+}
+
+// A free buffer, else the oldest finished capture nobody acquired.
+// That capture stays READY until the commit goes through, in case it
+// doesn't.
+static int PickFrame(writeback_capture* Capture) {
+    int Oldest = -1;
+    for (int FrameIndex = 0; FrameIndex < Capture->FramesCount; FrameIndex++) {
+        writeback_frame* Frame = &Capture->Frames[FrameIndex];
+        if (Frame->State == WRITEBACK_FREE) {
+            return FrameIndex;
+        }
+        if (Frame->State == WRITEBACK_READY &&
+            (Oldest < 0 || Frame->Sequence < Capture->Frames[Oldest].Sequence)) {
+            Oldest = FrameIndex;
+        }
+    }
+    return Oldest;
+}
+
+bool AddWritebackCapture(writeback_capture* Capture, drmModeAtomicReqPtr Request) {
+    int FrameIndex = PickFrame(Capture);
+    if (FrameIndex < 0) {
+        return false;
+    }
+    writeback_frame* Frame = &Capture->Frames[FrameIndex];
+    Frame->OutFence = -1;
+
+    drmModeAtomicAddProperty(Request, Capture->ConnectorID,
+        Capture->FbIDProperty, Frame->Buffer.Framebuffer);
+    // The kernel writes the fence's fd here during the commit
+    drmModeAtomicAddProperty(Request, Capture->ConnectorID,
+        Capture->OutFencePtrProperty, (uint64_t)(uintptr_t)&Frame->OutFence);
+    Capture->Adding = FrameIndex;
+    return true;
+}
+
+void FinishWritebackCommit(writeback_capture* Capture, bool Committed, uint64_t CommitNS) {
+    if (Capture->Adding < 0) {
+        return;
+    }
+    writeback_frame* Frame = &Capture->Frames[Capture->Adding];
+    Capture->Adding = -1;
+
+    if (!Committed) {
+        // Nothing was written, so a capture picked to be overwritten
+        // is still there
+        return;
+    }
+    if (Frame->State == WRITEBACK_READY) {
+        Capture->Overwritten++;
+    }
+    if (Frame->OutFence < 0) {
+        Frame->State = WRITEBACK_FREE;
+        return;
+    }
+    Frame->State    = WRITEBACK_PENDING;
+    Frame->Sequence = ++Capture->Sequence;
+    Frame->CommitNS = CommitNS;
+}
+
+bool CommitWritebackCapture(writeback_capture* Capture) {
+    drmModeAtomicReqPtr pAtomic = drmModeAtomicAlloc();
+    if (!AddWritebackCapture(Capture, pAtomic)) {
+        drmModeAtomicFree(pAtomic);
+        return false;
+    }
+    uint64_t CommitNS = GetTimeNS();
+    int ret = drmModeAtomicCommit(Capture->drmFd, pAtomic, DRM_MODE_ATOMIC_NONBLOCK, NULL);
+    drmModeAtomicFree(pAtomic);
+    FinishWritebackCommit(Capture, ret == 0, CommitNS);
+    return ret == 0;
+}
+
+// When the fence signalled, or now if the driver doesn't say
+static uint64_t FenceTimestampNS(int Fence) {
+    struct sync_fence_info FenceInfo = { 0 };
+    struct sync_file_info FileInfo = {
+        .num_fences      = 1,
+        .sync_fence_info = (uint64_t)(uintptr_t)&FenceInfo,
+    };
+    if (ioctl(Fence, SYNC_IOC_FILE_INFO, &FileInfo) == 0 &&
+        FenceInfo.status == 1 && FenceInfo.timestamp_ns) {
+        return FenceInfo.timestamp_ns;
+    }
+    return GetTimeNS();
+}
+
+static uint64_t FindStampCommitNS(writeback_capture* Capture, uint32_t Stamp) {
+    int Count = MIN(Capture->StampsCount, WRITEBACK_STAMP_HISTORY);
+    for (int Index = 0; Index < Count; Index++) {
+        if (Capture->Stamps[Index] == Stamp) {
+            return Capture->StampCommitNS[Index];
+        }
+    }
+    return 0;
+}
+
+static void FinishFrame(writeback_capture* Capture, writeback_frame* Frame) {
+    Frame->CaptureNS = FenceTimestampNS(Frame->OutFence);
+    close(Frame->OutFence);
+    Frame->OutFence = -1;
+    Frame->State    = WRITEBACK_READY;
+    Capture->Captured++;
+
+    dumb_buffer* Buffer = &Frame->Buffer;
+    Frame->HasStamp = ReadFrameStamp(DumbBufferRow(Buffer, 0),
+        Buffer->Pitch / sizeof(uint32_t), &Frame->Stamp);
+    uint64_t StampCommitNS = Frame->HasStamp ?
+        FindStampCommitNS(Capture, Frame->Stamp) : 0;
+    if (StampCommitNS == 0 || StampCommitNS > Frame->CaptureNS) {
+        Capture->Unstamped++;
+        return;
+    }
+    StatAdd(&Capture->Latency, (Frame->CaptureNS - StampCommitNS) / 1000000.0);
+}
+
+void WaitWritebackCapture(writeback_capture* Capture, int TimeoutMS) {
+    struct pollfd Fences[WRITEBACK_MAX_FRAMES];
+    int FencesCount = 0;
+    for (int FrameIndex = 0; FrameIndex < Capture->FramesCount; FrameIndex++) {
+        writeback_frame* Frame = &Capture->Frames[FrameIndex];
+        if (Frame->State == WRITEBACK_PENDING) {
+            Fences[FencesCount++] = (struct pollfd){ .fd = Frame->OutFence, .events = POLLIN };
+        }
+    }
+    if (FencesCount == 0 || poll(Fences, FencesCount, TimeoutMS) <= 0) {
+        return;
+    }
+
+    // Finish in commit order, so Sequence orders the captures
+    while (1) {
+        writeback_frame* Oldest = NULL;
+        for (int FrameIndex = 0; FrameIndex < Capture->FramesCount; FrameIndex++) {
+            writeback_frame* Frame = &Capture->Frames[FrameIndex];
+            if (Frame->State == WRITEBACK_PENDING &&
+                (!Oldest || Frame->Sequence < Oldest->Sequence)) {
+                Oldest = Frame;
+            }
+        }
+        if (!Oldest) {
+            break;
+        }
+        struct pollfd Fence = { .fd = Oldest->OutFence, .events = POLLIN };
+        if (poll(&Fence, 1, 0) <= 0) {
+            break;
+        }
+        FinishFrame(Capture, Oldest);
+    }
+}
+
+void UpdateWritebackCapture(writeback_capture* Capture) {
+    WaitWritebackCapture(Capture, 0);
+}
+
+writeback_frame* AcquireWritebackFrame(writeback_capture* Capture) {
+    writeback_frame* Oldest = NULL;
+    for (int FrameIndex = 0; FrameIndex < Capture->FramesCount; FrameIndex++) {
+        writeback_frame* Frame = &Capture->Frames[FrameIndex];
+        // Not one an uncommitted request is about to overwrite
+        if (Frame->State == WRITEBACK_READY && FrameIndex != Capture->Adding &&
+            (!Oldest || Frame->Sequence < Oldest->Sequence)) {
+            Oldest = Frame;
+        }
+    }
+    if (Oldest) {
+        Oldest->State = WRITEBACK_HELD;
+    }
+    return Oldest;
+}
+
+void ReleaseWritebackFrame(writeback_capture* Capture, writeback_frame* Frame) {
+    (void)Capture;
+    Frame->State = WRITEBACK_FREE;
+}
+
+void RecordFrameStamp(writeback_capture* Capture, uint32_t Stamp, uint64_t CommitNS) {
+    int Index = Capture->StampsCount++ % WRITEBACK_STAMP_HISTORY;
+    Capture->Stamps[Index]        = Stamp;
+    Capture->StampCommitNS[Index] = CommitNS;
+}
+
+damage_rect FrameStampRect() {
+    return (damage_rect){ 0, 0,
+        FRAME_STAMP_BLOCKS * FRAME_STAMP_BLOCK, FRAME_STAMP_BLOCK };
+}
+
+void DrawFrameStamp(pixel_tile* Tile, uint32_t Stamp) {
+    for (int Block = 0; Block < FRAME_STAMP_BLOCKS; Block++) {
+        bool White = Block == 0 ||
+            (Block >= 2 && (Stamp >> (Block - 2)) & 1);
+        FillRect(Tile, Block * FRAME_STAMP_BLOCK, 0,
+            FRAME_STAMP_BLOCK, FRAME_STAMP_BLOCK,
+            White ? 0xFFFFFFFF : 0xFF000000);
+    }
+}
+
+// Blocks are read at their centers, and thresholded, so color
+// correction or gamma at scanout (see color.h) doesn't break them.
+static int ReadBlock(const uint32_t* Pixels, int Stride, int Block) {
+    int Center = FRAME_STAMP_BLOCK / 2;
+    uint32_t Pixel = Pixels[Center * Stride + Block * FRAME_STAMP_BLOCK + Center];
+    int Brightness = ((Pixel >> 16) & 0xFF) + ((Pixel >> 8) & 0xFF) + (Pixel & 0xFF);
+    return Brightness > 3 * 0xC0 ? 1 : Brightness < 3 * 0x40 ? 0 : -1;
+}
+
+bool ReadFrameStamp(const uint32_t* Pixels, int Stride, uint32_t* Stamp) {
+    if (ReadBlock(Pixels, Stride, 0) != 1 || ReadBlock(Pixels, Stride, 1) != 0) {
+        return false;
+    }
+    uint32_t Value = 0;
+    for (int Bit = 0; Bit < 32; Bit++) {
+        int Block = ReadBlock(Pixels, Stride, 2 + Bit);
+        if (Block < 0) {
+            return false;
+        }
+        Value |= (uint32_t)Block << Bit;
+    }
+    *Stamp = Value;
+    return true;
+}
+
+void ReportWritebackCapture(writeback_capture* Capture) {
+    frame_stat* Latency = &Capture->Latency;
+    LOG(LOG_INFO, "%20s: %lu captures, %lu overwritten, %lu unstamped, "
+        "commit to scanout %.2fms (%.2f-%.2f)\n",
+        Capture->Plane->EDID->MonitorName,
+        (unsigned long)Capture->Captured, (unsigned long)Capture->Overwritten,
+        (unsigned long)Capture->Unstamped,
+        StatAverage(Latency), Latency->Count ? Latency->Min : 0, Latency->Max);
+    StatReset(Latency);
+    Capture->Captured    = 0;
+    Capture->Overwritten = 0;
+    Capture->Unstamped   = 0;
+}
+
+void DestroyWritebackCapture(writeback_capture* Capture) {
+    for (int FrameIndex = 0; FrameIndex < Capture->FramesCount; FrameIndex++) {
+        writeback_frame* Frame = &Capture->Frames[FrameIndex];
+        if (Frame->OutFence >= 0) {
+            // Wait for the hardware to stop writing before freeing
+            struct pollfd Fence = { .fd = Frame->OutFence, .events = POLLIN };
+            poll(&Fence, 1, 1000);
+            close(Frame->OutFence);
+        }
+        DestroyDumbBuffer(&Frame->Buffer);
+    }
+    free(Capture);
+}
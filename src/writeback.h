@@ -0,0 +1,133 @@
+#if !defined(WRITEBACK_H)
+#define WRITEBACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include "damage.h"
+#include "dumb.h"
+#include "frame.h"
+#include "kms.h"
+#include "pixels.h"
+
+// Captures what a CRTC actually scanned out, through a writeback
+// connector: the display hardware (or vkms) writes its composited
+// output into a framebuffer we give it in the same atomic commit as
+// the frame, and signals an out fence once it's written.
+//
+// Captures go into a small ring of dumb buffers. When every buffer is
+// waiting or unconsumed, the oldest unconsumed capture is overwritten.
+//
+//   writeback_capture* Capture = CreateWritebackCapture(drmFd, Plane, 4);
+//   ...
+//   AddWritebackCapture(Capture, Request);      // with a flip's commit
+//   int ret = drmModeAtomicCommit(...);
+//   FinishWritebackCommit(Capture, ret == 0, CommitNS);
+//   ...
+//   UpdateWritebackCapture(Capture);            // or WaitWritebackCapture
+//   writeback_frame* Frame = AcquireWritebackFrame(Capture);
+//   if (Frame) { check Frame->Buffer; ReleaseWritebackFrame(Capture, Frame); }
+//
+// Frames can carry a stamp (DrawFrameStamp) identifying them. The
+// time each stamp was committed is recorded with RecordFrameStamp,
+// and each capture's stamp is read back to measure commit-to-scanout
+// latency: from the commit to the writeback's out fence signalling.
+
+#define WRITEBACK_MAX_FRAMES 8
+// Stamps whose commit times are remembered
+#define WRITEBACK_STAMP_HISTORY 64
+
+// A stamp is 32 bits as a row of black or white blocks, after a
+// white and a black sync block, at the top left of the frame.
+#define FRAME_STAMP_BLOCK 4
+#define FRAME_STAMP_BLOCKS (2 + 32)
+
+typedef enum {
+    WRITEBACK_FREE,
+    WRITEBACK_PENDING, // Committed, fence not yet signalled
+    WRITEBACK_READY,
+    WRITEBACK_HELD,    // Acquired by the consumer
+} writeback_state;
+
+typedef struct {
+    dumb_buffer     Buffer;
+    writeback_state State;
+    // Set by the kernel on commit; -1 once closed
+    int32_t         OutFence;
+    uint64_t        Sequence;
+    uint64_t        CommitNS;
+    uint64_t        CaptureNS; // When the fence signalled
+    bool            HasStamp;
+    uint32_t        Stamp;
+} writeback_frame;
+
+typedef struct {
+    int        drmFd;
+    kms_plane* Plane;
+    uint32_t   ConnectorID;
+    uint32_t   FbIDProperty;
+    uint32_t   OutFencePtrProperty;
+
+    writeback_frame Frames[WRITEBACK_MAX_FRAMES];
+    int             FramesCount;
+    int             Adding; // Frame added to an uncommitted request, or -1
+    uint64_t        Sequence;
+
+    uint32_t   Stamps[WRITEBACK_STAMP_HISTORY];
+    uint64_t   StampCommitNS[WRITEBACK_STAMP_HISTORY];
+    int        StampsCount;
+
+    // Counters, for reporting
+    frame_stat Latency; // ms from commit to capture
+    uint64_t   Captured;
+    uint64_t   Overwritten;
+    uint64_t   Unstamped;
+} writeback_capture;
+
+// Finds a writeback connector for the plane's CRTC and attaches it,
+// with a blocking modeset commit, so call it before the CRTC's frame
+// loop starts. Returns NULL (printing why) if the driver has none.
+writeback_capture* CreateWritebackCapture(int drmFd, kms_plane* Plane, int FramesCount);
+
+// Adds a capture of this commit's output to an atomic request.
+// Returns false if there's no buffer to capture into.
+bool AddWritebackCapture(writeback_capture* Capture, drmModeAtomicReqPtr Request);
+
+// Call after committing a request that AddWritebackCapture added to.
+void FinishWritebackCommit(writeback_capture* Capture, bool Committed, uint64_t CommitNS);
+
+// Captures the CRTC's next frame with a commit of its own, for
+// backends that can't add to their flip commits (EGLStreams).
+// Returns false if the commit failed, e.g. with EBUSY during a flip.
+bool CommitWritebackCapture(writeback_capture* Capture);
+
+// Collects captures whose fences have signalled, without blocking.
+void UpdateWritebackCapture(writeback_capture* Capture);
+
+// Like UpdateWritebackCapture, but blocks up to TimeoutMS for a
+// pending capture to finish.
+void WaitWritebackCapture(writeback_capture* Capture, int TimeoutMS);
+
+// The oldest finished capture, or NULL. Hand it back with
+// ReleaseWritebackFrame.
+writeback_frame* AcquireWritebackFrame(writeback_capture* Capture);
+void ReleaseWritebackFrame(writeback_capture* Capture, writeback_frame* Frame);
+
+// Remembers when a frame with the stamp was committed.
+void RecordFrameStamp(writeback_capture* Capture, uint32_t Stamp, uint64_t CommitNS);
+
+// Draws the stamp within the tile; damage FrameStampRect with it.
+void DrawFrameStamp(pixel_tile* Tile, uint32_t Stamp);
+damage_rect FrameStampRect();
+
+// Reads a stamp from the top left of a frame; returns false if there
+// is none.
+bool ReadFrameStamp(const uint32_t* Pixels, int Stride, uint32_t* Stamp);
+
+// Logs the captures and latency since the last report.
+void ReportWritebackCapture(writeback_capture* Capture);
+
+void DestroyWritebackCapture(writeback_capture* Capture);
+
+#endif /* WRITEBACK_H */
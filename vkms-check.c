@@ -0,0 +1,796 @@
+/*
+Checks the KMS setup (kms.c) and page flip pacing against vkms, the
+kernel's virtual KMS driver, so they can be tested without NVIDIA
+hardware, and benchmarks flip event latency and startup time against
+a stored baseline. Needs root; `make check-vkms` runs it.
+
+With vkms' configfs (Linux 6.17+), creates a vkms device with
+--connectors N virtual connectors (default 3), each with a primary
+and an overlay plane on its own CRTC. Without it, uses whichever
+vkms device is loaded. Displays are driven by the software backend
+(see soft.h).
+
+Checks:
+ - every connected connector got a display, with its mode set on a
+   CRTC of its own and a primary plane of that CRTC
+ - every flip completes, and nearly all land on consecutive vblanks
+ - vblank events queued with EGLQueueVBlank and EGLQueueVBlankAt
+   arrive at the sequence queued, timestamped where the refresh
+   period says that vblank falls
+ - writeback captures (see writeback.h) show the frames committed
+Then compares the metrics below against --baseline PATH (`make
+check-vkms` passes the committed baselines/vkms.txt), failing if any
+got worse by more than --tolerance (default 0.25, i.e. 25%) plus a
+small absolute slack, or if the baseline can't be read. Without
+--baseline nothing is compared. The results are always written to
+--results PATH (default vkms-results.txt, which git ignores), ready
+to replace the baseline when a change is meant to move it.
+
+A baseline containing a `placeholder` line has no measurements yet,
+so nothing is compared and the run ends with PLACEHOLDER rather than
+PASSED: copy vkms-results.txt from a run on the CI host over it.
+
+Flip delivery is measured for every flip, as the time from its vblank
+to its event being handled. The first flip is measured from the first
+commit, so device setup and waiting for the card aren't included.
+
+Exits 0 if everything passed, 1 otherwise.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "soft.h"
+#include "utils.h"
+#include "writeback.h"
+
+#define VKMS_CONFIGFS "/sys/kernel/config/vkms"
+#define VKMS_DEVICE   VKMS_CONFIGFS "/eglstreams-mini"
+
+#define DEFAULT_CONNECTORS 3
+#define DEFAULT_FLIPS      600
+#define WRITEBACK_FLIPS    60
+#define VBLANK_DELTA       3
+#define DEFAULT_TOLERANCE  0.25
+// A flip interval longer than this many periods missed a vblank
+#define MISSED_FLIP_PERIODS 1.5
+// vkms' vblanks are hrtimers, so a loaded host can miss a few
+#define MAX_MISSED_PERCENT  1.0
+
+typedef enum {
+    METRIC_STARTUP_MODESET,
+    METRIC_STARTUP_FIRST_FLIP,
+    METRIC_FLIP_DELIVERY_P50,
+    METRIC_FLIP_DELIVERY_P99,
+    METRIC_FLIP_INTERVAL_STDDEV,
+    METRIC_MISSED_FLIPS,
+    METRIC_SCANOUT_LATENCY,
+    METRIC_COUNT
+} metric;
+
+// All lower is better
+static const struct {
+    const char* Name;
+    // Allowed on top of the tolerance, so near-zero values don't
+    // fail on noise
+    double      Slack;
+} Metrics[METRIC_COUNT] = {
+    [METRIC_STARTUP_MODESET]      = { "startup_modeset_ms",      5.0  },
+    [METRIC_STARTUP_FIRST_FLIP]   = { "startup_first_flip_ms",   5.0  },
+    [METRIC_FLIP_DELIVERY_P50]    = { "flip_delivery_p50_ms",    0.05 },
+    [METRIC_FLIP_DELIVERY_P99]    = { "flip_delivery_p99_ms",    0.2  },
+    [METRIC_FLIP_INTERVAL_STDDEV] = { "flip_interval_stddev_ms", 0.1  },
+    [METRIC_MISSED_FLIPS]         = { "missed_flips_percent",    1.0  },
+    [METRIC_SCANOUT_LATENCY]      = { "commit_to_scanout_ms",    0.5  },
+};
+
+static int Failures;
+
+static void Check(bool Passed, const char* Format, ...) {
+    va_list Args;
+    va_start(Args, Format);
+    printf("%s ", Passed ? "PASS" : "FAIL");
+    vprintf(Format, Args);
+    va_end(Args);
+    if (!Passed) {
+        Failures++;
+    }
+}
+
+static bool WriteString(const char* Path, const char* Value) {
+    FILE* File = fopen(Path, "w");
+    if (!File) {
+        printf("Couldn't open %s: %s\n", Path, strerror(errno));
+        return false;
+    }
+    bool Result = fputs(Value, File) >= 0;
+    Result = (fclose(File) == 0) && Result;
+    if (!Result) {
+        printf("Couldn't write %s: %s\n", Path, strerror(errno));
+    }
+    return Result;
+}
+
+static bool MakeDir(const char* Format, int Index) {
+    char Path[256];
+    snprintf(Path, sizeof(Path), Format, Index);
+    if (mkdir(Path, 0755) != 0 && errno != EEXIST) {
+        printf("Couldn't create %s: %s\n", Path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Links e.g. VKMS_DEVICE/crtcs/crtc0 into VKMS_DEVICE/planes/primary0/possible_crtcs
+static bool Link(const char* Kind, const char* Object, const char* Possible,
+    const char* TargetKind, const char* Target, int Index)
+{
+    char TargetPath[256], LinkPath[256];
+    snprintf(TargetPath, sizeof(TargetPath), VKMS_DEVICE "/%s/%s%i",
+        TargetKind, Target, Index);
+    snprintf(LinkPath, sizeof(LinkPath), VKMS_DEVICE "/%s/%s%i/%s/%s%i",
+        Kind, Object, Index, Possible, Target, Index);
+    if (symlink(TargetPath, LinkPath) != 0 && errno != EEXIST) {
+        printf("Couldn't link %s: %s\n", LinkPath, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Creates and enables a vkms device with one pipeline per connector.
+// Returns false if vkms has no configfs, or it failed.
+static bool CreateVKMSDevice(int Connectors) {
+    if (access(VKMS_CONFIGFS, F_OK) != 0) {
+        return false;
+    }
+
+    // Left enabled by an earlier run; it can't be changed while enabled
+    FILE* Enabled = fopen(VKMS_DEVICE "/enabled", "r");
+    if (Enabled) {
+        int Value = fgetc(Enabled);
+        fclose(Enabled);
+        if (Value == '1') {
+            printf("Reusing the vkms device at %s\n", VKMS_DEVICE);
+            return true;
+        }
+    }
+
+    if (!MakeDir(VKMS_DEVICE, 0)) {
+        return false;
+    }
+    for (int Index = 0; Index < Connectors; Index++) {
+        char Path[256];
+        bool Created =
+            MakeDir(VKMS_DEVICE "/crtcs/crtc%i",           Index) &&
+            MakeDir(VKMS_DEVICE "/planes/primary%i",       Index) &&
+            MakeDir(VKMS_DEVICE "/planes/overlay%i",       Index) &&
+            MakeDir(VKMS_DEVICE "/encoders/encoder%i",     Index) &&
+            MakeDir(VKMS_DEVICE "/connectors/connector%i", Index);
+        if (!Created) {
+            return false;
+        }
+
+        snprintf(Path, sizeof(Path), VKMS_DEVICE "/crtcs/crtc%i/writeback", Index);
+        if (!WriteString(Path, "1")) return false;
+
+        // DRM_PLANE_TYPE_PRIMARY and DRM_PLANE_TYPE_OVERLAY
+        snprintf(Path, sizeof(Path), VKMS_DEVICE "/planes/primary%i/type", Index);
+        if (!WriteString(Path, "1")) return false;
+        snprintf(Path, sizeof(Path), VKMS_DEVICE "/planes/overlay%i/type", Index);
+        if (!WriteString(Path, "0")) return false;
+
+        bool Linked =
+            Link("planes",     "primary",   "possible_crtcs",    "crtcs",    "crtc",    Index) &&
+            Link("planes",     "overlay",   "possible_crtcs",    "crtcs",    "crtc",    Index) &&
+            Link("encoders",   "encoder",   "possible_crtcs",    "crtcs",    "crtc",    Index) &&
+            Link("connectors", "connector", "possible_encoders", "encoders", "encoder", Index);
+        if (!Linked) {
+            return false;
+        }
+    }
+    return WriteString(VKMS_DEVICE "/enabled", "1");
+}
+
+static int CountConnected(int drmFd) {
+    drmModeResPtr pModeRes = drmModeGetResources(drmFd);
+    if (!pModeRes) {
+        return 0;
+    }
+    int Connected = 0;
+    for (int i = 0; i < pModeRes->count_connectors; i++) {
+        drmModeConnectorPtr pConnector = drmModeGetConnector(drmFd, pModeRes->connectors[i]);
+        if (pConnector) {
+            Connected += pConnector->connection == DRM_MODE_CONNECTED;
+            drmModeFreeConnector(pConnector);
+        }
+    }
+    drmModeFreeResources(pModeRes);
+    return Connected;
+}
+
+// Finds the vkms card with the most connected connectors.
+// Returns false if there is none.
+static bool FindVKMSCard(char* Path, int PathSize, int* Connected) {
+    *Connected = 0;
+    for (int CardIndex = 0; CardIndex < 16; CardIndex++) {
+        char CardPath[32];
+        snprintf(CardPath, sizeof(CardPath), "/dev/dri/card%i", CardIndex);
+        int fd = open(CardPath, O_RDWR, 0);
+        if (fd < 0) {
+            continue;
+        }
+        drmVersionPtr Version = drmGetVersion(fd);
+        if (Version && strcmp(Version->name, "vkms") == 0) {
+            int CardConnected = CountConnected(fd);
+            if (CardConnected > *Connected) {
+                *Connected = CardConnected;
+                snprintf(Path, PathSize, "%s", CardPath);
+            }
+        }
+        drmFreeVersion(Version);
+        close(fd);
+    }
+    return *Connected > 0;
+}
+
+// Checks that each display has its own CRTC, driven with its mode by
+// a primary plane of that CRTC, and its connector routed to it.
+static void CheckDisplays(soft_state* Soft, int ExpectedDisplays) {
+    egl_state* EGL = Soft->EGL;
+    int drmFd = EGL->DRMFD;
+
+    Check(EGL->DisplaysCount == ExpectedDisplays,
+        "%i displays for %i connected connectors\n",
+        EGL->DisplaysCount, ExpectedDisplays);
+
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        kms_plane* Plane = EGL->Displays[DisplayIndex].Plane;
+        const char* Name = EGL->Displays[DisplayIndex].MonitorName;
+
+        bool Unique = true;
+        for (int OtherIndex = 0; OtherIndex < DisplayIndex; OtherIndex++) {
+            kms_plane* Other = EGL->Displays[OtherIndex].Plane;
+            Unique = Unique &&
+                Other->CrtcID != Plane->CrtcID &&
+                Other->PlaneID != Plane->PlaneID &&
+                Other->ConnectorID != Plane->ConnectorID;
+        }
+        Check(Unique, "%s: CRTC %u, plane %u and connector %u not shared\n",
+            Name, Plane->CrtcID, Plane->PlaneID, Plane->ConnectorID);
+
+        uint64_t Type = 0;
+        FindPropertyValue(drmFd, Plane->PlaneID, DRM_MODE_OBJECT_PLANE, "type", &Type);
+        uint64_t PossibleCrtcs = 0;
+        drmModePlanePtr pPlane = drmModeGetPlane(drmFd, Plane->PlaneID);
+        if (pPlane) {
+            PossibleCrtcs = pPlane->possible_crtcs;
+            drmModeFreePlane(pPlane);
+        }
+        Check(Type == DRM_PLANE_TYPE_PRIMARY && (PossibleCrtcs & (1 << Plane->CrtcIndex)),
+            "%s: plane %u is a primary plane of CRTC %u\n",
+            Name, Plane->PlaneID, Plane->CrtcID);
+
+        uint64_t PlaneCrtc = 0, ConnectorCrtc = 0;
+        FindPropertyValue(drmFd, Plane->PlaneID, DRM_MODE_OBJECT_PLANE, "CRTC_ID", &PlaneCrtc);
+        FindPropertyValue(drmFd, Plane->ConnectorID, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", &ConnectorCrtc);
+        Check(PlaneCrtc == Plane->CrtcID && ConnectorCrtc == Plane->CrtcID,
+            "%s: plane and connector are on CRTC %u\n", Name, Plane->CrtcID);
+
+        drmModeCrtcPtr pCrtc = drmModeGetCrtc(drmFd, Plane->CrtcID);
+        bool ModeSet = pCrtc && pCrtc->mode_valid &&
+            pCrtc->mode.hdisplay == Plane->Width &&
+            pCrtc->mode.vdisplay == Plane->Height;
+        Check(ModeSet, "%s: CRTC %u is active at %ix%i\n",
+            Name, Plane->CrtcID, Plane->Width, Plane->Height);
+        drmModeFreeCrtc(pCrtc);
+    }
+}
+
+static void RenderTile(egl_display* Display, pixel_tile* Tile, void* UserData) {
+    uint32_t Color = *(uint32_t*)UserData;
+    FillRect(Tile, Tile->X, Tile->Y, Tile->Width, Tile->Height, Color);
+}
+
+static uint32_t StampColor(uint32_t Stamp) {
+    return 0xFF000000 | (Stamp * 0x0F2D4B);
+}
+
+static void RenderStampedTile(egl_display* Display, pixel_tile* Tile, void* UserData) {
+    soft_display* SoftDisplay = UserData;
+    uint32_t Stamp = (uint32_t)SoftDisplay->Frame;
+    FillRect(Tile, Tile->X, Tile->Y, Tile->Width, Tile->Height, StampColor(Stamp));
+    DrawFrameStamp(Tile, Stamp);
+}
+
+// Waits for every display's queued frames and flips to finish, e.g.
+// before a blocking commit.
+static void DrainFlips(soft_state* Soft) {
+    egl_state* EGL = Soft->EGL;
+    for (int Attempt = 0; Attempt < 100; Attempt++) {
+        bool Busy = false;
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            FlushSoftFrame(Soft, &EGL->Displays[DisplayIndex]);
+            Busy = Busy || Soft->Displays[DisplayIndex].Queued >= 0 ||
+                EGLPageFlipPending(&EGL->Displays[DisplayIndex]);
+        }
+        if (!Busy) {
+            return;
+        }
+        EGLWaitVSync(EGL, 100);
+    }
+}
+
+typedef struct {
+    bool     Delivered;
+    uint64_t Sequence;
+    uint64_t TimeNS;
+} vblank_event;
+
+static void RecordVBlank(egl_display* Display, uint64_t Sequence,
+    uint64_t TimeNS, void* UserData) {
+    vblank_event* Event = UserData;
+    Event->Delivered = true;
+    Event->Sequence  = Sequence;
+    Event->TimeNS    = TimeNS;
+}
+
+// Checks an event queued for the vblank Expected arrived at it, and
+// that its time is Expected - Base refresh periods after BaseNS.
+static void CheckVBlankEvent(egl_display* Display, const char* How, vblank_event* Event,
+    uint64_t Expected, uint64_t Base, uint64_t BaseNS) {
+    double PeriodNS = GetRefreshPeriodNS(Display->Plane);
+    double ExpectedNS = BaseNS + (Expected - Base) * PeriodNS;
+    Check(Event->Delivered && Event->Sequence == Expected,
+        "%s: %s event for vblank %llu arrived at %llu\n",
+        Display->MonitorName, How, (unsigned long long)Expected,
+        Event->Delivered ? (unsigned long long)Event->Sequence : 0ULL);
+    Check(Event->Delivered && fabs(Event->TimeNS - ExpectedNS) < PeriodNS / 2,
+        "%s: %s event timestamped %.2fms from where vblank %llu falls\n",
+        Display->MonitorName, How,
+        Event->Delivered ? (Event->TimeNS - ExpectedNS) / 1000000.0 : NAN,
+        (unsigned long long)Expected);
+}
+
+// Queues an event VBLANK_DELTA vblanks ahead on every display, and
+// another for the absolute vblank after it, and checks both arrive at
+// the sequence queued with timestamps that fit the refresh period.
+static void CheckVBlankEvents(soft_state* Soft) {
+    egl_state* EGL = Soft->EGL;
+    DrainFlips(Soft);
+
+    int DisplaysCount = EGL->DisplaysCount;
+    vblank_event* Relative = calloc(DisplaysCount, sizeof(vblank_event));
+    vblank_event* Absolute = calloc(DisplaysCount, sizeof(vblank_event));
+    uint64_t* Base     = calloc(DisplaysCount, sizeof(uint64_t));
+    uint64_t* BaseNS   = calloc(DisplaysCount, sizeof(uint64_t));
+    uint64_t* Queued   = calloc(DisplaysCount, sizeof(uint64_t));
+    bool*     QueuedRelative = calloc(DisplaysCount, sizeof(bool));
+    bool*     QueuedAbsolute = calloc(DisplaysCount, sizeof(bool));
+
+    for (int DisplayIndex = 0; DisplayIndex < DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        bool Current = EGLGetVBlank(EGL, Display, &Base[DisplayIndex], &BaseNS[DisplayIndex]);
+        QueuedRelative[DisplayIndex] = Current && EGLQueueVBlank(EGL, Display, VBLANK_DELTA,
+            RecordVBlank, &Relative[DisplayIndex], &Queued[DisplayIndex]);
+        Check(QueuedRelative[DisplayIndex] &&
+            Queued[DisplayIndex] >= Base[DisplayIndex] + VBLANK_DELTA,
+            "%s: queued an event %i vblanks after %llu\n",
+            Display->MonitorName, VBLANK_DELTA, (unsigned long long)Base[DisplayIndex]);
+        if (!QueuedRelative[DisplayIndex]) continue;
+
+        uint64_t QueuedAt = 0;
+        QueuedAbsolute[DisplayIndex] = EGLQueueVBlankAt(EGL, Display, Queued[DisplayIndex] + 1,
+            RecordVBlank, &Absolute[DisplayIndex], &QueuedAt);
+        Check(QueuedAbsolute[DisplayIndex] && QueuedAt == Queued[DisplayIndex] + 1,
+            "%s: queued an event for vblank %llu\n",
+            Display->MonitorName, (unsigned long long)(Queued[DisplayIndex] + 1));
+    }
+
+    uint64_t DeadlineNS = GetTimeNS() + (VBLANK_DELTA + 1) * 100000000ULL;
+    bool Done = false;
+    while (!Done && GetTimeNS() < DeadlineNS) {
+        EGLWaitVSync(EGL, 100);
+        Done = true;
+        for (int DisplayIndex = 0; DisplayIndex < DisplaysCount; DisplayIndex++) {
+            Done = Done &&
+                (!QueuedRelative[DisplayIndex] || Relative[DisplayIndex].Delivered) &&
+                (!QueuedAbsolute[DisplayIndex] || Absolute[DisplayIndex].Delivered);
+        }
+    }
+
+    for (int DisplayIndex = 0; DisplayIndex < DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        if (QueuedRelative[DisplayIndex]) {
+            CheckVBlankEvent(Display, "relative", &Relative[DisplayIndex],
+                Queued[DisplayIndex], Base[DisplayIndex], BaseNS[DisplayIndex]);
+        }
+        if (QueuedAbsolute[DisplayIndex]) {
+            CheckVBlankEvent(Display, "absolute", &Absolute[DisplayIndex],
+                Queued[DisplayIndex] + 1, Base[DisplayIndex], BaseNS[DisplayIndex]);
+        }
+    }
+
+    // An event that never arrived is still queued with a pointer into
+    // these, so they're only freed once every one has
+    if (Done) {
+        free(Relative);
+        free(Absolute);
+    }
+    free(Base);
+    free(BaseNS);
+    free(Queued);
+    free(QueuedRelative);
+    free(QueuedAbsolute);
+}
+
+// Captures WRITEBACK_FLIPS stamped frames on every display, and checks
+// each capture shows the frame its stamp says was committed.
+static void CheckWriteback(soft_state* Soft, double* Results) {
+    egl_state* EGL = Soft->EGL;
+    DrainFlips(Soft);
+
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        Soft->Displays[DisplayIndex].Capture =
+            CreateWritebackCapture(EGL->DRMFD, Display->Plane, 4);
+        Check(Soft->Displays[DisplayIndex].Capture != NULL,
+            "%s: has a writeback connector\n", Display->MonitorName);
+    }
+
+    double   LatencySum = 0;
+    uint64_t LatencyCount = 0;
+    int* Committed = calloc(EGL->DisplaysCount, sizeof(int));
+    int* Verified  = calloc(EGL->DisplaysCount, sizeof(int));
+    int* Wrong     = calloc(EGL->DisplaysCount, sizeof(int));
+    uint64_t DeadlineNS = GetTimeNS() + WRITEBACK_FLIPS * 100000000ULL;
+
+    bool Done = false;
+    while (!Done && GetTimeNS() < DeadlineNS) {
+        Done = true;
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+            soft_display* SoftDisplay = &Soft->Displays[DisplayIndex];
+            writeback_capture* Capture = SoftDisplay->Capture;
+            if (!Capture) continue;
+
+            FlushSoftFrame(Soft, Display);
+            if (Committed[DisplayIndex] < WRITEBACK_FLIPS && SoftFrameAvailable(Soft, Display)) {
+                RenderSoftFrame(Soft, Display, NULL, 0, RenderStampedTile, SoftDisplay);
+                PresentSoftFrame(Soft, Display);
+                Committed[DisplayIndex]++;
+            }
+
+            UpdateWritebackCapture(Capture);
+            writeback_frame* Frame;
+            while ((Frame = AcquireWritebackFrame(Capture))) {
+                dumb_buffer* Buffer = &Frame->Buffer;
+                uint32_t Pixel = DumbBufferRow(Buffer, Buffer->Height / 2)[Buffer->Width / 2];
+                bool Matches = Frame->HasStamp &&
+                    (Pixel & 0xFFFFFF) == (StampColor(Frame->Stamp) & 0xFFFFFF);
+                Verified[DisplayIndex] += Matches;
+                Wrong[DisplayIndex]    += !Matches;
+                ReleaseWritebackFrame(Capture, Frame);
+            }
+            Done = Done && Verified[DisplayIndex] + Wrong[DisplayIndex] >= WRITEBACK_FLIPS / 2 &&
+                Committed[DisplayIndex] >= WRITEBACK_FLIPS;
+        }
+        EGLWaitVSync(EGL, 100);
+    }
+
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        writeback_capture* Capture = Soft->Displays[DisplayIndex].Capture;
+        if (!Capture) continue;
+        Check(Verified[DisplayIndex] >= WRITEBACK_FLIPS / 2 && Wrong[DisplayIndex] == 0,
+            "%s: %i captures show their committed frame, %i don't\n",
+            EGL->Displays[DisplayIndex].MonitorName, Verified[DisplayIndex], Wrong[DisplayIndex]);
+        LatencySum   += Capture->Latency.Sum;
+        LatencyCount += Capture->Latency.Count;
+    }
+    Results[METRIC_SCANOUT_LATENCY] = LatencyCount ? LatencySum / LatencyCount : 0;
+
+    free(Committed);
+    free(Verified);
+    free(Wrong);
+}
+
+static int CompareDoubles(const void* A, const void* B) {
+    double L = *(const double*)A, R = *(const double*)B;
+    return (L > R) - (L < R);
+}
+
+// Every flip event's delivery: from its vblank to being handled
+typedef struct {
+    double* Samples;
+    int     Count;
+    int     MaxSamples;
+} flip_delivery;
+
+static flip_delivery Delivery;
+static void (*HandlePageFlip)(int fd, unsigned int frame,
+    unsigned int sec, unsigned int usec, void* data);
+
+// Wraps EGL's handler, sampling as each event is handled; the flip
+// history only has the vblank times, and by the time the loop gets to
+// look, they may have been handled a while ago.
+static void SamplePageFlip(int fd, unsigned int frame,
+    unsigned int sec, unsigned int usec, void* data)
+{
+    uint64_t HandledNS = GetTimeNS();
+    uint64_t VBlankNS  = sec * 1000000000ULL + usec * 1000ULL;
+    if (Delivery.Count < Delivery.MaxSamples && HandledNS >= VBlankNS) {
+        Delivery.Samples[Delivery.Count++] = (HandledNS - VBlankNS) / 1000000.0;
+    }
+    HandlePageFlip(fd, frame, sec, usec, data);
+}
+
+// Flips every display Flips times, as fast as vblank allows, and
+// measures when each flip's event is delivered after its vblank,
+// the intervals between vblanks flipped on, and the time from the
+// first commit to the first flip.
+static void MeasureFlips(soft_state* Soft, int Flips, double* Results)
+{
+    egl_state* EGL = Soft->EGL;
+    int DisplaysCount = EGL->DisplaysCount;
+
+    int MaxSamples = Flips * DisplaysCount;
+    double* Intervals = calloc(MaxSamples, sizeof(double));
+    int IntervalsCount = 0, Missed = 0;
+    double PeriodSum = 0;
+
+    Delivery = (flip_delivery){
+        .Samples    = calloc(MaxSamples, sizeof(double)),
+        .MaxSamples = MaxSamples,
+    };
+    HandlePageFlip = EGL->DRMEventContext.page_flip_handler;
+    EGL->DRMEventContext.page_flip_handler = SamplePageFlip;
+
+    uint64_t* SeenFlips  = calloc(DisplaysCount, sizeof(uint64_t));
+    uint64_t* LastFlipNS = calloc(DisplaysCount, sizeof(uint64_t));
+    int*      Committed  = calloc(DisplaysCount, sizeof(int));
+    uint64_t  FirstCommitNS = 0;
+    uint64_t  FirstFlipNS = 0;
+    uint64_t  DeadlineNS = GetTimeNS() + Flips * 100000000ULL;
+
+    bool Done = false;
+    while (!Done && GetTimeNS() < DeadlineNS) {
+        Done = true;
+        for (int DisplayIndex = 0; DisplayIndex < DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+
+            FlushSoftFrame(Soft, Display);
+            if (Committed[DisplayIndex] < Flips && SoftFrameAvailable(Soft, Display)) {
+                uint32_t Color = 0xFF000000 | (Committed[DisplayIndex] * 0x010305);
+                RenderSoftFrame(Soft, Display, NULL, 0, RenderTile, &Color);
+                if (FirstCommitNS == 0) {
+                    FirstCommitNS = GetTimeNS();
+                }
+                PresentSoftFrame(Soft, Display);
+                Committed[DisplayIndex]++;
+            }
+            Done = Done && SeenFlips[DisplayIndex] >= (uint64_t)Flips;
+        }
+
+        EGLWaitVSync(EGL, 100);
+
+        for (int DisplayIndex = 0; DisplayIndex < DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+            double PeriodMS = GetRefreshPeriodNS(Display->Plane) / 1000000.0;
+            uint64_t DisplayFlips = atomic_load_explicit(&Display->Hot->Flips,
+                memory_order_acquire);
+
+            // Only the newest flips are still in the history
+            uint64_t First = MAX(SeenFlips[DisplayIndex], DisplayFlips - MIN(DisplayFlips, FLIP_HISTORY));
+            for (uint64_t Flip = First; Flip < DisplayFlips; Flip++) {
+                uint64_t FlipNS = atomic_load_explicit(
+                    &Display->Hot->FlipTimeNS[Flip % FLIP_HISTORY], memory_order_relaxed);
+                if (FirstFlipNS == 0 || FlipNS < FirstFlipNS) {
+                    FirstFlipNS = FlipNS;
+                }
+                if (LastFlipNS[DisplayIndex] && IntervalsCount < MaxSamples) {
+                    double Interval = (FlipNS - LastFlipNS[DisplayIndex]) / 1000000.0;
+                    Intervals[IntervalsCount++] = Interval;
+                    PeriodSum += PeriodMS;
+                    Missed += Interval > PeriodMS * MISSED_FLIP_PERIODS;
+                }
+                LastFlipNS[DisplayIndex] = FlipNS;
+            }
+            SeenFlips[DisplayIndex] = DisplayFlips;
+        }
+    }
+    EGL->DRMEventContext.page_flip_handler = HandlePageFlip;
+
+    for (int DisplayIndex = 0; DisplayIndex < DisplaysCount; DisplayIndex++) {
+        soft_display* SoftDisplay = &Soft->Displays[DisplayIndex];
+        Check(SeenFlips[DisplayIndex] >= (uint64_t)Flips,
+            "%s: %lu of %i flips completed (%lu busy commits)\n",
+            SoftDisplay->Display->MonitorName, (unsigned long)SeenFlips[DisplayIndex],
+            Flips, (unsigned long)SoftDisplay->BusyCommits);
+    }
+
+    double MeanInterval = 0, MeanPeriod = 0, Variance = 0;
+    if (IntervalsCount > 0) {
+        for (int Index = 0; Index < IntervalsCount; Index++) {
+            MeanInterval += Intervals[Index];
+        }
+        MeanInterval /= IntervalsCount;
+        MeanPeriod = PeriodSum / IntervalsCount;
+        for (int Index = 0; Index < IntervalsCount; Index++) {
+            double Deviation = Intervals[Index] - MeanInterval;
+            Variance += Deviation * Deviation;
+        }
+        Variance /= IntervalsCount;
+    }
+    double MissedPercent = IntervalsCount ? 100.0 * Missed / IntervalsCount : 100;
+    Check(IntervalsCount > 0 && MissedPercent <= MAX_MISSED_PERCENT,
+        "%i of %i flips missed a vblank (mean interval %.3fms, period %.3fms)\n",
+        Missed, IntervalsCount, MeanInterval, MeanPeriod);
+
+    int DeliveryCount = Delivery.Count;
+    qsort(Delivery.Samples, DeliveryCount, sizeof(double), CompareDoubles);
+    Check(DeliveryCount >= MIN(IntervalsCount, MaxSamples),
+        "%i flip events sampled for delivery\n", DeliveryCount);
+    Results[METRIC_STARTUP_FIRST_FLIP]   = FirstFlipNS > FirstCommitNS && FirstCommitNS ?
+        (FirstFlipNS - FirstCommitNS) / 1000000.0 : 0;
+    Results[METRIC_FLIP_DELIVERY_P50]    = DeliveryCount ? Delivery.Samples[DeliveryCount / 2] : 0;
+    Results[METRIC_FLIP_DELIVERY_P99]    = DeliveryCount ? Delivery.Samples[DeliveryCount * 99 / 100] : 0;
+    Results[METRIC_FLIP_INTERVAL_STDDEV] = sqrt(Variance);
+    Results[METRIC_MISSED_FLIPS]         = MissedPercent;
+
+    free(Delivery.Samples);
+    free(Intervals);
+    free(SeenFlips);
+    free(LastFlipNS);
+    free(Committed);
+}
+
+// Reads "name value" lines, skipping blank lines and # comments, and
+// notes a "placeholder" line. Returns false if the file can't be opened.
+static bool ReadBaseline(const char* Path, double* Baseline, bool* Present,
+    bool* Placeholder)
+{
+    FILE* File = fopen(Path, "r");
+    if (!File) {
+        return false;
+    }
+    *Placeholder = false;
+    char Line[256];
+    while (fgets(Line, sizeof(Line), File)) {
+        char Name[128];
+        double Value;
+        if (Line[0] == '#') {
+            continue;
+        }
+        if (sscanf(Line, "%127s", Name) == 1 && strcmp(Name, "placeholder") == 0) {
+            *Placeholder = true;
+            continue;
+        }
+        if (sscanf(Line, "%127s %lf", Name, &Value) != 2) {
+            continue;
+        }
+        for (int Metric = 0; Metric < METRIC_COUNT; Metric++) {
+            if (strcmp(Name, Metrics[Metric].Name) == 0) {
+                Baseline[Metric] = Value;
+                Present[Metric]  = true;
+            }
+        }
+    }
+    fclose(File);
+    return true;
+}
+
+// In the baseline's format, so it can replace it
+static void WriteResults(const char* Path, double* Results) {
+    FILE* File = fopen(Path, "w");
+    if (!File) {
+        Fatal("Couldn't write %s: %s\n", Path, strerror(errno));
+    }
+    fprintf(File, "# vkms-check results: metric value, lower is better\n");
+    for (int Metric = 0; Metric < METRIC_COUNT; Metric++) {
+        fprintf(File, "%s %.4f\n", Metrics[Metric].Name, Results[Metric]);
+    }
+    fclose(File);
+    printf("Wrote the results to %s\n", Path);
+}
+
+int main(int argc, char** argv) {
+    int Connectors = DEFAULT_CONNECTORS;
+    int Flips = DEFAULT_FLIPS;
+    double Tolerance = DEFAULT_TOLERANCE;
+    const char* BaselinePath = NULL;
+    const char* ResultsPath = "vkms-results.txt";
+    for (int ArgIndex = 1; ArgIndex < argc; ArgIndex++) {
+        bool HasValue = ArgIndex + 1 < argc;
+        if (strcmp(argv[ArgIndex], "--connectors") == 0 && HasValue) {
+            Connectors = atoi(argv[++ArgIndex]);
+        } else if (strcmp(argv[ArgIndex], "--flips") == 0 && HasValue) {
+            Flips = MAX(atoi(argv[++ArgIndex]), 2);
+        } else if (strcmp(argv[ArgIndex], "--tolerance") == 0 && HasValue) {
+            Tolerance = atof(argv[++ArgIndex]);
+        } else if (strcmp(argv[ArgIndex], "--baseline") == 0 && HasValue) {
+            BaselinePath = argv[++ArgIndex];
+        } else if (strcmp(argv[ArgIndex], "--results") == 0 && HasValue) {
+            ResultsPath = argv[++ArgIndex];
+        } else {
+            Fatal("Unknown option %s\n", argv[ArgIndex]);
+        }
+    }
+
+    if (!CreateVKMSDevice(Connectors)) {
+        printf("No vkms configfs; using the loaded vkms device's connectors\n");
+        Connectors = 0;
+    }
+
+    // Enabling the device creates its card asynchronously
+    char CardPath[32];
+    int Connected = 0;
+    for (int Attempt = 0; Attempt < 100; Attempt++) {
+        if (FindVKMSCard(CardPath, sizeof(CardPath), &Connected) &&
+            (Connectors == 0 || Connected >= Connectors)) {
+            break;
+        }
+        usleep(10000);
+    }
+    if (Connected == 0) {
+        Fatal("No vkms device with connected connectors (modprobe vkms?)\n");
+    }
+    setenv("DRI_DEVICE", CardPath, 1);
+
+    double Results[METRIC_COUNT] = { 0 };
+    uint64_t SetupStartNS = GetTimeNS();
+    soft_state* Soft = SetupSoftware(DefaultSoftOptions());
+    Results[METRIC_STARTUP_MODESET] = (GetTimeNS() - SetupStartNS) / 1000000.0;
+
+    printf("\n");
+    CheckDisplays(Soft, Connected);
+    MeasureFlips(Soft, Flips, Results);
+    CheckVBlankEvents(Soft);
+    CheckWriteback(Soft, Results);
+
+    double Baseline[METRIC_COUNT] = { 0 };
+    bool   Present[METRIC_COUNT]  = { 0 };
+    bool   HaveBaseline = false;
+    bool   Placeholder  = false;
+    if (BaselinePath) {
+        HaveBaseline = ReadBaseline(BaselinePath, Baseline, Present, &Placeholder);
+        Check(HaveBaseline, "read the baseline %s\n", BaselinePath);
+        if (Placeholder) {
+            printf("PLACEHOLDER %s has no measurements; metrics not compared\n",
+                BaselinePath);
+            HaveBaseline = false;
+        }
+    }
+
+    printf("\n%30s %12s %12s\n", "", "Result", "Baseline");
+    for (int Metric = 0; Metric < METRIC_COUNT; Metric++) {
+        if (!HaveBaseline || !Present[Metric]) {
+            printf("%30s %12.4f %12s\n", Metrics[Metric].Name, Results[Metric], "-");
+            if (HaveBaseline) {
+                Check(false, "%s in the baseline\n", Metrics[Metric].Name);
+            }
+            continue;
+        }
+        double Limit = Baseline[Metric] * (1 + Tolerance) + Metrics[Metric].Slack;
+        printf("%30s %12.4f %12.4f\n", Metrics[Metric].Name, Results[Metric], Baseline[Metric]);
+        Check(Results[Metric] <= Limit, "%s %.4f within %.4f\n",
+            Metrics[Metric].Name, Results[Metric], Limit);
+    }
+    WriteResults(ResultsPath, Results);
+
+    if (Placeholder && Failures == 0) {
+        printf("\nPLACEHOLDER: functional checks passed, but no metric was compared; "
+            "commit %s from the CI host as %s\n", ResultsPath, BaselinePath);
+        return 0;
+    }
+    printf("\n%s: %i failed\n", Failures ? "FAILED" : "PASSED", Failures);
+    return Failures ? 1 : 0;
+}
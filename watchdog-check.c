@@ -0,0 +1,176 @@
+/*
+Checks the watchdog's recovery of stuck page flips (see watchdog.h)
+against simulated displays, so it can be tested without a GPU, DRM
+device or EGLStreams.
+
+Sets up --displays N displays (default 3) as the software backend's
+are, with no EGL objects, and drives them the way the render, acquire
+and event threads would: marking flips pending, completing them, and
+dropping the first display's flip events with the same fault
+injection as `render-thread-per-display --inject-stuck-flip`.
+
+Checks:
+ - a flip isn't stuck before StuckPeriods refresh periods pass
+ - the stuck display walks through each recovery step in order,
+   repeating the last, with its flip cleared each time
+ - the render thread is asked to recreate the stream exactly once
+ - the other displays, flipping normally, are never touched
+ - once a flip lands, recovery starts over at the gentlest step
+ - a flip can't be marked pending over a pending one
+
+Exits 0 if everything passed, 1 otherwise.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "egl.h"
+#include "log.h"
+#include "utils.h"
+#include "watchdog.h"
+
+#define DEFAULT_DISPLAYS 3
+#define STUCK_PERIODS    2
+// Flip events dropped on the first display, one per recovery step
+#define DROPPED_FLIPS    4
+
+static int Failures;
+
+static void Check(bool Passed, const char* What, int Round) {
+    if (!Passed) {
+        printf("FAIL: round %i: %s\n", Round, What);
+        Failures++;
+    }
+}
+
+// Displays with only what CreateDisplays and the watchdog read;
+// a zero mode clock makes their refresh period 60Hz.
+static egl_state* SetupSimulatedDisplays(int DisplaysCount) {
+    kms_plane* Planes = calloc(DisplaysCount, sizeof(kms_plane));
+    for (int PlaneIndex = 0; PlaneIndex < DisplaysCount; PlaneIndex++) {
+        drm_edid* EDID = calloc(1, sizeof(drm_edid));
+        EDID->MonitorName = malloc(32);
+        snprintf(EDID->MonitorName, 32, "Simulated-%i", PlaneIndex);
+        EDID->SerialNumber = strdup("");
+        EDID->PNPID        = strdup("");
+        Planes[PlaneIndex].EDID    = EDID;
+        Planes[PlaneIndex].Width   = 640;
+        Planes[PlaneIndex].Height  = 480;
+        Planes[PlaneIndex].PlaneID = 100 + PlaneIndex;
+    }
+
+    egl_state* EGL = calloc(1, sizeof(egl_state));
+    EGL->DRMFD         = -1;
+    EGL->DisplaysCount = DisplaysCount;
+    EGL->Displays      = CreateDisplays(Planes, DisplaysCount);
+    return EGL;
+}
+
+// What a display's loop does each frame: acquire (marking the flip
+// pending), then the flip event arrives, unless it's being dropped.
+static void FlipDisplay(egl_display* Display) {
+    EGLSetPageFlipPending(Display);
+    EGLPageFlipCompleted(Display, GetTimeNS());
+}
+
+int main(int argc, char** argv) {
+    int DisplaysCount = DEFAULT_DISPLAYS;
+    for (int ArgIndex = 1; ArgIndex < argc; ArgIndex++) {
+        if (strcmp(argv[ArgIndex], "--displays") == 0 && ArgIndex + 1 < argc) {
+            DisplaysCount = MAX(atoi(argv[++ArgIndex]), 2);
+        }
+    }
+
+    egl_state* EGL = SetupSimulatedDisplays(DisplaysCount);
+    watchdog* Watchdog = CreateWatchdog(EGL, STUCK_PERIODS);
+    egl_display* Stuck = &EGL->Displays[0];
+    uint64_t StuckNS = STUCK_PERIODS * GetRefreshPeriodNS(Stuck->Plane);
+
+    // Without a stream, the watchdog's query of it mustn't call EGL
+    Check(EGLQueryDisplayStreamState(Stuck) == 0, "stream state without a stream", 0);
+
+    // A blocked waiter's mark survives another flip being marked
+    Check(EGLSetPageFlipPending(Stuck), "couldn't mark an idle flip pending", 0);
+    atomic_store(&Stuck->Hot->PageFlipPending, PAGE_FLIP_PENDING_WAITERS);
+    Check(!EGLSetPageFlipPending(Stuck) &&
+        atomic_load(&Stuck->Hot->PageFlipPending) == PAGE_FLIP_PENDING_WAITERS,
+        "marking a flip pending overwrote its waiters", 0);
+    EGLCancelPageFlipPending(Stuck);
+
+    WatchdogInjectDroppedFlips(Stuck, DROPPED_FLIPS);
+
+    static const watchdog_step Steps[] = {
+        WATCHDOG_REACQUIRE,
+        WATCHDOG_RECREATE_STREAM,
+        WATCHDOG_RECOMMIT_PLANE,
+        WATCHDOG_RECOMMIT_PLANE,
+    };
+    int Recreations = 0;
+    for (int Round = 0; Round < ARRAY_LEN(Steps); Round++) {
+        FlipDisplay(Stuck);
+        Check(EGLPageFlipPending(Stuck), "dropped flip event was handled", Round);
+        Check(!EGLSetPageFlipPending(Stuck), "marked a second flip pending", Round);
+
+        // Not stuck yet
+        WatchdogCheck(Watchdog);
+        Check(EGLPageFlipPending(Stuck), "recovered before the flip was stuck", Round);
+        Check(Watchdog->Displays[0].Recoveries == (uint64_t)Round,
+            "recovered before the flip was stuck", Round);
+
+        usleep((StuckNS + StuckNS / 2) / 1000);
+        for (int DisplayIndex = 1; DisplayIndex < DisplaysCount; DisplayIndex++) {
+            FlipDisplay(&EGL->Displays[DisplayIndex]);
+        }
+        // One healthy display has just acquired, so its flip is pending
+        EGLSetPageFlipPending(&EGL->Displays[1]);
+
+        watchdog_step Step = Watchdog->Displays[0].NextStep;
+        Check(Step == Steps[Round], "wrong recovery step", Round);
+        WatchdogCheck(Watchdog);
+
+        Check(!EGLPageFlipPending(Stuck), "stuck flip wasn't cleared", Round);
+        Check(Watchdog->Displays[0].Recoveries == (uint64_t)Round + 1,
+            "stuck display wasn't recovered", Round);
+
+        // The render thread, in BeginFrame
+        if (atomic_exchange(&Stuck->Hot->RecreateStreamRequested, 0)) {
+            Recreations++;
+            Check(Step == WATCHDOG_RECREATE_STREAM,
+                "stream recreation requested by the wrong step", Round);
+        }
+
+        for (int DisplayIndex = 1; DisplayIndex < DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+            Check(Watchdog->Displays[DisplayIndex].Recoveries == 0,
+                "healthy display was recovered", Round);
+            Check(atomic_load(&Display->Hot->RecreateStreamRequested) == 0,
+                "healthy display was asked to recreate its stream", Round);
+        }
+        Check(EGLPageFlipPending(&EGL->Displays[1]),
+            "healthy display's pending flip was cleared", Round);
+        EGLClearPageFlipPending(&EGL->Displays[1]);
+    }
+    Check(Recreations == 1, "stream recreation wasn't requested exactly once",
+        ARRAY_LEN(Steps));
+
+    // The injected drops are used up, so this flip lands
+    int Round = ARRAY_LEN(Steps);
+    uint64_t Flips = atomic_load(&Stuck->Hot->Flips);
+    FlipDisplay(Stuck);
+    Check(atomic_load(&Stuck->Hot->Flips) == Flips + 1, "flip event was dropped", Round);
+    Check(!EGLPageFlipPending(Stuck), "landed flip still pending", Round);
+    WatchdogCheck(Watchdog);
+    Check(Watchdog->Displays[0].NextStep == WATCHDOG_REACQUIRE,
+        "recovery didn't start over after a flip landed", Round);
+
+    FlushLog();
+    if (Failures) {
+        printf("%i check(s) failed\n", Failures);
+        return 1;
+    }
+    printf("PASS: %i displays, %i recoveries\n", DisplaysCount, ARRAY_LEN(Steps));
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+Captures every frame each display scans out through its writeback
+connector (see writeback.h), checks that what was scanned out is the
+frame that was committed, and reports commit-to-scanout latency.
+Rendering uses the software backend (see soft.h), so it runs on vkms:
+  sudo modprobe vkms enable_writeback=1 && sudo ./writeback-capture.app
+
+Each frame is filled with a color derived from its frame number and
+stamped with it. A capture is correct if its color matches its stamp.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "soft.h"
+#include "threads.h"
+#include "utils.h"
+#include "writeback.h"
+
+#define CAPTURE_FRAMES 4
+
+static uint32_t FrameColor(uint32_t Frame) {
+    return 0xFF000000 |
+        ((Frame * 37) & 0xFF) << 16 | ((Frame * 101) & 0xFF) << 8 | ((Frame * 59) & 0xFF);
+}
+
+static void RenderTile(egl_display* Display, pixel_tile* Tile, void* UserData) {
+    soft_display* SoftDisplay = UserData;
+    uint32_t Frame = (uint32_t)SoftDisplay->Frame;
+    FillRect(Tile, Tile->X, Tile->Y, Tile->Width, Tile->Height, FrameColor(Frame));
+    DrawFrameStamp(Tile, Frame);
+}
+
+// Checks the capture's color at the center of the display, away from
+// the stamp. Returns false on a mismatch.
+static bool CheckCapture(writeback_frame* Frame) {
+    dumb_buffer* Buffer = &Frame->Buffer;
+    uint32_t Pixel = DumbBufferRow(Buffer, Buffer->Height / 2)[Buffer->Width / 2];
+    return Frame->HasStamp &&
+        (Pixel & 0xFFFFFF) == (FrameColor(Frame->Stamp) & 0xFFFFFF);
+}
+
+int main() {
+    GetTime();
+
+    soft_state* Soft = SetupSoftware(DefaultSoftOptions());
+    egl_state* EGL = Soft->EGL;
+
+    ApplyThreadProfile("Render loop", GetThreadProfile("RENDER_THREAD_PROFILE", -1));
+
+    int Captures = 0;
+    for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+        egl_display* Display = &EGL->Displays[DisplayIndex];
+        Soft->Displays[DisplayIndex].Capture =
+            CreateWritebackCapture(EGL->DRMFD, Display->Plane, CAPTURE_FRAMES);
+        Captures += Soft->Displays[DisplayIndex].Capture != NULL;
+    }
+    if (Captures == 0) {
+        Fatal("No display can be captured\n");
+    }
+
+    uint64_t* Verified   = calloc(EGL->DisplaysCount, sizeof(uint64_t));
+    uint64_t* Mismatched = calloc(EGL->DisplaysCount, sizeof(uint64_t));
+
+    double LastReport = GetTime();
+    while (1) {
+        EGLWaitVSync(EGL, 100);
+
+        for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+            egl_display* Display = &EGL->Displays[DisplayIndex];
+            soft_display* SoftDisplay = &Soft->Displays[DisplayIndex];
+            writeback_capture* Capture = SoftDisplay->Capture;
+
+            FlushSoftFrame(Soft, Display);
+            if (SoftFrameAvailable(Soft, Display)) {
+                RenderSoftFrame(Soft, Display, NULL, 0, RenderTile, SoftDisplay);
+                PresentSoftFrame(Soft, Display);
+            }
+
+            if (!Capture) {
+                continue;
+            }
+            UpdateWritebackCapture(Capture);
+            writeback_frame* Frame;
+            while ((Frame = AcquireWritebackFrame(Capture))) {
+                if (CheckCapture(Frame)) {
+                    Verified[DisplayIndex]++;
+                } else {
+                    Mismatched[DisplayIndex]++;
+                }
+                ReleaseWritebackFrame(Capture, Frame);
+            }
+        }
+
+        if (GetTime() - LastReport > 1) {
+            LastReport = GetTime();
+            ReportSoftFrames(Soft);
+            for (int DisplayIndex = 0; DisplayIndex < EGL->DisplaysCount; DisplayIndex++) {
+                writeback_capture* Capture = Soft->Displays[DisplayIndex].Capture;
+                if (!Capture) continue;
+                ReportWritebackCapture(Capture);
+                LOG(LOG_INFO, "%20s: %lu captures verified, %lu mismatched\n",
+                    EGL->Displays[DisplayIndex].MonitorName,
+                    (unsigned long)Verified[DisplayIndex],
+                    (unsigned long)Mismatched[DisplayIndex]);
+            }
+        }
+    }
+
+    return 0;
+}